@@ -0,0 +1,793 @@
+/* Simple Plugin API
+ * Copyright (C) 2017 Wim Taymans <wim.taymans@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef __SPA_GRAPH_SCHEDULER_H__
+#define __SPA_GRAPH_SCHEDULER_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdlib.h>
+#include <errno.h>
+
+#include <spa/graph/graph.h>
+
+/* The graph scheduler. Use spa_graph_impl_plan as the graph callbacks to
+ * schedule from a sorted execution plan, which processes a node as soon as
+ * its dependencies are done or, with an executor, processes the independent
+ * nodes of a level in parallel. spa_graph_impl_default schedules recursively
+ * from the node that needs input or has output without a plan.
+ * spa/tests/benchmark-graph.c compares them on synthetic graphs. */
+
+/** a port in the execution plan */
+struct spa_graph_plan_port {
+	struct spa_graph_port *peer;	/**< the peer port or NULL */
+	struct spa_io_buffers *io;	/**< io area of the peer port */
+	struct spa_graph_plan_node *node;	/**< plan node of the peer or NULL */
+#define SPA_GRAPH_PLAN_PORT_REQUIRED		(1 << 0)	/**< the port is not optional */
+#define SPA_GRAPH_PLAN_PORT_PEER_REQUIRED	(1 << 1)	/**< the peer port is not optional */
+	uint32_t flags;
+};
+
+/** a node in the execution plan */
+struct spa_graph_plan_node {
+	struct spa_graph_node *node;
+	uint32_t wait[2];		/**< ports to wait for before the node is processed */
+	uint32_t required[2];		/**< number of non optional input and output ports */
+	uint32_t ports[2];		/**< index of the first input and output port */
+	uint32_t n_ports[2];		/**< number of input and output ports */
+	uint32_t level;			/**< level of the node */
+#define SPA_GRAPH_PLAN_NODE_FLAG_OUTSIDE(d)	(1 << (d))	/**< ports of direction d have peers
+								  *  that are not in the plan */
+	uint32_t flags;
+#define SPA_GRAPH_PLAN_QUEUED(d)	(1 << (d))	/**< queued for processing ports of direction d */
+	uint32_t pending;
+};
+
+/** runs the nodes of one level of the plan */
+struct spa_graph_executor {
+	/** call func for index 0 to n_jobs - 1, possibly from other threads, and
+	 * return when all calls are done */
+	void (*run) (void *data, void (*func) (void *arg, uint32_t index), void *arg,
+		     uint32_t n_jobs);
+	void *data;
+};
+
+/** The nodes of a graph sorted in levels. The nodes of a level only take
+ * input from the nodes of the levels before it, so that they can be processed
+ * at the same time. A plan is made with spa_graph_plan_new while the graph
+ * does not change and can only be used while the graph has the version of
+ * the plan. The plan of a graph with a cycle has no nodes. */
+struct spa_graph_plan {
+	struct spa_graph *graph;
+	uint32_t version;		/**< graph version of the plan */
+
+	struct spa_graph_plan_node *nodes;
+	uint32_t n_nodes;
+
+	struct spa_graph_plan_port *ports;
+	uint32_t n_ports;
+
+	uint32_t *levels;		/**< index of the first node of each level */
+	uint32_t n_levels;
+
+	/* the nodes to process for their input and output ports, the nodes of
+	 * a level are queued at the index of the first node of the level */
+	struct spa_graph_plan_node **queue[2];
+	uint32_t *n_queued[2];		/**< number of queued nodes of each level */
+	uint32_t *mask[2];		/**< bit of each level with queued nodes */
+
+	struct spa_graph_plan_node **jobs;	/**< nodes to process */
+};
+
+/** The scheduler state of a graph. Plans are not made on the thread that
+ * runs the graph, they are swapped in with spa_graph_data_set_plan. The
+ * recursive scheduler is used while there is no plan for the current graph
+ * version. */
+struct spa_graph_data {
+	struct spa_graph *graph;
+	struct spa_graph_plan *plan;	/**< the plan or NULL */
+	bool running;			/**< plan is being executed */
+
+	const struct spa_graph_executor *executor;	/**< optional executor */
+	uint32_t min_jobs;				/**< min jobs for the executor */
+	uint32_t run;					/**< direction of the jobs */
+};
+
+static inline void spa_graph_data_init(struct spa_graph_data *data,
+				       struct spa_graph *graph)
+{
+	data->graph = graph;
+	data->plan = NULL;
+	data->running = false;
+	data->executor = NULL;
+	data->min_jobs = 2;
+	data->run = 0;
+}
+
+static inline void spa_graph_plan_free(struct spa_graph_plan *plan)
+{
+	free(plan);
+}
+
+static inline void spa_graph_data_clear(struct spa_graph_data *data)
+{
+	spa_graph_plan_free(data->plan);
+	data->plan = NULL;
+}
+
+/** Use executor to process the nodes of a level in parallel when the level
+ * has at least min_jobs nodes to process. Nodes that are processed in
+ * parallel are never linked to each other. */
+static inline void spa_graph_data_set_executor(struct spa_graph_data *data,
+					       const struct spa_graph_executor *executor,
+					       uint32_t min_jobs)
+{
+	data->executor = executor;
+	data->min_jobs = SPA_MAX(min_jobs, 2u);
+}
+
+static inline int spa_graph_impl_need_input(void *data, struct spa_graph_node *node)
+{
+	struct spa_graph_port *p;
+
+	spa_debug("node %p start pull", node);
+
+	node->required[SPA_DIRECTION_INPUT] = 0;
+	spa_list_for_each(p, &node->ports[SPA_DIRECTION_INPUT], link) {
+		if (p->io->status == SPA_STATUS_NEED_BUFFER)
+			node->required[SPA_DIRECTION_INPUT]++;
+	}
+	node->ready[SPA_DIRECTION_INPUT] = 0;
+	spa_list_for_each(p, &node->ports[SPA_DIRECTION_INPUT], link) {
+		struct spa_graph_port *pport;
+		struct spa_graph_node *pnode;
+		uint32_t prequired, pready;
+
+		if ((pport = p->peer) == NULL || (pport->flags & SPA_GRAPH_PORT_FLAG_DISABLED)) {
+			spa_debug("node %p port %p has no peer", node, p);
+			continue;
+		}
+		pnode = pport->node;
+
+		if (pport->io->status == SPA_STATUS_NEED_BUFFER)
+			pnode->ready[SPA_DIRECTION_OUTPUT]++;
+
+		pready = pnode->ready[SPA_DIRECTION_OUTPUT];
+		prequired = pnode->required[SPA_DIRECTION_OUTPUT];
+
+		spa_debug("node %p peer %p io %d %d %d %d", node, pnode, pport->io->status,
+				pport->io->buffer_id, pready, prequired);
+
+		if (prequired > 0 && pready >= prequired) {
+			pnode->state = spa_node_process_output(pnode->implementation);
+
+			spa_debug("peer %p processed out %d", pnode, pnode->state);
+			if (pnode->state == SPA_STATUS_HAVE_BUFFER)
+				spa_graph_have_output(pnode->graph, pnode);
+			else if (pnode->state == SPA_STATUS_NEED_BUFFER)
+				spa_graph_need_input(pnode->graph, pnode);
+		}
+	}
+	spa_debug("node %p end pull", node);
+	return 0;
+}
+
+static inline int spa_graph_impl_have_output(void *data, struct spa_graph_node *node)
+{
+	struct spa_graph_port *p;
+
+	spa_debug("node %p start push", node);
+
+	node->required[SPA_DIRECTION_OUTPUT] = 0;
+	spa_list_for_each(p, &node->ports[SPA_DIRECTION_OUTPUT], link) {
+		if (p->io->status == SPA_STATUS_HAVE_BUFFER) {
+			if (!(p->flags & SPA_PORT_INFO_FLAG_OPTIONAL))
+				node->required[SPA_DIRECTION_OUTPUT]++;
+		}
+	}
+	node->ready[SPA_DIRECTION_OUTPUT] = 0;
+	spa_list_for_each(p, &node->ports[SPA_DIRECTION_OUTPUT], link) {
+		struct spa_graph_port *pport;
+		struct spa_graph_node *pnode;
+		uint32_t prequired, pready;
+
+		if ((pport = p->peer) == NULL || (pport->flags & SPA_GRAPH_PORT_FLAG_DISABLED)) {
+			spa_debug("node %p port %p has no peer", node, p);
+			continue;
+		}
+		pnode = pport->node;
+
+		if (pport->io->status == SPA_STATUS_HAVE_BUFFER)
+			pnode->ready[SPA_DIRECTION_INPUT]++;
+
+		pready = pnode->ready[SPA_DIRECTION_INPUT];
+		prequired = pnode->required[SPA_DIRECTION_INPUT];
+
+		spa_debug("node %p peer %p io %d %d %d %d", node, pnode, pport->io->status,
+				pport->io->buffer_id, pready, prequired);
+
+		if (prequired > 0 && pready >= prequired) {
+			pnode->state = spa_node_process_input(pnode->implementation);
+
+			spa_debug("peer %p processed in %d", pnode, pnode->state);
+			if (pnode->state == SPA_STATUS_HAVE_BUFFER)
+				spa_graph_have_output(pnode->graph, pnode);
+			else if (pnode->state == SPA_STATUS_NEED_BUFFER)
+				spa_graph_need_input(pnode->graph, pnode);
+		}
+	}
+	spa_debug("node %p end push", node);
+	return 0;
+}
+
+static const struct spa_graph_callbacks spa_graph_impl_default = {
+	SPA_VERSION_GRAPH_CALLBACKS,
+	.need_input = spa_graph_impl_need_input,
+	.have_output = spa_graph_impl_have_output,
+};
+
+/* a node of the graph and its index in the list of nodes */
+struct spa_graph_plan_entry {
+	struct spa_graph_node *node;
+	uint32_t index;
+};
+
+static inline int spa_graph_plan_entry_compare(const void *a, const void *b)
+{
+	const struct spa_graph_plan_entry *ea = a, *eb = b;
+	return ea->node < eb->node ? -1 : ea->node > eb->node ? 1 : 0;
+}
+
+/* the list index of the peer of p or SPA_ID_INVALID, entries is sorted */
+static inline uint32_t
+spa_graph_plan_peer_index(struct spa_graph_plan_entry *entries, uint32_t n,
+			  struct spa_graph_port *p)
+{
+	struct spa_graph_plan_entry key, *e;
+
+	if (p->peer == NULL || (key.node = p->peer->node) == NULL)
+		return SPA_ID_INVALID;
+	e = (struct spa_graph_plan_entry *) bsearch(&key, entries, n, sizeof(key),
+						    spa_graph_plan_entry_compare);
+	return e ? e->index : SPA_ID_INVALID;
+}
+
+/** Sort the nodes of graph in levels and make the flat port arrays. The graph
+ * is only read, the plan is used after spa_graph_data_set_plan. Returns NULL
+ * with errno set when there is no memory. */
+static inline struct spa_graph_plan *spa_graph_plan_new(struct spa_graph *graph)
+{
+	struct spa_graph_plan *plan;
+	struct spa_graph_plan_entry *entries;
+	struct spa_graph_node *n, **list;
+	struct spa_graph_port *p;
+	uint32_t i, j, k, n_nodes = 0, n_ports = 0, n_levels = 0, n_words, head, tail, idx;
+	uint32_t *deg, *order, *level, *pos;
+
+	spa_list_for_each(n, &graph->nodes, link) {
+		n_nodes++;
+		for (i = 0; i < 2; i++) {
+			spa_list_for_each(p, &n->ports[i], link)
+				n_ports++;
+		}
+	}
+
+	/* there are at most as many levels as nodes. The nodes and queues
+	 * first, they have pointers, the levels and masks last */
+	n_words = (n_nodes + 31) / 32;
+	plan = (struct spa_graph_plan *) calloc(1, sizeof(*plan) +
+			n_nodes * sizeof(struct spa_graph_plan_node) +
+			2 * n_nodes * sizeof(struct spa_graph_plan_node *) +
+			n_ports * sizeof(struct spa_graph_plan_port) +
+			(n_nodes + 1) * sizeof(uint32_t) +
+			2 * (n_nodes + n_words) * sizeof(uint32_t));
+	if (plan == NULL)
+		return NULL;
+	plan->graph = graph;
+	plan->version = graph->version;
+	plan->nodes = SPA_MEMBER(plan, sizeof(*plan), struct spa_graph_plan_node);
+	plan->queue[0] = SPA_MEMBER(plan->nodes, n_nodes * sizeof(struct spa_graph_plan_node),
+				    struct spa_graph_plan_node *);
+	plan->queue[1] = plan->queue[0] + n_nodes;
+	plan->ports = SPA_MEMBER(plan->queue[1], n_nodes * sizeof(struct spa_graph_plan_node *),
+				 struct spa_graph_plan_port);
+	plan->levels = SPA_MEMBER(plan->ports, n_ports * sizeof(struct spa_graph_plan_port),
+				  uint32_t);
+	plan->n_queued[0] = plan->levels + n_nodes + 1;
+	plan->n_queued[1] = plan->n_queued[0] + n_nodes;
+	plan->mask[0] = plan->n_queued[1] + n_nodes;
+	plan->mask[1] = plan->mask[0] + n_words;
+
+	entries = (struct spa_graph_plan_entry *) malloc(n_nodes * (sizeof(*entries) +
+				sizeof(*list) + 4 * sizeof(uint32_t)));
+	if (entries == NULL) {
+		free(plan);
+		return NULL;
+	}
+	list = SPA_MEMBER(entries, n_nodes * sizeof(*entries), struct spa_graph_node *);
+	deg = SPA_MEMBER(list, n_nodes * sizeof(*list), uint32_t);
+	order = deg + n_nodes;
+	level = order + n_nodes;
+	pos = level + n_nodes;
+
+	i = 0;
+	spa_list_for_each(n, &graph->nodes, link) {
+		list[i] = n;
+		entries[i].node = n;
+		entries[i].index = i;
+		i++;
+	}
+	qsort(entries, n_nodes, sizeof(*entries), spa_graph_plan_entry_compare);
+
+	/* count the inputs from nodes in the graph */
+	for (i = 0; i < n_nodes; i++) {
+		deg[i] = 0;
+		spa_list_for_each(p, &list[i]->ports[SPA_DIRECTION_INPUT], link) {
+			if (spa_graph_plan_peer_index(entries, n_nodes, p) != SPA_ID_INVALID)
+				deg[i]++;
+		}
+	}
+
+	/* take the nodes without inputs, then the nodes that get all their
+	 * input from the nodes taken so far */
+	for (head = tail = i = 0; i < n_nodes; i++) {
+		if (deg[i] == 0)
+			order[tail++] = i;
+	}
+	while (head < tail) {
+		n = list[order[head++]];
+		spa_list_for_each(p, &n->ports[SPA_DIRECTION_OUTPUT], link) {
+			idx = spa_graph_plan_peer_index(entries, n_nodes, p);
+			if (idx != SPA_ID_INVALID && --deg[idx] == 0)
+				order[tail++] = idx;
+		}
+	}
+	if (tail < n_nodes) {
+		spa_debug("graph %p: cycle in graph, not using plan", graph);
+		goto done;
+	}
+
+	/* a node is one level after the last node it takes input from */
+	for (i = 0; i < n_nodes; i++) {
+		k = order[i];
+		level[k] = 0;
+		spa_list_for_each(p, &list[k]->ports[SPA_DIRECTION_INPUT], link) {
+			idx = spa_graph_plan_peer_index(entries, n_nodes, p);
+			if (idx != SPA_ID_INVALID)
+				level[k] = SPA_MAX(level[k], level[idx] + 1);
+		}
+		n_levels = SPA_MAX(n_levels, level[k] + 1);
+	}
+
+	/* the first node of each level, then the position of each node, the
+	 * nodes of a level keep their sorted order */
+	for (i = 0; i < n_nodes; i++)
+		plan->levels[level[i] + 1]++;
+	for (i = 0; i < n_levels; i++) {
+		plan->levels[i + 1] += plan->levels[i];
+		deg[i] = plan->levels[i];
+	}
+	for (i = 0; i < n_nodes; i++) {
+		k = order[i];
+		pos[k] = deg[level[k]]++;
+	}
+
+	for (i = 0; i < n_nodes; i++) {
+		plan->nodes[pos[i]].node = list[i];
+		plan->nodes[pos[i]].level = level[i];
+	}
+
+	for (i = 0, k = 0; i < n_nodes; i++) {
+		struct spa_graph_plan_node *pn = &plan->nodes[i];
+
+		for (j = 0; j < 2; j++) {
+			pn->ports[j] = k;
+			spa_list_for_each(p, &pn->node->ports[j], link) {
+				struct spa_graph_plan_port *pp = &plan->ports[k++];
+
+				idx = spa_graph_plan_peer_index(entries, n_nodes, p);
+				pp->peer = p->peer;
+				pp->io = p->peer ? p->peer->io : NULL;
+				if (idx != SPA_ID_INVALID)
+					pp->node = &plan->nodes[pos[idx]];
+				else if (p->peer != NULL)
+					pn->flags |= SPA_GRAPH_PLAN_NODE_FLAG_OUTSIDE(j);
+				if (!(p->flags & SPA_PORT_INFO_FLAG_OPTIONAL)) {
+					pp->flags |= SPA_GRAPH_PLAN_PORT_REQUIRED;
+					pn->required[j]++;
+				}
+				if (p->peer && !(p->peer->flags & SPA_PORT_INFO_FLAG_OPTIONAL))
+					pp->flags |= SPA_GRAPH_PLAN_PORT_PEER_REQUIRED;
+			}
+			pn->n_ports[j] = k - pn->ports[j];
+			pn->wait[j] = pn->required[j];
+		}
+	}
+	plan->n_nodes = n_nodes;
+	plan->n_ports = n_ports;
+	plan->n_levels = n_levels;
+
+	spa_debug("graph %p: plan with %d nodes %d ports %d levels", graph,
+			n_nodes, n_ports, n_levels);
+
+      done:
+	free(entries);
+	return plan;
+}
+
+/** Use plan for the graph of data and return the previous plan. This does not
+ * allocate or free memory and is called from the thread that runs the graph,
+ * the previous plan can be freed after it returns. */
+static inline struct spa_graph_plan *
+spa_graph_data_set_plan(struct spa_graph_data *data, struct spa_graph_plan *plan)
+{
+	struct spa_graph_plan *old = data->plan;
+	uint32_t i;
+
+	if (plan != NULL) {
+		for (i = 0; i < plan->n_nodes; i++)
+			plan->nodes[i].node->scheduler_data = &plan->nodes[i];
+	}
+	data->plan = plan;
+	return old;
+}
+
+/** Make a plan for the current graph and use it, for when the graph is
+ * changed and run from the same thread. */
+static inline int spa_graph_data_build(struct spa_graph_data *data)
+{
+	struct spa_graph_plan *plan;
+
+	if ((plan = spa_graph_plan_new(data->graph)) == NULL)
+		return -errno;
+	spa_graph_plan_free(spa_graph_data_set_plan(data, plan));
+	return 0;
+}
+
+/* the plan node of node or NULL when the node is not in the plan */
+static inline struct spa_graph_plan_node *
+spa_graph_plan_find(struct spa_graph_plan *plan, struct spa_graph_node *node)
+{
+	struct spa_graph_plan_node *pn = (struct spa_graph_plan_node *) node->scheduler_data;
+
+	if (node->graph != plan->graph ||
+	    pn < plan->nodes || pn >= plan->nodes + plan->n_nodes || pn->node != node)
+		return NULL;
+	return pn;
+}
+
+/* process a peer that is not in the plan right away like the recursive
+ * scheduler does */
+static inline void
+spa_graph_plan_process_peer(struct spa_graph_node *pnode, enum spa_direction direction)
+{
+	if (direction == SPA_DIRECTION_OUTPUT)
+		pnode->state = spa_node_process_output(pnode->implementation);
+	else
+		pnode->state = spa_node_process_input(pnode->implementation);
+
+	spa_debug("peer %p processed %d", pnode, pnode->state);
+	if (pnode->state == SPA_STATUS_HAVE_BUFFER)
+		spa_graph_have_output(pnode->graph, pnode);
+	else if (pnode->state == SPA_STATUS_NEED_BUFFER)
+		spa_graph_need_input(pnode->graph, pnode);
+}
+
+static inline void
+spa_graph_plan_queue(struct spa_graph_plan *plan, struct spa_graph_plan_node *pn,
+		     enum spa_direction direction)
+{
+	uint32_t l = pn->level;
+
+	if (pn->pending & SPA_GRAPH_PLAN_QUEUED(direction))
+		return;
+	pn->pending |= SPA_GRAPH_PLAN_QUEUED(direction);
+	plan->queue[direction][plan->levels[l] + plan->n_queued[direction][l]++] = pn;
+	plan->mask[direction][l / 32] |= 1u << (l % 32);
+}
+
+static inline void
+spa_graph_plan_pull(struct spa_graph_data *data, struct spa_graph_plan_node *pn);
+static inline void
+spa_graph_plan_push(struct spa_graph_data *data, struct spa_graph_plan_node *pn);
+
+/* schedule the peers of pn with the result of processing it */
+static inline void
+spa_graph_plan_schedule(struct spa_graph_data *data, struct spa_graph_plan_node *pn)
+{
+	spa_debug("peer %p processed %d", pn->node, pn->node->state);
+	if (pn->node->state == SPA_STATUS_HAVE_BUFFER)
+		spa_graph_plan_push(data, pn);
+	else if (pn->node->state == SPA_STATUS_NEED_BUFFER)
+		spa_graph_plan_pull(data, pn);
+}
+
+/* One of the ports of pn in direction is ready, pn is processed when it was
+ * the last port it waited for. Without an executor pn is processed right
+ * away, which keeps the data of a node and its peers in the cache. With an
+ * executor pn is queued in its level so that it can be processed at the
+ * same time as the other nodes of the level. */
+static inline void
+spa_graph_plan_ready(struct spa_graph_data *data, struct spa_graph_plan_node *pn,
+		     enum spa_direction direction)
+{
+	struct spa_graph_node *node = pn->node;
+
+	if (pn->wait[direction] == 0 || --pn->wait[direction] > 0)
+		return;
+
+	pn->wait[direction] = pn->required[direction];
+
+	if (data->executor) {
+		spa_graph_plan_queue(data->plan, pn, direction);
+		return;
+	}
+	if (direction == SPA_DIRECTION_OUTPUT)
+		node->state = spa_node_process_output(node->implementation);
+	else
+		node->state = spa_node_process_input(node->implementation);
+
+	spa_graph_plan_schedule(data, pn);
+}
+
+/* Same as spa_graph_impl_need_input but the dependency counts come from the
+ * plan. pn waits for its input ports that need a buffer from a peer, the
+ * other ports are ready. */
+static inline void
+spa_graph_plan_pull(struct spa_graph_data *data, struct spa_graph_plan_node *pn)
+{
+	struct spa_graph_plan *plan = data->plan;
+	struct spa_graph_plan_port *ports = &plan->ports[pn->ports[SPA_DIRECTION_INPUT]];
+	uint32_t i, n_ports = pn->n_ports[SPA_DIRECTION_INPUT];
+
+	spa_debug("node %p start pull", pn->node);
+
+	pn->wait[SPA_DIRECTION_INPUT] = pn->required[SPA_DIRECTION_INPUT];
+	/* peers that are not in the plan count on the node like the recursive
+	 * scheduler does */
+	if (pn->flags & SPA_GRAPH_PLAN_NODE_FLAG_OUTSIDE(SPA_DIRECTION_INPUT))
+		pn->node->ready[SPA_DIRECTION_INPUT] = 0;
+
+	for (i = 0; i < n_ports; i++) {
+		struct spa_graph_port *pport = ports[i].peer;
+		struct spa_graph_node *pnode;
+
+		if (pport == NULL || ports[i].io->status != SPA_STATUS_NEED_BUFFER ||
+		    (pport->flags & SPA_GRAPH_PORT_FLAG_DISABLED)) {
+			if ((ports[i].flags & SPA_GRAPH_PLAN_PORT_REQUIRED) &&
+			    pn->wait[SPA_DIRECTION_INPUT] > 0)
+				pn->wait[SPA_DIRECTION_INPUT]--;
+			continue;
+		}
+		if (ports[i].node) {
+			if (ports[i].flags & SPA_GRAPH_PLAN_PORT_PEER_REQUIRED)
+				spa_graph_plan_ready(data, ports[i].node, SPA_DIRECTION_OUTPUT);
+			continue;
+		}
+		pnode = pport->node;
+		pnode->ready[SPA_DIRECTION_OUTPUT]++;
+		if (pnode->required[SPA_DIRECTION_OUTPUT] > 0 &&
+		    pnode->ready[SPA_DIRECTION_OUTPUT] >= pnode->required[SPA_DIRECTION_OUTPUT])
+			spa_graph_plan_process_peer(pnode, SPA_DIRECTION_OUTPUT);
+	}
+	spa_debug("node %p end pull", pn->node);
+}
+
+/* Same as spa_graph_impl_have_output but the dependency counts come from the
+ * plan. pn waits for the peers of its output ports that have a buffer, the
+ * other ports are ready. */
+static inline void
+spa_graph_plan_push(struct spa_graph_data *data, struct spa_graph_plan_node *pn)
+{
+	struct spa_graph_plan *plan = data->plan;
+	struct spa_graph_plan_port *ports = &plan->ports[pn->ports[SPA_DIRECTION_OUTPUT]];
+	uint32_t i, n_ports = pn->n_ports[SPA_DIRECTION_OUTPUT];
+
+	spa_debug("node %p start push", pn->node);
+
+	pn->wait[SPA_DIRECTION_OUTPUT] = pn->required[SPA_DIRECTION_OUTPUT];
+	/* peers that are not in the plan count on the node like the recursive
+	 * scheduler does */
+	if (pn->flags & SPA_GRAPH_PLAN_NODE_FLAG_OUTSIDE(SPA_DIRECTION_OUTPUT))
+		pn->node->ready[SPA_DIRECTION_OUTPUT] = 0;
+
+	for (i = 0; i < n_ports; i++) {
+		struct spa_graph_port *pport = ports[i].peer;
+		struct spa_graph_node *pnode;
+
+		if (pport == NULL || ports[i].io->status != SPA_STATUS_HAVE_BUFFER ||
+		    (pport->flags & SPA_GRAPH_PORT_FLAG_DISABLED)) {
+			if ((ports[i].flags & SPA_GRAPH_PLAN_PORT_REQUIRED) &&
+			    pn->wait[SPA_DIRECTION_OUTPUT] > 0)
+				pn->wait[SPA_DIRECTION_OUTPUT]--;
+			continue;
+		}
+		if (ports[i].node) {
+			if (ports[i].flags & SPA_GRAPH_PLAN_PORT_PEER_REQUIRED)
+				spa_graph_plan_ready(data, ports[i].node, SPA_DIRECTION_INPUT);
+			continue;
+		}
+		pnode = pport->node;
+		pnode->ready[SPA_DIRECTION_INPUT]++;
+		if (pnode->required[SPA_DIRECTION_INPUT] > 0 &&
+		    pnode->ready[SPA_DIRECTION_INPUT] >= pnode->required[SPA_DIRECTION_INPUT])
+			spa_graph_plan_process_peer(pnode, SPA_DIRECTION_INPUT);
+	}
+	spa_debug("node %p end push", pn->node);
+}
+
+static inline void spa_graph_plan_exec(void *arg, uint32_t index)
+{
+	struct spa_graph_data *data = (struct spa_graph_data *) arg;
+	struct spa_graph_node *node = data->plan->jobs[index]->node;
+
+	if (data->run == SPA_DIRECTION_OUTPUT)
+		node->state = spa_node_process_output(node->implementation);
+	else
+		node->state = spa_node_process_input(node->implementation);
+}
+
+/* process the nodes of a level that are queued for direction and schedule
+ * their peers with the result. Pulls only queue nodes of the levels before
+ * it and pushes only the nodes of the levels after it. */
+static inline void
+spa_graph_plan_run_level(struct spa_graph_data *data, uint32_t level,
+			 enum spa_direction direction)
+{
+	struct spa_graph_plan *plan = data->plan;
+	struct spa_graph_plan_node *pn;
+	uint32_t i, n_jobs = plan->n_queued[direction][level];
+
+	plan->n_queued[direction][level] = 0;
+	plan->mask[direction][level / 32] &= ~(1u << (level % 32));
+	plan->jobs = &plan->queue[direction][plan->levels[level]];
+
+	data->run = direction;
+	if (n_jobs >= data->min_jobs)
+		data->executor->run(data->executor->data, spa_graph_plan_exec, data, n_jobs);
+	else {
+		for (i = 0; i < n_jobs; i++)
+			spa_graph_plan_exec(data, i);
+	}
+
+	for (i = 0; i < n_jobs; i++) {
+		pn = plan->jobs[i];
+		pn->pending &= ~SPA_GRAPH_PLAN_QUEUED(direction);
+		spa_graph_plan_schedule(data, pn);
+	}
+}
+
+/* the last level before end with queued nodes in mask or SPA_ID_INVALID */
+static inline uint32_t spa_graph_plan_prev_level(const uint32_t *mask, uint32_t end)
+{
+	uint32_t w, m;
+
+	while (end > 0) {
+		w = (end - 1) / 32;
+		m = mask[w] & (0xffffffffu >> (31 - (end - 1) % 32));
+		if (m)
+			return w * 32 + 31 - __builtin_clz(m);
+		end = w * 32;
+	}
+	return SPA_ID_INVALID;
+}
+
+/* the first level from start with queued nodes in mask or n_levels */
+static inline uint32_t spa_graph_plan_next_level(const uint32_t *mask, uint32_t start,
+						 uint32_t n_levels)
+{
+	uint32_t w, m;
+
+	while (start < n_levels) {
+		w = start / 32;
+		m = mask[w] & (0xffffffffu << (start % 32));
+		if (m)
+			return w * 32 + __builtin_ctz(m);
+		start = (w + 1) * 32;
+	}
+	return n_levels;
+}
+
+/* Run the plan starting from node, that needs input when direction is
+ * SPA_DIRECTION_INPUT and has output otherwise. The queued nodes that need
+ * to be processed for their output are processed from the last to the first
+ * level, so that a node is done before the nodes it takes input from, then
+ * the nodes that need to be processed for their input from the first to the
+ * last level. Only the levels with queued nodes are visited. Returns false
+ * when there is no plan for the current graph or the node is not in it. */
+static inline bool
+spa_graph_plan_run(struct spa_graph_data *data, struct spa_graph_node *node,
+		   enum spa_direction direction)
+{
+	struct spa_graph_plan *plan = data ? data->plan : NULL;
+	struct spa_graph_plan_node *pn;
+	uint32_t l, n_levels;
+
+	if (plan == NULL || data->running)
+		return false;
+
+	/* plans are never made here, the graph is run recursively until a plan
+	 * for this version of the graph is set */
+	if (plan->version != data->graph->version)
+		return false;
+
+	if ((pn = spa_graph_plan_find(plan, node)) == NULL)
+		return false;
+
+	data->running = true;
+	n_levels = plan->n_levels;
+
+	if (direction == SPA_DIRECTION_INPUT)
+		spa_graph_plan_pull(data, pn);
+	else
+		spa_graph_plan_push(data, pn);
+
+	/* without an executor the nodes were processed when they were ready,
+	 * otherwise run the queued levels, a push can make a node ask for more
+	 * input */
+	while (data->executor) {
+		l = n_levels;
+		while ((l = spa_graph_plan_prev_level(plan->mask[SPA_DIRECTION_OUTPUT], l)) !=
+		       SPA_ID_INVALID)
+			spa_graph_plan_run_level(data, l, SPA_DIRECTION_OUTPUT);
+
+		l = 0;
+		while ((l = spa_graph_plan_next_level(plan->mask[SPA_DIRECTION_INPUT], l,
+						      n_levels)) < n_levels)
+			spa_graph_plan_run_level(data, l++, SPA_DIRECTION_INPUT);
+
+		if (spa_graph_plan_prev_level(plan->mask[SPA_DIRECTION_OUTPUT], n_levels) ==
+		    SPA_ID_INVALID)
+			break;
+	}
+
+	data->running = false;
+
+	return true;
+}
+
+static inline int spa_graph_impl_plan_need_input(void *data, struct spa_graph_node *node)
+{
+	if (!spa_graph_plan_run(data, node, SPA_DIRECTION_INPUT))
+		return spa_graph_impl_need_input(data, node);
+	return 0;
+}
+
+static inline int spa_graph_impl_plan_have_output(void *data, struct spa_graph_node *node)
+{
+	if (!spa_graph_plan_run(data, node, SPA_DIRECTION_OUTPUT))
+		return spa_graph_impl_have_output(data, node);
+	return 0;
+}
+
+/** callbacks that use an execution plan, data is a struct spa_graph_data */
+static const struct spa_graph_callbacks spa_graph_impl_plan = {
+	SPA_VERSION_GRAPH_CALLBACKS,
+	.need_input = spa_graph_impl_plan_need_input,
+	.have_output = spa_graph_impl_plan_have_output,
+};
+
+
+#ifdef __cplusplus
+}  /* extern "C" */
+#endif
+
+#endif /* __SPA_GRAPH_SCHEDULER_H__ */
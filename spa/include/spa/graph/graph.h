@@ -49,6 +49,7 @@ struct spa_graph {
 	struct spa_list nodes;
 	const struct spa_graph_callbacks *callbacks;
 	void *callbacks_data;
+	uint32_t version;		/**< changes when nodes or links change */
 };
 
 #define spa_graph_need_input(g,n)	((g)->callbacks->need_input((g)->callbacks_data, (n)))
@@ -84,6 +85,14 @@ struct spa_graph_port {
 static inline void spa_graph_init(struct spa_graph *graph)
 {
 	spa_list_init(&graph->nodes);
+	graph->version = 0;
+}
+
+/* mark the graph of the port as changed */
+static inline void spa_graph_port_changed(struct spa_graph_port *port)
+{
+	if (port->node && port->node->graph)
+		port->node->graph->version++;
 }
 
 static inline void
@@ -100,6 +109,7 @@ spa_graph_node_init(struct spa_graph_node *node)
 {
 	spa_list_init(&node->ports[SPA_DIRECTION_INPUT]);
 	spa_list_init(&node->ports[SPA_DIRECTION_OUTPUT]);
+	node->graph = NULL;
 	node->flags = 0;
 	node->required[SPA_DIRECTION_INPUT] = node->ready[SPA_DIRECTION_INPUT] = 0;
 	node->required[SPA_DIRECTION_OUTPUT] = node->ready[SPA_DIRECTION_OUTPUT] = 0;
@@ -121,6 +131,7 @@ spa_graph_node_add(struct spa_graph *graph,
 	node->state = SPA_STATUS_OK;
 	node->ready_link.next = NULL;
 	spa_list_append(&graph->nodes, &node->link);
+	graph->version++;
 	spa_debug("node %p add", node);
 }
 
@@ -132,6 +143,7 @@ spa_graph_port_init(struct spa_graph_port *port,
 		    struct spa_io_buffers *io)
 {
 	spa_debug("port %p init type %d id %d", port, direction, port_id);
+	port->node = NULL;
 	port->direction = direction;
 	port->port_id = port_id;
 	port->flags = flags;
@@ -147,12 +159,14 @@ spa_graph_port_add(struct spa_graph_node *node,
 	spa_list_append(&node->ports[port->direction], &port->link);
 	if (!(port->flags & SPA_PORT_INFO_FLAG_OPTIONAL))
 		node->required[port->direction]++;
+	spa_graph_port_changed(port);
 }
 
 static inline void spa_graph_node_remove(struct spa_graph_node *node)
 {
 	spa_debug("node %p remove", node);
 	spa_list_remove(&node->link);
+	node->graph->version++;
 	if (node->ready_link.next)
 		spa_list_remove(&node->ready_link);
 }
@@ -161,6 +175,7 @@ static inline void spa_graph_port_remove(struct spa_graph_port *port)
 {
 	spa_debug("port %p remove", port);
 	spa_list_remove(&port->link);
+	spa_graph_port_changed(port);
 	if (!(port->flags & SPA_PORT_INFO_FLAG_OPTIONAL) &&
 	    port->node->required[port->direction] > 0) {
 		port->node->required[port->direction]--;
@@ -173,6 +188,8 @@ spa_graph_port_link(struct spa_graph_port *out, struct spa_graph_port *in)
 	spa_debug("port %p link to %p", out, in);
 	out->peer = in;
 	in->peer = out;
+	spa_graph_port_changed(out);
+	spa_graph_port_changed(in);
 }
 
 static inline void
@@ -180,9 +197,11 @@ spa_graph_port_unlink(struct spa_graph_port *port)
 {
 	spa_debug("port %p unlink from %p", port, port->peer);
 	if (port->peer) {
+		spa_graph_port_changed(port->peer);
 		port->peer->peer = NULL;
 		port->peer = NULL;
 	}
+	spa_graph_port_changed(port);
 }
 
 #ifdef __cplusplus
@@ -35,6 +35,7 @@ extern "C" {
 #define SPA_TYPE_PARAM_BUFFERS__stride		SPA_TYPE_PARAM_BUFFERS_BASE "stride"
 #define SPA_TYPE_PARAM_BUFFERS__buffers		SPA_TYPE_PARAM_BUFFERS_BASE "buffers"
 #define SPA_TYPE_PARAM_BUFFERS__align		SPA_TYPE_PARAM_BUFFERS_BASE "align"
+#define SPA_TYPE_PARAM_BUFFERS__hugepages	SPA_TYPE_PARAM_BUFFERS_BASE "hugepages"
 
 struct spa_type_param_buffers {
 	uint32_t Buffers;
@@ -42,6 +43,7 @@ struct spa_type_param_buffers {
 	uint32_t stride;
 	uint32_t buffers;
 	uint32_t align;
+	uint32_t hugepages;
 };
 
 static inline void
@@ -54,6 +56,7 @@ spa_type_param_buffers_map(struct spa_type_map *map,
 		type->stride = spa_type_map_get_id(map, SPA_TYPE_PARAM_BUFFERS__stride);
 		type->buffers = spa_type_map_get_id(map, SPA_TYPE_PARAM_BUFFERS__buffers);
 		type->align = spa_type_map_get_id(map, SPA_TYPE_PARAM_BUFFERS__align);
+		type->hugepages = spa_type_map_get_id(map, SPA_TYPE_PARAM_BUFFERS__hugepages);
 	}
 }
 
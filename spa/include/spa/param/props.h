@@ -50,6 +50,9 @@ extern "C" {
 #define SPA_TYPE_PROPS__frequency	SPA_TYPE_PROPS_BASE "frequency"
 #define SPA_TYPE_PROPS__volume		SPA_TYPE_PROPS_BASE "volume"
 #define SPA_TYPE_PROPS__mute		SPA_TYPE_PROPS_BASE "mute"
+#define SPA_TYPE_PROPS__channelVolumes	SPA_TYPE_PROPS_BASE "channelVolumes"	/**< array of float gains, one for each channel */
+#define SPA_TYPE_PROPS__rampLength	SPA_TYPE_PROPS_BASE "rampLength"	/**< volume ramp length in frames */
+#define SPA_TYPE_PROPS__rampType	SPA_TYPE_PROPS_BASE "rampType"		/**< volume ramp curve */
 #define SPA_TYPE_PROPS__patternType	SPA_TYPE_PROPS_BASE "patternType"
 
 #define SPA_TYPE_PROPS__brightness	SPA_TYPE_PROPS_BASE "brightness"
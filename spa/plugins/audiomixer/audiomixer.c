@@ -20,6 +20,7 @@
 #include <errno.h>
 #include <string.h>
 #include <stdio.h>
+#include <stdlib.h>
 
 #include <spa/support/log.h>
 #include <spa/support/type-map.h>
@@ -42,6 +43,20 @@
 #define PORT_DEFAULT_VOLUME	1.0
 #define PORT_DEFAULT_MUTE	false
 
+#define DEFAULT_RAMP_LENGTH	256
+#define DEFAULT_RAMP_TYPE	MIX_RAMP_LINEAR
+
+struct props {
+	int32_t ramp_length;
+	int32_t ramp_type;
+};
+
+static void props_reset(struct props *props)
+{
+	props->ramp_length = DEFAULT_RAMP_LENGTH;
+	props->ramp_type = DEFAULT_RAMP_TYPE;
+}
+
 struct port_props {
 	double volume;
 	int32_t mute;
@@ -72,6 +87,8 @@ struct port {
 	double *io_volume;
 	int32_t *io_mute;
 
+	struct mix_ramp ramp;
+
 	struct spa_port_info info;
 
 	bool have_format;
@@ -86,8 +103,11 @@ struct port {
 struct type {
 	uint32_t node;
 	uint32_t format;
+	uint32_t props;
 	uint32_t prop_volume;
 	uint32_t prop_mute;
+	uint32_t prop_ramp_length;
+	uint32_t prop_ramp_type;
 	uint32_t io_prop_volume;
 	uint32_t io_prop_mute;
 	struct spa_type_io io;
@@ -110,6 +130,9 @@ static inline void init_type(struct type *type, struct spa_type_map *map)
 	type->format = spa_type_map_get_id(map, SPA_TYPE__Format);
 	type->prop_volume = spa_type_map_get_id(map, SPA_TYPE_PROPS__volume);
 	type->prop_mute = spa_type_map_get_id(map, SPA_TYPE_PROPS__mute);
+	type->props = spa_type_map_get_id(map, SPA_TYPE__Props);
+	type->prop_ramp_length = spa_type_map_get_id(map, SPA_TYPE_PROPS__rampLength);
+	type->prop_ramp_type = spa_type_map_get_id(map, SPA_TYPE_PROPS__rampType);
 	type->io_prop_volume = spa_type_map_get_id(map, SPA_TYPE_IO_PROP_BASE "volume");
 	type->io_prop_mute = spa_type_map_get_id(map, SPA_TYPE_IO_PROP_BASE "mute");
 	spa_type_io_map(map, &type->io);
@@ -126,6 +149,16 @@ static inline void init_type(struct type *type, struct spa_type_map *map)
 	spa_type_param_io_map(map, &type->param_io);
 }
 
+struct mix_input {
+	struct port *port;
+	struct buffer *buffer;
+	void *data;
+	uint32_t maxsize;
+	uint32_t offset;
+	double volume;
+	bool ramp;
+};
+
 struct impl {
 	struct spa_handle handle;
 	struct spa_node node;
@@ -136,6 +169,8 @@ struct impl {
 
 	struct spa_audiomixer_ops ops;
 
+	struct props props;
+
 	const struct spa_node_callbacks *callbacks;
 	void *user_data;
 
@@ -148,12 +183,12 @@ struct impl {
 	int n_formats;
 	struct spa_audio_info format;
 	uint32_t bpf;
+	uint32_t n_channels;
 
-	mix_clear_func_t clear;
-	mix_func_t copy;
-	mix_func_t add;
-	mix_scale_func_t copy_scale;
-	mix_scale_func_t add_scale;
+	mix_n_func_t mix;
+	mix_ramp_func_t add_ramp;
+	struct mix_input inputs[MAX_PORTS];
+	struct mix_source sources[MAX_PORTS];
 
 	bool started;
 };
@@ -169,16 +204,113 @@ struct impl {
 static int impl_node_enum_params(struct spa_node *node,
 				 uint32_t id, uint32_t *index,
 				 const struct spa_pod *filter,
-				 struct spa_pod **param,
+				 struct spa_pod **result,
 				 struct spa_pod_builder *builder)
 {
-	return -ENOTSUP;
+	struct impl *this;
+	struct type *t;
+	struct spa_pod *param;
+	struct spa_pod_builder b = { 0 };
+	uint8_t buffer[1024];
+	struct props *p;
+
+	spa_return_val_if_fail(node != NULL, -EINVAL);
+	spa_return_val_if_fail(index != NULL, -EINVAL);
+	spa_return_val_if_fail(builder != NULL, -EINVAL);
+
+	this = SPA_CONTAINER_OF(node, struct impl, node);
+	t = &this->type;
+	p = &this->props;
+
+      next:
+	spa_pod_builder_init(&b, buffer, sizeof(buffer));
+
+	if (id == t->param.idList) {
+		uint32_t list[] = { t->param.idPropInfo,
+				    t->param.idProps };
+
+		if (*index < SPA_N_ELEMENTS(list))
+			param = spa_pod_builder_object(&b, id, t->param.List,
+				":", t->param.listId, "I", list[*index]);
+		else
+			return 0;
+	}
+	else if (id == t->param.idPropInfo) {
+		switch (*index) {
+		case 0:
+			param = spa_pod_builder_object(&b,
+				id, t->param.PropInfo,
+				":", t->param.propId,   "I", t->prop_ramp_length,
+				":", t->param.propName, "s", "Volume ramp length in frames",
+				":", t->param.propType, "ir", p->ramp_length,
+					SPA_POD_PROP_MIN_MAX(0, INT32_MAX));
+			break;
+		case 1:
+			param = spa_pod_builder_object(&b,
+				id, t->param.PropInfo,
+				":", t->param.propId,   "I", t->prop_ramp_type,
+				":", t->param.propName, "s", "Volume ramp curve",
+				":", t->param.propType, "i", p->ramp_type,
+				":", t->param.propLabels, "[-i",
+					"i", MIX_RAMP_LINEAR, "s", "Linear",
+					"i", MIX_RAMP_EXPONENTIAL, "s", "Exponential", "]");
+			break;
+		default:
+			return 0;
+		}
+	}
+	else if (id == t->param.idProps) {
+		switch (*index) {
+		case 0:
+			param = spa_pod_builder_object(&b,
+				id, t->props,
+				":", t->prop_ramp_length, "i", p->ramp_length,
+				":", t->prop_ramp_type,   "i", p->ramp_type);
+			break;
+		default:
+			return 0;
+		}
+	}
+	else
+		return -ENOENT;
+
+	(*index)++;
+
+	if (spa_pod_filter(builder, result, param, filter) < 0)
+		goto next;
+
+	return 1;
 }
 
 static int impl_node_set_param(struct spa_node *node, uint32_t id, uint32_t flags,
 			       const struct spa_pod *param)
 {
-	return -ENOTSUP;
+	struct impl *this;
+	struct type *t;
+
+	spa_return_val_if_fail(node != NULL, -EINVAL);
+
+	this = SPA_CONTAINER_OF(node, struct impl, node);
+	t = &this->type;
+
+	if (id == t->param.idProps) {
+		struct props *p = &this->props;
+
+		if (param == NULL) {
+			props_reset(p);
+			return 0;
+		}
+		spa_pod_object_parse(param,
+			":", t->prop_ramp_length, "?i", &p->ramp_length,
+			":", t->prop_ramp_type,   "?i", &p->ramp_type,
+			NULL);
+
+		p->ramp_length = SPA_MAX(p->ramp_length, 0);
+	}
+	else
+		return -ENOENT;
+
+	return 0;
 }
 
 static int impl_node_send_command(struct spa_node *node, const struct spa_command *command)
@@ -285,6 +417,7 @@ static int impl_node_add_port(struct spa_node *node, enum spa_direction directio
 	port_props_reset(&port->props);
 	port->io_volume = &port->props.volume;
 	port->io_mute = &port->props.mute;
+	mix_ramp_init(&port->ramp, port->props.volume);
 
 	spa_list_init(&port->queue);
 	port->info.flags = SPA_PORT_INFO_FLAG_CAN_USE_BUFFERS |
@@ -383,8 +516,12 @@ static int port_enum_formats(struct spa_node *node,
 				"I", t->media_type.audio,
 				"I", t->media_subtype.raw,
 				":", t->format_audio.format,   "Ieu", t->audio_format.S16,
-					SPA_POD_PROP_ENUM(2, t->audio_format.S16,
-							     t->audio_format.F32),
+					SPA_POD_PROP_ENUM(6, t->audio_format.S16,
+							     t->audio_format.S24_32,
+							     t->audio_format.S24,
+							     t->audio_format.S32,
+							     t->audio_format.F32,
+							     t->audio_format.F64),
 				":", t->format_audio.rate,     "iru", 44100,
 					SPA_POD_PROP_MIN_MAX(1, INT32_MAX),
 				":", t->format_audio.channels, "iru", 2,
@@ -616,25 +753,40 @@ static int port_set_format(struct spa_node *node,
 			if (memcmp(&info, &this->format, sizeof(struct spa_audio_info)))
 				return -EINVAL;
 		} else {
+			uint32_t fmt, size;
+
 			if (info.info.raw.format == t->audio_format.S16) {
-				this->clear = this->ops.clear[FMT_S16];
-				this->copy = this->ops.copy[FMT_S16];
-				this->add = this->ops.add[FMT_S16];
-				this->copy_scale = this->ops.copy_scale[FMT_S16];
-				this->add_scale = this->ops.add_scale[FMT_S16];
-				this->bpf = sizeof(int16_t) * info.info.raw.channels;
+				fmt = FMT_S16;
+				size = sizeof(int16_t);
+			}
+			else if (info.info.raw.format == t->audio_format.S24) {
+				fmt = FMT_S24;
+				size = 3;
+			}
+			else if (info.info.raw.format == t->audio_format.S24_32) {
+				fmt = FMT_S24_32;
+				size = sizeof(int32_t);
+			}
+			else if (info.info.raw.format == t->audio_format.S32) {
+				fmt = FMT_S32;
+				size = sizeof(int32_t);
 			}
 			else if (info.info.raw.format == t->audio_format.F32) {
-				this->clear = this->ops.clear[FMT_F32];
-				this->copy = this->ops.copy[FMT_F32];
-				this->add = this->ops.add[FMT_F32];
-				this->copy_scale = this->ops.copy_scale[FMT_F32];
-				this->add_scale = this->ops.add_scale[FMT_F32];
-				this->bpf = sizeof(float) * info.info.raw.channels;
+				fmt = FMT_F32;
+				size = sizeof(float);
+			}
+			else if (info.info.raw.format == t->audio_format.F64) {
+				fmt = FMT_F64;
+				size = sizeof(double);
 			}
 			else
 				return -EINVAL;
 
+			this->mix = this->ops.mix[fmt];
+			this->add_ramp = this->ops.add_ramp[fmt];
+			this->n_channels = info.info.raw.channels;
+			this->bpf = size * info.info.raw.channels;
+
 			this->have_format = true;
 			this->format = info;
 		}
@@ -816,78 +968,122 @@ impl_node_port_send_command(struct spa_node *node,
 	return -ENOTSUP;
 }
 
-static inline void
-add_port_data(struct impl *this, void *out, size_t outsize, struct port *port, int layer)
+static void consume_port_data(struct impl *this, struct port *port, struct buffer *b, size_t size)
 {
-	size_t insize;
-	struct buffer *b;
-	uint32_t index, offset, len1, len2, maxsize;
-	struct spa_data *d;
-	void *data;
-	double volume = *port->io_volume;
-	bool mute = *port->io_mute;
+	port->queued_bytes -= size;
 
-	b = spa_list_first(&port->queue, struct buffer, link);
-
-	d = b->outbuf->datas;
-
-	maxsize = d[0].maxsize;
-	data = d[0].data;
+	if (port->queued_bytes == 0) {
+		spa_log_trace(this->log, NAME " %p: return buffer %d on port %p %zd",
+			      this, b->outbuf->id, port, size);
+		port->io->buffer_id = b->outbuf->id;
+		spa_list_remove(&b->link);
+		b->outstanding = true;
+	} else {
+		spa_log_trace(this->log, NAME " %p: keeping buffer %d on port %p %zd %zd",
+			      this, b->outbuf->id, port, port->queued_bytes, size);
+	}
+}
 
-	insize = SPA_MIN(d[0].chunk->size, maxsize);
-	outsize = SPA_MIN(outsize, insize);
+/* add the input with a changing volume to out, following the wrap of the
+ * input ringbuffer. The ramp advances per frame, a frame that is split by
+ * the wrap is added from a copy on the stack */
+static void add_ramp_input(struct impl *this, void *out, struct mix_input *in, size_t n_bytes)
+{
+	struct mix_ramp *r = &in->port->ramp;
+	uint32_t bpf = this->bpf, n_frames, done, len;
+	size_t pos, avail;
+	float start, step;
+
+	for (pos = 0; pos < n_bytes; pos += avail) {
+		avail = SPA_MIN(n_bytes - pos, in->maxsize - in->offset);
+
+		if (avail < bpf) {
+			uint8_t sframe[MIX_MAX_CHANNELS * sizeof(double)];
+			uint8_t dframe[MIX_MAX_CHANNELS * sizeof(double)];
+			size_t l0 = avail;
+
+			avail = SPA_MIN(n_bytes - pos, bpf);
+			memset(sframe, 0, bpf);
+			memcpy(sframe, SPA_MEMBER(in->data, in->offset, void), l0);
+			memcpy(SPA_MEMBER(sframe, l0, void), in->data, avail - l0);
+			memset(dframe, 0, bpf);
+			memcpy(dframe, SPA_MEMBER(out, pos, void), avail);
+
+			mix_ramp_next(r, 1, &start, &step);
+			this->add_ramp(dframe, sframe, this->n_channels, start, step, bpf);
+
+			memcpy(SPA_MEMBER(out, pos, void), dframe, avail);
+		} else {
+			avail -= avail % bpf;
+			n_frames = avail / bpf;
+
+			for (done = 0; done < n_frames; done += len) {
+				len = mix_ramp_next(r, n_frames - done, &start, &step);
+				this->add_ramp(SPA_MEMBER(out, pos + done * bpf, void),
+					       SPA_MEMBER(in->data, in->offset + done * bpf, void),
+					       this->n_channels, start, step, len * bpf);
+			}
+		}
+		in->offset = (in->offset + avail) % in->maxsize;
+	}
+}
 
-	index = d[0].chunk->offset + (insize - port->queued_bytes);
-	offset = index % maxsize;
+/* mix n_bytes of all inputs into out. The inputs without a volume ramp are
+ * mixed in one pass, split only where one of their ringbuffers wraps around.
+ * Inputs with a volume ramp in progress are added afterwards */
+static void mix_inputs(struct impl *this, void *out, size_t n_bytes,
+		       struct mix_input *inputs, uint32_t n_inputs)
+{
+	struct mix_source *sources = this->sources;
+	uint32_t i, n_sources;
+	size_t done, len;
+
+	for (done = 0; done < n_bytes; done += len) {
+		len = n_bytes - done;
+		for (i = 0; i < n_inputs; i++) {
+			if (!inputs[i].ramp)
+				len = SPA_MIN(len, inputs[i].maxsize - inputs[i].offset);
+		}
 
-	len1 = SPA_MIN(outsize, maxsize - offset);
-	len2 = outsize - len1;
+		for (i = 0, n_sources = 0; i < n_inputs; i++) {
+			struct mix_input *in = &inputs[i];
 
-	if (volume < 0.001 || mute) {
-		/* silence, for the first layer clear, otherwise do nothing */
-		if (layer == 0) {
-			this->clear(out, len1);
-			if (len2 > 0)
-				this->clear(out + len1, len2);
+			if (!in->ramp && in->volume >= 0.001) {
+				sources[n_sources].data = SPA_MEMBER(in->data, in->offset, void);
+				sources[n_sources].scale = in->volume;
+				n_sources++;
+			}
 		}
-	}
-	else if (volume < 0.999 || volume > 1.001) {
-		mix_scale_func_t mix = layer == 0 ? this->copy_scale : this->add_scale;
+		this->mix(SPA_MEMBER(out, done, void), sources, n_sources, len);
 
-		mix(out, SPA_MEMBER(data, offset, void), volume, len1);
-		if (len2 > 0)
-			mix(out + len1, data, volume, len2);
-	}
-	else {
-		mix_func_t mix = layer == 0 ? this->copy : this->add;
+		for (i = 0; i < n_inputs; i++) {
+			struct mix_input *in = &inputs[i];
 
-		mix(out, SPA_MEMBER(data, offset, void), len1);
-		if (len2 > 0)
-			mix(out + len1, data, len2);
-	}
+			if (in->ramp)
+				continue;
 
-	port->queued_bytes -= outsize;
+			in->offset += len;
+			if (in->offset >= in->maxsize)
+				in->offset = 0;
+		}
+	}
 
-	if (port->queued_bytes == 0) {
-		spa_log_trace(this->log, NAME " %p: return buffer %d on port %p %zd",
-			      this, b->outbuf->id, port, outsize);
-		port->io->buffer_id = b->outbuf->id;
-		spa_list_remove(&b->link);
-		b->outstanding = true;
-	} else {
-		spa_log_trace(this->log, NAME " %p: keeping buffer %d on port %p %zd %zd",
-			      this, b->outbuf->id, port, port->queued_bytes, outsize);
+	for (i = 0; i < n_inputs; i++) {
+		if (inputs[i].ramp)
+			add_ramp_input(this, out, &inputs[i], n_bytes);
 	}
 }
 
 static int mix_output(struct impl *this, size_t n_bytes)
 {
 	struct buffer *outbuf;
-	int i, layer;
+	int i;
+	uint32_t n_inputs;
 	struct port *outport;
 	struct spa_io_buffers *outio;
 	struct spa_data *od;
 	uint32_t avail, index, maxsize, len1, len2, offset;
+	struct mix_input *inputs = this->inputs;
 
 	outport = GET_OUT_PORT(this, 0);
 	outio = outport->io;
@@ -915,8 +1111,11 @@ static int mix_output(struct impl *this, size_t n_bytes)
 	spa_log_trace(this->log, NAME " %p: dequeue output buffer %d %zd %d %d %d",
 		      this, outbuf->outbuf->id, n_bytes, offset, len1, len2);
 
-	for (layer = 0, i = 0; i < this->last_port; i++) {
+	for (n_inputs = 0, i = 0; i < this->last_port; i++) {
 		struct port *in_port = GET_IN_PORT(this, i);
+		struct mix_input *in;
+		struct spa_data *d;
+		size_t insize;
 
 		if (in_port->io == NULL || in_port->n_buffers == 0)
 			continue;
@@ -926,12 +1125,31 @@ static int mix_output(struct impl *this, size_t n_bytes)
 			continue;
 		}
 
-		add_port_data(this, SPA_MEMBER(od[0].data, offset, void), len1, in_port, layer);
-		if (len2 > 0)
-			add_port_data(this, od[0].data, len2, in_port, layer);
-		layer++;
+		in = &inputs[n_inputs++];
+		in->port = in_port;
+		in->buffer = spa_list_first(&in_port->queue, struct buffer, link);
+
+		d = in->buffer->outbuf->datas;
+		in->data = d[0].data;
+		in->maxsize = d[0].maxsize;
+		insize = SPA_MIN(d[0].chunk->size, in->maxsize);
+		in->offset = (d[0].chunk->offset + (insize - in_port->queued_bytes)) % in->maxsize;
+		in->volume = *in_port->io_mute ? 0.0 : *in_port->io_volume;
+		if (in->volume > 0.999 && in->volume < 1.001)
+			in->volume = 1.0;
+
+		mix_ramp_set_target(&in_port->ramp, in->volume,
+				this->props.ramp_type, this->props.ramp_length);
+		in->ramp = mix_ramp_active(&in_port->ramp);
 	}
 
+	mix_inputs(this, SPA_MEMBER(od[0].data, offset, void), len1, inputs, n_inputs);
+	if (len2 > 0)
+		mix_inputs(this, od[0].data, len2, inputs, n_inputs);
+
+	for (i = 0; i < n_inputs; i++)
+		consume_port_data(this, inputs[i].port, inputs[i].buffer, n_bytes);
+
 	od[0].chunk->offset = index;
 	od[0].chunk->size = n_bytes;
 	od[0].chunk->stride = 0;
@@ -1115,7 +1333,8 @@ impl_init(const struct spa_handle_factory *factory,
 {
 	struct impl *this;
 	struct port *port;
-	uint32_t i;
+	uint32_t i, cpu_flags;
+	const char *str;
 
 	spa_return_val_if_fail(factory != NULL, -EINVAL);
 	spa_return_val_if_fail(handle != NULL, -EINVAL);
@@ -1145,7 +1364,18 @@ impl_init(const struct spa_handle_factory *factory,
 	    SPA_PORT_INFO_FLAG_NO_REF;
 	spa_list_init(&port->queue);
 
-	spa_audiomixer_get_ops(&this->ops);
+	cpu_flags = spa_audiomixer_get_cpu_flags();
+	/* force the plain C mix functions */
+	if ((str = getenv("SPA_AUDIOMIXER_DISABLE_SIMD")) ||
+	    (info && (str = spa_dict_lookup(info, "audiomixer.disable-simd")))) {
+		if (strcmp(str, "true") == 0 || atoi(str) == 1)
+			cpu_flags = 0;
+	}
+	spa_log_info(this->log, NAME " %p: using cpu flags %08x", this, cpu_flags);
+
+	spa_audiomixer_get_ops(&this->ops, cpu_flags);
+
+	props_reset(&this->props);
 
 	return 0;
 }
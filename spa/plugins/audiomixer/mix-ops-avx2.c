@@ -0,0 +1,471 @@
+/* Spa
+ * Copyright (C) 2018 Wim Taymans <wim.taymans@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include <immintrin.h>
+
+#include "mix-ops.h"
+
+/* (s * v) >> 11 for 16 samples, saturated to 16 bits */
+static inline __m256i
+scale_s16_avx2(__m128i s0, __m128i s1, __m256i v, __m256i *lo, __m256i *hi)
+{
+	*lo = _mm256_srai_epi32(_mm256_mullo_epi32(_mm256_cvtepi16_epi32(s0), v), 11);
+	*hi = _mm256_srai_epi32(_mm256_mullo_epi32(_mm256_cvtepi16_epi32(s1), v), 11);
+	/* packs works per 128 bit lane, put the samples back in order */
+	return _mm256_permute4x64_epi64(_mm256_packs_epi32(*lo, *hi), 0xd8);
+}
+
+static void
+copy_s16_avx2(void *dst, const void *src, int n_bytes)
+{
+	memcpy(dst, src, n_bytes);
+}
+
+static void
+copy_f32_avx2(void *dst, const void *src, int n_bytes)
+{
+	memcpy(dst, src, n_bytes);
+}
+
+static void
+add_s16_avx2(void *dst, const void *src, int n_bytes)
+{
+	const int16_t *s = src;
+	int16_t *d = dst;
+	int n, n_samples = n_bytes / sizeof(int16_t);
+	int32_t t;
+
+	for (n = 0; n + 32 <= n_samples; n += 32) {
+		__m256i d0 = _mm256_loadu_si256((__m256i*)&d[n]);
+		__m256i d1 = _mm256_loadu_si256((__m256i*)&d[n + 16]);
+		__m256i s0 = _mm256_loadu_si256((__m256i*)&s[n]);
+		__m256i s1 = _mm256_loadu_si256((__m256i*)&s[n + 16]);
+
+		_mm256_storeu_si256((__m256i*)&d[n], _mm256_adds_epi16(d0, s0));
+		_mm256_storeu_si256((__m256i*)&d[n + 16], _mm256_adds_epi16(d1, s1));
+	}
+	for (; n < n_samples; n++) {
+		t = d[n] + s[n];
+		d[n] = SPA_CLAMP(t, INT16_MIN, INT16_MAX);
+	}
+}
+
+static void
+add_f32_avx2(void *dst, const void *src, int n_bytes)
+{
+	const float *s = src;
+	float *d = dst;
+	int n, n_samples = n_bytes / sizeof(float);
+
+	for (n = 0; n + 16 <= n_samples; n += 16) {
+		__m256 d0 = _mm256_loadu_ps(&d[n]);
+		__m256 d1 = _mm256_loadu_ps(&d[n + 8]);
+
+		d0 = _mm256_add_ps(d0, _mm256_loadu_ps(&s[n]));
+		d1 = _mm256_add_ps(d1, _mm256_loadu_ps(&s[n + 8]));
+
+		_mm256_storeu_ps(&d[n], d0);
+		_mm256_storeu_ps(&d[n + 8], d1);
+	}
+	for (; n < n_samples; n++)
+		d[n] += s[n];
+}
+
+static void
+copy_scale_s16_avx2(void *dst, const void *src, const double scale, int n_bytes)
+{
+	const int16_t *s = src;
+	int16_t *d = dst;
+	int n, n_samples = n_bytes / sizeof(int16_t);
+	int32_t v = scale * (1 << 11), t;
+	__m256i vv = _mm256_set1_epi32(v), lo, hi;
+
+	for (n = 0; n + 16 <= n_samples; n += 16) {
+		__m128i s0 = _mm_loadu_si128((__m128i*)&s[n]);
+		__m128i s1 = _mm_loadu_si128((__m128i*)&s[n + 8]);
+
+		_mm256_storeu_si256((__m256i*)&d[n], scale_s16_avx2(s0, s1, vv, &lo, &hi));
+	}
+	for (; n < n_samples; n++) {
+		t = (s[n] * v) >> 11;
+		d[n] = SPA_CLAMP(t, INT16_MIN, INT16_MAX);
+	}
+}
+
+static void
+copy_scale_f32_avx2(void *dst, const void *src, const double scale, int n_bytes)
+{
+	const float *s = src;
+	float *d = dst;
+	int n, n_samples = n_bytes / sizeof(float);
+	float v = scale;
+	__m256 vv = _mm256_set1_ps(v);
+
+	for (n = 0; n + 16 <= n_samples; n += 16) {
+		_mm256_storeu_ps(&d[n], _mm256_mul_ps(_mm256_loadu_ps(&s[n]), vv));
+		_mm256_storeu_ps(&d[n + 8], _mm256_mul_ps(_mm256_loadu_ps(&s[n + 8]), vv));
+	}
+	for (; n < n_samples; n++)
+		d[n] = s[n] * v;
+}
+
+static void
+add_scale_s16_avx2(void *dst, const void *src, const double scale, int n_bytes)
+{
+	const int16_t *s = src;
+	int16_t *d = dst;
+	int n, n_samples = n_bytes / sizeof(int16_t);
+	int32_t v = scale * (1 << 11), t;
+	__m256i vv = _mm256_set1_epi32(v), lo, hi;
+
+	for (n = 0; n + 16 <= n_samples; n += 16) {
+		__m128i s0 = _mm_loadu_si128((__m128i*)&s[n]);
+		__m128i s1 = _mm_loadu_si128((__m128i*)&s[n + 8]);
+		__m128i d0 = _mm_loadu_si128((__m128i*)&d[n]);
+		__m128i d1 = _mm_loadu_si128((__m128i*)&d[n + 8]);
+
+		scale_s16_avx2(s0, s1, vv, &lo, &hi);
+		lo = _mm256_add_epi32(lo, _mm256_cvtepi16_epi32(d0));
+		hi = _mm256_add_epi32(hi, _mm256_cvtepi16_epi32(d1));
+		_mm256_storeu_si256((__m256i*)&d[n],
+				_mm256_permute4x64_epi64(_mm256_packs_epi32(lo, hi), 0xd8));
+	}
+	for (; n < n_samples; n++) {
+		t = d[n] + ((s[n] * v) >> 11);
+		d[n] = SPA_CLAMP(t, INT16_MIN, INT16_MAX);
+	}
+}
+
+static void
+add_scale_f32_avx2(void *dst, const void *src, const double scale, int n_bytes)
+{
+	const float *s = src;
+	float *d = dst;
+	int n, n_samples = n_bytes / sizeof(float);
+	float v = scale;
+	__m256 vv = _mm256_set1_ps(v);
+
+	for (n = 0; n + 16 <= n_samples; n += 16) {
+		__m256 d0 = _mm256_loadu_ps(&d[n]);
+		__m256 d1 = _mm256_loadu_ps(&d[n + 8]);
+
+		d0 = _mm256_add_ps(d0, _mm256_mul_ps(_mm256_loadu_ps(&s[n]), vv));
+		d1 = _mm256_add_ps(d1, _mm256_mul_ps(_mm256_loadu_ps(&s[n + 8]), vv));
+
+		_mm256_storeu_ps(&d[n], d0);
+		_mm256_storeu_ps(&d[n + 8], d1);
+	}
+	for (; n < n_samples; n++)
+		d[n] += s[n] * v;
+}
+
+static void
+mix_s16_avx2(void *dst, const struct mix_source *src, uint32_t n_src, int n_bytes)
+{
+	int16_t *d = dst;
+	int32_t acc[MIX_BLOCK] SPA_ALIGNED(32), v;
+	int i, n, chunk, n_samples = n_bytes / sizeof(int16_t);
+	uint32_t j;
+	__m256i vv, lo, hi;
+
+	for (n = 0; n < n_samples; n += chunk) {
+		chunk = SPA_MIN(n_samples - n, MIX_BLOCK);
+
+		memset(acc, 0, chunk * sizeof(int32_t));
+		for (j = 0; j < n_src; j++) {
+			const int16_t *s = (const int16_t *) src[j].data + n;
+
+			v = src[j].scale * (1 << 11);
+			vv = _mm256_set1_epi32(v);
+			for (i = 0; i + 16 <= chunk; i += 16) {
+				scale_s16_avx2(_mm_loadu_si128((__m128i*)&s[i]),
+					       _mm_loadu_si128((__m128i*)&s[i + 8]), vv, &lo, &hi);
+				_mm256_store_si256((__m256i*)&acc[i],
+						_mm256_add_epi32(_mm256_load_si256((__m256i*)&acc[i]), lo));
+				_mm256_store_si256((__m256i*)&acc[i + 8],
+						_mm256_add_epi32(_mm256_load_si256((__m256i*)&acc[i + 8]), hi));
+			}
+			for (; i < chunk; i++)
+				acc[i] += (s[i] * v) >> 11;
+		}
+		for (i = 0; i + 16 <= chunk; i += 16) {
+			lo = _mm256_load_si256((__m256i*)&acc[i]);
+			hi = _mm256_load_si256((__m256i*)&acc[i + 8]);
+			_mm256_storeu_si256((__m256i*)&d[n + i],
+					_mm256_permute4x64_epi64(_mm256_packs_epi32(lo, hi), 0xd8));
+		}
+		for (; i < chunk; i++)
+			d[n + i] = SPA_CLAMP(acc[i], INT16_MIN, INT16_MAX);
+	}
+}
+
+static void
+mix_f32_avx2(void *dst, const struct mix_source *src, uint32_t n_src, int n_bytes)
+{
+	float *d = dst;
+	int n, chunk, n_samples = n_bytes / sizeof(float);
+	uint32_t j;
+
+	if (n_src == 0) {
+		memset(dst, 0, n_bytes);
+		return;
+	}
+	for (n = 0; n < n_samples; n += chunk) {
+		chunk = SPA_MIN(n_samples - n, MIX_BLOCK);
+
+		copy_scale_f32_avx2(&d[n], (const float *) src[0].data + n,
+				src[0].scale, chunk * sizeof(float));
+		for (j = 1; j < n_src; j++)
+			add_scale_f32_avx2(&d[n], (const float *) src[j].data + n,
+					src[j].scale, chunk * sizeof(float));
+	}
+}
+
+static inline void
+init_frame_index_avx2(__m256 *idx, uint32_t n_vec, uint32_t n_channels)
+{
+	uint32_t i;
+
+	for (i = 0; i < n_vec * 8; i += 8)
+		idx[i / 8] = _mm256_setr_ps(i / n_channels, (i + 1) / n_channels,
+				(i + 2) / n_channels, (i + 3) / n_channels,
+				(i + 4) / n_channels, (i + 5) / n_channels,
+				(i + 6) / n_channels, (i + 7) / n_channels);
+}
+
+static void
+ramp_f32_avx2(void *dst, const void *src, uint32_t n_channels,
+		float start, float step, int n_bytes, bool add)
+{
+	const float *s = src;
+	float *d = dst;
+	int n, n_samples = (n_bytes / (sizeof(float) * n_channels)) * n_channels;
+	uint32_t i, n_vec = mix_n_vectors(n_channels, 8);
+	__m256 idx[MIX_MAX_CHANNELS], inc, vstart, vstep, g, v;
+	float gain;
+
+	init_frame_index_avx2(idx, n_vec, n_channels);
+	inc = _mm256_set1_ps(n_vec * 8 / n_channels);
+	vstart = _mm256_set1_ps(start);
+	vstep = _mm256_set1_ps(step);
+
+	for (n = 0; n + (int) n_vec * 8 <= n_samples;) {
+		for (i = 0; i < n_vec; i++, n += 8) {
+			g = _mm256_add_ps(vstart, _mm256_mul_ps(idx[i], vstep));
+			v = _mm256_mul_ps(_mm256_loadu_ps(&s[n]), g);
+			if (add)
+				v = _mm256_add_ps(_mm256_loadu_ps(&d[n]), v);
+			_mm256_storeu_ps(&d[n], v);
+			idx[i] = _mm256_add_ps(idx[i], inc);
+		}
+	}
+	for (; n < n_samples; n++) {
+		gain = start + (uint32_t) (n / n_channels) * step;
+		if (add)
+			d[n] += s[n] * gain;
+		else
+			d[n] = s[n] * gain;
+	}
+}
+
+static void
+copy_ramp_f32_avx2(void *dst, const void *src, uint32_t n_channels, float start, float step, int n_bytes)
+{
+	if (n_channels > MIX_MAX_CHANNELS)
+		copy_ramp_f32_c(dst, src, n_channels, start, step, n_bytes);
+	else
+		ramp_f32_avx2(dst, src, n_channels, start, step, n_bytes, false);
+}
+
+static void
+add_ramp_f32_avx2(void *dst, const void *src, uint32_t n_channels, float start, float step, int n_bytes)
+{
+	if (n_channels > MIX_MAX_CHANNELS)
+		add_ramp_f32_c(dst, src, n_channels, start, step, n_bytes);
+	else
+		ramp_f32_avx2(dst, src, n_channels, start, step, n_bytes, true);
+}
+
+static void
+ramp_s16_avx2(void *dst, const void *src, uint32_t n_channels,
+		float start, float step, int n_bytes, bool add)
+{
+	const int16_t *s = src;
+	int16_t *d = dst;
+	int n, n_samples = (n_bytes / (sizeof(int16_t) * n_channels)) * n_channels;
+	uint32_t i, n_vec = mix_n_vectors(n_channels, 16) * 2;
+	__m256 idx[MIX_MAX_CHANNELS * 2], inc, vstart, vstep, g0, g1;
+	__m256i lo, hi;
+	int32_t t;
+	float gain;
+
+	init_frame_index_avx2(idx, n_vec, n_channels);
+	inc = _mm256_set1_ps(n_vec * 8 / n_channels);
+	vstart = _mm256_set1_ps(start);
+	vstep = _mm256_set1_ps(step);
+
+	for (n = 0; n + (int) n_vec * 8 <= n_samples;) {
+		for (i = 0; i < n_vec; i += 2, n += 16) {
+			g0 = _mm256_add_ps(vstart, _mm256_mul_ps(idx[i], vstep));
+			g1 = _mm256_add_ps(vstart, _mm256_mul_ps(idx[i + 1], vstep));
+
+			lo = _mm256_cvtepi16_epi32(_mm_loadu_si128((__m128i*)&s[n]));
+			hi = _mm256_cvtepi16_epi32(_mm_loadu_si128((__m128i*)&s[n + 8]));
+			lo = _mm256_cvttps_epi32(_mm256_mul_ps(_mm256_cvtepi32_ps(lo), g0));
+			hi = _mm256_cvttps_epi32(_mm256_mul_ps(_mm256_cvtepi32_ps(hi), g1));
+			if (add) {
+				lo = _mm256_add_epi32(lo,
+					_mm256_cvtepi16_epi32(_mm_loadu_si128((__m128i*)&d[n])));
+				hi = _mm256_add_epi32(hi,
+					_mm256_cvtepi16_epi32(_mm_loadu_si128((__m128i*)&d[n + 8])));
+			}
+			_mm256_storeu_si256((__m256i*)&d[n],
+				_mm256_permute4x64_epi64(_mm256_packs_epi32(lo, hi), 0xd8));
+
+			idx[i] = _mm256_add_ps(idx[i], inc);
+			idx[i + 1] = _mm256_add_ps(idx[i + 1], inc);
+		}
+	}
+	for (; n < n_samples; n++) {
+		gain = start + (uint32_t) (n / n_channels) * step;
+		t = (int32_t) (s[n] * gain);
+		if (add)
+			t += d[n];
+		d[n] = SPA_CLAMP(t, INT16_MIN, INT16_MAX);
+	}
+}
+
+static void
+copy_ramp_s16_avx2(void *dst, const void *src, uint32_t n_channels, float start, float step, int n_bytes)
+{
+	if (n_channels > MIX_MAX_CHANNELS)
+		copy_ramp_s16_c(dst, src, n_channels, start, step, n_bytes);
+	else
+		ramp_s16_avx2(dst, src, n_channels, start, step, n_bytes, false);
+}
+
+static void
+add_ramp_s16_avx2(void *dst, const void *src, uint32_t n_channels, float start, float step, int n_bytes)
+{
+	if (n_channels > MIX_MAX_CHANNELS)
+		add_ramp_s16_c(dst, src, n_channels, start, step, n_bytes);
+	else
+		ramp_s16_avx2(dst, src, n_channels, start, step, n_bytes, true);
+}
+
+static void
+copy_channels_f32_avx2(void *dst, const void *src, uint32_t n_channels, const float *scales, int n_bytes)
+{
+	const float *s = src;
+	float *d = dst;
+	int n, n_samples = (n_bytes / (sizeof(float) * n_channels)) * n_channels;
+	uint32_t i, j, n_vec = mix_n_vectors(n_channels, 8);
+	__m256 g[MIX_MAX_CHANNELS];
+	float f[8];
+
+	if (n_channels > MIX_MAX_CHANNELS) {
+		copy_channels_f32_c(dst, src, n_channels, scales, n_bytes);
+		return;
+	}
+	for (i = 0; i < n_vec; i++) {
+		for (j = 0; j < 8; j++)
+			f[j] = scales[(i * 8 + j) % n_channels];
+		g[i] = _mm256_loadu_ps(f);
+	}
+
+	for (n = 0; n + (int) n_vec * 8 <= n_samples;) {
+		for (i = 0; i < n_vec; i++, n += 8)
+			_mm256_storeu_ps(&d[n], _mm256_mul_ps(_mm256_loadu_ps(&s[n]), g[i]));
+	}
+	for (; n < n_samples; n++)
+		d[n] = s[n] * scales[n % n_channels];
+}
+
+static void
+copy_channels_s16_avx2(void *dst, const void *src, uint32_t n_channels, const float *scales, int n_bytes)
+{
+	const int16_t *s = src;
+	int16_t *d = dst;
+	int n, n_samples = (n_bytes / (sizeof(int16_t) * n_channels)) * n_channels;
+	uint32_t i, j, n_vec = mix_n_vectors(n_channels, 16) * 2;
+	__m256 g[MIX_MAX_CHANNELS * 2];
+	__m256i lo, hi;
+	float f[8];
+	int32_t t;
+
+	if (n_channels > MIX_MAX_CHANNELS) {
+		copy_channels_s16_c(dst, src, n_channels, scales, n_bytes);
+		return;
+	}
+	for (i = 0; i < n_vec; i++) {
+		for (j = 0; j < 8; j++)
+			f[j] = scales[(i * 8 + j) % n_channels];
+		g[i] = _mm256_loadu_ps(f);
+	}
+
+	for (n = 0; n + (int) n_vec * 8 <= n_samples;) {
+		for (i = 0; i < n_vec; i += 2, n += 16) {
+			lo = _mm256_cvtepi16_epi32(_mm_loadu_si128((__m128i*)&s[n]));
+			hi = _mm256_cvtepi16_epi32(_mm_loadu_si128((__m128i*)&s[n + 8]));
+			lo = _mm256_cvttps_epi32(_mm256_mul_ps(_mm256_cvtepi32_ps(lo), g[i]));
+			hi = _mm256_cvttps_epi32(_mm256_mul_ps(_mm256_cvtepi32_ps(hi), g[i + 1]));
+			_mm256_storeu_si256((__m256i*)&d[n],
+				_mm256_permute4x64_epi64(_mm256_packs_epi32(lo, hi), 0xd8));
+		}
+	}
+	for (; n < n_samples; n++) {
+		t = (int32_t) (s[n] * scales[n % n_channels]);
+		d[n] = SPA_CLAMP(t, INT16_MIN, INT16_MAX);
+	}
+}
+
+DEFINE_MIX_I_FUNC(copy_s16_i, copy_s16_avx2, avx2)
+DEFINE_MIX_I_FUNC(copy_f32_i, copy_f32_avx2, avx2)
+DEFINE_MIX_I_FUNC(add_s16_i, add_s16_avx2, avx2)
+DEFINE_MIX_I_FUNC(add_f32_i, add_f32_avx2, avx2)
+DEFINE_MIX_SCALE_I_FUNC(copy_scale_s16_i, copy_scale_s16_avx2, avx2)
+DEFINE_MIX_SCALE_I_FUNC(copy_scale_f32_i, copy_scale_f32_avx2, avx2)
+DEFINE_MIX_SCALE_I_FUNC(add_scale_s16_i, add_scale_s16_avx2, avx2)
+DEFINE_MIX_SCALE_I_FUNC(add_scale_f32_i, add_scale_f32_avx2, avx2)
+
+void spa_audiomixer_get_ops_avx2(struct spa_audiomixer_ops *ops)
+{
+	ops->add[FMT_S16] = add_s16_avx2;
+	ops->add[FMT_F32] = add_f32_avx2;
+	ops->copy_scale[FMT_S16] = copy_scale_s16_avx2;
+	ops->copy_scale[FMT_F32] = copy_scale_f32_avx2;
+	ops->add_scale[FMT_S16] = add_scale_s16_avx2;
+	ops->add_scale[FMT_F32] = add_scale_f32_avx2;
+	ops->copy_i[FMT_S16] = copy_s16_i_avx2;
+	ops->copy_i[FMT_F32] = copy_f32_i_avx2;
+	ops->add_i[FMT_S16] = add_s16_i_avx2;
+	ops->add_i[FMT_F32] = add_f32_i_avx2;
+	ops->copy_scale_i[FMT_S16] = copy_scale_s16_i_avx2;
+	ops->copy_scale_i[FMT_F32] = copy_scale_f32_i_avx2;
+	ops->add_scale_i[FMT_S16] = add_scale_s16_i_avx2;
+	ops->add_scale_i[FMT_F32] = add_scale_f32_i_avx2;
+	ops->mix[FMT_S16] = mix_s16_avx2;
+	ops->mix[FMT_F32] = mix_f32_avx2;
+	ops->copy_ramp[FMT_S16] = copy_ramp_s16_avx2;
+	ops->copy_ramp[FMT_F32] = copy_ramp_f32_avx2;
+	ops->add_ramp[FMT_S16] = add_ramp_s16_avx2;
+	ops->add_ramp[FMT_F32] = add_ramp_f32_avx2;
+	ops->copy_channels[FMT_S16] = copy_channels_s16_avx2;
+	ops->copy_channels[FMT_F32] = copy_channels_f32_avx2;
+}
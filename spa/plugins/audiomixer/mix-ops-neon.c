@@ -0,0 +1,441 @@
+/* Spa
+ * Copyright (C) 2018 Wim Taymans <wim.taymans@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include <arm_neon.h>
+
+#include "mix-ops.h"
+
+/* (s * v) >> 11 for 8 samples, kept as 32 bits */
+static inline void
+scale_s16_neon(int16x8_t s, int32x4_t v, int32x4_t *lo, int32x4_t *hi)
+{
+	*lo = vshrq_n_s32(vmulq_s32(vmovl_s16(vget_low_s16(s)), v), 11);
+	*hi = vshrq_n_s32(vmulq_s32(vmovl_s16(vget_high_s16(s)), v), 11);
+}
+
+static void
+copy_s16_neon(void *dst, const void *src, int n_bytes)
+{
+	memcpy(dst, src, n_bytes);
+}
+
+static void
+copy_f32_neon(void *dst, const void *src, int n_bytes)
+{
+	memcpy(dst, src, n_bytes);
+}
+
+static void
+add_s16_neon(void *dst, const void *src, int n_bytes)
+{
+	const int16_t *s = src;
+	int16_t *d = dst;
+	int n, n_samples = n_bytes / sizeof(int16_t);
+	int32_t t;
+
+	for (n = 0; n + 16 <= n_samples; n += 16) {
+		vst1q_s16(&d[n], vqaddq_s16(vld1q_s16(&d[n]), vld1q_s16(&s[n])));
+		vst1q_s16(&d[n + 8], vqaddq_s16(vld1q_s16(&d[n + 8]), vld1q_s16(&s[n + 8])));
+	}
+	for (; n < n_samples; n++) {
+		t = d[n] + s[n];
+		d[n] = SPA_CLAMP(t, INT16_MIN, INT16_MAX);
+	}
+}
+
+static void
+add_f32_neon(void *dst, const void *src, int n_bytes)
+{
+	const float *s = src;
+	float *d = dst;
+	int n, n_samples = n_bytes / sizeof(float);
+
+	for (n = 0; n + 8 <= n_samples; n += 8) {
+		vst1q_f32(&d[n], vaddq_f32(vld1q_f32(&d[n]), vld1q_f32(&s[n])));
+		vst1q_f32(&d[n + 4], vaddq_f32(vld1q_f32(&d[n + 4]), vld1q_f32(&s[n + 4])));
+	}
+	for (; n < n_samples; n++)
+		d[n] += s[n];
+}
+
+static void
+copy_scale_s16_neon(void *dst, const void *src, const double scale, int n_bytes)
+{
+	const int16_t *s = src;
+	int16_t *d = dst;
+	int n, n_samples = n_bytes / sizeof(int16_t);
+	int32_t v = scale * (1 << 11), t;
+	int32x4_t vv = vdupq_n_s32(v), lo, hi;
+
+	for (n = 0; n + 8 <= n_samples; n += 8) {
+		scale_s16_neon(vld1q_s16(&s[n]), vv, &lo, &hi);
+		vst1q_s16(&d[n], vcombine_s16(vqmovn_s32(lo), vqmovn_s32(hi)));
+	}
+	for (; n < n_samples; n++) {
+		t = (s[n] * v) >> 11;
+		d[n] = SPA_CLAMP(t, INT16_MIN, INT16_MAX);
+	}
+}
+
+static void
+copy_scale_f32_neon(void *dst, const void *src, const double scale, int n_bytes)
+{
+	const float *s = src;
+	float *d = dst;
+	int n, n_samples = n_bytes / sizeof(float);
+	float v = scale;
+
+	for (n = 0; n + 8 <= n_samples; n += 8) {
+		vst1q_f32(&d[n], vmulq_n_f32(vld1q_f32(&s[n]), v));
+		vst1q_f32(&d[n + 4], vmulq_n_f32(vld1q_f32(&s[n + 4]), v));
+	}
+	for (; n < n_samples; n++)
+		d[n] = s[n] * v;
+}
+
+static void
+add_scale_s16_neon(void *dst, const void *src, const double scale, int n_bytes)
+{
+	const int16_t *s = src;
+	int16_t *d = dst;
+	int n, n_samples = n_bytes / sizeof(int16_t);
+	int32_t v = scale * (1 << 11), t;
+	int32x4_t vv = vdupq_n_s32(v), lo, hi;
+
+	for (n = 0; n + 8 <= n_samples; n += 8) {
+		int16x8_t d0 = vld1q_s16(&d[n]);
+
+		scale_s16_neon(vld1q_s16(&s[n]), vv, &lo, &hi);
+		lo = vaddw_s16(lo, vget_low_s16(d0));
+		hi = vaddw_s16(hi, vget_high_s16(d0));
+		vst1q_s16(&d[n], vcombine_s16(vqmovn_s32(lo), vqmovn_s32(hi)));
+	}
+	for (; n < n_samples; n++) {
+		t = d[n] + ((s[n] * v) >> 11);
+		d[n] = SPA_CLAMP(t, INT16_MIN, INT16_MAX);
+	}
+}
+
+static void
+add_scale_f32_neon(void *dst, const void *src, const double scale, int n_bytes)
+{
+	const float *s = src;
+	float *d = dst;
+	int n, n_samples = n_bytes / sizeof(float);
+	float v = scale;
+
+	for (n = 0; n + 8 <= n_samples; n += 8) {
+		/* not vmlaq, we want the same rounding as the C version */
+		vst1q_f32(&d[n], vaddq_f32(vld1q_f32(&d[n]),
+					vmulq_n_f32(vld1q_f32(&s[n]), v)));
+		vst1q_f32(&d[n + 4], vaddq_f32(vld1q_f32(&d[n + 4]),
+					vmulq_n_f32(vld1q_f32(&s[n + 4]), v)));
+	}
+	for (; n < n_samples; n++)
+		d[n] += s[n] * v;
+}
+
+static void
+mix_s16_neon(void *dst, const struct mix_source *src, uint32_t n_src, int n_bytes)
+{
+	int16_t *d = dst;
+	int32_t acc[MIX_BLOCK] SPA_ALIGNED(16), v;
+	int i, n, chunk, n_samples = n_bytes / sizeof(int16_t);
+	uint32_t j;
+	int32x4_t vv, lo, hi;
+
+	for (n = 0; n < n_samples; n += chunk) {
+		chunk = SPA_MIN(n_samples - n, MIX_BLOCK);
+
+		memset(acc, 0, chunk * sizeof(int32_t));
+		for (j = 0; j < n_src; j++) {
+			const int16_t *s = (const int16_t *) src[j].data + n;
+
+			v = src[j].scale * (1 << 11);
+			vv = vdupq_n_s32(v);
+			for (i = 0; i + 8 <= chunk; i += 8) {
+				scale_s16_neon(vld1q_s16(&s[i]), vv, &lo, &hi);
+				vst1q_s32(&acc[i], vaddq_s32(vld1q_s32(&acc[i]), lo));
+				vst1q_s32(&acc[i + 4], vaddq_s32(vld1q_s32(&acc[i + 4]), hi));
+			}
+			for (; i < chunk; i++)
+				acc[i] += (s[i] * v) >> 11;
+		}
+		for (i = 0; i + 8 <= chunk; i += 8) {
+			lo = vld1q_s32(&acc[i]);
+			hi = vld1q_s32(&acc[i + 4]);
+			vst1q_s16(&d[n + i], vcombine_s16(vqmovn_s32(lo), vqmovn_s32(hi)));
+		}
+		for (; i < chunk; i++)
+			d[n + i] = SPA_CLAMP(acc[i], INT16_MIN, INT16_MAX);
+	}
+}
+
+static void
+mix_f32_neon(void *dst, const struct mix_source *src, uint32_t n_src, int n_bytes)
+{
+	float *d = dst;
+	int n, chunk, n_samples = n_bytes / sizeof(float);
+	uint32_t j;
+
+	if (n_src == 0) {
+		memset(dst, 0, n_bytes);
+		return;
+	}
+	for (n = 0; n < n_samples; n += chunk) {
+		chunk = SPA_MIN(n_samples - n, MIX_BLOCK);
+
+		copy_scale_f32_neon(&d[n], (const float *) src[0].data + n,
+				src[0].scale, chunk * sizeof(float));
+		for (j = 1; j < n_src; j++)
+			add_scale_f32_neon(&d[n], (const float *) src[j].data + n,
+					src[j].scale, chunk * sizeof(float));
+	}
+}
+
+static inline void
+init_frame_index_neon(float32x4_t *idx, uint32_t n_vec, uint32_t n_channels)
+{
+	uint32_t i;
+	float f[4];
+
+	for (i = 0; i < n_vec * 4; i += 4) {
+		f[0] = i / n_channels;
+		f[1] = (i + 1) / n_channels;
+		f[2] = (i + 2) / n_channels;
+		f[3] = (i + 3) / n_channels;
+		idx[i / 4] = vld1q_f32(f);
+	}
+}
+
+static void
+ramp_f32_neon(void *dst, const void *src, uint32_t n_channels,
+		float start, float step, int n_bytes, bool add)
+{
+	const float *s = src;
+	float *d = dst;
+	int n, n_samples = (n_bytes / (sizeof(float) * n_channels)) * n_channels;
+	uint32_t i, n_vec = mix_n_vectors(n_channels, 4);
+	float32x4_t idx[MIX_MAX_CHANNELS], inc, vstart, g, v;
+	float gain;
+
+	init_frame_index_neon(idx, n_vec, n_channels);
+	inc = vdupq_n_f32(n_vec * 4 / n_channels);
+	vstart = vdupq_n_f32(start);
+
+	for (n = 0; n + (int) n_vec * 4 <= n_samples;) {
+		for (i = 0; i < n_vec; i++, n += 4) {
+			g = vaddq_f32(vstart, vmulq_n_f32(idx[i], step));
+			v = vmulq_f32(vld1q_f32(&s[n]), g);
+			if (add)
+				v = vaddq_f32(vld1q_f32(&d[n]), v);
+			vst1q_f32(&d[n], v);
+			idx[i] = vaddq_f32(idx[i], inc);
+		}
+	}
+	for (; n < n_samples; n++) {
+		gain = start + (uint32_t) (n / n_channels) * step;
+		if (add)
+			d[n] += s[n] * gain;
+		else
+			d[n] = s[n] * gain;
+	}
+}
+
+static void
+copy_ramp_f32_neon(void *dst, const void *src, uint32_t n_channels, float start, float step, int n_bytes)
+{
+	if (n_channels > MIX_MAX_CHANNELS)
+		copy_ramp_f32_c(dst, src, n_channels, start, step, n_bytes);
+	else
+		ramp_f32_neon(dst, src, n_channels, start, step, n_bytes, false);
+}
+
+static void
+add_ramp_f32_neon(void *dst, const void *src, uint32_t n_channels, float start, float step, int n_bytes)
+{
+	if (n_channels > MIX_MAX_CHANNELS)
+		add_ramp_f32_c(dst, src, n_channels, start, step, n_bytes);
+	else
+		ramp_f32_neon(dst, src, n_channels, start, step, n_bytes, true);
+}
+
+static void
+ramp_s16_neon(void *dst, const void *src, uint32_t n_channels,
+		float start, float step, int n_bytes, bool add)
+{
+	const int16_t *s = src;
+	int16_t *d = dst;
+	int n, n_samples = (n_bytes / (sizeof(int16_t) * n_channels)) * n_channels;
+	uint32_t i, n_vec = mix_n_vectors(n_channels, 8) * 2;
+	float32x4_t idx[MIX_MAX_CHANNELS * 2], inc, vstart, g0, g1;
+	int16x8_t s0, d0;
+	int32x4_t lo, hi;
+	int32_t t;
+	float gain;
+
+	init_frame_index_neon(idx, n_vec, n_channels);
+	inc = vdupq_n_f32(n_vec * 4 / n_channels);
+	vstart = vdupq_n_f32(start);
+
+	for (n = 0; n + (int) n_vec * 4 <= n_samples;) {
+		for (i = 0; i < n_vec; i += 2, n += 8) {
+			g0 = vaddq_f32(vstart, vmulq_n_f32(idx[i], step));
+			g1 = vaddq_f32(vstart, vmulq_n_f32(idx[i + 1], step));
+
+			s0 = vld1q_s16(&s[n]);
+			lo = vcvtq_s32_f32(vmulq_f32(vcvtq_f32_s32(vmovl_s16(vget_low_s16(s0))), g0));
+			hi = vcvtq_s32_f32(vmulq_f32(vcvtq_f32_s32(vmovl_s16(vget_high_s16(s0))), g1));
+			if (add) {
+				d0 = vld1q_s16(&d[n]);
+				lo = vaddq_s32(lo, vmovl_s16(vget_low_s16(d0)));
+				hi = vaddq_s32(hi, vmovl_s16(vget_high_s16(d0)));
+			}
+			vst1q_s16(&d[n], vcombine_s16(vqmovn_s32(lo), vqmovn_s32(hi)));
+
+			idx[i] = vaddq_f32(idx[i], inc);
+			idx[i + 1] = vaddq_f32(idx[i + 1], inc);
+		}
+	}
+	for (; n < n_samples; n++) {
+		gain = start + (uint32_t) (n / n_channels) * step;
+		t = (int32_t) (s[n] * gain);
+		if (add)
+			t += d[n];
+		d[n] = SPA_CLAMP(t, INT16_MIN, INT16_MAX);
+	}
+}
+
+static void
+copy_ramp_s16_neon(void *dst, const void *src, uint32_t n_channels, float start, float step, int n_bytes)
+{
+	if (n_channels > MIX_MAX_CHANNELS)
+		copy_ramp_s16_c(dst, src, n_channels, start, step, n_bytes);
+	else
+		ramp_s16_neon(dst, src, n_channels, start, step, n_bytes, false);
+}
+
+static void
+add_ramp_s16_neon(void *dst, const void *src, uint32_t n_channels, float start, float step, int n_bytes)
+{
+	if (n_channels > MIX_MAX_CHANNELS)
+		add_ramp_s16_c(dst, src, n_channels, start, step, n_bytes);
+	else
+		ramp_s16_neon(dst, src, n_channels, start, step, n_bytes, true);
+}
+
+static void
+copy_channels_f32_neon(void *dst, const void *src, uint32_t n_channels, const float *scales, int n_bytes)
+{
+	const float *s = src;
+	float *d = dst;
+	int n, n_samples = (n_bytes / (sizeof(float) * n_channels)) * n_channels;
+	uint32_t i, j, n_vec = mix_n_vectors(n_channels, 4);
+	float32x4_t g[MIX_MAX_CHANNELS];
+	float f[4];
+
+	if (n_channels > MIX_MAX_CHANNELS) {
+		copy_channels_f32_c(dst, src, n_channels, scales, n_bytes);
+		return;
+	}
+	for (i = 0; i < n_vec; i++) {
+		for (j = 0; j < 4; j++)
+			f[j] = scales[(i * 4 + j) % n_channels];
+		g[i] = vld1q_f32(f);
+	}
+
+	for (n = 0; n + (int) n_vec * 4 <= n_samples;) {
+		for (i = 0; i < n_vec; i++, n += 4)
+			vst1q_f32(&d[n], vmulq_f32(vld1q_f32(&s[n]), g[i]));
+	}
+	for (; n < n_samples; n++)
+		d[n] = s[n] * scales[n % n_channels];
+}
+
+static void
+copy_channels_s16_neon(void *dst, const void *src, uint32_t n_channels, const float *scales, int n_bytes)
+{
+	const int16_t *s = src;
+	int16_t *d = dst;
+	int n, n_samples = (n_bytes / (sizeof(int16_t) * n_channels)) * n_channels;
+	uint32_t i, j, n_vec = mix_n_vectors(n_channels, 8) * 2;
+	float32x4_t g[MIX_MAX_CHANNELS * 2];
+	int16x8_t s0;
+	int32x4_t lo, hi;
+	float f[4];
+	int32_t t;
+
+	if (n_channels > MIX_MAX_CHANNELS) {
+		copy_channels_s16_c(dst, src, n_channels, scales, n_bytes);
+		return;
+	}
+	for (i = 0; i < n_vec; i++) {
+		for (j = 0; j < 4; j++)
+			f[j] = scales[(i * 4 + j) % n_channels];
+		g[i] = vld1q_f32(f);
+	}
+
+	for (n = 0; n + (int) n_vec * 4 <= n_samples;) {
+		for (i = 0; i < n_vec; i += 2, n += 8) {
+			s0 = vld1q_s16(&s[n]);
+			lo = vcvtq_s32_f32(vmulq_f32(vcvtq_f32_s32(vmovl_s16(vget_low_s16(s0))), g[i]));
+			hi = vcvtq_s32_f32(vmulq_f32(vcvtq_f32_s32(vmovl_s16(vget_high_s16(s0))), g[i + 1]));
+			vst1q_s16(&d[n], vcombine_s16(vqmovn_s32(lo), vqmovn_s32(hi)));
+		}
+	}
+	for (; n < n_samples; n++) {
+		t = (int32_t) (s[n] * scales[n % n_channels]);
+		d[n] = SPA_CLAMP(t, INT16_MIN, INT16_MAX);
+	}
+}
+
+DEFINE_MIX_I_FUNC(copy_s16_i, copy_s16_neon, neon)
+DEFINE_MIX_I_FUNC(copy_f32_i, copy_f32_neon, neon)
+DEFINE_MIX_I_FUNC(add_s16_i, add_s16_neon, neon)
+DEFINE_MIX_I_FUNC(add_f32_i, add_f32_neon, neon)
+DEFINE_MIX_SCALE_I_FUNC(copy_scale_s16_i, copy_scale_s16_neon, neon)
+DEFINE_MIX_SCALE_I_FUNC(copy_scale_f32_i, copy_scale_f32_neon, neon)
+DEFINE_MIX_SCALE_I_FUNC(add_scale_s16_i, add_scale_s16_neon, neon)
+DEFINE_MIX_SCALE_I_FUNC(add_scale_f32_i, add_scale_f32_neon, neon)
+
+void spa_audiomixer_get_ops_neon(struct spa_audiomixer_ops *ops)
+{
+	ops->add[FMT_S16] = add_s16_neon;
+	ops->add[FMT_F32] = add_f32_neon;
+	ops->copy_scale[FMT_S16] = copy_scale_s16_neon;
+	ops->copy_scale[FMT_F32] = copy_scale_f32_neon;
+	ops->add_scale[FMT_S16] = add_scale_s16_neon;
+	ops->add_scale[FMT_F32] = add_scale_f32_neon;
+	ops->copy_i[FMT_S16] = copy_s16_i_neon;
+	ops->copy_i[FMT_F32] = copy_f32_i_neon;
+	ops->add_i[FMT_S16] = add_s16_i_neon;
+	ops->add_i[FMT_F32] = add_f32_i_neon;
+	ops->copy_scale_i[FMT_S16] = copy_scale_s16_i_neon;
+	ops->copy_scale_i[FMT_F32] = copy_scale_f32_i_neon;
+	ops->add_scale_i[FMT_S16] = add_scale_s16_i_neon;
+	ops->add_scale_i[FMT_F32] = add_scale_f32_i_neon;
+	ops->mix[FMT_S16] = mix_s16_neon;
+	ops->mix[FMT_F32] = mix_f32_neon;
+	ops->copy_ramp[FMT_S16] = copy_ramp_s16_neon;
+	ops->copy_ramp[FMT_F32] = copy_ramp_f32_neon;
+	ops->add_ramp[FMT_S16] = add_ramp_s16_neon;
+	ops->add_ramp[FMT_F32] = add_ramp_f32_neon;
+	ops->copy_channels[FMT_S16] = copy_channels_s16_neon;
+	ops->copy_channels[FMT_F32] = copy_channels_f32_neon;
+}
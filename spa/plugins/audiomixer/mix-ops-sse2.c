@@ -0,0 +1,481 @@
+/* Spa
+ * Copyright (C) 2018 Wim Taymans <wim.taymans@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include <emmintrin.h>
+
+#include "mix-ops.h"
+
+/* (s * v) >> 11 for 8 samples, saturated to 16 bits. v must fit in
+ * 16 bits so that we can use the 16x16->32 multiply */
+static inline __m128i
+scale_s16_sse2(__m128i s, __m128i v, __m128i *lo, __m128i *hi)
+{
+	__m128i pl = _mm_mullo_epi16(s, v);
+	__m128i ph = _mm_mulhi_epi16(s, v);
+
+	*lo = _mm_srai_epi32(_mm_unpacklo_epi16(pl, ph), 11);
+	*hi = _mm_srai_epi32(_mm_unpackhi_epi16(pl, ph), 11);
+	return _mm_packs_epi32(*lo, *hi);
+}
+
+static void
+copy_s16_sse2(void *dst, const void *src, int n_bytes)
+{
+	memcpy(dst, src, n_bytes);
+}
+
+static void
+copy_f32_sse2(void *dst, const void *src, int n_bytes)
+{
+	memcpy(dst, src, n_bytes);
+}
+
+static void
+add_s16_sse2(void *dst, const void *src, int n_bytes)
+{
+	const int16_t *s = src;
+	int16_t *d = dst;
+	int n, n_samples = n_bytes / sizeof(int16_t);
+	int32_t t;
+
+	for (n = 0; n + 16 <= n_samples; n += 16) {
+		__m128i d0 = _mm_loadu_si128((__m128i*)&d[n]);
+		__m128i d1 = _mm_loadu_si128((__m128i*)&d[n + 8]);
+		__m128i s0 = _mm_loadu_si128((__m128i*)&s[n]);
+		__m128i s1 = _mm_loadu_si128((__m128i*)&s[n + 8]);
+
+		_mm_storeu_si128((__m128i*)&d[n], _mm_adds_epi16(d0, s0));
+		_mm_storeu_si128((__m128i*)&d[n + 8], _mm_adds_epi16(d1, s1));
+	}
+	for (; n < n_samples; n++) {
+		t = d[n] + s[n];
+		d[n] = SPA_CLAMP(t, INT16_MIN, INT16_MAX);
+	}
+}
+
+static void
+add_f32_sse2(void *dst, const void *src, int n_bytes)
+{
+	const float *s = src;
+	float *d = dst;
+	int n, n_samples = n_bytes / sizeof(float);
+
+	for (n = 0; n + 8 <= n_samples; n += 8) {
+		__m128 d0 = _mm_loadu_ps(&d[n]);
+		__m128 d1 = _mm_loadu_ps(&d[n + 4]);
+
+		d0 = _mm_add_ps(d0, _mm_loadu_ps(&s[n]));
+		d1 = _mm_add_ps(d1, _mm_loadu_ps(&s[n + 4]));
+
+		_mm_storeu_ps(&d[n], d0);
+		_mm_storeu_ps(&d[n + 4], d1);
+	}
+	for (; n < n_samples; n++)
+		d[n] += s[n];
+}
+
+static void
+copy_scale_s16_sse2(void *dst, const void *src, const double scale, int n_bytes)
+{
+	const int16_t *s = src;
+	int16_t *d = dst;
+	int n, n_samples = n_bytes / sizeof(int16_t);
+	int32_t v = scale * (1 << 11), t;
+	__m128i vv, lo, hi;
+
+	if (v < INT16_MIN || v > INT16_MAX) {
+		copy_scale_s16_c(dst, src, scale, n_bytes);
+		return;
+	}
+	vv = _mm_set1_epi16(v);
+
+	for (n = 0; n + 8 <= n_samples; n += 8) {
+		__m128i s0 = _mm_loadu_si128((__m128i*)&s[n]);
+		_mm_storeu_si128((__m128i*)&d[n], scale_s16_sse2(s0, vv, &lo, &hi));
+	}
+	for (; n < n_samples; n++) {
+		t = (s[n] * v) >> 11;
+		d[n] = SPA_CLAMP(t, INT16_MIN, INT16_MAX);
+	}
+}
+
+static void
+copy_scale_f32_sse2(void *dst, const void *src, const double scale, int n_bytes)
+{
+	const float *s = src;
+	float *d = dst;
+	int n, n_samples = n_bytes / sizeof(float);
+	float v = scale;
+	__m128 vv = _mm_set1_ps(v);
+
+	for (n = 0; n + 8 <= n_samples; n += 8) {
+		_mm_storeu_ps(&d[n], _mm_mul_ps(_mm_loadu_ps(&s[n]), vv));
+		_mm_storeu_ps(&d[n + 4], _mm_mul_ps(_mm_loadu_ps(&s[n + 4]), vv));
+	}
+	for (; n < n_samples; n++)
+		d[n] = s[n] * v;
+}
+
+static void
+add_scale_s16_sse2(void *dst, const void *src, const double scale, int n_bytes)
+{
+	const int16_t *s = src;
+	int16_t *d = dst;
+	int n, n_samples = n_bytes / sizeof(int16_t);
+	int32_t v = scale * (1 << 11), t;
+	__m128i vv, lo, hi;
+
+	if (v < INT16_MIN || v > INT16_MAX) {
+		add_scale_s16_c(dst, src, scale, n_bytes);
+		return;
+	}
+	vv = _mm_set1_epi16(v);
+
+	for (n = 0; n + 8 <= n_samples; n += 8) {
+		__m128i s0 = _mm_loadu_si128((__m128i*)&s[n]);
+		__m128i d0 = _mm_loadu_si128((__m128i*)&d[n]);
+
+		scale_s16_sse2(s0, vv, &lo, &hi);
+		/* sign extend the destination to 32 bits and add */
+		lo = _mm_add_epi32(lo, _mm_srai_epi32(_mm_unpacklo_epi16(d0, d0), 16));
+		hi = _mm_add_epi32(hi, _mm_srai_epi32(_mm_unpackhi_epi16(d0, d0), 16));
+		_mm_storeu_si128((__m128i*)&d[n], _mm_packs_epi32(lo, hi));
+	}
+	for (; n < n_samples; n++) {
+		t = d[n] + ((s[n] * v) >> 11);
+		d[n] = SPA_CLAMP(t, INT16_MIN, INT16_MAX);
+	}
+}
+
+static void
+add_scale_f32_sse2(void *dst, const void *src, const double scale, int n_bytes)
+{
+	const float *s = src;
+	float *d = dst;
+	int n, n_samples = n_bytes / sizeof(float);
+	float v = scale;
+	__m128 vv = _mm_set1_ps(v);
+
+	for (n = 0; n + 8 <= n_samples; n += 8) {
+		__m128 d0 = _mm_loadu_ps(&d[n]);
+		__m128 d1 = _mm_loadu_ps(&d[n + 4]);
+
+		d0 = _mm_add_ps(d0, _mm_mul_ps(_mm_loadu_ps(&s[n]), vv));
+		d1 = _mm_add_ps(d1, _mm_mul_ps(_mm_loadu_ps(&s[n + 4]), vv));
+
+		_mm_storeu_ps(&d[n], d0);
+		_mm_storeu_ps(&d[n + 4], d1);
+	}
+	for (; n < n_samples; n++)
+		d[n] += s[n] * v;
+}
+
+static void
+mix_s16_sse2(void *dst, const struct mix_source *src, uint32_t n_src, int n_bytes)
+{
+	int16_t *d = dst;
+	int32_t acc[MIX_BLOCK] SPA_ALIGNED(16), v;
+	int i, n, chunk, n_samples = n_bytes / sizeof(int16_t);
+	uint32_t j;
+	__m128i vv, lo, hi;
+
+	for (j = 0; j < n_src; j++) {
+		v = src[j].scale * (1 << 11);
+		if (v < INT16_MIN || v > INT16_MAX) {
+			mix_s16_c(dst, src, n_src, n_bytes);
+			return;
+		}
+	}
+
+	for (n = 0; n < n_samples; n += chunk) {
+		chunk = SPA_MIN(n_samples - n, MIX_BLOCK);
+
+		memset(acc, 0, chunk * sizeof(int32_t));
+		for (j = 0; j < n_src; j++) {
+			const int16_t *s = (const int16_t *) src[j].data + n;
+
+			v = src[j].scale * (1 << 11);
+			vv = _mm_set1_epi16(v);
+			for (i = 0; i + 8 <= chunk; i += 8) {
+				scale_s16_sse2(_mm_loadu_si128((__m128i*)&s[i]), vv, &lo, &hi);
+				_mm_store_si128((__m128i*)&acc[i],
+						_mm_add_epi32(_mm_load_si128((__m128i*)&acc[i]), lo));
+				_mm_store_si128((__m128i*)&acc[i + 4],
+						_mm_add_epi32(_mm_load_si128((__m128i*)&acc[i + 4]), hi));
+			}
+			for (; i < chunk; i++)
+				acc[i] += (s[i] * v) >> 11;
+		}
+		for (i = 0; i + 8 <= chunk; i += 8) {
+			lo = _mm_load_si128((__m128i*)&acc[i]);
+			hi = _mm_load_si128((__m128i*)&acc[i + 4]);
+			_mm_storeu_si128((__m128i*)&d[n + i], _mm_packs_epi32(lo, hi));
+		}
+		for (; i < chunk; i++)
+			d[n + i] = SPA_CLAMP(acc[i], INT16_MIN, INT16_MAX);
+	}
+}
+
+static void
+mix_f32_sse2(void *dst, const struct mix_source *src, uint32_t n_src, int n_bytes)
+{
+	float *d = dst;
+	int n, chunk, n_samples = n_bytes / sizeof(float);
+	uint32_t j;
+
+	if (n_src == 0) {
+		memset(dst, 0, n_bytes);
+		return;
+	}
+	for (n = 0; n < n_samples; n += chunk) {
+		chunk = SPA_MIN(n_samples - n, MIX_BLOCK);
+
+		copy_scale_f32_sse2(&d[n], (const float *) src[0].data + n,
+				src[0].scale, chunk * sizeof(float));
+		for (j = 1; j < n_src; j++)
+			add_scale_f32_sse2(&d[n], (const float *) src[j].data + n,
+					src[j].scale, chunk * sizeof(float));
+	}
+}
+
+/* frame index of the lanes of the first n_vec vectors of n_lanes samples */
+static inline void
+init_frame_index_sse2(__m128 *idx, uint32_t n_vec, uint32_t n_channels)
+{
+	uint32_t i;
+
+	for (i = 0; i < n_vec * 4; i += 4)
+		idx[i / 4] = _mm_setr_ps(i / n_channels, (i + 1) / n_channels,
+				(i + 2) / n_channels, (i + 3) / n_channels);
+}
+
+static void
+ramp_f32_sse2(void *dst, const void *src, uint32_t n_channels,
+		float start, float step, int n_bytes, bool add)
+{
+	const float *s = src;
+	float *d = dst;
+	int n, n_samples = (n_bytes / (sizeof(float) * n_channels)) * n_channels;
+	uint32_t i, n_vec = mix_n_vectors(n_channels, 4);
+	__m128 idx[MIX_MAX_CHANNELS], inc, vstart, vstep, g, v;
+	float gain;
+
+	init_frame_index_sse2(idx, n_vec, n_channels);
+	inc = _mm_set1_ps(n_vec * 4 / n_channels);
+	vstart = _mm_set1_ps(start);
+	vstep = _mm_set1_ps(step);
+
+	for (n = 0; n + (int) n_vec * 4 <= n_samples;) {
+		for (i = 0; i < n_vec; i++, n += 4) {
+			g = _mm_add_ps(vstart, _mm_mul_ps(idx[i], vstep));
+			v = _mm_mul_ps(_mm_loadu_ps(&s[n]), g);
+			if (add)
+				v = _mm_add_ps(_mm_loadu_ps(&d[n]), v);
+			_mm_storeu_ps(&d[n], v);
+			idx[i] = _mm_add_ps(idx[i], inc);
+		}
+	}
+	for (; n < n_samples; n++) {
+		gain = start + (uint32_t) (n / n_channels) * step;
+		if (add)
+			d[n] += s[n] * gain;
+		else
+			d[n] = s[n] * gain;
+	}
+}
+
+static void
+copy_ramp_f32_sse2(void *dst, const void *src, uint32_t n_channels, float start, float step, int n_bytes)
+{
+	if (n_channels > MIX_MAX_CHANNELS)
+		copy_ramp_f32_c(dst, src, n_channels, start, step, n_bytes);
+	else
+		ramp_f32_sse2(dst, src, n_channels, start, step, n_bytes, false);
+}
+
+static void
+add_ramp_f32_sse2(void *dst, const void *src, uint32_t n_channels, float start, float step, int n_bytes)
+{
+	if (n_channels > MIX_MAX_CHANNELS)
+		add_ramp_f32_c(dst, src, n_channels, start, step, n_bytes);
+	else
+		ramp_f32_sse2(dst, src, n_channels, start, step, n_bytes, true);
+}
+
+static void
+ramp_s16_sse2(void *dst, const void *src, uint32_t n_channels,
+		float start, float step, int n_bytes, bool add)
+{
+	const int16_t *s = src;
+	int16_t *d = dst;
+	int n, n_samples = (n_bytes / (sizeof(int16_t) * n_channels)) * n_channels;
+	uint32_t i, n_vec = mix_n_vectors(n_channels, 8) * 2;
+	__m128 idx[MIX_MAX_CHANNELS * 2], inc, vstart, vstep, g0, g1;
+	__m128i s0, lo, hi;
+	int32_t t;
+	float gain;
+
+	/* two vectors of 4 float gains for each vector of 8 samples */
+	init_frame_index_sse2(idx, n_vec, n_channels);
+	inc = _mm_set1_ps(n_vec * 4 / n_channels);
+	vstart = _mm_set1_ps(start);
+	vstep = _mm_set1_ps(step);
+
+	for (n = 0; n + (int) n_vec * 4 <= n_samples;) {
+		for (i = 0; i < n_vec; i += 2, n += 8) {
+			g0 = _mm_add_ps(vstart, _mm_mul_ps(idx[i], vstep));
+			g1 = _mm_add_ps(vstart, _mm_mul_ps(idx[i + 1], vstep));
+
+			s0 = _mm_loadu_si128((__m128i*)&s[n]);
+			lo = _mm_srai_epi32(_mm_unpacklo_epi16(s0, s0), 16);
+			hi = _mm_srai_epi32(_mm_unpackhi_epi16(s0, s0), 16);
+			lo = _mm_cvttps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(lo), g0));
+			hi = _mm_cvttps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(hi), g1));
+			if (add) {
+				__m128i d0 = _mm_loadu_si128((__m128i*)&d[n]);
+				lo = _mm_add_epi32(lo, _mm_srai_epi32(_mm_unpacklo_epi16(d0, d0), 16));
+				hi = _mm_add_epi32(hi, _mm_srai_epi32(_mm_unpackhi_epi16(d0, d0), 16));
+			}
+			_mm_storeu_si128((__m128i*)&d[n], _mm_packs_epi32(lo, hi));
+
+			idx[i] = _mm_add_ps(idx[i], inc);
+			idx[i + 1] = _mm_add_ps(idx[i + 1], inc);
+		}
+	}
+	for (; n < n_samples; n++) {
+		gain = start + (uint32_t) (n / n_channels) * step;
+		t = (int32_t) (s[n] * gain);
+		if (add)
+			t += d[n];
+		d[n] = SPA_CLAMP(t, INT16_MIN, INT16_MAX);
+	}
+}
+
+static void
+copy_ramp_s16_sse2(void *dst, const void *src, uint32_t n_channels, float start, float step, int n_bytes)
+{
+	if (n_channels > MIX_MAX_CHANNELS)
+		copy_ramp_s16_c(dst, src, n_channels, start, step, n_bytes);
+	else
+		ramp_s16_sse2(dst, src, n_channels, start, step, n_bytes, false);
+}
+
+static void
+add_ramp_s16_sse2(void *dst, const void *src, uint32_t n_channels, float start, float step, int n_bytes)
+{
+	if (n_channels > MIX_MAX_CHANNELS)
+		add_ramp_s16_c(dst, src, n_channels, start, step, n_bytes);
+	else
+		ramp_s16_sse2(dst, src, n_channels, start, step, n_bytes, true);
+}
+
+static void
+copy_channels_f32_sse2(void *dst, const void *src, uint32_t n_channels, const float *scales, int n_bytes)
+{
+	const float *s = src;
+	float *d = dst;
+	int n, n_samples = (n_bytes / (sizeof(float) * n_channels)) * n_channels;
+	uint32_t i, n_vec = mix_n_vectors(n_channels, 4);
+	__m128 g[MIX_MAX_CHANNELS];
+
+	if (n_channels > MIX_MAX_CHANNELS) {
+		copy_channels_f32_c(dst, src, n_channels, scales, n_bytes);
+		return;
+	}
+	for (i = 0; i < n_vec * 4; i += 4)
+		g[i / 4] = _mm_setr_ps(scales[i % n_channels], scales[(i + 1) % n_channels],
+				scales[(i + 2) % n_channels], scales[(i + 3) % n_channels]);
+
+	for (n = 0; n + (int) n_vec * 4 <= n_samples;) {
+		for (i = 0; i < n_vec; i++, n += 4)
+			_mm_storeu_ps(&d[n], _mm_mul_ps(_mm_loadu_ps(&s[n]), g[i]));
+	}
+	for (; n < n_samples; n++)
+		d[n] = s[n] * scales[n % n_channels];
+}
+
+static void
+copy_channels_s16_sse2(void *dst, const void *src, uint32_t n_channels, const float *scales, int n_bytes)
+{
+	const int16_t *s = src;
+	int16_t *d = dst;
+	int n, n_samples = (n_bytes / (sizeof(int16_t) * n_channels)) * n_channels;
+	uint32_t i, n_vec = mix_n_vectors(n_channels, 8) * 2;
+	__m128 g[MIX_MAX_CHANNELS * 2];
+	__m128i s0, lo, hi;
+	int32_t t;
+
+	if (n_channels > MIX_MAX_CHANNELS) {
+		copy_channels_s16_c(dst, src, n_channels, scales, n_bytes);
+		return;
+	}
+	for (i = 0; i < n_vec * 4; i += 4)
+		g[i / 4] = _mm_setr_ps(scales[i % n_channels], scales[(i + 1) % n_channels],
+				scales[(i + 2) % n_channels], scales[(i + 3) % n_channels]);
+
+	for (n = 0; n + (int) n_vec * 4 <= n_samples;) {
+		for (i = 0; i < n_vec; i += 2, n += 8) {
+			s0 = _mm_loadu_si128((__m128i*)&s[n]);
+			lo = _mm_srai_epi32(_mm_unpacklo_epi16(s0, s0), 16);
+			hi = _mm_srai_epi32(_mm_unpackhi_epi16(s0, s0), 16);
+			lo = _mm_cvttps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(lo), g[i]));
+			hi = _mm_cvttps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(hi), g[i + 1]));
+			_mm_storeu_si128((__m128i*)&d[n], _mm_packs_epi32(lo, hi));
+		}
+	}
+	for (; n < n_samples; n++) {
+		t = (int32_t) (s[n] * scales[n % n_channels]);
+		d[n] = SPA_CLAMP(t, INT16_MIN, INT16_MAX);
+	}
+}
+
+DEFINE_MIX_I_FUNC(copy_s16_i, copy_s16_sse2, sse2)
+DEFINE_MIX_I_FUNC(copy_f32_i, copy_f32_sse2, sse2)
+DEFINE_MIX_I_FUNC(add_s16_i, add_s16_sse2, sse2)
+DEFINE_MIX_I_FUNC(add_f32_i, add_f32_sse2, sse2)
+DEFINE_MIX_SCALE_I_FUNC(copy_scale_s16_i, copy_scale_s16_sse2, sse2)
+DEFINE_MIX_SCALE_I_FUNC(copy_scale_f32_i, copy_scale_f32_sse2, sse2)
+DEFINE_MIX_SCALE_I_FUNC(add_scale_s16_i, add_scale_s16_sse2, sse2)
+DEFINE_MIX_SCALE_I_FUNC(add_scale_f32_i, add_scale_f32_sse2, sse2)
+
+void spa_audiomixer_get_ops_sse2(struct spa_audiomixer_ops *ops)
+{
+	ops->add[FMT_S16] = add_s16_sse2;
+	ops->add[FMT_F32] = add_f32_sse2;
+	ops->copy_scale[FMT_S16] = copy_scale_s16_sse2;
+	ops->copy_scale[FMT_F32] = copy_scale_f32_sse2;
+	ops->add_scale[FMT_S16] = add_scale_s16_sse2;
+	ops->add_scale[FMT_F32] = add_scale_f32_sse2;
+	ops->copy_i[FMT_S16] = copy_s16_i_sse2;
+	ops->copy_i[FMT_F32] = copy_f32_i_sse2;
+	ops->add_i[FMT_S16] = add_s16_i_sse2;
+	ops->add_i[FMT_F32] = add_f32_i_sse2;
+	ops->copy_scale_i[FMT_S16] = copy_scale_s16_i_sse2;
+	ops->copy_scale_i[FMT_F32] = copy_scale_f32_i_sse2;
+	ops->add_scale_i[FMT_S16] = add_scale_s16_i_sse2;
+	ops->add_scale_i[FMT_F32] = add_scale_f32_i_sse2;
+	ops->mix[FMT_S16] = mix_s16_sse2;
+	ops->mix[FMT_F32] = mix_f32_sse2;
+	ops->copy_ramp[FMT_S16] = copy_ramp_s16_sse2;
+	ops->copy_ramp[FMT_F32] = copy_ramp_f32_sse2;
+	ops->add_ramp[FMT_S16] = add_ramp_s16_sse2;
+	ops->add_ramp[FMT_F32] = add_ramp_f32_sse2;
+	ops->copy_channels[FMT_S16] = copy_channels_s16_sse2;
+	ops->copy_channels[FMT_F32] = copy_channels_f32_sse2;
+}
@@ -17,34 +17,81 @@
  * Boston, MA 02110-1301, USA.
  */
 
+#include <math.h>
+
 #include "mix-ops.h"
 
+#define S24_MIN		-8388608
+#define S24_MAX		8388607
+
+static inline int32_t read_s24(const void *src)
+{
+	const uint8_t *s = src;
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	return (int32_t) (((uint32_t) s[2] << 24) | (s[1] << 16) | (s[0] << 8)) >> 8;
+#else
+	return (int32_t) (((uint32_t) s[0] << 24) | (s[1] << 16) | (s[2] << 8)) >> 8;
+#endif
+}
+
+static inline void write_s24(void *dst, int32_t val)
+{
+	uint8_t *d = dst;
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	d[0] = (uint8_t) (val);
+	d[1] = (uint8_t) (val >> 8);
+	d[2] = (uint8_t) (val >> 16);
+#else
+	d[0] = (uint8_t) (val >> 16);
+	d[1] = (uint8_t) (val >> 8);
+	d[2] = (uint8_t) (val);
+#endif
+}
+
+/* the upper 8 bits of the 32 bits container are ignored */
+static inline int32_t read_s24_32(const int32_t *src)
+{
+	return (int32_t) ((uint32_t) *src << 8) >> 8;
+}
+
+static void
+clear_c(void *dst, int n_bytes)
+{
+	memset(dst, 0, n_bytes);
+}
+
+static void
+copy_c(void *dst, const void *src, int n_bytes)
+{
+	memcpy(dst, src, n_bytes);
+}
+
 static void
-clear_s16(void *dst, int n_bytes)
+clear_s16_c(void *dst, int n_bytes)
 {
 	memset(dst, 0, n_bytes);
 }
 
 static void
-clear_f32(void *dst, int n_bytes)
+clear_f32_c(void *dst, int n_bytes)
 {
 	memset(dst, 0, n_bytes);
 }
 
 static void
-copy_s16(void *dst, const void *src, int n_bytes)
+copy_s16_c(void *dst, const void *src, int n_bytes)
 {
 	memcpy(dst, src, n_bytes);
 }
 
 static void
-copy_f32(void *dst, const void *src, int n_bytes)
+copy_f32_c(void *dst, const void *src, int n_bytes)
 {
 	memcpy(dst, src, n_bytes);
 }
 
 static void
-add_s16(void *dst, const void *src, int n_bytes)
+add_s16_c(void *dst, const void *src, int n_bytes)
 {
 	const int16_t *s = src;
 	int16_t *d = dst;
@@ -60,7 +107,7 @@ add_s16(void *dst, const void *src, int n_bytes)
 }
 
 static void
-add_f32(void *dst, const void *src, int n_bytes)
+add_f32_c(void *dst, const void *src, int n_bytes)
 {
 	const float *s = src;
 	float *d = dst;
@@ -73,8 +120,8 @@ add_f32(void *dst, const void *src, int n_bytes)
 	}
 }
 
-static void
-copy_scale_s16(void *dst, const void *src, const double scale, int n_bytes)
+void
+copy_scale_s16_c(void *dst, const void *src, const double scale, int n_bytes)
 {
 	const int16_t *s = src;
 	int16_t *d = dst;;
@@ -90,7 +137,7 @@ copy_scale_s16(void *dst, const void *src, const double scale, int n_bytes)
 }
 
 static void
-copy_scale_f32(void *dst, const void *src, const double scale, int n_bytes)
+copy_scale_f32_c(void *dst, const void *src, const double scale, int n_bytes)
 {
 	const float *s = src;
 	float *d = dst;
@@ -104,8 +151,8 @@ copy_scale_f32(void *dst, const void *src, const double scale, int n_bytes)
 	}
 }
 
-static void
-add_scale_s16(void *dst, const void *src, const double scale, int n_bytes)
+void
+add_scale_s16_c(void *dst, const void *src, const double scale, int n_bytes)
 {
 	const int16_t *s = src;
 	int16_t *d = dst;
@@ -121,7 +168,7 @@ add_scale_s16(void *dst, const void *src, const double scale, int n_bytes)
 }
 
 static void
-add_scale_f32(void *dst, const void *src, const double scale, int n_bytes)
+add_scale_f32_c(void *dst, const void *src, const double scale, int n_bytes)
 {
 	const float *s = src;
 	float *d = dst;
@@ -135,8 +182,8 @@ add_scale_f32(void *dst, const void *src, const double scale, int n_bytes)
 	}
 }
 
-static void
-copy_s16_i(void *dst, int dst_stride, const void *src, int src_stride, int n_bytes)
+void
+copy_s16_i_c(void *dst, int dst_stride, const void *src, int src_stride, int n_bytes)
 {
 	const int16_t *s = src;
 	int16_t *d = dst;
@@ -149,8 +196,8 @@ copy_s16_i(void *dst, int dst_stride, const void *src, int src_stride, int n_byt
 	}
 }
 
-static void
-copy_f32_i(void *dst, int dst_stride, const void *src, int src_stride, int n_bytes)
+void
+copy_f32_i_c(void *dst, int dst_stride, const void *src, int src_stride, int n_bytes)
 {
 	const float *s = src;
 	float *d = dst;
@@ -163,8 +210,8 @@ copy_f32_i(void *dst, int dst_stride, const void *src, int src_stride, int n_byt
 	}
 }
 
-static void
-add_s16_i(void *dst, int dst_stride, const void *src, int src_stride, int n_bytes)
+void
+add_s16_i_c(void *dst, int dst_stride, const void *src, int src_stride, int n_bytes)
 {
 	const int16_t *s = src;
 	int16_t *d = dst;
@@ -179,8 +226,8 @@ add_s16_i(void *dst, int dst_stride, const void *src, int src_stride, int n_byte
 	}
 }
 
-static void
-add_f32_i(void *dst, int dst_stride, const void *src, int src_stride, int n_bytes)
+void
+add_f32_i_c(void *dst, int dst_stride, const void *src, int src_stride, int n_bytes)
 {
 	const float *s = src;
 	float *d = dst;
@@ -193,8 +240,8 @@ add_f32_i(void *dst, int dst_stride, const void *src, int src_stride, int n_byte
 	}
 }
 
-static void
-copy_scale_s16_i(void *dst, int dst_stride, const void *src, int src_stride, const double scale, int n_bytes)
+void
+copy_scale_s16_i_c(void *dst, int dst_stride, const void *src, int src_stride, const double scale, int n_bytes)
 {
 	const int16_t *s = src;
 	int16_t *d = dst;
@@ -209,8 +256,8 @@ copy_scale_s16_i(void *dst, int dst_stride, const void *src, int src_stride, con
 	}
 }
 
-static void
-copy_scale_f32_i(void *dst, int dst_stride, const void *src, int src_stride, const double scale, int n_bytes)
+void
+copy_scale_f32_i_c(void *dst, int dst_stride, const void *src, int src_stride, const double scale, int n_bytes)
 {
 	const float *s = src;
 	float *d = dst;
@@ -224,8 +271,8 @@ copy_scale_f32_i(void *dst, int dst_stride, const void *src, int src_stride, con
 	}
 }
 
-static void
-add_scale_s16_i(void *dst, int dst_stride, const void *src, int src_stride, const double scale, int n_bytes)
+void
+add_scale_s16_i_c(void *dst, int dst_stride, const void *src, int src_stride, const double scale, int n_bytes)
 {
 	const int16_t *s = src;
 	int16_t *d = dst;
@@ -240,8 +287,8 @@ add_scale_s16_i(void *dst, int dst_stride, const void *src, int src_stride, cons
 	}
 }
 
-static void
-add_scale_f32_i(void *dst, int dst_stride, const void *src, int src_stride, const double scale, int n_bytes)
+void
+add_scale_f32_i_c(void *dst, int dst_stride, const void *src, int src_stride, const double scale, int n_bytes)
 {
 	const float *s = src;
 	float *d = dst;
@@ -255,24 +302,1088 @@ add_scale_f32_i(void *dst, int dst_stride, const void *src, int src_stride, cons
 	}
 }
 
-void spa_audiomixer_get_ops(struct spa_audiomixer_ops *ops)
-{
-	ops->clear[FMT_S16] = clear_s16;
-	ops->clear[FMT_F32] = clear_f32;
-	ops->copy[FMT_S16] = copy_s16;
-	ops->copy[FMT_F32] = copy_f32;
-        ops->add[FMT_S16] = add_s16;
-        ops->add[FMT_F32] = add_f32;
-        ops->copy_scale[FMT_S16] = copy_scale_s16;
-        ops->copy_scale[FMT_F32] = copy_scale_f32;
-        ops->add_scale[FMT_S16] = add_scale_s16;
-        ops->add_scale[FMT_F32] = add_scale_f32;
-        ops->copy_i[FMT_S16] = copy_s16_i;
-        ops->copy_i[FMT_F32] = copy_f32_i;
-        ops->add_i[FMT_S16] = add_s16_i;
-        ops->add_i[FMT_F32] = add_f32_i;
-        ops->copy_scale_i[FMT_S16] = copy_scale_s16_i;
-        ops->copy_scale_i[FMT_F32] = copy_scale_f32_i;
-        ops->add_scale_i[FMT_S16] = add_scale_s16_i;
-        ops->add_scale_i[FMT_F32] = add_scale_f32_i;
+void
+mix_s16_c(void *dst, const struct mix_source *src, uint32_t n_src, int n_bytes)
+{
+	int16_t *d = dst;
+	int32_t acc[MIX_BLOCK], v;
+	int i, n, chunk, n_samples = n_bytes / sizeof(int16_t);
+	uint32_t j;
+
+	for (n = 0; n < n_samples; n += chunk) {
+		chunk = SPA_MIN(n_samples - n, MIX_BLOCK);
+
+		memset(acc, 0, chunk * sizeof(int32_t));
+		for (j = 0; j < n_src; j++) {
+			const int16_t *s = (const int16_t *) src[j].data + n;
+
+			v = src[j].scale * (1 << 11);
+			for (i = 0; i < chunk; i++)
+				acc[i] += (s[i] * v) >> 11;
+		}
+		for (i = 0; i < chunk; i++)
+			d[n + i] = SPA_CLAMP(acc[i], INT16_MIN, INT16_MAX);
+	}
+}
+
+static void
+mix_f32_c(void *dst, const struct mix_source *src, uint32_t n_src, int n_bytes)
+{
+	float *d = dst;
+	int n, chunk, n_samples = n_bytes / sizeof(float);
+	uint32_t j;
+
+	if (n_src == 0) {
+		memset(dst, 0, n_bytes);
+		return;
+	}
+	/* the block of dst stays in the cache while the sources are added */
+	for (n = 0; n < n_samples; n += chunk) {
+		chunk = SPA_MIN(n_samples - n, MIX_BLOCK);
+
+		copy_scale_f32_c(&d[n], (const float *) src[0].data + n,
+				src[0].scale, chunk * sizeof(float));
+		for (j = 1; j < n_src; j++)
+			add_scale_f32_c(&d[n], (const float *) src[j].data + n,
+					src[j].scale, chunk * sizeof(float));
+	}
+}
+
+static void
+add_s24_c(void *dst, const void *src, int n_bytes)
+{
+	const uint8_t *s = src;
+	uint8_t *d = dst;
+	int64_t t;
+
+	n_bytes /= 3;
+	while (n_bytes--) {
+		t = (int64_t) read_s24(d) + read_s24(s);
+		write_s24(d, SPA_CLAMP(t, S24_MIN, S24_MAX));
+		d += 3;
+		s += 3;
+	}
+}
+
+static void
+copy_scale_s24_c(void *dst, const void *src, const double scale, int n_bytes)
+{
+	const uint8_t *s = src;
+	uint8_t *d = dst;
+	int64_t v = scale * (1 << 16), t;
+
+	n_bytes /= 3;
+	while (n_bytes--) {
+		t = (read_s24(s) * v) >> 16;
+		write_s24(d, SPA_CLAMP(t, S24_MIN, S24_MAX));
+		d += 3;
+		s += 3;
+	}
+}
+
+static void
+add_scale_s24_c(void *dst, const void *src, const double scale, int n_bytes)
+{
+	const uint8_t *s = src;
+	uint8_t *d = dst;
+	int64_t v = scale * (1 << 16), t;
+
+	n_bytes /= 3;
+	while (n_bytes--) {
+		t = read_s24(d) + ((read_s24(s) * v) >> 16);
+		write_s24(d, SPA_CLAMP(t, S24_MIN, S24_MAX));
+		d += 3;
+		s += 3;
+	}
+}
+
+static void
+copy_s24_i_c(void *dst, int dst_stride, const void *src, int src_stride, int n_bytes)
+{
+	const uint8_t *s = src;
+	uint8_t *d = dst;
+
+	n_bytes /= 3;
+	while (n_bytes--) {
+		memcpy(d, s, 3);
+		d += dst_stride * 3;
+		s += src_stride * 3;
+	}
+}
+
+static void
+add_s24_i_c(void *dst, int dst_stride, const void *src, int src_stride, int n_bytes)
+{
+	const uint8_t *s = src;
+	uint8_t *d = dst;
+	int64_t t;
+
+	n_bytes /= 3;
+	while (n_bytes--) {
+		t = (int64_t) read_s24(d) + read_s24(s);
+		write_s24(d, SPA_CLAMP(t, S24_MIN, S24_MAX));
+		d += dst_stride * 3;
+		s += src_stride * 3;
+	}
+}
+
+static void
+copy_scale_s24_i_c(void *dst, int dst_stride, const void *src, int src_stride, const double scale, int n_bytes)
+{
+	const uint8_t *s = src;
+	uint8_t *d = dst;
+	int64_t v = scale * (1 << 16), t;
+
+	n_bytes /= 3;
+	while (n_bytes--) {
+		t = (read_s24(s) * v) >> 16;
+		write_s24(d, SPA_CLAMP(t, S24_MIN, S24_MAX));
+		d += dst_stride * 3;
+		s += src_stride * 3;
+	}
+}
+
+static void
+add_scale_s24_i_c(void *dst, int dst_stride, const void *src, int src_stride, const double scale, int n_bytes)
+{
+	const uint8_t *s = src;
+	uint8_t *d = dst;
+	int64_t v = scale * (1 << 16), t;
+
+	n_bytes /= 3;
+	while (n_bytes--) {
+		t = read_s24(d) + ((read_s24(s) * v) >> 16);
+		write_s24(d, SPA_CLAMP(t, S24_MIN, S24_MAX));
+		d += dst_stride * 3;
+		s += src_stride * 3;
+	}
+}
+
+static void
+mix_s24_c(void *dst, const struct mix_source *src, uint32_t n_src, int n_bytes)
+{
+	uint8_t *d = dst;
+	int64_t acc[MIX_BLOCK], v;
+	int i, n, chunk, n_samples = n_bytes / 3;
+	uint32_t j;
+
+	for (n = 0; n < n_samples; n += chunk) {
+		chunk = SPA_MIN(n_samples - n, MIX_BLOCK);
+
+		memset(acc, 0, chunk * sizeof(int64_t));
+		for (j = 0; j < n_src; j++) {
+			const uint8_t *s = (const uint8_t *) src[j].data + n * 3;
+
+			v = src[j].scale * (1 << 16);
+			for (i = 0; i < chunk; i++)
+				acc[i] += (read_s24(&s[i * 3]) * v) >> 16;
+		}
+		for (i = 0; i < chunk; i++)
+			write_s24(&d[(n + i) * 3], SPA_CLAMP(acc[i], S24_MIN, S24_MAX));
+	}
+}
+
+static void
+add_s24_32_c(void *dst, const void *src, int n_bytes)
+{
+	const int32_t *s = src;
+	int32_t *d = dst;
+	int64_t t;
+
+	n_bytes /= sizeof(int32_t);
+	while (n_bytes--) {
+		t = (int64_t) read_s24_32(d) + read_s24_32(s);
+		*d = SPA_CLAMP(t, S24_MIN, S24_MAX);
+		d++;
+		s++;
+	}
+}
+
+static void
+copy_scale_s24_32_c(void *dst, const void *src, const double scale, int n_bytes)
+{
+	const int32_t *s = src;
+	int32_t *d = dst;
+	int64_t v = scale * (1 << 16), t;
+
+	n_bytes /= sizeof(int32_t);
+	while (n_bytes--) {
+		t = (read_s24_32(s) * v) >> 16;
+		*d = SPA_CLAMP(t, S24_MIN, S24_MAX);
+		d++;
+		s++;
+	}
+}
+
+static void
+add_scale_s24_32_c(void *dst, const void *src, const double scale, int n_bytes)
+{
+	const int32_t *s = src;
+	int32_t *d = dst;
+	int64_t v = scale * (1 << 16), t;
+
+	n_bytes /= sizeof(int32_t);
+	while (n_bytes--) {
+		t = read_s24_32(d) + ((read_s24_32(s) * v) >> 16);
+		*d = SPA_CLAMP(t, S24_MIN, S24_MAX);
+		d++;
+		s++;
+	}
+}
+
+static void
+copy_s24_32_i_c(void *dst, int dst_stride, const void *src, int src_stride, int n_bytes)
+{
+	const int32_t *s = src;
+	int32_t *d = dst;
+
+	n_bytes /= sizeof(int32_t);
+	while (n_bytes--) {
+		*d = *s;
+		d += dst_stride;
+		s += src_stride;
+	}
+}
+
+static void
+add_s24_32_i_c(void *dst, int dst_stride, const void *src, int src_stride, int n_bytes)
+{
+	const int32_t *s = src;
+	int32_t *d = dst;
+	int64_t t;
+
+	n_bytes /= sizeof(int32_t);
+	while (n_bytes--) {
+		t = (int64_t) read_s24_32(d) + read_s24_32(s);
+		*d = SPA_CLAMP(t, S24_MIN, S24_MAX);
+		d += dst_stride;
+		s += src_stride;
+	}
+}
+
+static void
+copy_scale_s24_32_i_c(void *dst, int dst_stride, const void *src, int src_stride, const double scale, int n_bytes)
+{
+	const int32_t *s = src;
+	int32_t *d = dst;
+	int64_t v = scale * (1 << 16), t;
+
+	n_bytes /= sizeof(int32_t);
+	while (n_bytes--) {
+		t = (read_s24_32(s) * v) >> 16;
+		*d = SPA_CLAMP(t, S24_MIN, S24_MAX);
+		d += dst_stride;
+		s += src_stride;
+	}
+}
+
+static void
+add_scale_s24_32_i_c(void *dst, int dst_stride, const void *src, int src_stride, const double scale, int n_bytes)
+{
+	const int32_t *s = src;
+	int32_t *d = dst;
+	int64_t v = scale * (1 << 16), t;
+
+	n_bytes /= sizeof(int32_t);
+	while (n_bytes--) {
+		t = read_s24_32(d) + ((read_s24_32(s) * v) >> 16);
+		*d = SPA_CLAMP(t, S24_MIN, S24_MAX);
+		d += dst_stride;
+		s += src_stride;
+	}
+}
+
+static void
+mix_s24_32_c(void *dst, const struct mix_source *src, uint32_t n_src, int n_bytes)
+{
+	int32_t *d = dst;
+	int64_t acc[MIX_BLOCK], v;
+	int i, n, chunk, n_samples = n_bytes / sizeof(int32_t);
+	uint32_t j;
+
+	for (n = 0; n < n_samples; n += chunk) {
+		chunk = SPA_MIN(n_samples - n, MIX_BLOCK);
+
+		memset(acc, 0, chunk * sizeof(int64_t));
+		for (j = 0; j < n_src; j++) {
+			const int32_t *s = (const int32_t *) src[j].data + n;
+
+			v = src[j].scale * (1 << 16);
+			for (i = 0; i < chunk; i++)
+				acc[i] += (read_s24_32(&s[i]) * v) >> 16;
+		}
+		for (i = 0; i < chunk; i++)
+			d[n + i] = SPA_CLAMP(acc[i], S24_MIN, S24_MAX);
+	}
+}
+
+static void
+add_s32_c(void *dst, const void *src, int n_bytes)
+{
+	const int32_t *s = src;
+	int32_t *d = dst;
+	int64_t t;
+
+	n_bytes /= sizeof(int32_t);
+	while (n_bytes--) {
+		t = (int64_t) *d + *s;
+		*d = SPA_CLAMP(t, INT32_MIN, INT32_MAX);
+		d++;
+		s++;
+	}
+}
+
+static void
+copy_scale_s32_c(void *dst, const void *src, const double scale, int n_bytes)
+{
+	const int32_t *s = src;
+	int32_t *d = dst;
+	int64_t v = scale * (1 << 16), t;
+
+	n_bytes /= sizeof(int32_t);
+	while (n_bytes--) {
+		t = (*s * v) >> 16;
+		*d = SPA_CLAMP(t, INT32_MIN, INT32_MAX);
+		d++;
+		s++;
+	}
+}
+
+static void
+add_scale_s32_c(void *dst, const void *src, const double scale, int n_bytes)
+{
+	const int32_t *s = src;
+	int32_t *d = dst;
+	int64_t v = scale * (1 << 16), t;
+
+	n_bytes /= sizeof(int32_t);
+	while (n_bytes--) {
+		t = *d + ((*s * v) >> 16);
+		*d = SPA_CLAMP(t, INT32_MIN, INT32_MAX);
+		d++;
+		s++;
+	}
+}
+
+static void
+copy_s32_i_c(void *dst, int dst_stride, const void *src, int src_stride, int n_bytes)
+{
+	const int32_t *s = src;
+	int32_t *d = dst;
+
+	n_bytes /= sizeof(int32_t);
+	while (n_bytes--) {
+		*d = *s;
+		d += dst_stride;
+		s += src_stride;
+	}
+}
+
+static void
+add_s32_i_c(void *dst, int dst_stride, const void *src, int src_stride, int n_bytes)
+{
+	const int32_t *s = src;
+	int32_t *d = dst;
+	int64_t t;
+
+	n_bytes /= sizeof(int32_t);
+	while (n_bytes--) {
+		t = (int64_t) *d + *s;
+		*d = SPA_CLAMP(t, INT32_MIN, INT32_MAX);
+		d += dst_stride;
+		s += src_stride;
+	}
+}
+
+static void
+copy_scale_s32_i_c(void *dst, int dst_stride, const void *src, int src_stride, const double scale, int n_bytes)
+{
+	const int32_t *s = src;
+	int32_t *d = dst;
+	int64_t v = scale * (1 << 16), t;
+
+	n_bytes /= sizeof(int32_t);
+	while (n_bytes--) {
+		t = (*s * v) >> 16;
+		*d = SPA_CLAMP(t, INT32_MIN, INT32_MAX);
+		d += dst_stride;
+		s += src_stride;
+	}
+}
+
+static void
+add_scale_s32_i_c(void *dst, int dst_stride, const void *src, int src_stride, const double scale, int n_bytes)
+{
+	const int32_t *s = src;
+	int32_t *d = dst;
+	int64_t v = scale * (1 << 16), t;
+
+	n_bytes /= sizeof(int32_t);
+	while (n_bytes--) {
+		t = *d + ((*s * v) >> 16);
+		*d = SPA_CLAMP(t, INT32_MIN, INT32_MAX);
+		d += dst_stride;
+		s += src_stride;
+	}
+}
+
+static void
+mix_s32_c(void *dst, const struct mix_source *src, uint32_t n_src, int n_bytes)
+{
+	int32_t *d = dst;
+	int64_t acc[MIX_BLOCK], v;
+	int i, n, chunk, n_samples = n_bytes / sizeof(int32_t);
+	uint32_t j;
+
+	for (n = 0; n < n_samples; n += chunk) {
+		chunk = SPA_MIN(n_samples - n, MIX_BLOCK);
+
+		memset(acc, 0, chunk * sizeof(int64_t));
+		for (j = 0; j < n_src; j++) {
+			const int32_t *s = (const int32_t *) src[j].data + n;
+
+			v = src[j].scale * (1 << 16);
+			for (i = 0; i < chunk; i++)
+				acc[i] += (s[i] * v) >> 16;
+		}
+		for (i = 0; i < chunk; i++)
+			d[n + i] = SPA_CLAMP(acc[i], INT32_MIN, INT32_MAX);
+	}
+}
+
+
+static void
+add_f64_c(void *dst, const void *src, int n_bytes)
+{
+	const double *s = src;
+	double *d = dst;
+
+	n_bytes /= sizeof(double);
+	while (n_bytes--) {
+		*d += *s;
+		d++;
+		s++;
+	}
+}
+
+static void
+copy_scale_f64_c(void *dst, const void *src, const double scale, int n_bytes)
+{
+	const double *s = src;
+	double *d = dst;
+
+	n_bytes /= sizeof(double);
+	while (n_bytes--) {
+		*d = *s * scale;
+		d++;
+		s++;
+	}
+}
+
+static void
+add_scale_f64_c(void *dst, const void *src, const double scale, int n_bytes)
+{
+	const double *s = src;
+	double *d = dst;
+
+	n_bytes /= sizeof(double);
+	while (n_bytes--) {
+		*d += *s * scale;
+		d++;
+		s++;
+	}
+}
+
+static void
+copy_f64_i_c(void *dst, int dst_stride, const void *src, int src_stride, int n_bytes)
+{
+	const double *s = src;
+	double *d = dst;
+
+	n_bytes /= sizeof(double);
+	while (n_bytes--) {
+		*d = *s;
+		d += dst_stride;
+		s += src_stride;
+	}
+}
+
+static void
+add_f64_i_c(void *dst, int dst_stride, const void *src, int src_stride, int n_bytes)
+{
+	const double *s = src;
+	double *d = dst;
+
+	n_bytes /= sizeof(double);
+	while (n_bytes--) {
+		*d += *s;
+		d += dst_stride;
+		s += src_stride;
+	}
+}
+
+static void
+copy_scale_f64_i_c(void *dst, int dst_stride, const void *src, int src_stride, const double scale, int n_bytes)
+{
+	const double *s = src;
+	double *d = dst;
+
+	n_bytes /= sizeof(double);
+	while (n_bytes--) {
+		*d = *s * scale;
+		d += dst_stride;
+		s += src_stride;
+	}
+}
+
+static void
+add_scale_f64_i_c(void *dst, int dst_stride, const void *src, int src_stride, const double scale, int n_bytes)
+{
+	const double *s = src;
+	double *d = dst;
+
+	n_bytes /= sizeof(double);
+	while (n_bytes--) {
+		*d += *s * scale;
+		d += dst_stride;
+		s += src_stride;
+	}
+}
+
+static void
+mix_f64_c(void *dst, const struct mix_source *src, uint32_t n_src, int n_bytes)
+{
+	double *d = dst;
+	int n, chunk, n_samples = n_bytes / sizeof(double);
+	uint32_t j;
+
+	if (n_src == 0) {
+		memset(dst, 0, n_bytes);
+		return;
+	}
+	for (n = 0; n < n_samples; n += chunk) {
+		chunk = SPA_MIN(n_samples - n, MIX_BLOCK);
+
+		copy_scale_f64_c(&d[n], (const double *) src[0].data + n,
+				src[0].scale, chunk * sizeof(double));
+		for (j = 1; j < n_src; j++)
+			add_scale_f64_c(&d[n], (const double *) src[j].data + n,
+					src[j].scale, chunk * sizeof(double));
+	}
+}
+
+void
+copy_ramp_s16_c(void *dst, const void *src, uint32_t n_channels, float start, float step, int n_bytes)
+{
+	const int16_t *s = src;
+	int16_t *d = dst;
+	uint32_t n, c, n_frames = n_bytes / (sizeof(int16_t) * n_channels);
+	int32_t t;
+	float g;
+
+	for (n = 0; n < n_frames; n++) {
+		g = start + n * step;
+		for (c = 0; c < n_channels; c++) {
+			t = (int32_t) (*s * g);
+			*d = SPA_CLAMP(t, INT16_MIN, INT16_MAX);
+			d++;
+			s++;
+		}
+	}
+}
+
+void
+add_ramp_s16_c(void *dst, const void *src, uint32_t n_channels, float start, float step, int n_bytes)
+{
+	const int16_t *s = src;
+	int16_t *d = dst;
+	uint32_t n, c, n_frames = n_bytes / (sizeof(int16_t) * n_channels);
+	int32_t t;
+	float g;
+
+	for (n = 0; n < n_frames; n++) {
+		g = start + n * step;
+		for (c = 0; c < n_channels; c++) {
+			t = *d + (int32_t) (*s * g);
+			*d = SPA_CLAMP(t, INT16_MIN, INT16_MAX);
+			d++;
+			s++;
+		}
+	}
+}
+
+void
+copy_ramp_f32_c(void *dst, const void *src, uint32_t n_channels, float start, float step, int n_bytes)
+{
+	const float *s = src;
+	float *d = dst;
+	uint32_t n, c, n_frames = n_bytes / (sizeof(float) * n_channels);
+	float g;
+
+	for (n = 0; n < n_frames; n++) {
+		g = start + n * step;
+		for (c = 0; c < n_channels; c++) {
+			*d = *s * g;
+			d++;
+			s++;
+		}
+	}
+}
+
+void
+add_ramp_f32_c(void *dst, const void *src, uint32_t n_channels, float start, float step, int n_bytes)
+{
+	const float *s = src;
+	float *d = dst;
+	uint32_t n, c, n_frames = n_bytes / (sizeof(float) * n_channels);
+	float g;
+
+	for (n = 0; n < n_frames; n++) {
+		g = start + n * step;
+		for (c = 0; c < n_channels; c++) {
+			*d += *s * g;
+			d++;
+			s++;
+		}
+	}
+}
+
+static void
+copy_ramp_s24_c(void *dst, const void *src, uint32_t n_channels, float start, float step, int n_bytes)
+{
+	const uint8_t *s = src;
+	uint8_t *d = dst;
+	uint32_t n, c, n_frames = n_bytes / (3 * n_channels);
+	int64_t t;
+	float g;
+
+	for (n = 0; n < n_frames; n++) {
+		g = start + n * step;
+		for (c = 0; c < n_channels; c++) {
+			t = (int64_t) (read_s24(s) * (double) g);
+			write_s24(d, SPA_CLAMP(t, S24_MIN, S24_MAX));
+			d += 3;
+			s += 3;
+		}
+	}
+}
+
+static void
+add_ramp_s24_c(void *dst, const void *src, uint32_t n_channels, float start, float step, int n_bytes)
+{
+	const uint8_t *s = src;
+	uint8_t *d = dst;
+	uint32_t n, c, n_frames = n_bytes / (3 * n_channels);
+	int64_t t;
+	float g;
+
+	for (n = 0; n < n_frames; n++) {
+		g = start + n * step;
+		for (c = 0; c < n_channels; c++) {
+			t = read_s24(d) + (int64_t) (read_s24(s) * (double) g);
+			write_s24(d, SPA_CLAMP(t, S24_MIN, S24_MAX));
+			d += 3;
+			s += 3;
+		}
+	}
+}
+
+static void
+copy_ramp_s24_32_c(void *dst, const void *src, uint32_t n_channels, float start, float step, int n_bytes)
+{
+	const int32_t *s = src;
+	int32_t *d = dst;
+	uint32_t n, c, n_frames = n_bytes / (sizeof(int32_t) * n_channels);
+	int64_t t;
+	float g;
+
+	for (n = 0; n < n_frames; n++) {
+		g = start + n * step;
+		for (c = 0; c < n_channels; c++) {
+			t = (int64_t) (read_s24_32(s) * (double) g);
+			*d = SPA_CLAMP(t, S24_MIN, S24_MAX);
+			d++;
+			s++;
+		}
+	}
+}
+
+static void
+add_ramp_s24_32_c(void *dst, const void *src, uint32_t n_channels, float start, float step, int n_bytes)
+{
+	const int32_t *s = src;
+	int32_t *d = dst;
+	uint32_t n, c, n_frames = n_bytes / (sizeof(int32_t) * n_channels);
+	int64_t t;
+	float g;
+
+	for (n = 0; n < n_frames; n++) {
+		g = start + n * step;
+		for (c = 0; c < n_channels; c++) {
+			t = read_s24_32(d) + (int64_t) (read_s24_32(s) * (double) g);
+			*d = SPA_CLAMP(t, S24_MIN, S24_MAX);
+			d++;
+			s++;
+		}
+	}
+}
+
+static void
+copy_ramp_s32_c(void *dst, const void *src, uint32_t n_channels, float start, float step, int n_bytes)
+{
+	const int32_t *s = src;
+	int32_t *d = dst;
+	uint32_t n, c, n_frames = n_bytes / (sizeof(int32_t) * n_channels);
+	int64_t t;
+	float g;
+
+	for (n = 0; n < n_frames; n++) {
+		g = start + n * step;
+		for (c = 0; c < n_channels; c++) {
+			t = (int64_t) (*s * (double) g);
+			*d = SPA_CLAMP(t, INT32_MIN, INT32_MAX);
+			d++;
+			s++;
+		}
+	}
+}
+
+static void
+add_ramp_s32_c(void *dst, const void *src, uint32_t n_channels, float start, float step, int n_bytes)
+{
+	const int32_t *s = src;
+	int32_t *d = dst;
+	uint32_t n, c, n_frames = n_bytes / (sizeof(int32_t) * n_channels);
+	int64_t t;
+	float g;
+
+	for (n = 0; n < n_frames; n++) {
+		g = start + n * step;
+		for (c = 0; c < n_channels; c++) {
+			t = *d + (int64_t) (*s * (double) g);
+			*d = SPA_CLAMP(t, INT32_MIN, INT32_MAX);
+			d++;
+			s++;
+		}
+	}
+}
+
+static void
+copy_ramp_f64_c(void *dst, const void *src, uint32_t n_channels, float start, float step, int n_bytes)
+{
+	const double *s = src;
+	double *d = dst;
+	uint32_t n, c, n_frames = n_bytes / (sizeof(double) * n_channels);
+	double g;
+
+	for (n = 0; n < n_frames; n++) {
+		g = start + n * (double) step;
+		for (c = 0; c < n_channels; c++) {
+			*d = *s * g;
+			d++;
+			s++;
+		}
+	}
+}
+
+static void
+add_ramp_f64_c(void *dst, const void *src, uint32_t n_channels, float start, float step, int n_bytes)
+{
+	const double *s = src;
+	double *d = dst;
+	uint32_t n, c, n_frames = n_bytes / (sizeof(double) * n_channels);
+	double g;
+
+	for (n = 0; n < n_frames; n++) {
+		g = start + n * (double) step;
+		for (c = 0; c < n_channels; c++) {
+			*d += *s * g;
+			d++;
+			s++;
+		}
+	}
+}
+
+void
+copy_channels_s16_c(void *dst, const void *src, uint32_t n_channels, const float *scales, int n_bytes)
+{
+	const int16_t *s = src;
+	int16_t *d = dst;
+	uint32_t n, c, n_frames = n_bytes / (sizeof(int16_t) * n_channels);
+	int32_t t;
+
+	for (n = 0; n < n_frames; n++) {
+		for (c = 0; c < n_channels; c++) {
+			t = (int32_t) (*s * scales[c]);
+			*d = SPA_CLAMP(t, INT16_MIN, INT16_MAX);
+			d++;
+			s++;
+		}
+	}
+}
+
+void
+copy_channels_f32_c(void *dst, const void *src, uint32_t n_channels, const float *scales, int n_bytes)
+{
+	const float *s = src;
+	float *d = dst;
+	uint32_t n, c, n_frames = n_bytes / (sizeof(float) * n_channels);
+
+	for (n = 0; n < n_frames; n++) {
+		for (c = 0; c < n_channels; c++) {
+			*d = *s * scales[c];
+			d++;
+			s++;
+		}
+	}
+}
+
+static void
+copy_channels_s24_c(void *dst, const void *src, uint32_t n_channels, const float *scales, int n_bytes)
+{
+	const uint8_t *s = src;
+	uint8_t *d = dst;
+	uint32_t n, c, n_frames = n_bytes / (3 * n_channels);
+	int64_t t;
+
+	for (n = 0; n < n_frames; n++) {
+		for (c = 0; c < n_channels; c++) {
+			t = (int64_t) (read_s24(s) * (double) scales[c]);
+			write_s24(d, SPA_CLAMP(t, S24_MIN, S24_MAX));
+			d += 3;
+			s += 3;
+		}
+	}
+}
+
+static void
+copy_channels_s24_32_c(void *dst, const void *src, uint32_t n_channels, const float *scales, int n_bytes)
+{
+	const int32_t *s = src;
+	int32_t *d = dst;
+	uint32_t n, c, n_frames = n_bytes / (sizeof(int32_t) * n_channels);
+	int64_t t;
+
+	for (n = 0; n < n_frames; n++) {
+		for (c = 0; c < n_channels; c++) {
+			t = (int64_t) (read_s24_32(s) * (double) scales[c]);
+			*d = SPA_CLAMP(t, S24_MIN, S24_MAX);
+			d++;
+			s++;
+		}
+	}
+}
+
+static void
+copy_channels_s32_c(void *dst, const void *src, uint32_t n_channels, const float *scales, int n_bytes)
+{
+	const int32_t *s = src;
+	int32_t *d = dst;
+	uint32_t n, c, n_frames = n_bytes / (sizeof(int32_t) * n_channels);
+	int64_t t;
+
+	for (n = 0; n < n_frames; n++) {
+		for (c = 0; c < n_channels; c++) {
+			t = (int64_t) (*s * (double) scales[c]);
+			*d = SPA_CLAMP(t, INT32_MIN, INT32_MAX);
+			d++;
+			s++;
+		}
+	}
+}
+
+static void
+copy_channels_f64_c(void *dst, const void *src, uint32_t n_channels, const float *scales, int n_bytes)
+{
+	const double *s = src;
+	double *d = dst;
+	uint32_t n, c, n_frames = n_bytes / (sizeof(double) * n_channels);
+
+	for (n = 0; n < n_frames; n++) {
+		for (c = 0; c < n_channels; c++) {
+			*d = *s * scales[c];
+			d++;
+			s++;
+		}
+	}
+}
+
+static double ramp_gain(struct mix_ramp *r, uint32_t pos)
+{
+	double x, from, to;
+
+	if (pos >= r->length)
+		return r->target;
+
+	x = (double) pos / r->length;
+
+	switch (r->type) {
+	case MIX_RAMP_EXPONENTIAL:
+		/* equal steps in dB, with silence at -100dB */
+		from = SPA_MAX(r->start, 0.00001);
+		to = SPA_MAX(r->target, 0.00001);
+		return from * pow(to / from, x);
+	default:
+		return r->start + (r->target - r->start) * x;
+	}
+}
+
+void mix_ramp_init(struct mix_ramp *r, double gain)
+{
+	r->start = r->current = r->target = gain;
+	r->pos = r->length = 0;
+	r->type = MIX_RAMP_LINEAR;
+}
+
+void mix_ramp_set_target(struct mix_ramp *r, double target, uint32_t type, uint32_t length)
+{
+	if (target == r->target)
+		return;
+
+	r->start = r->current;
+	r->target = target;
+	r->type = type;
+	r->pos = 0;
+	r->length = length;
+	if (length == 0)
+		r->current = target;
+}
+
+uint32_t mix_ramp_next(struct mix_ramp *r, uint32_t n_frames, float *start, float *step)
+{
+	uint32_t len;
+	double from;
+
+	if (!mix_ramp_active(r)) {
+		*start = r->current;
+		*step = 0.0f;
+		return n_frames;
+	}
+
+	len = SPA_MIN(n_frames, r->length - r->pos);
+	/* the exponential ramp is made of short linear segments */
+	if (r->type == MIX_RAMP_EXPONENTIAL)
+		len = SPA_MIN(len, MIX_RAMP_SEGMENT);
+
+	from = r->current;
+	r->pos += len;
+	r->current = ramp_gain(r, r->pos);
+
+	*start = from;
+	*step = (r->current - from) / len;
+
+	return len;
+}
+
+uint32_t spa_audiomixer_get_cpu_flags(void)
+{
+	uint32_t flags = 0;
+
+#if defined (__i386__) || defined (__x86_64__)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("sse2"))
+		flags |= MIX_CPU_FLAG_SSE2;
+	if (__builtin_cpu_supports("avx2"))
+		flags |= MIX_CPU_FLAG_AVX2;
+#elif defined (__aarch64__)
+	flags |= MIX_CPU_FLAG_NEON;
+#endif
+	return flags;
+}
+
+void spa_audiomixer_get_ops(struct spa_audiomixer_ops *ops, uint32_t cpu_flags)
+{
+	ops->clear[FMT_S16] = clear_s16_c;
+	ops->clear[FMT_F32] = clear_f32_c;
+	ops->copy[FMT_S16] = copy_s16_c;
+	ops->copy[FMT_F32] = copy_f32_c;
+	ops->add[FMT_S16] = add_s16_c;
+	ops->add[FMT_F32] = add_f32_c;
+	ops->copy_scale[FMT_S16] = copy_scale_s16_c;
+	ops->copy_scale[FMT_F32] = copy_scale_f32_c;
+	ops->add_scale[FMT_S16] = add_scale_s16_c;
+	ops->add_scale[FMT_F32] = add_scale_f32_c;
+	ops->copy_i[FMT_S16] = copy_s16_i_c;
+	ops->copy_i[FMT_F32] = copy_f32_i_c;
+	ops->add_i[FMT_S16] = add_s16_i_c;
+	ops->add_i[FMT_F32] = add_f32_i_c;
+	ops->copy_scale_i[FMT_S16] = copy_scale_s16_i_c;
+	ops->copy_scale_i[FMT_F32] = copy_scale_f32_i_c;
+	ops->add_scale_i[FMT_S16] = add_scale_s16_i_c;
+	ops->add_scale_i[FMT_F32] = add_scale_f32_i_c;
+	ops->mix[FMT_S16] = mix_s16_c;
+	ops->mix[FMT_F32] = mix_f32_c;
+	ops->clear[FMT_S24] = clear_c;
+	ops->copy[FMT_S24] = copy_c;
+	ops->add[FMT_S24] = add_s24_c;
+	ops->copy_scale[FMT_S24] = copy_scale_s24_c;
+	ops->add_scale[FMT_S24] = add_scale_s24_c;
+	ops->copy_i[FMT_S24] = copy_s24_i_c;
+	ops->add_i[FMT_S24] = add_s24_i_c;
+	ops->copy_scale_i[FMT_S24] = copy_scale_s24_i_c;
+	ops->add_scale_i[FMT_S24] = add_scale_s24_i_c;
+	ops->mix[FMT_S24] = mix_s24_c;
+	ops->clear[FMT_S24_32] = clear_c;
+	ops->copy[FMT_S24_32] = copy_c;
+	ops->add[FMT_S24_32] = add_s24_32_c;
+	ops->copy_scale[FMT_S24_32] = copy_scale_s24_32_c;
+	ops->add_scale[FMT_S24_32] = add_scale_s24_32_c;
+	ops->copy_i[FMT_S24_32] = copy_s24_32_i_c;
+	ops->add_i[FMT_S24_32] = add_s24_32_i_c;
+	ops->copy_scale_i[FMT_S24_32] = copy_scale_s24_32_i_c;
+	ops->add_scale_i[FMT_S24_32] = add_scale_s24_32_i_c;
+	ops->mix[FMT_S24_32] = mix_s24_32_c;
+	ops->clear[FMT_S32] = clear_c;
+	ops->copy[FMT_S32] = copy_c;
+	ops->add[FMT_S32] = add_s32_c;
+	ops->copy_scale[FMT_S32] = copy_scale_s32_c;
+	ops->add_scale[FMT_S32] = add_scale_s32_c;
+	ops->copy_i[FMT_S32] = copy_s32_i_c;
+	ops->add_i[FMT_S32] = add_s32_i_c;
+	ops->copy_scale_i[FMT_S32] = copy_scale_s32_i_c;
+	ops->add_scale_i[FMT_S32] = add_scale_s32_i_c;
+	ops->mix[FMT_S32] = mix_s32_c;
+	ops->clear[FMT_F64] = clear_c;
+	ops->copy[FMT_F64] = copy_c;
+	ops->add[FMT_F64] = add_f64_c;
+	ops->copy_scale[FMT_F64] = copy_scale_f64_c;
+	ops->add_scale[FMT_F64] = add_scale_f64_c;
+	ops->copy_i[FMT_F64] = copy_f64_i_c;
+	ops->add_i[FMT_F64] = add_f64_i_c;
+	ops->copy_scale_i[FMT_F64] = copy_scale_f64_i_c;
+	ops->add_scale_i[FMT_F64] = add_scale_f64_i_c;
+	ops->mix[FMT_F64] = mix_f64_c;
+	ops->copy_ramp[FMT_S16] = copy_ramp_s16_c;
+	ops->add_ramp[FMT_S16] = add_ramp_s16_c;
+	ops->copy_ramp[FMT_F32] = copy_ramp_f32_c;
+	ops->add_ramp[FMT_F32] = add_ramp_f32_c;
+	ops->copy_ramp[FMT_S24] = copy_ramp_s24_c;
+	ops->add_ramp[FMT_S24] = add_ramp_s24_c;
+	ops->copy_ramp[FMT_S24_32] = copy_ramp_s24_32_c;
+	ops->add_ramp[FMT_S24_32] = add_ramp_s24_32_c;
+	ops->copy_ramp[FMT_S32] = copy_ramp_s32_c;
+	ops->add_ramp[FMT_S32] = add_ramp_s32_c;
+	ops->copy_ramp[FMT_F64] = copy_ramp_f64_c;
+	ops->add_ramp[FMT_F64] = add_ramp_f64_c;
+	ops->copy_channels[FMT_S16] = copy_channels_s16_c;
+	ops->copy_channels[FMT_F32] = copy_channels_f32_c;
+	ops->copy_channels[FMT_S24] = copy_channels_s24_c;
+	ops->copy_channels[FMT_S24_32] = copy_channels_s24_32_c;
+	ops->copy_channels[FMT_S32] = copy_channels_s32_c;
+	ops->copy_channels[FMT_F64] = copy_channels_f64_c;
+
+	/* the optimized versions only replace what they implement, in
+	 * order of preference */
+#if defined (HAVE_SSE2)
+	if (cpu_flags & MIX_CPU_FLAG_SSE2)
+		spa_audiomixer_get_ops_sse2(ops);
+#endif
+#if defined (HAVE_AVX2)
+	if (cpu_flags & MIX_CPU_FLAG_AVX2)
+		spa_audiomixer_get_ops_avx2(ops);
+#endif
+#if defined (HAVE_NEON)
+	if (cpu_flags & MIX_CPU_FLAG_NEON)
+		spa_audiomixer_get_ops_neon(ops);
+#endif
 }
@@ -30,9 +30,43 @@ typedef void (*mix_i_func_t) (void *dst, int dst_stride,
 typedef void (*mix_scale_i_func_t) (void *dst, int dst_stride,
 				    const void *src, int src_stride, const double scale, int n_bytes);
 
+/* a source for the fused mix functions */
+struct mix_source {
+	const void *data;
+	double scale;
+};
+
+/* sum n_src scaled sources into dst in one pass, dst is cleared when
+ * there are no sources */
+typedef void (*mix_n_func_t) (void *dst, const struct mix_source *src, uint32_t n_src, int n_bytes);
+
+/* number of samples the fused mix functions handle at once */
+#define MIX_BLOCK	256
+
+/* scale n_channels interleaved channels with a gain that starts at start
+ * and changes with step for each frame */
+typedef void (*mix_ramp_func_t) (void *dst, const void *src, uint32_t n_channels,
+				 float start, float step, int n_bytes);
+
+/* scale each of the n_channels interleaved channels with its own gain */
+typedef void (*mix_channels_func_t) (void *dst, const void *src, uint32_t n_channels,
+				     const float *scales, int n_bytes);
+
+/* the optimized ramp and channels functions use the C versions for
+ * more channels */
+#define MIX_MAX_CHANNELS	64
+
+#define MIX_CPU_FLAG_SSE2	(1 << 0)
+#define MIX_CPU_FLAG_AVX2	(1 << 1)
+#define MIX_CPU_FLAG_NEON	(1 << 2)
+
 enum {
 	FMT_S16,
 	FMT_F32,
+	FMT_S24,
+	FMT_S24_32,
+	FMT_S32,
+	FMT_F64,
 	FMT_MAX,
 };
 
@@ -46,6 +80,117 @@ struct spa_audiomixer_ops {
 	mix_i_func_t add_i[FMT_MAX];
 	mix_scale_i_func_t copy_scale_i[FMT_MAX];
 	mix_scale_i_func_t add_scale_i[FMT_MAX];
+	mix_n_func_t mix[FMT_MAX];
+	mix_ramp_func_t copy_ramp[FMT_MAX];
+	mix_ramp_func_t add_ramp[FMT_MAX];
+	mix_channels_func_t copy_channels[FMT_MAX];
+};
+
+enum mix_ramp_type {
+	MIX_RAMP_LINEAR,
+	MIX_RAMP_EXPONENTIAL,
+};
+
+/* length in frames of the linear segments of an exponential ramp */
+#define MIX_RAMP_SEGMENT	64
+
+/* a gain that moves to a new target over a number of frames */
+struct mix_ramp {
+	double start;		/* gain at the start of the ramp */
+	double current;		/* gain after the last processed frame */
+	double target;
+	uint32_t type;		/* enum mix_ramp_type */
+	uint32_t pos;		/* frames done */
+	uint32_t length;	/* frames in the ramp */
 };
 
-void spa_audiomixer_get_ops(struct spa_audiomixer_ops *ops);
+void mix_ramp_init(struct mix_ramp *r, double gain);
+
+/* start a ramp from the current gain to target, does nothing when the
+ * target did not change */
+void mix_ramp_set_target(struct mix_ramp *r, double target, uint32_t type, uint32_t length);
+
+static inline bool mix_ramp_active(const struct mix_ramp *r)
+{
+	return r->pos < r->length;
+}
+
+/* get the next linear piece of the ramp for at most n_frames. Returns the
+ * number of frames in the piece, step is 0 when the ramp is done */
+uint32_t mix_ramp_next(struct mix_ramp *r, uint32_t n_frames, float *start, float *step);
+
+/* number of vectors of n_lanes samples after which the same channel is
+ * in the first lane again */
+static inline uint32_t mix_n_vectors(uint32_t n_channels, uint32_t n_lanes)
+{
+	uint32_t a = n_channels, b = n_lanes, t;
+
+	while (b) {
+		t = a % b;
+		a = b;
+		b = t;
+	}
+	return n_channels / a;
+}
+
+/* the cpu features that the optimized mix functions can use on this machine */
+uint32_t spa_audiomixer_get_cpu_flags(void);
+
+/* fill ops with the best functions for the given cpu flags, with 0
+ * this gives the plain C versions */
+void spa_audiomixer_get_ops(struct spa_audiomixer_ops *ops, uint32_t cpu_flags);
+
+/* plain C versions, used as fallback by the optimized versions */
+void copy_s16_i_c(void *dst, int dst_stride, const void *src, int src_stride, int n_bytes);
+void copy_f32_i_c(void *dst, int dst_stride, const void *src, int src_stride, int n_bytes);
+void add_s16_i_c(void *dst, int dst_stride, const void *src, int src_stride, int n_bytes);
+void add_f32_i_c(void *dst, int dst_stride, const void *src, int src_stride, int n_bytes);
+void copy_scale_s16_c(void *dst, const void *src, const double scale, int n_bytes);
+void add_scale_s16_c(void *dst, const void *src, const double scale, int n_bytes);
+void mix_s16_c(void *dst, const struct mix_source *src, uint32_t n_src, int n_bytes);
+void copy_ramp_s16_c(void *dst, const void *src, uint32_t n_channels, float start, float step, int n_bytes);
+void add_ramp_s16_c(void *dst, const void *src, uint32_t n_channels, float start, float step, int n_bytes);
+void copy_ramp_f32_c(void *dst, const void *src, uint32_t n_channels, float start, float step, int n_bytes);
+void add_ramp_f32_c(void *dst, const void *src, uint32_t n_channels, float start, float step, int n_bytes);
+void copy_channels_s16_c(void *dst, const void *src, uint32_t n_channels, const float *scales, int n_bytes);
+void copy_channels_f32_c(void *dst, const void *src, uint32_t n_channels, const float *scales, int n_bytes);
+void copy_scale_s16_i_c(void *dst, int dst_stride, const void *src, int src_stride,
+			const double scale, int n_bytes);
+void copy_scale_f32_i_c(void *dst, int dst_stride, const void *src, int src_stride,
+			const double scale, int n_bytes);
+void add_scale_s16_i_c(void *dst, int dst_stride, const void *src, int src_stride,
+		       const double scale, int n_bytes);
+void add_scale_f32_i_c(void *dst, int dst_stride, const void *src, int src_stride,
+		       const double scale, int n_bytes);
+
+/* define the interleaved version of an optimized function, it is only
+ * used when the samples are contiguous */
+#define DEFINE_MIX_I_FUNC(name,func,arch)						\
+static void name##_##arch(void *dst, int dst_stride,					\
+		const void *src, int src_stride, int n_bytes)				\
+{											\
+	if (dst_stride == 1 && src_stride == 1)						\
+		func(dst, src, n_bytes);						\
+	else										\
+		name##_c(dst, dst_stride, src, src_stride, n_bytes);			\
+}
+
+#define DEFINE_MIX_SCALE_I_FUNC(name,func,arch)						\
+static void name##_##arch(void *dst, int dst_stride,					\
+		const void *src, int src_stride, const double scale, int n_bytes)	\
+{											\
+	if (dst_stride == 1 && src_stride == 1)						\
+		func(dst, src, scale, n_bytes);						\
+	else										\
+		name##_c(dst, dst_stride, src, src_stride, scale, n_bytes);		\
+}
+
+#if defined (HAVE_SSE2)
+void spa_audiomixer_get_ops_sse2(struct spa_audiomixer_ops *ops);
+#endif
+#if defined (HAVE_AVX2)
+void spa_audiomixer_get_ops_avx2(struct spa_audiomixer_ops *ops);
+#endif
+#if defined (HAVE_NEON)
+void spa_audiomixer_get_ops_neon(struct spa_audiomixer_ops *ops);
+#endif
@@ -0,0 +1,400 @@
+/* Spa
+ * Copyright (C) 2018 Wim Taymans <wim.taymans@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "mix-ops.h"
+
+#define N_SAMPLES	1027
+#define MAX_SIZE	(N_SAMPLES * sizeof(double))
+
+static int n_failed;
+
+struct test_fmt {
+	const char *name;
+	uint32_t fmt;
+	uint32_t size;
+};
+
+static const struct test_fmt formats[] = {
+	{ "s16", FMT_S16, sizeof(int16_t) },
+	{ "f32", FMT_F32, sizeof(float) },
+	{ "s24", FMT_S24, 3 },
+	{ "s24_32", FMT_S24_32, sizeof(int32_t) },
+	{ "s32", FMT_S32, sizeof(int32_t) },
+	{ "f64", FMT_F64, sizeof(double) },
+};
+
+static const double scales[] = { 0.0, 0.25, 0.5, 1.0, 1.7, 3.14, 9.99, 20.0 };
+
+static void fill_random(const struct test_fmt *f, void *data, int n_samples)
+{
+	int i;
+
+	for (i = 0; i < n_samples; i++) {
+		switch (f->fmt) {
+		case FMT_S16:
+			((int16_t*)data)[i] = (rand() & 0xffff) - 0x8000;
+			break;
+		case FMT_F32:
+			((float*)data)[i] = (rand() / (float)RAND_MAX) * 2.0f - 1.0f;
+			break;
+		case FMT_S24:
+		{
+			int32_t v = (rand() & 0xffffff) - 0x800000;
+			memcpy(SPA_MEMBER(data, i * 3, void), &v, 3);
+			break;
+		}
+		case FMT_S24_32:
+			((int32_t*)data)[i] = (rand() & 0xffffff) - 0x800000;
+			break;
+		case FMT_S32:
+			((int32_t*)data)[i] = (int32_t) ((uint32_t) rand() << 1);
+			break;
+		case FMT_F64:
+			((double*)data)[i] = (rand() / (double)RAND_MAX) * 2.0 - 1.0;
+			break;
+		}
+	}
+}
+
+static bool compare(const struct test_fmt *f, const void *a, const void *b, int n_samples, int fuzz)
+{
+	int i;
+
+	for (i = 0; i < n_samples; i++) {
+		switch (f->fmt) {
+		case FMT_S16:
+			if (abs(((int16_t*)a)[i] - ((int16_t*)b)[i]) > fuzz)
+				return false;
+			break;
+		case FMT_F32:
+			if (fabsf(((float*)a)[i] - ((float*)b)[i]) > 1e-6f)
+				return false;
+			break;
+		case FMT_S24:
+			if (memcmp(SPA_MEMBER(a, i * 3, void), SPA_MEMBER(b, i * 3, void), 3))
+				return false;
+			break;
+		case FMT_S24_32:
+		case FMT_S32:
+			if (((int32_t*)a)[i] != ((int32_t*)b)[i])
+				return false;
+			break;
+		case FMT_F64:
+			if (fabs(((double*)a)[i] - ((double*)b)[i]) > 1e-12)
+				return false;
+			break;
+		}
+	}
+	return true;
+}
+
+static void check_fuzz(const char *arch, const char *op, const struct test_fmt *f,
+		  double scale, int offset, int n_samples, const void *a, const void *b, int fuzz)
+{
+	if (!compare(f, a, b, n_samples, fuzz)) {
+		fprintf(stderr, "%s %s_%s failed: scale %f offset %d samples %d\n",
+				arch, op, f->name, scale, offset, n_samples);
+		n_failed++;
+	}
+}
+
+static void check(const char *arch, const char *op, const struct test_fmt *f,
+		  double scale, int offset, int n_samples, const void *a, const void *b)
+{
+	check_fuzz(arch, op, f, scale, offset, n_samples, a, b, 0);
+}
+
+#define MAX_SOURCES	9
+
+static void test_mix(const char *arch, struct spa_audiomixer_ops *ops, struct spa_audiomixer_ops *ref)
+{
+	static uint8_t src[MAX_SOURCES][MAX_SIZE], dst[MAX_SIZE], ref_dst[MAX_SIZE];
+	struct mix_source sources[MAX_SOURCES];
+	uint32_t i, j, n_src;
+	int n;
+
+	for (i = 0; i < SPA_N_ELEMENTS(formats); i++) {
+		const struct test_fmt *f = &formats[i];
+
+		for (n = 1; n <= N_SAMPLES; n += 61) {
+			for (n_src = 0; n_src <= MAX_SOURCES; n_src++) {
+				for (j = 0; j < n_src; j++) {
+					fill_random(f, src[j], n);
+					sources[j].data = src[j];
+					sources[j].scale = scales[rand() % SPA_N_ELEMENTS(scales)];
+				}
+				ops->mix[f->fmt](dst, sources, n_src, n * f->size);
+				ref->mix[f->fmt](ref_dst, sources, n_src, n * f->size);
+				check(arch, "mix", f, n_src, 0, n, dst, ref_dst);
+			}
+		}
+	}
+}
+
+static void test_ops(const char *arch, struct spa_audiomixer_ops *ops, struct spa_audiomixer_ops *ref)
+{
+	static uint8_t src[MAX_SIZE + 64], dst[MAX_SIZE + 64], ref_dst[MAX_SIZE + 64];
+	uint32_t i, j;
+	int n, offset;
+
+	for (i = 0; i < SPA_N_ELEMENTS(formats); i++) {
+		const struct test_fmt *f = &formats[i];
+		uint32_t fmt = f->fmt;
+
+		/* odd sizes to test the tails and odd offsets to test unaligned access */
+		for (n = 1; n <= N_SAMPLES; n += 17) {
+			int n_bytes = n * f->size;
+
+			for (offset = 0; offset < 2; offset++) {
+				void *s = SPA_MEMBER(src, offset * f->size, void);
+				void *d = SPA_MEMBER(dst, offset * f->size, void);
+				void *r = SPA_MEMBER(ref_dst, offset * f->size, void);
+
+				fill_random(f, s, n);
+				fill_random(f, d, n);
+				memcpy(r, d, n_bytes);
+
+				ops->add[fmt](d, s, n_bytes);
+				ref->add[fmt](r, s, n_bytes);
+				check(arch, "add", f, 1.0, offset, n, d, r);
+
+				ops->add_i[fmt](d, 1, s, 1, n_bytes);
+				ref->add_i[fmt](r, 1, s, 1, n_bytes);
+				check(arch, "add_i", f, 1.0, offset, n, d, r);
+
+				ops->add_i[fmt](d, 2, s, 1, n_bytes / 2);
+				ref->add_i[fmt](r, 2, s, 1, n_bytes / 2);
+				check(arch, "add_i", f, 1.0, offset, n, d, r);
+
+				ops->copy_i[fmt](d, 1, s, 1, n_bytes);
+				ref->copy_i[fmt](r, 1, s, 1, n_bytes);
+				check(arch, "copy_i", f, 1.0, offset, n, d, r);
+
+				for (j = 0; j < SPA_N_ELEMENTS(scales); j++) {
+					double sc = scales[j];
+
+					ops->copy_scale[fmt](d, s, sc, n_bytes);
+					ref->copy_scale[fmt](r, s, sc, n_bytes);
+					check(arch, "copy_scale", f, sc, offset, n, d, r);
+
+					ops->add_scale[fmt](d, s, sc, n_bytes);
+					ref->add_scale[fmt](r, s, sc, n_bytes);
+					check(arch, "add_scale", f, sc, offset, n, d, r);
+
+					ops->copy_scale_i[fmt](d, 1, s, 1, sc, n_bytes);
+					ref->copy_scale_i[fmt](r, 1, s, 1, sc, n_bytes);
+					check(arch, "copy_scale_i", f, sc, offset, n, d, r);
+
+					ops->add_scale_i[fmt](d, 1, s, 1, sc, n_bytes);
+					ref->add_scale_i[fmt](r, 1, s, 1, sc, n_bytes);
+					check(arch, "add_scale_i", f, sc, offset, n, d, r);
+
+					ops->add_scale_i[fmt](d, 1, s, 2, sc, n_bytes / 2);
+					ref->add_scale_i[fmt](r, 1, s, 2, sc, n_bytes / 2);
+					check(arch, "add_scale_i", f, sc, offset, n, d, r);
+				}
+			}
+		}
+	}
+}
+
+static const uint32_t ramp_channels[] = { 1, 2, 3, 6, 8, 12, 64, 65 };
+
+static void test_ramp(const char *arch, struct spa_audiomixer_ops *ops, struct spa_audiomixer_ops *ref)
+{
+	static uint8_t src[MAX_SIZE], dst[MAX_SIZE], ref_dst[MAX_SIZE];
+	uint32_t i, j, n_channels;
+	int n_frames, n_bytes;
+	/* the gains may be computed with fused multiply-adds on some
+	 * architectures, which can round s16 samples differently */
+	int fuzz = strcmp(arch, "neon") == 0 ? 1 : 0;
+
+	for (i = 0; i < SPA_N_ELEMENTS(formats); i++) {
+		const struct test_fmt *f = &formats[i];
+
+		for (j = 0; j < SPA_N_ELEMENTS(ramp_channels); j++) {
+			n_channels = ramp_channels[j];
+
+			for (n_frames = 1; n_frames * n_channels <= N_SAMPLES; n_frames += 13) {
+				float start = (rand() % 100) / 50.0f;
+				float step = ((rand() % 200) - 100) / (100.0f * n_frames);
+
+				n_bytes = n_frames * n_channels * f->size;
+
+				fill_random(f, src, n_frames * n_channels);
+				fill_random(f, dst, n_frames * n_channels);
+				memcpy(ref_dst, dst, n_bytes);
+
+				ops->add_ramp[f->fmt](dst, src, n_channels, start, step, n_bytes);
+				ref->add_ramp[f->fmt](ref_dst, src, n_channels, start, step, n_bytes);
+				check_fuzz(arch, "add_ramp", f, start, n_channels,
+						n_frames * n_channels, dst, ref_dst, fuzz);
+
+				ops->copy_ramp[f->fmt](dst, src, n_channels, start, step, n_bytes);
+				ref->copy_ramp[f->fmt](ref_dst, src, n_channels, start, step, n_bytes);
+				check_fuzz(arch, "copy_ramp", f, start, n_channels,
+						n_frames * n_channels, dst, ref_dst, fuzz);
+			}
+		}
+	}
+}
+
+static void test_channels(const char *arch, struct spa_audiomixer_ops *ops, struct spa_audiomixer_ops *ref)
+{
+	static uint8_t src[MAX_SIZE], dst[MAX_SIZE], ref_dst[MAX_SIZE];
+	float scales[MIX_MAX_CHANNELS + 1];
+	uint32_t i, j, c, n_channels;
+	int n_frames, n_bytes;
+
+	for (i = 0; i < SPA_N_ELEMENTS(formats); i++) {
+		const struct test_fmt *f = &formats[i];
+
+		for (j = 0; j < SPA_N_ELEMENTS(ramp_channels); j++) {
+			n_channels = ramp_channels[j];
+
+			for (n_frames = 1; n_frames * n_channels <= N_SAMPLES; n_frames += 13) {
+				for (c = 0; c < n_channels; c++)
+					scales[c] = (rand() % 300) / 100.0f;
+
+				n_bytes = n_frames * n_channels * f->size;
+				fill_random(f, src, n_frames * n_channels);
+
+				ops->copy_channels[f->fmt](dst, src, n_channels, scales, n_bytes);
+				ref->copy_channels[f->fmt](ref_dst, src, n_channels, scales, n_bytes);
+				check(arch, "copy_channels", f, scales[0], n_channels,
+						n_frames * n_channels, dst, ref_dst);
+
+				/* in place */
+				ops->copy_channels[f->fmt](src, src, n_channels, scales, n_bytes);
+				check(arch, "copy_channels", f, scales[0], n_channels,
+						n_frames * n_channels, src, ref_dst);
+			}
+		}
+	}
+}
+
+static void test_ramp_state(void)
+{
+	struct mix_ramp r;
+	float start, step;
+	uint32_t n, total;
+
+	mix_ramp_init(&r, 1.0);
+	spa_assert_se(!mix_ramp_active(&r));
+	spa_assert_se(mix_ramp_next(&r, 100, &start, &step) == 100);
+	spa_assert_se(start == 1.0f && step == 0.0f);
+
+	/* linear ramp reaches the target exactly after length frames */
+	mix_ramp_set_target(&r, 0.0, MIX_RAMP_LINEAR, 1000);
+	spa_assert_se(mix_ramp_active(&r));
+	n = mix_ramp_next(&r, 300, &start, &step);
+	spa_assert_se(n == 300 && start == 1.0f && fabsf(step + 0.001f) < 1e-7f);
+	for (total = n; mix_ramp_active(&r); total += n)
+		n = mix_ramp_next(&r, 300, &start, &step);
+	spa_assert_se(total == 1000 && r.current == 0.0);
+
+	/* retargeting starts from the current gain */
+	mix_ramp_set_target(&r, 1.0, MIX_RAMP_EXPONENTIAL, 256);
+	n = mix_ramp_next(&r, 1024, &start, &step);
+	spa_assert_se(n == MIX_RAMP_SEGMENT && start == 0.0f && step > 0.0f);
+	mix_ramp_set_target(&r, 0.5, MIX_RAMP_EXPONENTIAL, 256);
+	n = mix_ramp_next(&r, 1024, &start, &step);
+	spa_assert_se(start > 0.0f && start < 0.5f && step > 0.0f);
+	for (; mix_ramp_active(&r); )
+		mix_ramp_next(&r, 1024, &start, &step);
+	spa_assert_se(r.current == 0.5);
+
+	spa_assert_se(mix_n_vectors(2, 4) == 1);
+	spa_assert_se(mix_n_vectors(3, 4) == 3);
+	spa_assert_se(mix_n_vectors(6, 8) == 3);
+}
+
+static void test_saturation(struct spa_audiomixer_ops *ops)
+{
+	int16_t s16[2] = { INT16_MAX, INT16_MIN }, s16_d[2] = { INT16_MAX, INT16_MIN };
+	int32_t s32[2] = { INT32_MAX, INT32_MIN }, s32_d[2] = { INT32_MAX, INT32_MIN };
+	int32_t s24_32[2] = { 0x7fffff, -0x800000 }, s24_32_d[2] = { 0x7fffff, -0x800000 };
+	uint8_t s24[6] = { 0xff, 0xff, 0x7f, 0x00, 0x00, 0x80 }, s24_d[6];
+	struct mix_source sources[2] = { { s32, 1.0 }, { s32, 1.0 } };
+
+	ops->add[FMT_S16](s16_d, s16, sizeof(s16));
+	spa_assert_se(s16_d[0] == INT16_MAX && s16_d[1] == INT16_MIN);
+	ops->mix[FMT_S32](s32_d, sources, 2, sizeof(s32));
+	spa_assert_se(s32_d[0] == INT32_MAX && s32_d[1] == INT32_MIN);
+	ops->copy_scale[FMT_S32](s32_d, s32, 2.0, sizeof(s32));
+	spa_assert_se(s32_d[0] == INT32_MAX && s32_d[1] == INT32_MIN);
+	ops->add_scale[FMT_S24_32](s24_32_d, s24_32, 0.5, sizeof(s24_32));
+	spa_assert_se(s24_32_d[0] == 0x7fffff && s24_32_d[1] == -0x800000);
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	memcpy(s24_d, s24, sizeof(s24));
+	ops->add[FMT_S24](s24_d, s24, sizeof(s24));
+	spa_assert_se(memcmp(s24_d, s24, sizeof(s24)) == 0);
+	ops->copy_scale[FMT_S24](s24_d, s24, 0.5, sizeof(s24));
+	spa_assert_se(s24_d[2] == 0x3f && s24_d[5] == 0xc0);
+#endif
+}
+
+int main(int argc, char *argv[])
+{
+	struct spa_audiomixer_ops ref, ops;
+	uint32_t cpu_flags = spa_audiomixer_get_cpu_flags();
+
+	srand(4321);
+
+	spa_audiomixer_get_ops(&ref, 0);
+	test_saturation(&ref);
+	test_ramp_state();
+
+	if (cpu_flags & MIX_CPU_FLAG_SSE2) {
+		spa_audiomixer_get_ops(&ops, MIX_CPU_FLAG_SSE2);
+		test_ops("sse2", &ops, &ref);
+		test_mix("sse2", &ops, &ref);
+		test_ramp("sse2", &ops, &ref);
+		test_channels("sse2", &ops, &ref);
+	}
+	if (cpu_flags & MIX_CPU_FLAG_AVX2) {
+		spa_audiomixer_get_ops(&ops, MIX_CPU_FLAG_AVX2);
+		test_ops("avx2", &ops, &ref);
+		test_mix("avx2", &ops, &ref);
+		test_ramp("avx2", &ops, &ref);
+		test_channels("avx2", &ops, &ref);
+	}
+	if (cpu_flags & MIX_CPU_FLAG_NEON) {
+		spa_audiomixer_get_ops(&ops, MIX_CPU_FLAG_NEON);
+		test_ops("neon", &ops, &ref);
+		test_mix("neon", &ops, &ref);
+		test_ramp("neon", &ops, &ref);
+		test_channels("neon", &ops, &ref);
+	}
+	spa_audiomixer_get_ops(&ops, cpu_flags);
+	test_ops("best", &ops, &ref);
+	test_mix("best", &ops, &ref);
+	test_ramp("best", &ops, &ref);
+	test_channels("best", &ops, &ref);
+
+	if (n_failed > 0) {
+		fprintf(stderr, "%d tests failed\n", n_failed);
+		return 1;
+	}
+	return 0;
+}
@@ -19,6 +19,7 @@
 
 #include <stddef.h>
 #include <unistd.h>
+#include <stdlib.h>
 #include <string.h>
 #include <errno.h>
 #include <stdio.h>
@@ -38,10 +39,20 @@ static inline void init_type(struct type *type, struct spa_type_map *map)
 	type->type_map = spa_type_map_get_id(map, SPA_TYPE__TypeMap);
 }
 
-struct array {
+/* The strings are interned in chunks that are never moved, so that the
+ * pointers returned by get_type stay valid. */
+#define CHUNK_SIZE	4096
+
+struct chunk {
+	struct chunk *next;
+	size_t used;
 	size_t size;
-	size_t maxsize;
-	void *data;
+	char data[];
+};
+
+struct entry {
+	const char *type;
+	uint32_t hash;
 };
 
 struct impl {
@@ -50,48 +61,120 @@ struct impl {
 
 	struct type type;
 
-	struct array types;
-	struct array strings;
+	struct entry *entries;		/* indexed by id */
+	uint32_t n_entries;
+	uint32_t max_entries;
+
+	uint32_t *table;		/* open addressing hash of id + 1, 0 is free */
+	uint32_t table_size;		/* power of 2, at least twice n_entries */
+
+	struct chunk *chunks;
 };
 
-static inline void * alloc_size(struct array *array, size_t size, size_t extend)
+/* FNV-1a */
+static inline uint32_t hash_string(const char *str)
+{
+	uint32_t h = 2166136261u;
+
+	while (*str) {
+		h ^= (uint8_t) *str++;
+		h *= 16777619u;
+	}
+	return h;
+}
+
+static const char *intern_string(struct impl *impl, const char *str)
 {
-	void *res;
-	if (array->size + size > array->maxsize) {
-		array->maxsize = SPA_ROUND_UP_N(array->size + size, extend);
-		array->data = realloc(array->data, array->maxsize);
+	size_t len = strlen(str) + 1;
+	struct chunk *c = impl->chunks;
+	char *p;
+
+	if (c == NULL || c->used + len > c->size) {
+		size_t size = SPA_MAX(len, CHUNK_SIZE - sizeof(struct chunk));
+
+		if ((c = malloc(sizeof(struct chunk) + size)) == NULL)
+			return NULL;
+		c->next = impl->chunks;
+		c->used = 0;
+		c->size = size;
+		impl->chunks = c;
 	}
-	res = SPA_MEMBER(array->data, array->size, void);
-	array->size += size;
-	return res;
+	p = c->data + c->used;
+	memcpy(p, str, len);
+	c->used += len;
+
+	return p;
+}
+
+static void table_insert(uint32_t *table, uint32_t size, uint32_t hash, uint32_t id)
+{
+	uint32_t i;
+
+	for (i = hash & (size - 1); table[i] != 0; i = (i + 1) & (size - 1));
+	table[i] = id + 1;
+}
+
+static int table_grow(struct impl *impl)
+{
+	uint32_t i, size, *table;
+
+	size = impl->table_size ? impl->table_size * 2 : 256;
+	if ((table = calloc(size, sizeof(uint32_t))) == NULL)
+		return -ENOMEM;
+
+	for (i = 0; i < impl->n_entries; i++)
+		table_insert(table, size, impl->entries[i].hash, i);
+
+	free(impl->table);
+	impl->table = table;
+	impl->table_size = size;
+
+	return 0;
 }
 
 static uint32_t
 impl_type_map_get_id(struct spa_type_map *map, const char *type)
 {
 	struct impl *impl = SPA_CONTAINER_OF(map, struct impl, map);
-	uint32_t i, len;
-	void *p;
-	off_t o, *off;
+	uint32_t i, id, hash;
+	struct entry *e;
 
 	if (type == NULL)
 		return SPA_ID_INVALID;
 
-	for (i = 0; i < impl->types.size / sizeof(off_t); i++) {
-		o = ((off_t *)impl->types.data)[i];
-		if (strcmp(SPA_MEMBER(impl->strings.data, o, char), type) == 0)
-			return i;
+	hash = hash_string(type);
+
+	if (impl->table_size > 0) {
+		for (i = hash & (impl->table_size - 1); impl->table[i] != 0;
+		     i = (i + 1) & (impl->table_size - 1)) {
+			e = &impl->entries[impl->table[i] - 1];
+			if (e->hash == hash && strcmp(e->type, type) == 0)
+				return impl->table[i] - 1;
+		}
+	}
+
+	if ((impl->n_entries + 1) * 2 > impl->table_size && table_grow(impl) < 0)
+		return SPA_ID_INVALID;
+
+	if (impl->n_entries == impl->max_entries) {
+		uint32_t max = impl->max_entries ? impl->max_entries * 2 : 128;
+
+		if ((e = realloc(impl->entries, max * sizeof(struct entry))) == NULL)
+			return SPA_ID_INVALID;
+		impl->entries = e;
+		impl->max_entries = max;
 	}
-	len = strlen(type);
-	p = alloc_size(&impl->strings, len+1, 1024);
-	memcpy(p, type, len + 1);
 
-	off = alloc_size(&impl->types, sizeof(off_t), 128);
-	*off = SPA_PTRDIFF(p, impl->strings.data);
-	i = SPA_PTRDIFF(off, impl->types.data) / sizeof(off_t);
+	id = impl->n_entries;
+	e = &impl->entries[id];
+	if ((e->type = intern_string(impl, type)) == NULL)
+		return SPA_ID_INVALID;
+	e->hash = hash;
+	impl->n_entries++;
 
-	return i;
+	table_insert(impl->table, impl->table_size, hash, id);
 
+	return id;
 }
 
 static const char *
@@ -99,10 +182,8 @@ impl_type_map_get_type(const struct spa_type_map *map, uint32_t id)
 {
 	struct impl *impl = SPA_CONTAINER_OF(map, struct impl, map);
 
-	if (id < impl->types.size / sizeof(off_t)) {
-		off_t o = ((off_t *)impl->types.data)[id];
-		return SPA_MEMBER(impl->strings.data, o, char);
-	}
+	if (id < impl->n_entries)
+		return impl->entries[id].type;
 	return NULL;
 }
 
@@ -110,7 +191,7 @@ static size_t
 impl_type_map_get_size(const struct spa_type_map *map)
 {
 	struct impl *impl = SPA_CONTAINER_OF(map, struct impl, map);
-	return impl->types.size / sizeof(off_t);
+	return impl->n_entries;
 }
 
 static const struct spa_type_map impl_type_map = {
@@ -146,10 +227,13 @@ static int impl_clear(struct spa_handle *handle)
 
 	impl = (struct impl *) handle;
 
-	if (impl->types.data)
-		free(impl->types.data);
-	if (impl->strings.data)
-		free(impl->strings.data);
+	while (impl->chunks) {
+		struct chunk *c = impl->chunks;
+		impl->chunks = c->next;
+		free(c);
+	}
+	free(impl->entries);
+	free(impl->table);
 
 	return 0;
 }
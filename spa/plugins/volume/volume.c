@@ -32,20 +32,37 @@
 #include <spa/param/io.h>
 #include <spa/pod/filter.h>
 
+#include "mix-ops.h"
+
 #define NAME "volume"
 
 #define DEFAULT_VOLUME 1.0
 #define DEFAULT_MUTE false
+#define DEFAULT_RAMP_LENGTH 256
+#define DEFAULT_RAMP_TYPE MIX_RAMP_LINEAR
+
+#define MAX_CHANNELS	MIX_MAX_CHANNELS
 
 struct props {
 	double volume;
 	bool mute;
+	float channel_volumes[MAX_CHANNELS];
+	uint32_t n_channel_volumes;
+	int32_t ramp_length;
+	int32_t ramp_type;
 };
 
 static void reset_props(struct props *props)
 {
+	uint32_t i;
+
 	props->volume = DEFAULT_VOLUME;
 	props->mute = DEFAULT_MUTE;
+	for (i = 0; i < MAX_CHANNELS; i++)
+		props->channel_volumes[i] = DEFAULT_VOLUME;
+	props->n_channel_volumes = 0;
+	props->ramp_length = DEFAULT_RAMP_LENGTH;
+	props->ramp_type = DEFAULT_RAMP_TYPE;
 }
 
 #define MAX_BUFFERS     16
@@ -78,6 +95,9 @@ struct type {
 	uint32_t props;
 	uint32_t prop_volume;
 	uint32_t prop_mute;
+	uint32_t prop_channel_volumes;
+	uint32_t prop_ramp_length;
+	uint32_t prop_ramp_type;
 	struct spa_type_io io;
 	struct spa_type_param param;
 	struct spa_type_meta meta;
@@ -100,6 +120,9 @@ static inline void init_type(struct type *type, struct spa_type_map *map)
 	type->props = spa_type_map_get_id(map, SPA_TYPE__Props);
 	type->prop_volume = spa_type_map_get_id(map, SPA_TYPE_PROPS__volume);
 	type->prop_mute = spa_type_map_get_id(map, SPA_TYPE_PROPS__mute);
+	type->prop_channel_volumes = spa_type_map_get_id(map, SPA_TYPE_PROPS__channelVolumes);
+	type->prop_ramp_length = spa_type_map_get_id(map, SPA_TYPE_PROPS__rampLength);
+	type->prop_ramp_type = spa_type_map_get_id(map, SPA_TYPE_PROPS__rampType);
 	spa_type_io_map(map, &type->io);
 	spa_type_param_map(map, &type->param);
 	spa_type_meta_map(map, &type->meta);
@@ -124,17 +147,23 @@ struct impl {
 	struct spa_log *log;
 
 	struct props props;
+	struct mix_ramp ramp;
+
+	struct spa_audiomixer_ops ops;
 
 	const struct spa_node_callbacks *callbacks;
 	void *callbacks_data;
 
 	struct spa_audio_info current_format;
 	int bpf;
+	uint32_t fmt;
+	float gains[MAX_CHANNELS];
 
 	struct port in_ports[1];
 	struct port out_ports[1];
 
 	bool started;
+	bool in_place;
 };
 
 #define CHECK_IN_PORT(this,d,p)  ((d) == SPA_DIRECTION_INPUT && (p) == 0)
@@ -156,6 +185,7 @@ static int impl_node_enum_params(struct spa_node *node,
 	uint8_t buffer[1024];
 	struct spa_pod *param;
 	struct props *p;
+	uint32_t n_channels;
 
 	spa_return_val_if_fail(node != NULL, -EINVAL);
 	spa_return_val_if_fail(index != NULL, -EINVAL);
@@ -164,6 +194,7 @@ static int impl_node_enum_params(struct spa_node *node,
 	this = SPA_CONTAINER_OF(node, struct impl, node);
 	t = &this->type;
 	p = &this->props;
+	n_channels = SPA_MAX(p->n_channel_volumes, this->current_format.info.raw.channels);
 
       next:
 	spa_pod_builder_init(&b, buffer, sizeof(buffer));
@@ -195,6 +226,32 @@ static int impl_node_enum_params(struct spa_node *node,
 				":", t->param.propName, "s", "Mute",
 				":", t->param.propType, "b", p->mute);
 			break;
+		case 2:
+			param = spa_pod_builder_object(&b,
+				id, t->param.PropInfo,
+				":", t->param.propId,   "I", t->prop_channel_volumes,
+				":", t->param.propName, "s", "The volume of each channel",
+				":", t->param.propType, "a", sizeof(float), SPA_POD_TYPE_FLOAT,
+					n_channels, p->channel_volumes);
+			break;
+		case 3:
+			param = spa_pod_builder_object(&b,
+				id, t->param.PropInfo,
+				":", t->param.propId,   "I", t->prop_ramp_length,
+				":", t->param.propName, "s", "Volume ramp length in frames",
+				":", t->param.propType, "ir", p->ramp_length,
+					SPA_POD_PROP_MIN_MAX(0, INT32_MAX));
+			break;
+		case 4:
+			param = spa_pod_builder_object(&b,
+				id, t->param.PropInfo,
+				":", t->param.propId,   "I", t->prop_ramp_type,
+				":", t->param.propName, "s", "Volume ramp curve",
+				":", t->param.propType, "i", p->ramp_type,
+				":", t->param.propLabels, "[-i",
+					"i", MIX_RAMP_LINEAR, "s", "Linear",
+					"i", MIX_RAMP_EXPONENTIAL, "s", "Exponential", "]");
+			break;
 		default:
 			return 0;
 		}
@@ -204,8 +261,12 @@ static int impl_node_enum_params(struct spa_node *node,
 		case 0:
 			param = spa_pod_builder_object(&b,
 				id, t->props,
-				":", t->prop_volume, "d", p->volume,
-				":", t->prop_mute,   "b", p->mute);
+				":", t->prop_volume,      "d", p->volume,
+				":", t->prop_mute,        "b", p->mute,
+				":", t->prop_channel_volumes, "a", sizeof(float), SPA_POD_TYPE_FLOAT,
+					n_channels, p->channel_volumes,
+				":", t->prop_ramp_length, "i", p->ramp_length,
+				":", t->prop_ramp_type,   "i", p->ramp_type);
 			break;
 		default:
 			return 0;
@@ -222,11 +283,32 @@ static int impl_node_enum_params(struct spa_node *node,
 	return 1;
 }
 
+static void parse_channel_volumes(struct props *p, const struct spa_pod_prop *prop)
+{
+	const struct spa_pod_array *arr = (const struct spa_pod_array *) &prop->body.value;
+	const float *v;
+	uint32_t i, n;
+
+	if (arr->pod.type != SPA_POD_TYPE_ARRAY ||
+	    arr->body.child.type != SPA_POD_TYPE_FLOAT ||
+	    arr->body.child.size != sizeof(float))
+		return;
+
+	n = (arr->pod.size - sizeof(struct spa_pod_array_body)) / sizeof(float);
+	n = SPA_MIN(n, MAX_CHANNELS);
+	v = SPA_MEMBER(arr, sizeof(struct spa_pod_array), const float);
+
+	for (i = 0; i < n; i++)
+		p->channel_volumes[i] = SPA_MAX(v[i], 0.0f);
+	p->n_channel_volumes = n;
+}
+
 static int impl_node_set_param(struct spa_node *node, uint32_t id, uint32_t flags,
 			       const struct spa_pod *param)
 {
 	struct impl *this;
 	struct type *t;
+	struct spa_pod_prop *prop;
 
 	spa_return_val_if_fail(node != NULL, -EINVAL);
 
@@ -241,8 +323,15 @@ static int impl_node_set_param(struct spa_node *node, uint32_t id, uint32_t flag
 			return 0;
 		}
 		spa_pod_object_parse(param,
-			":", t->prop_volume, "?d", &p->volume,
-			":", t->prop_mute,   "?b", &p->mute, NULL);
+			":", t->prop_volume,      "?d", &p->volume,
+			":", t->prop_mute,        "?b", &p->mute,
+			":", t->prop_ramp_length, "?i", &p->ramp_length,
+			":", t->prop_ramp_type,   "?i", &p->ramp_type, NULL);
+
+		if ((prop = spa_pod_find_prop(param, t->prop_channel_volumes)) != NULL)
+			parse_channel_volumes(p, prop);
+
+		p->ramp_length = SPA_MAX(p->ramp_length, 0);
 	}
 	else
 		return -ENOENT;
@@ -375,12 +464,13 @@ static int port_enum_formats(struct spa_node *node,
 			"I", t->media_type.audio,
 			"I", t->media_subtype.raw,
 			":", t->format_audio.format,  "Ieu", t->audio_format.S16,
-				SPA_POD_PROP_ENUM(2, t->audio_format.S16,
-						     t->audio_format.S32),
+				SPA_POD_PROP_ENUM(3, t->audio_format.S16,
+						     t->audio_format.S32,
+						     t->audio_format.F32),
 			":", t->format_audio.rate,    "iru", 44100,
 				SPA_POD_PROP_MIN_MAX(1, INT32_MAX),
 			":", t->format_audio.channels,"iru", 2,
-				SPA_POD_PROP_MIN_MAX(1, INT32_MAX));
+				SPA_POD_PROP_MIN_MAX(1, MAX_CHANNELS));
 		break;
 	default:
 		return 0;
@@ -538,6 +628,11 @@ static int clear_buffers(struct impl *this, struct port *port)
 		port->n_buffers = 0;
 		spa_list_init(&port->empty);
 	}
+	/* in place, the output buffers are the input buffers */
+	if (this->in_place) {
+		this->in_place = false;
+		clear_buffers(this, GET_OUT_PORT(this, 0));
+	}
 	return 0;
 }
 
@@ -548,6 +643,7 @@ static int port_set_format(struct spa_node *node,
 {
 	struct impl *this = SPA_CONTAINER_OF(node, struct impl, node);
 	struct port *port;
+	uint32_t size;
 
 	port = GET_PORT(this, direction, port_id);
 
@@ -568,7 +664,25 @@ static int port_set_format(struct spa_node *node,
 		if (spa_format_audio_raw_parse(format, &info.info.raw, &this->type.format_audio) < 0)
 			return -EINVAL;
 
-		this->bpf = 2 * info.info.raw.channels;
+		if (info.info.raw.channels == 0 || info.info.raw.channels > MAX_CHANNELS)
+			return -EINVAL;
+
+		if (info.info.raw.format == this->type.audio_format.S16) {
+			this->fmt = FMT_S16;
+			size = sizeof(int16_t);
+		}
+		else if (info.info.raw.format == this->type.audio_format.S32) {
+			this->fmt = FMT_S32;
+			size = sizeof(int32_t);
+		}
+		else if (info.info.raw.format == this->type.audio_format.F32) {
+			this->fmt = FMT_F32;
+			size = sizeof(float);
+		}
+		else
+			return -EINVAL;
+
+		this->bpf = size * info.info.raw.channels;
 		this->current_format = info;
 		port->have_format = true;
 	}
@@ -599,6 +713,31 @@ impl_node_port_set_param(struct spa_node *node,
 		return -ENOENT;
 }
 
+/* when the output port gets the buffers of the input port, which the link
+ * only does when the input buffers are not seen by other nodes, we scale
+ * the input buffer and send it out again */
+static void update_in_place(struct impl *this)
+{
+	struct port *in_port = GET_IN_PORT(this, 0);
+	struct port *out_port = GET_OUT_PORT(this, 0);
+	uint32_t i;
+
+	this->in_place = in_port->n_buffers > 0 &&
+			 in_port->n_buffers == out_port->n_buffers;
+
+	for (i = 0; this->in_place && i < in_port->n_buffers; i++)
+		this->in_place = in_port->buffers[i].outbuf == out_port->buffers[i].outbuf;
+
+	if (!this->in_place)
+		return;
+
+	spa_list_init(&out_port->empty);
+	for (i = 0; i < out_port->n_buffers; i++)
+		out_port->buffers[i].outstanding = true;
+
+	spa_log_info(this->log, NAME " %p: processing in place", this);
+}
+
 static int
 impl_node_port_use_buffers(struct spa_node *node,
 			   enum spa_direction direction,
@@ -647,6 +786,8 @@ impl_node_port_use_buffers(struct spa_node *node,
 	}
 	port->n_buffers = n_buffers;
 
+	update_in_place(this);
+
 	return 0;
 }
 
@@ -724,7 +865,8 @@ static int impl_node_port_reuse_buffer(struct spa_node *node, uint32_t port_id,
 	if (buffer_id >= port->n_buffers)
 		return -EINVAL;
 
-	recycle_buffer(this, buffer_id);
+	if (!this->in_place)
+		recycle_buffer(this, buffer_id);
 
 	return 0;
 }
@@ -752,48 +894,140 @@ static struct spa_buffer *find_free_buffer(struct impl *this, struct port *port)
 	return b->outbuf;
 }
 
+/* the gain of each channel at the given volume, returns true when all
+ * channels have the same gain */
+static bool update_gains(struct impl *this, double volume)
+{
+	uint32_t i, n_channels = this->current_format.info.raw.channels;
+	const float *cv = this->props.channel_volumes;
+	bool uniform = true;
+
+	for (i = 0; i < n_channels; i++) {
+		this->gains[i] = volume * cv[i];
+		uniform &= cv[i] == cv[0];
+	}
+	return uniform;
+}
+
+/* apply the volume to the whole frames in n_bytes of samples, following
+ * the ramp to the current volume when it changed. Returns the number of
+ * bytes that were converted */
+static uint32_t apply_volume(struct impl *this, void *dst, const void *src, uint32_t n_bytes)
+{
+	struct mix_ramp *r = &this->ramp;
+	uint32_t n_channels = this->current_format.info.raw.channels;
+	uint32_t fmt = this->fmt, bpf = this->bpf;
+	uint32_t n_frames, done, len;
+	float start, step, gain;
+	bool uniform;
+
+	n_frames = n_bytes / bpf;
+	n_bytes = n_frames * bpf;
+
+	if (mix_ramp_active(r)) {
+		/* a gain that is the same for all channels is folded into the
+		 * ramp, other channel volumes are applied after it */
+		uniform = update_gains(this, 1.0);
+		gain = uniform ? this->gains[0] : 1.0f;
+
+		for (done = 0; done < n_frames; done += len) {
+			len = mix_ramp_next(r, n_frames - done, &start, &step);
+			this->ops.copy_ramp[fmt](SPA_MEMBER(dst, done * bpf, void),
+					SPA_MEMBER(src, done * bpf, void),
+					n_channels, start * gain, step * gain, len * bpf);
+		}
+		if (!uniform)
+			this->ops.copy_channels[fmt](dst, dst, n_channels, this->gains, n_bytes);
+		return n_bytes;
+	}
+
+	uniform = update_gains(this, r->current);
+	if (uniform && this->gains[0] == 0.0f)
+		/* muted, don't even read the source */
+		this->ops.clear[fmt](dst, n_bytes);
+	else if (uniform && this->gains[0] == 1.0f) {
+		if (dst != src)
+			this->ops.copy[fmt](dst, src, n_bytes);
+	}
+	else if (uniform)
+		this->ops.copy_scale[fmt](dst, src, this->gains[0], n_bytes);
+	else
+		this->ops.copy_channels[fmt](dst, src, n_channels, this->gains, n_bytes);
+
+	return n_bytes;
+}
+
+/* copy size bytes from offset in the ringbuffer data d, wrapping around */
+static void read_wrap(struct spa_data *d, uint32_t offset, void *dst, uint32_t size)
+{
+	uint32_t l0 = SPA_MIN(size, d->maxsize - offset);
+
+	memcpy(dst, SPA_MEMBER(d->data, offset, void), l0);
+	memcpy(SPA_MEMBER(dst, l0, void), d->data, size - l0);
+}
+
+/* copy size bytes to offset in the ringbuffer data d, wrapping around */
+static void write_wrap(struct spa_data *d, uint32_t offset, const void *src, uint32_t size)
+{
+	uint32_t l0 = SPA_MIN(size, d->maxsize - offset);
+
+	memcpy(SPA_MEMBER(d->data, offset, void), src, l0);
+	memcpy(d->data, SPA_MEMBER(src, l0, void), size - l0);
+}
+
 static void do_volume(struct impl *this, struct spa_buffer *dbuf, struct spa_buffer *sbuf)
 {
-	uint32_t i, n_samples, n_bytes;
+	uint32_t n_bytes;
 	struct spa_data *sd, *dd;
-	int16_t *src, *dst;
-	double volume;
+	void *src, *dst;
 	uint32_t written, towrite, savail, davail;
 	uint32_t sindex, dindex;
 
-	volume = this->props.volume;
+	mix_ramp_set_target(&this->ramp,
+			this->props.mute ? 0.0 : this->props.volume,
+			this->props.ramp_type, this->props.ramp_length);
 
 	sd = sbuf->datas;
 	dd = dbuf->datas;
 
 	savail = SPA_MIN(sd[0].chunk->size, sd[0].maxsize);
 	sindex = sd[0].chunk->offset;
-	davail = 0;
-	dindex = 0;
-	davail = dd[0].maxsize - davail;
+	/* in place, the samples stay where they are */
+	dindex = dbuf == sbuf ? sindex : 0;
+	davail = dd[0].maxsize;
 
 	towrite = SPA_MIN(savail, davail);
+	towrite -= towrite % this->bpf;
 	written = 0;
 
 	while (written < towrite) {
 		uint32_t soffset = sindex % sd[0].maxsize;
 		uint32_t doffset = dindex % dd[0].maxsize;
 
-		src = SPA_MEMBER(sd[0].data, soffset, int16_t);
-		dst = SPA_MEMBER(dd[0].data, doffset, int16_t);
+		src = SPA_MEMBER(sd[0].data, soffset, void);
+		dst = SPA_MEMBER(dd[0].data, doffset, void);
 
-		n_bytes = SPA_MIN(towrite, sd[0].maxsize - soffset);
+		n_bytes = SPA_MIN(towrite - written, sd[0].maxsize - soffset);
 		n_bytes = SPA_MIN(n_bytes, dd[0].maxsize - doffset);
 
-		n_samples = n_bytes / sizeof(int16_t);
-		for (i = 0; i < n_samples; i++)
-			dst[i] = src[i] * volume;
+		if (n_bytes < this->bpf) {
+			/* the wrap of one of the buffers splits a frame, convert
+			 * it through a frame on the stack */
+			uint8_t sframe[MAX_CHANNELS * sizeof(int32_t)];
+			uint8_t dframe[MAX_CHANNELS * sizeof(int32_t)];
+
+			read_wrap(&sd[0], soffset, sframe, this->bpf);
+			n_bytes = apply_volume(this, dframe, sframe, this->bpf);
+			write_wrap(&dd[0], doffset, dframe, n_bytes);
+		}
+		else
+			n_bytes = apply_volume(this, dst, src, n_bytes);
 
 		sindex += n_bytes;
 		dindex += n_bytes;
 		written += n_bytes;
 	}
-	dd[0].chunk->offset = 0;
+	dd[0].chunk->offset = dbuf == sbuf ? sd[0].chunk->offset : 0;
 	dd[0].chunk->size = written;
 	dd[0].chunk->stride = 0;
 }
@@ -825,13 +1059,15 @@ static int impl_node_process_input(struct spa_node *node)
 		return -EINVAL;
 	}
 
-	if ((dbuf = find_free_buffer(this, out_port)) == NULL) {
+	sbuf = in_port->buffers[input->buffer_id].outbuf;
+
+	if (this->in_place)
+		dbuf = sbuf;
+	else if ((dbuf = find_free_buffer(this, out_port)) == NULL) {
                 spa_log_error(this->log, NAME " %p: out of buffers", this);
 		return -EPIPE;
 	}
 
-	sbuf = in_port->buffers[input->buffer_id].outbuf;
-
 	input->status = SPA_STATUS_OK;
 
 	spa_log_trace(this->log, NAME " %p: do volume %d -> %d", this, sbuf->id, dbuf->id);
@@ -860,9 +1096,11 @@ static int impl_node_process_output(struct spa_node *node)
 	if (output->status == SPA_STATUS_HAVE_BUFFER)
 		return SPA_STATUS_HAVE_BUFFER;
 
-	/* recycle */
+	/* recycle, in place the buffer goes back upstream when we ask for
+	 * a new input buffer */
 	if (output->buffer_id < out_port->n_buffers) {
-		recycle_buffer(this, output->buffer_id);
+		if (!this->in_place)
+			recycle_buffer(this, output->buffer_id);
 		output->buffer_id = SPA_ID_INVALID;
 	}
 
@@ -954,13 +1192,16 @@ impl_init(const struct spa_handle_factory *factory,
 
 	this->node = impl_node;
 	reset_props(&this->props);
+	mix_ramp_init(&this->ramp, this->props.volume);
+
+	spa_audiomixer_get_ops(&this->ops, spa_audiomixer_get_cpu_flags());
 
 	this->in_ports[0].info.flags = SPA_PORT_INFO_FLAG_CAN_USE_BUFFERS |
 	    SPA_PORT_INFO_FLAG_IN_PLACE;
 	spa_list_init(&this->in_ports[0].empty);
 
 	this->out_ports[0].info.flags = SPA_PORT_INFO_FLAG_CAN_USE_BUFFERS |
-	    SPA_PORT_INFO_FLAG_NO_REF;
+	    SPA_PORT_INFO_FLAG_NO_REF | SPA_PORT_INFO_FLAG_IN_PLACE;
 	spa_list_init(&this->out_ports[0].empty);
 
 	return 0;
@@ -0,0 +1,389 @@
+/* Spa
+ * Copyright (C) 2018 Wim Taymans <wim.taymans@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/* Runs the same synthetic graphs through every scheduler and prints the
+ * percentiles of the time of one cycle. The schedulers are the recursive
+ * and the plan callbacks of spa/graph/graph-scheduler.h, the plan with an
+ * executor that runs the jobs of a level on this thread, and the reference
+ * scheduler in schedulers/. A scheduler that does not process every node
+ * once per cycle fails the run. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <inttypes.h>
+#include <stdbool.h>
+
+#include <spa/node/node.h>
+#include <spa/graph/graph.h>
+
+#define debug(...)
+
+#include <spa/graph/graph-scheduler.h>
+#include "schedulers/graph-scheduler4.h"
+
+enum node_kind {
+	NODE_SOURCE,
+	NODE_FILTER,
+	NODE_SINK,
+};
+
+struct node {
+	struct spa_node node;
+	struct spa_graph_node graph_node;
+	enum node_kind kind;
+
+	uint32_t n_in;
+	uint32_t n_out;
+	/* the io areas of the ports, nodes get them with port_set_io and do not
+	 * look at the graph ports */
+	struct spa_io_buffers **in_io;
+	struct spa_io_buffers **out_io;
+
+	uint32_t count;
+};
+
+struct data {
+	struct spa_graph graph;
+	struct spa_graph_data graph_data;
+
+	struct node *nodes;
+	uint32_t n_nodes;
+	uint32_t max_nodes;
+
+	struct spa_io_buffers *ios;
+	struct spa_graph_port *ports;	/* an output and an input port per io */
+	uint32_t n_ios;
+	uint32_t max_ios;
+
+	uint64_t processed;	/* number of process calls */
+};
+
+static struct data *current;
+
+static void produce(struct node *n)
+{
+	uint32_t i;
+
+	for (i = 0; i < n->n_out; i++) {
+		n->out_io[i]->status = SPA_STATUS_HAVE_BUFFER;
+		n->out_io[i]->buffer_id = n->count;
+	}
+	n->count++;
+}
+
+static void consume(struct node *n)
+{
+	uint32_t i;
+
+	for (i = 0; i < n->n_in; i++)
+		n->in_io[i]->status = SPA_STATUS_NEED_BUFFER;
+}
+
+static int impl_process_input(struct spa_node *node)
+{
+	struct node *n = SPA_CONTAINER_OF(node, struct node, node);
+
+	current->processed++;
+	consume(n);
+	if (n->kind == NODE_SINK)
+		return SPA_STATUS_OK;
+	produce(n);
+	return SPA_STATUS_HAVE_BUFFER;
+}
+
+static int impl_process_output(struct spa_node *node)
+{
+	struct node *n = SPA_CONTAINER_OF(node, struct node, node);
+
+	current->processed++;
+	if (n->kind == NODE_SOURCE) {
+		produce(n);
+		return SPA_STATUS_HAVE_BUFFER;
+	}
+	consume(n);
+	return SPA_STATUS_NEED_BUFFER;
+}
+
+static const struct spa_node node_impl = {
+	SPA_VERSION_NODE,
+	.process_input = impl_process_input,
+	.process_output = impl_process_output,
+};
+
+static struct node *add_node(struct data *data, enum node_kind kind)
+{
+	struct node *n = &data->nodes[data->n_nodes++];
+
+	n->node = node_impl;
+	n->kind = kind;
+	n->n_in = n->n_out = 0;
+	n->in_io = n->out_io = NULL;
+	n->count = 0;
+	spa_graph_node_init(&n->graph_node);
+	spa_graph_node_set_implementation(&n->graph_node, &n->node);
+	spa_graph_node_add(&data->graph, &n->graph_node);
+	return n;
+}
+
+static void link_nodes(struct data *data, struct node *out, struct node *in)
+{
+	struct spa_io_buffers *io = &data->ios[data->n_ios];
+	struct spa_graph_port *op = &data->ports[2 * data->n_ios];
+	struct spa_graph_port *ip = &data->ports[2 * data->n_ios + 1];
+
+	data->n_ios++;
+	*io = SPA_IO_BUFFERS_INIT;
+	out->out_io = realloc(out->out_io, (out->n_out + 1) * sizeof(io));
+	out->out_io[out->n_out] = io;
+	in->in_io = realloc(in->in_io, (in->n_in + 1) * sizeof(io));
+	in->in_io[in->n_in] = io;
+	spa_graph_port_init(op, SPA_DIRECTION_OUTPUT, out->n_out++, 0, io);
+	spa_graph_port_init(ip, SPA_DIRECTION_INPUT, in->n_in++, 0, io);
+	spa_graph_port_add(&out->graph_node, op);
+	spa_graph_port_add(&in->graph_node, ip);
+	spa_graph_port_link(op, ip);
+}
+
+/* source -> n filters -> sink */
+static struct node *make_chain(struct data *data, uint32_t n)
+{
+	struct node *prev = add_node(data, NODE_SOURCE), *f, *sink;
+	uint32_t i;
+
+	for (i = 0; i < n; i++) {
+		f = add_node(data, NODE_FILTER);
+		link_nodes(data, prev, f);
+		prev = f;
+	}
+	sink = add_node(data, NODE_SINK);
+	link_nodes(data, prev, sink);
+	return sink;
+}
+
+/* n sources -> mixer -> sink */
+static struct node *make_fan_in(struct data *data, uint32_t n)
+{
+	struct node *sink = add_node(data, NODE_SINK), *mix = add_node(data, NODE_FILTER);
+	uint32_t i;
+
+	link_nodes(data, mix, sink);
+	for (i = 0; i < n; i++)
+		link_nodes(data, add_node(data, NODE_SOURCE), mix);
+	return sink;
+}
+
+/* source -> splitter -> n sinks, the source drives the graph */
+static struct node *make_fan_out(struct data *data, uint32_t n)
+{
+	struct node *source = add_node(data, NODE_SOURCE), *split = add_node(data, NODE_FILTER);
+	uint32_t i;
+
+	link_nodes(data, source, split);
+	for (i = 0; i < n; i++)
+		link_nodes(data, split, add_node(data, NODE_SINK));
+	return source;
+}
+
+/* source -> n filters -> mixer -> sink */
+static struct node *make_diamond(struct data *data, uint32_t n)
+{
+	struct node *source = add_node(data, NODE_SOURCE), *mix, *sink, *f;
+	uint32_t i;
+
+	mix = add_node(data, NODE_FILTER);
+	sink = add_node(data, NODE_SINK);
+	link_nodes(data, mix, sink);
+	for (i = 0; i < n; i++) {
+		f = add_node(data, NODE_FILTER);
+		link_nodes(data, source, f);
+		link_nodes(data, f, mix);
+	}
+	return sink;
+}
+
+/* n / 2 source -> filter pairs -> mixer -> sink */
+static struct node *make_large(struct data *data, uint32_t n)
+{
+	struct node *sink = add_node(data, NODE_SINK), *mix = add_node(data, NODE_FILTER), *f, *s;
+	uint32_t i;
+
+	link_nodes(data, mix, sink);
+	for (i = 2; i + 2 <= n; i += 2) {
+		s = add_node(data, NODE_SOURCE);
+		f = add_node(data, NODE_FILTER);
+		link_nodes(data, s, f);
+		link_nodes(data, f, mix);
+	}
+	return sink;
+}
+
+static const struct test {
+	const char *name;
+	struct node *(*make) (struct data *data, uint32_t n);
+	uint32_t n;
+} tests[] = {
+	{ "chain", make_chain, 16 },
+	{ "fan-in", make_fan_in, 16 },
+	{ "fan-out", make_fan_out, 16 },
+	{ "diamond", make_diamond, 16 },
+	{ "large", make_large, 1000 },
+};
+
+/* runs the jobs of a level one after the other, for the level queues of the
+ * plan */
+static void run_jobs(void *data, void (*func) (void *arg, uint32_t index), void *arg,
+		     uint32_t n_jobs)
+{
+	uint32_t i;
+
+	for (i = 0; i < n_jobs; i++)
+		func(arg, i);
+}
+
+static const struct spa_graph_executor serial_executor = {
+	.run = run_jobs,
+};
+
+static const struct scheduler {
+	const char *name;
+	const struct spa_graph_callbacks *callbacks;
+	const struct spa_graph_executor *executor;
+} schedulers[] = {
+	{ "recursive", &spa_graph_impl_default, NULL },
+	{ "plan", &spa_graph_impl_plan, NULL },
+	{ "plan-jobs", &spa_graph_impl_plan, &serial_executor },
+	{ "ref4", &spa_graph_impl4, NULL },
+};
+
+/* Every node with inputs is processed once per cycle when its input
+ * arrives. When a sink drives the graph, the nodes with outputs are also
+ * processed once to pull their input. */
+static uint32_t expected_calls(struct data *data, struct node *driver)
+{
+	uint32_t i, calls = 0;
+
+	for (i = 0; i < data->n_nodes; i++) {
+		struct node *n = &data->nodes[i];
+
+		if (n->n_in > 0)
+			calls++;
+		if (n->n_out > 0 && driver->kind == NODE_SINK)
+			calls++;
+	}
+	return calls;
+}
+
+static int compare_u64(const void *a, const void *b)
+{
+	uint64_t va = *(const uint64_t *) a, vb = *(const uint64_t *) b;
+	return va < vb ? -1 : va > vb;
+}
+
+static uint64_t get_time_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * SPA_NSEC_PER_SEC + ts.tv_nsec;
+}
+
+static bool run_test(const struct scheduler *s, const struct test *t, uint32_t cycles)
+{
+	struct data data = { { { 0, } } };
+	struct node *driver;
+	uint64_t *times, t1;
+	uint32_t i, expected;
+	bool res;
+
+	data.max_nodes = t->n + 4;
+	data.nodes = calloc(data.max_nodes, sizeof(struct node));
+	data.max_ios = 2 * data.max_nodes;
+	data.ios = calloc(data.max_ios, sizeof(struct spa_io_buffers));
+	data.ports = calloc(2 * data.max_ios, sizeof(struct spa_graph_port));
+	times = calloc(cycles, sizeof(uint64_t));
+	current = &data;
+
+	spa_graph_init(&data.graph);
+	spa_graph_data_init(&data.graph_data, &data.graph);
+	if (s->executor)
+		spa_graph_data_set_executor(&data.graph_data, s->executor, 2);
+	spa_graph_set_callbacks(&data.graph, s->callbacks, &data.graph_data);
+
+	driver = t->make(&data, t->n);
+	spa_graph_data_build(&data.graph_data);
+	expected = expected_calls(&data, driver);
+
+	for (i = 0; i < cycles; i++) {
+		t1 = get_time_ns();
+		if (driver->kind == NODE_SINK) {
+			consume(driver);
+			spa_graph_need_input(&data.graph, &driver->graph_node);
+		} else {
+			produce(driver);
+			spa_graph_have_output(&data.graph, &driver->graph_node);
+		}
+		times[i] = get_time_ns() - t1;
+	}
+	qsort(times, cycles, sizeof(uint64_t), compare_u64);
+
+	printf("%-10s %-8s %5d %8.1f %8" PRIu64 " %8" PRIu64 " %8" PRIu64 " %8" PRIu64 "\n",
+			s->name, t->name, data.n_nodes,
+			(double) data.processed / cycles,
+			times[cycles / 2], times[cycles * 9 / 10],
+			times[cycles * 99 / 100], times[cycles - 1]);
+
+	res = data.processed == (uint64_t) expected * cycles;
+	if (!res)
+		fprintf(stderr, "%s %s: %.1f calls per cycle, expected %u\n",
+				s->name, t->name, (double) data.processed / cycles, expected);
+
+	spa_graph_data_clear(&data.graph_data);
+	for (i = 0; i < data.n_nodes; i++) {
+		free(data.nodes[i].in_io);
+		free(data.nodes[i].out_io);
+	}
+	free(data.nodes);
+	free(data.ios);
+	free(data.ports);
+	free(times);
+
+	return res;
+}
+
+int main(int argc, char *argv[])
+{
+	uint32_t i, j, cycles = argc > 1 ? atoi(argv[1]) : 10000;
+	int res = 0;
+
+	if (cycles == 0)
+		return -EINVAL;
+
+	printf("%-10s %-8s %5s %8s %8s %8s %8s %8s\n", "scheduler", "graph", "nodes",
+			"calls", "p50 ns", "p90 ns", "p99 ns", "max ns");
+
+	for (i = 0; i < SPA_N_ELEMENTS(tests); i++) {
+		for (j = 0; j < SPA_N_ELEMENTS(schedulers); j++) {
+			if (!run_test(&schedulers[j], &tests[i], cycles))
+				res = 1;
+		}
+	}
+	return res;
+}
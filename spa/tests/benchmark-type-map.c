@@ -0,0 +1,204 @@
+/* Spa
+ * Copyright (C) 2018 Wim Taymans <wim.taymans@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/* Registers the same type names in the type map of the support plugin and
+ * in a copy of the linear type map it replaced and prints the time per
+ * get_id call, both when the types are added and when they are looked up
+ * again like the init_type() of a plugin does. The first argument is the
+ * path of the support plugin, the second the number of lookup rounds. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <dlfcn.h>
+
+#include <spa/support/plugin.h>
+#include <spa/support/type-map.h>
+
+/* the linear map that was used before, it compares the type with every
+ * registered type */
+struct linear_map {
+	struct spa_type_map map;
+	char **types;
+	uint32_t n_types;
+	uint32_t max_types;
+};
+
+static uint32_t linear_get_id(struct spa_type_map *map, const char *type)
+{
+	struct linear_map *impl = SPA_CONTAINER_OF(map, struct linear_map, map);
+	uint32_t i;
+
+	if (type == NULL)
+		return SPA_ID_INVALID;
+
+	for (i = 0; i < impl->n_types; i++) {
+		if (strcmp(impl->types[i], type) == 0)
+			return i;
+	}
+	if (impl->n_types == impl->max_types) {
+		impl->max_types = impl->max_types ? impl->max_types * 2 : 128;
+		impl->types = realloc(impl->types, impl->max_types * sizeof(char *));
+	}
+	impl->types[i] = strdup(type);
+	return impl->n_types++;
+}
+
+static const char *linear_get_type(const struct spa_type_map *map, uint32_t id)
+{
+	struct linear_map *impl = SPA_CONTAINER_OF(map, struct linear_map, map);
+	return id < impl->n_types ? impl->types[id] : NULL;
+}
+
+static size_t linear_get_size(const struct spa_type_map *map)
+{
+	struct linear_map *impl = SPA_CONTAINER_OF(map, struct linear_map, map);
+	return impl->n_types;
+}
+
+static void linear_clear(struct linear_map *impl)
+{
+	uint32_t i;
+
+	for (i = 0; i < impl->n_types; i++)
+		free(impl->types[i]);
+	free(impl->types);
+}
+
+static struct spa_handle *load_mapper(const char *lib, struct spa_type_map **map)
+{
+	spa_handle_factory_enum_func_t enum_func;
+	const struct spa_handle_factory *factory;
+	struct spa_handle *handle;
+	uint32_t i;
+	void *hnd, *iface;
+
+	if ((hnd = dlopen(lib, RTLD_NOW)) == NULL) {
+		printf("can't load %s: %s\n", lib, dlerror());
+		return NULL;
+	}
+	if ((enum_func = dlsym(hnd, SPA_HANDLE_FACTORY_ENUM_FUNC_NAME)) == NULL) {
+		printf("can't find enum function\n");
+		return NULL;
+	}
+	for (i = 0; enum_func(&factory, &i) > 0;) {
+		if (strcmp(factory->name, "mapper"))
+			continue;
+
+		handle = calloc(1, factory->size);
+		if (spa_handle_factory_init(factory, handle, NULL, NULL, 0) < 0)
+			return NULL;
+		/* the type map is the only interface and the map gives it id 0 */
+		if (spa_handle_get_interface(handle, 0, &iface) < 0)
+			return NULL;
+		*map = iface;
+		return handle;
+	}
+	printf("can't find the mapper factory\n");
+	return NULL;
+}
+
+static uint64_t get_time_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * SPA_NSEC_PER_SEC + ts.tv_nsec;
+}
+
+/* type names with the long common prefixes of the real types */
+static char **make_types(uint32_t n_types)
+{
+	static const char *bases[] = {
+		SPA_TYPE_BASE "Props:",
+		SPA_TYPE_BASE "Param:Format:Audio:",
+		SPA_TYPE_BASE "Param:Buffers:",
+		SPA_TYPE_BASE "Pointer:Interface:Node:",
+	};
+	char **types = calloc(n_types, sizeof(char *));
+	uint32_t i;
+
+	for (i = 0; i < n_types; i++) {
+		types[i] = malloc(128);
+		snprintf(types[i], 128, "%sproperty%u", bases[i % SPA_N_ELEMENTS(bases)], i);
+	}
+	return types;
+}
+
+static void run(const char *name, struct spa_type_map *map, char **types,
+		uint32_t n_types, uint32_t rounds)
+{
+	uint64_t t1, t2, t3;
+	uint32_t i, j, base = spa_type_map_get_size(map);
+
+	t1 = get_time_ns();
+	for (i = 0; i < n_types; i++)
+		spa_type_map_get_id(map, types[i]);
+	t2 = get_time_ns();
+	for (j = 0; j < rounds; j++) {
+		for (i = 0; i < n_types; i++) {
+			if (spa_type_map_get_id(map, types[i]) != base + i) {
+				printf("%s: wrong id for %s\n", name, types[i]);
+				return;
+			}
+		}
+	}
+	t3 = get_time_ns();
+
+	printf("%-8s %6u %10.1f %10.1f\n", name, n_types,
+			(double) (t2 - t1) / n_types,
+			(double) (t3 - t2) / ((uint64_t) n_types * rounds));
+}
+
+int main(int argc, char *argv[])
+{
+	const char *lib = argc > 1 ? argv[1] : "build/spa/plugins/support/libspa-support.so";
+	uint32_t rounds = argc > 2 ? atoi(argv[2]) : 100;
+	static const uint32_t sizes[] = { 100, 300, 1000, 3000 };
+	uint32_t i;
+
+	if (rounds == 0)
+		return -EINVAL;
+
+	printf("%-8s %6s %10s %10s\n", "map", "types", "add ns", "lookup ns");
+
+	for (i = 0; i < SPA_N_ELEMENTS(sizes); i++) {
+		struct linear_map linear = { { SPA_VERSION_TYPE_MAP, NULL,
+			linear_get_id, linear_get_type, linear_get_size, }, };
+		struct spa_handle *handle;
+		struct spa_type_map *map;
+		char **types = make_types(sizes[i]);
+		uint32_t j;
+
+		run("linear", &linear.map, types, sizes[i], rounds);
+		linear_clear(&linear);
+
+		if ((handle = load_mapper(lib, &map)) == NULL)
+			return -ENOENT;
+		run("mapper", map, types, sizes[i], rounds);
+		spa_handle_clear(handle);
+		free(handle);
+
+		for (j = 0; j < sizes[i]; j++)
+			free(types[j]);
+		free(types);
+	}
+	return 0;
+}
@@ -17,8 +17,13 @@
  * Boston, MA 02110-1301, USA.
  */
 
-#ifndef __SPA_GRAPH_SCHEDULER_H__
-#define __SPA_GRAPH_SCHEDULER_H__
+/* Reference scheduler for benchmark-graph. Like the recursive scheduler it
+ * counts the ready ports of the peers, but it activates a peer from the
+ * port that makes it ready and does not recount the required ports of a
+ * node before it is pulled. */
+
+#ifndef __SPA_GRAPH_SCHEDULER4_H__
+#define __SPA_GRAPH_SCHEDULER4_H__
 
 #ifdef __cplusplus
 extern "C" {
@@ -26,53 +31,45 @@ extern "C" {
 
 #include <spa/graph/graph.h>
 
-struct spa_graph_data {
-	struct spa_graph *graph;
-};
+static inline int spa_graph_impl4_need_input(void *data, struct spa_graph_node *node);
+static inline int spa_graph_impl4_have_output(void *data, struct spa_graph_node *node);
 
-static inline void spa_graph_data_init(struct spa_graph_data *data,
-                                       struct spa_graph *graph)
+static inline void spa_graph_impl4_activate(void *data, struct spa_graph_node *node)
 {
-	data->graph = graph;
-}
-
-static inline int spa_graph_impl_need_input(void *data, struct spa_graph_node *node);
-static inline int spa_graph_impl_have_output(void *data, struct spa_graph_node *node);
-
-static inline void spa_graph_impl_activate(void *data, struct spa_graph_node *node, bool recurse)
-{
-	int res = node->state;
+	int res;
 
 	debug("node %p activate %d\n", node, node->state);
 	if (node->state == SPA_STATUS_NEED_BUFFER) {
-                res = spa_node_process_input(node->implementation);
+		res = spa_node_process_input(node->implementation);
 		debug("node %p process in %d\n", node, res);
 	}
 	else if (node->state == SPA_STATUS_HAVE_BUFFER) {
-                res = spa_node_process_output(node->implementation);
+		res = spa_node_process_output(node->implementation);
 		debug("node %p process out %d\n", node, res);
 	}
-
-	if (recurse && (res == SPA_STATUS_NEED_BUFFER || res == SPA_STATUS_OK))
-		spa_graph_impl_need_input(data, node);
-	else if (recurse && (res == SPA_STATUS_HAVE_BUFFER))
-		spa_graph_impl_have_output(data, node);
 	else
-		node->state = res;
+		return;
 
-	debug("node %p activate end %d\n", node, node->state);
+	node->state = res;
+
+	/* continue with the peers, a node that needs input pulls from its
+	 * inputs and a node that has output pushes to its outputs */
+	if (res == SPA_STATUS_NEED_BUFFER)
+		spa_graph_impl4_need_input(data, node);
+	else if (res == SPA_STATUS_HAVE_BUFFER)
+		spa_graph_impl4_have_output(data, node);
+
+	debug("node %p activate end %d\n", node, res);
 }
 
-static inline int spa_graph_impl_need_input(void *data, struct spa_graph_node *node)
+static inline int spa_graph_impl4_need_input(void *data, struct spa_graph_node *node)
 {
 	struct spa_graph_port *p;
-	uint32_t required;
 
 	debug("node %p start pull\n", node);
 
 	node->state = SPA_STATUS_NEED_BUFFER;
 	node->ready[SPA_DIRECTION_INPUT] = 0;
-	required = node->required[SPA_DIRECTION_INPUT];
 
 	spa_list_for_each(p, &node->ports[SPA_DIRECTION_INPUT], link) {
 		struct spa_graph_port *pport;
@@ -85,33 +82,30 @@ static inline int spa_graph_impl_need_input(void *data, struct spa_graph_node *n
 		prequired = pnode->required[SPA_DIRECTION_OUTPUT];
 		debug("node %p pull peer %p io %d %d\n", node, pnode, pport->io->status, pport->io->buffer_id);
 
-		if (pport->io->status == SPA_STATUS_NEED_BUFFER)
-			pnode->ready[SPA_DIRECTION_OUTPUT]++;
-		else if (pport->io->status == SPA_STATUS_OK)
+		pnode->ready[SPA_DIRECTION_OUTPUT]++;
+		if (pport->io->status == SPA_STATUS_OK)
 			node->ready[SPA_DIRECTION_INPUT]++;
 
 		debug("node %p pull peer %p out %d %d\n", node, pnode, prequired, pnode->ready[SPA_DIRECTION_OUTPUT]);
 		if (prequired > 0 && pnode->ready[SPA_DIRECTION_OUTPUT] >= prequired) {
-			if (pnode->state == SPA_STATUS_NEED_BUFFER)
-				pnode->state = SPA_STATUS_HAVE_BUFFER;
-			spa_graph_impl_activate(data, pnode, true);
+			pnode->state = SPA_STATUS_HAVE_BUFFER;
+			spa_graph_impl4_activate(data, pnode);
 		}
 	}
-	if (required > 0 && node->ready[SPA_DIRECTION_INPUT] >= required)
-		spa_graph_impl_activate(data, node, false);
 
 	debug("node %p end pull\n", node);
 
 	return 0;
 }
 
-static inline int spa_graph_impl_have_output(void *data, struct spa_graph_node *node)
+static inline int spa_graph_impl4_have_output(void *data, struct spa_graph_node *node)
 {
 	struct spa_graph_port *p;
 
 	debug("node %p start push\n", node);
 
 	node->state = SPA_STATUS_HAVE_BUFFER;
+
 	node->ready[SPA_DIRECTION_OUTPUT] = 0;
 	node->required[SPA_DIRECTION_OUTPUT] = 0;
 
@@ -132,27 +126,24 @@ static inline int spa_graph_impl_have_output(void *data, struct spa_graph_node *
 			node->required[SPA_DIRECTION_OUTPUT]++;
 		}
 		debug("node %p push peer %p in %d %d\n", node, pnode, prequired, pnode->ready[SPA_DIRECTION_INPUT]);
-		if (prequired > 0 && pnode->ready[SPA_DIRECTION_INPUT] >= prequired)
-			spa_graph_impl_activate(data, pnode, true);
+		if (prequired > 0 && pnode->ready[SPA_DIRECTION_INPUT] >= prequired) {
+			pnode->state = SPA_STATUS_NEED_BUFFER;
+			spa_graph_impl4_activate(data, pnode);
+		}
 	}
-	required = node->required[SPA_DIRECTION_OUTPUT];
-	if (required > 0 && node->ready[SPA_DIRECTION_OUTPUT] >= required)
-		spa_graph_impl_activate(data, node, false);
-
 	debug("node %p end push\n", node);
 
 	return 0;
 }
 
-static const struct spa_graph_callbacks spa_graph_impl_default = {
+static const struct spa_graph_callbacks spa_graph_impl4 = {
 	SPA_VERSION_GRAPH_CALLBACKS,
-	.need_input = spa_graph_impl_need_input,
-	.have_output = spa_graph_impl_have_output,
+	.need_input = spa_graph_impl4_need_input,
+	.have_output = spa_graph_impl4_have_output,
 };
 
-
 #ifdef __cplusplus
 }  /* extern "C" */
 #endif
 
-#endif /* __SPA_GRAPH_SCHEDULER_H__ */
+#endif /* __SPA_GRAPH_SCHEDULER4_H__ */
@@ -35,7 +35,7 @@
 #include <spa/param/audio/format-utils.h>
 #include <spa/param/format-utils.h>
 #include <spa/graph/graph.h>
-#include <spa/graph/graph-scheduler1.h>
+#include <spa/graph/graph-scheduler.h>
 
 static SPA_TYPE_MAP_IMPL(default_map, 4096);
 static SPA_LOG_IMPL(default_log);
@@ -25,10 +25,13 @@ extern "C" {
 #endif
 
 #include <spa/utils/defs.h>
+#include <spa/utils/ringbuffer.h>
 #include <spa/param/param.h>
 #include <spa/node/node.h>
+#include <spa/node/io.h>
 
 #include <pipewire/proxy.h>
+#include <pipewire/mem.h>
 
 struct pw_client_node_proxy;
 
@@ -38,12 +41,34 @@ struct pw_client_node_proxy;
 
 struct pw_client_node_message;
 
+/** Statistics of a message ringbuffer, updated by the writer \memberof pw_client_node */
+struct pw_client_node_ring_stats {
+	uint32_t size;			/**< size of the ringbuffer memory */
+	uint32_t max_filled;		/**< max number of bytes in the ringbuffer */
+	uint32_t n_overflows;		/**< number of messages that did not fit */
+};
+
 /** Shared structure between client and server \memberof pw_client_node */
 struct pw_client_node_area {
 	uint32_t max_input_ports;	/**< max input ports of the node */
 	uint32_t n_input_ports;		/**< number of input ports of the node */
 	uint32_t max_output_ports;	/**< max output ports of the node */
 	uint32_t n_output_ports;	/**< number of output ports of the node */
+	uint32_t input_wakeup;		/**< reader of the input ringbuffer is woken up, the
+					  *  wakeup of the output reader is in the activation */
+	uint32_t direct_input;		/**< input port that a peer activates directly or
+					  *  SPA_ID_INVALID, set by the server */
+	struct pw_client_node_ring_stats input_stats;	/**< stats of the input ringbuffer */
+	struct pw_client_node_ring_stats output_stats;	/**< stats of the output ringbuffer */
+};
+
+/** Memory of a node that the client of a linked peer uses to activate the
+ * node directly. It has its own memfd, the peer gets no access to the
+ * transport area. \memberof pw_client_node */
+struct pw_client_node_activation {
+	uint32_t wakeup;		/**< the client reading messages is woken up */
+	uint32_t activation;		/**< io was updated by the peer */
+	struct spa_io_buffers io;	/**< io of the direct input port */
 };
 
 /** \class pw_client_node_transport
@@ -58,10 +83,17 @@ struct pw_client_node_transport {
 	struct pw_client_node_area *area;	/**< the transport area */
 	struct spa_io_buffers *inputs;		/**< array of buffer input io */
 	struct spa_io_buffers *outputs;		/**< array of buffer output io */
+	uint64_t *input_reuse;			/**< buffers to reuse on the input ports */
+	uint64_t *output_reuse;			/**< buffers to reuse on the output ports */
 	void *input_data;			/**< input memory for ringbuffer */
 	struct spa_ringbuffer *input_buffer;	/**< ringbuffer for input memory */
 	void *output_data;			/**< output memory for ringbuffer */
 	struct spa_ringbuffer *output_buffer;	/**< ringbuffer for output memory */
+	uint32_t *input_wakeup;			/**< wakeup state of the input reader */
+	uint32_t *output_wakeup;		/**< wakeup state of the output reader */
+	struct pw_client_node_activation *activation;	/**< activation by a peer */
+	struct pw_client_node_ring_stats *input_stats;	/**< stats of the input ringbuffer */
+	struct pw_client_node_ring_stats *output_stats;	/**< stats of the output ringbuffer */
 
 	/** Destroy a transport
 	 * \param trans a transport to destroy
@@ -107,12 +139,113 @@ struct pw_client_node_transport {
 #define pw_client_node_transport_next_message(t,m)	((t)->next_message((t), (m)))
 #define pw_client_node_transport_parse_message(t,m)	((t)->parse_message((t), (m)))
 
+/** Check if the reader of the output ringbuffer must be woken up
+ * \param trans the transport messages were added to
+ * \return true when the reader is sleeping, false when it was already woken up
+ *
+ * Call this after adding messages and only signal the reader when it returns
+ * true. This saves the signal when the reader is still reading messages.
+ *
+ * \memberof pw_client_node_transport
+ */
+static inline bool pw_client_node_transport_need_wakeup(struct pw_client_node_transport *trans)
+{
+	return __atomic_exchange_n(trans->output_wakeup, 1, __ATOMIC_SEQ_CST) == 0;
+}
+
+/** Poll the input ringbuffer for new messages
+ * \param trans the transport to poll
+ * \param spin the number of times to poll
+ * \return true when a message is available
+ *
+ * \memberof pw_client_node_transport
+ */
+static inline bool pw_client_node_transport_spin(struct pw_client_node_transport *trans,
+						 uint32_t spin)
+{
+	uint32_t index;
+
+	while (spin-- > 0) {
+		if (spa_ringbuffer_get_read_index(trans->input_buffer, &index) > 0 ||
+		    __atomic_load_n(&trans->activation->activation, __ATOMIC_ACQUIRE))
+			return true;
+#if defined(__i386__) || defined(__x86_64__)
+		__builtin_ia32_pause();
+#endif
+	}
+	return false;
+}
+
+/** Mark the reader of the input ringbuffer as sleeping
+ * \param trans the transport that was read
+ * \return true when new messages arrived, they should be read before sleeping
+ *
+ * Call this after reading all messages. When it returns false, the next
+ * message is signaled.
+ *
+ * \memberof pw_client_node_transport
+ */
+static inline bool pw_client_node_transport_sleep(struct pw_client_node_transport *trans)
+{
+	uint32_t index;
+
+	__atomic_store_n(trans->input_wakeup, 0, __ATOMIC_SEQ_CST);
+	if (spa_ringbuffer_get_read_index(trans->input_buffer, &index) <= 0 &&
+	    __atomic_load_n(&trans->activation->activation, __ATOMIC_SEQ_CST) == 0)
+		return false;
+	__atomic_store_n(trans->input_wakeup, 1, __ATOMIC_SEQ_CST);
+	return true;
+}
+
+/** Activate a peer node directly
+ * \param peer the activation of the peer, as received with the port_set_peer event
+ * \param io the output io to pass to the peer
+ * \return true when the peer is sleeping and its fd must be signaled
+ *
+ * The peer handles the activation like a process_input message.
+ *
+ * \memberof pw_client_node_transport
+ */
+static inline bool pw_client_node_transport_activate(struct pw_client_node_activation *peer,
+						     const struct spa_io_buffers *io)
+{
+	peer->io = *io;
+	__atomic_store_n(&peer->activation, 1, __ATOMIC_SEQ_CST);
+	return __atomic_exchange_n(&peer->wakeup, 1, __ATOMIC_SEQ_CST) == 0;
+}
+
+/** Check if a peer activated the node
+ * \param trans the transport of the node
+ * \return true when the input of the direct port was updated by a peer, the
+ *          activation is cleared.
+ *
+ * The io of the peer is copied to the input port that the server assigned
+ * to the peer, the peer itself can't select the port.
+ *
+ * \memberof pw_client_node_transport
+ */
+static inline bool pw_client_node_transport_activated(struct pw_client_node_transport *trans)
+{
+	uint32_t port_id;
+
+	if (__atomic_exchange_n(&trans->activation->activation, 0, __ATOMIC_ACQUIRE) == 0)
+		return false;
+
+	port_id = __atomic_load_n(&trans->area->direct_input, __ATOMIC_ACQUIRE);
+	if (port_id >= trans->area->max_input_ports)
+		return false;
+
+	trans->inputs[port_id] = trans->activation->io;
+	return true;
+}
+
 enum pw_client_node_message_type {
 	PW_CLIENT_NODE_MESSAGE_HAVE_OUTPUT,		/*< signal that the node has output */
 	PW_CLIENT_NODE_MESSAGE_NEED_INPUT,		/*< signal that the node needs input */
 	PW_CLIENT_NODE_MESSAGE_PROCESS_INPUT,		/*< instruct the node to process input */
 	PW_CLIENT_NODE_MESSAGE_PROCESS_OUTPUT,		/*< instruct the node output is processed */
 	PW_CLIENT_NODE_MESSAGE_PORT_REUSE_BUFFER,	/*< reuse a buffer */
+	PW_CLIENT_NODE_MESSAGE_PORT_REUSE_BUFFERS,	/*< reuse the buffers in the reuse mask */
 };
 
 struct pw_client_node_message_body {
@@ -135,6 +268,16 @@ struct pw_client_node_message_port_reuse_buffer {
 	struct pw_client_node_message_port_reuse_buffer_body body;
 };
 
+struct pw_client_node_message_port_reuse_buffers_body {
+	struct spa_pod_int type		SPA_ALIGNED(8);	/*< PW_CLIENT_NODE_MESSAGE_PORT_REUSE_BUFFERS */
+	struct spa_pod_int port_id	SPA_ALIGNED(8);	/*< port id */
+};
+
+struct pw_client_node_message_port_reuse_buffers {
+	struct spa_pod_struct pod;
+	struct pw_client_node_message_port_reuse_buffers_body body;
+};
+
 #define PW_CLIENT_NODE_MESSAGE_TYPE(message)	(((struct pw_client_node_message*)(message))->body.type.value)
 
 #define PW_CLIENT_NODE_MESSAGE_INIT(message) (struct pw_client_node_message)			\
@@ -152,6 +295,74 @@ struct pw_client_node_message_port_reuse_buffer {
 		SPA_POD_INT_INIT(port_id),							\
 		SPA_POD_INT_INIT(buffer_id))
 
+#define PW_CLIENT_NODE_MESSAGE_PORT_REUSE_BUFFERS_INIT(port_id)				\
+	PW_CLIENT_NODE_MESSAGE_INIT_FULL(struct pw_client_node_message_port_reuse_buffers,	\
+		sizeof(struct pw_client_node_message_port_reuse_buffers_body),			\
+		PW_CLIENT_NODE_MESSAGE_PORT_REUSE_BUFFERS,					\
+		SPA_POD_INT_INIT(port_id))
+
+/** Reuse a buffer of a port
+ * \param trans the transport to send the message on
+ * \param direction the direction of the port, output on the server, input on
+ *	the client
+ * \param port_id the port id
+ * \param buffer_id the buffer to reuse
+ * \return 1 when a message was added, 0 when the buffer is sent with a
+ *	pending message, < 0 on error
+ *
+ * The buffers to reuse are collected in a mask of the port in the transport
+ * area. Only the first buffer of the mask adds a
+ * PW_CLIENT_NODE_MESSAGE_PORT_REUSE_BUFFERS message, the reader of the message
+ * takes all buffers with \ref pw_client_node_transport_take_reuse().
+ *
+ * \memberof pw_client_node_transport
+ */
+static inline int
+pw_client_node_transport_reuse_buffer(struct pw_client_node_transport *trans,
+				      enum spa_direction direction,
+				      uint32_t port_id, uint32_t buffer_id)
+{
+	uint64_t *reuse = direction == SPA_DIRECTION_INPUT ?
+		&trans->input_reuse[port_id] : &trans->output_reuse[port_id];
+	int res;
+
+	if (buffer_id >= 64) {
+		res = pw_client_node_transport_add_message(trans, (struct pw_client_node_message *)
+				&PW_CLIENT_NODE_MESSAGE_PORT_REUSE_BUFFER_INIT(port_id, buffer_id));
+		return res < 0 ? res : 1;
+	}
+
+	if (__atomic_fetch_or(reuse, 1ULL << buffer_id, __ATOMIC_SEQ_CST) != 0)
+		return 0;
+
+	if ((res = pw_client_node_transport_add_message(trans, (struct pw_client_node_message *)
+			&PW_CLIENT_NODE_MESSAGE_PORT_REUSE_BUFFERS_INIT(port_id))) < 0) {
+		/* no message would ever take the mask */
+		__atomic_store_n(reuse, 0, __ATOMIC_SEQ_CST);
+		return res;
+	}
+	return 1;
+}
+
+/** Take the buffers to reuse of a port
+ * \param trans the transport that received a PW_CLIENT_NODE_MESSAGE_PORT_REUSE_BUFFERS
+ * \param direction the direction of the port, input on the server, output on
+ *	the client
+ * \param port_id the port id of the message
+ * \return a mask with a bit set for each buffer id to reuse
+ *
+ * \memberof pw_client_node_transport
+ */
+static inline uint64_t
+pw_client_node_transport_take_reuse(struct pw_client_node_transport *trans,
+				    enum spa_direction direction, uint32_t port_id)
+{
+	uint64_t *reuse = direction == SPA_DIRECTION_INPUT ?
+		&trans->input_reuse[port_id] : &trans->output_reuse[port_id];
+
+	return __atomic_exchange_n(reuse, 0, __ATOMIC_SEQ_CST);
+}
+
 /** information about a buffer */
 struct pw_client_node_buffer {
 	uint32_t mem_id;		/**< the memory id for the metadata */
@@ -299,7 +510,8 @@ pw_client_node_proxy_destroy(struct pw_client_node_proxy *p)
 #define PW_CLIENT_NODE_PROXY_EVENT_PORT_USE_BUFFERS	8
 #define PW_CLIENT_NODE_PROXY_EVENT_PORT_COMMAND		9
 #define PW_CLIENT_NODE_PROXY_EVENT_PORT_SET_IO		10
-#define PW_CLIENT_NODE_PROXY_EVENT_NUM			11
+#define PW_CLIENT_NODE_PROXY_EVENT_PORT_SET_PEER	11
+#define PW_CLIENT_NODE_PROXY_EVENT_NUM			12
 
 /** \ref pw_client_node events */
 struct pw_client_node_proxy_events {
@@ -446,6 +658,23 @@ struct pw_client_node_proxy_events {
 			     uint32_t mem_id,
 			     uint32_t offset,
 			     uint32_t size);
+	/**
+	 * Set the peer of an output port
+	 *
+	 * The output port is linked to the input port of another client
+	 * node. The client can pass buffers to the peer and wake it up
+	 * without going through the server.
+	 *
+	 * \param port_id the output port id
+	 * \param writefd fd to signal the peer or -1
+	 * \param activation the memory with the \ref pw_client_node_activation
+	 *		of the peer or NULL to remove the peer. The client
+	 *		frees it.
+	 */
+	void (*port_set_peer) (void *object,
+			       uint32_t port_id,
+			       int writefd,
+			       struct pw_memblock *activation);
 };
 
 static inline void
@@ -479,6 +708,8 @@ pw_client_node_proxy_add_listener(struct pw_client_node_proxy *p,
 	pw_resource_notify(r,struct pw_client_node_proxy_events,port_command,__VA_ARGS__)
 #define pw_client_node_resource_port_set_io(r,...)	\
 	pw_resource_notify(r,struct pw_client_node_proxy_events,port_set_io,__VA_ARGS__)
+#define pw_client_node_resource_port_set_peer(r,...)	\
+	pw_resource_notify(r,struct pw_client_node_proxy_events,port_set_peer,__VA_ARGS__)
 
 #ifdef __cplusplus
 }  /* extern "C" */
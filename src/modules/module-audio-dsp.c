@@ -17,6 +17,7 @@
  * Boston, MA 02110-1301, USA.
  */
 
+#include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 #include <errno.h>
@@ -36,10 +37,16 @@
 #include "pipewire/type.h"
 #include "pipewire/private.h"
 
+#include "module-audio-dsp/fmt-ops.h"
+
 #define NAME "dsp"
 
 #define MAX_PORTS	256
 #define MAX_BUFFERS	8
+#define MAX_SAMPLES	1024
+
+#define DEFAULT_CHANNELS	2
+#define DEFAULT_BUFFER_SIZE	(1024 / sizeof(float))
 
 struct type {
 	struct spa_type_media_type media_type;
@@ -68,6 +75,11 @@ struct impl {
 	struct spa_hook module_listener;
 	struct pw_properties *properties;
 
+	uint32_t cpu_flags;
+	uint32_t dither;
+	int channels;
+	int buffer_size;
+
 	int node_count;
 
 	struct spa_list node_list;
@@ -115,6 +127,7 @@ struct node {
 
 	struct impl *impl;
 
+	enum pw_direction direction;	/* direction of the device port */
 	int channels;
 	int sample_rate;
 	int buffer_size;
@@ -127,6 +140,12 @@ struct node {
 	int n_out_ports;
 
 	int port_count[2];
+
+	struct convert conv;
+	uint32_t stride;		/* bytes per interleaved frame */
+
+	float empty[MAX_SAMPLES];	/* silence for unconnected ports */
+	float discard[MAX_SAMPLES];	/* output of ports without a buffer */
 };
 
 /** \endcond */
@@ -239,27 +258,6 @@ static struct buffer * dequeue_buffer(struct node *n, struct port *p)
         return b;
 }
 
-static void conv_f32_s16(int16_t *out, float *in, int n_samples, int stride)
-{
-	int i;
-	for (i = 0; i < n_samples; i++) {
-		if (in[i] < -1.0f)
-			*out = -32767;
-		else if (in[i] >= 1.0f)
-			*out = 32767;
-		else
-			*out = lrintf(in[i] * 32767.0f);
-		out += stride;
-	}
-}
-static void fill_s16(int16_t *out, int n_samples, int stride)
-{
-	int i;
-	for (i = 0; i < n_samples; i++) {
-		*out = 0;
-		out += stride;
-	}
-}
 #if 0
 static void add_f32(float *out, float *in, int n_samples)
 {
@@ -269,18 +267,31 @@ static void add_f32(float *out, float *in, int n_samples)
 }
 #endif
 
-static int node_process_input(struct spa_node *node)
+/* the output buffer that was sent in the previous cycle is recycled when
+ * the peer does not hold on to it */
+static void recycle_output(struct node *n, struct port *p)
+{
+	struct spa_io_buffers *io = p->io;
+
+	if (io->status != SPA_STATUS_HAVE_BUFFER && io->buffer_id < p->n_buffers) {
+		recycle_buffer(n, p, io->buffer_id);
+		io->buffer_id = SPA_ID_INVALID;
+	}
+}
+
+/* playback, convert the planes of the dsp input ports to the interleaved
+ * buffer of the device output port */
+static int process_playback(struct node *n)
 {
-	struct node *n = SPA_CONTAINER_OF(node, struct node, node_impl);
 	struct pw_node *this = n->node;
 	struct port *outp = GET_OUT_PORT(n, 0);
 	struct spa_io_buffers *outio = outp->io;
 	struct buffer *out;
-	int16_t *op;
+	const void *src[MAX_PORTS];
+	void *dst[1];
+	uint32_t n_samples;
 	int i;
 
-	pw_log_trace(NAME " %p: process input", this);
-
         if (outio->status == SPA_STATUS_HAVE_BUFFER)
 		return SPA_STATUS_HAVE_BUFFER;
 
@@ -293,42 +304,151 @@ static int node_process_input(struct spa_node *node)
 	outio->buffer_id = out->outbuf->id;
 	outio->status = SPA_STATUS_HAVE_BUFFER;
 
-	op = out->ptr;
+	n_samples = SPA_MIN(n->buffer_size, out->outbuf->datas[0].maxsize / n->stride);
 
-	for (i = 0; i < n->n_in_ports; i++) {
+	/* collect the planes and convert them to the interleaved output in
+	 * one go, ports without data are converted as silence */
+	for (i = 0; i < n->channels; i++) {
 		struct port *inp = GET_IN_PORT(n, i);
-		struct spa_io_buffers *inio = inp->io;
-		struct buffer *in;
-		int stride = 2;
+		struct spa_io_buffers *inio;
+
+		src[i] = n->empty;
+
+		if (inp == NULL || (inio = inp->io) == NULL)
+			continue;
+
+		if (inio->buffer_id < inp->n_buffers && inio->status == SPA_STATUS_HAVE_BUFFER)
+			src[i] = inp->buffers[inio->buffer_id].ptr;
 
-		if (inio->buffer_id < inp->n_buffers && inio->status == SPA_STATUS_HAVE_BUFFER) {
-			in = &inp->buffers[inio->buffer_id];
-			conv_f32_s16(op, in->ptr, n->buffer_size, stride);
-		}
-		else {
-			fill_s16(op, n->buffer_size, stride);
-		}
-		op++;
 		inio->status = SPA_STATUS_NEED_BUFFER;
 	}
 
+	dst[0] = out->ptr;
+	convert_process(&n->conv, dst, src, n_samples);
+
 	out->outbuf->datas[0].chunk->offset = 0;
-	out->outbuf->datas[0].chunk->size = n->buffer_size * sizeof(int16_t) * 2;
-	out->outbuf->datas[0].chunk->stride = 0;
+	out->outbuf->datas[0].chunk->size = n_samples * n->stride;
+	out->outbuf->datas[0].chunk->stride = n->stride;
 
 	return outio->status;
 }
 
+/* capture, convert the interleaved buffer of the device input port to a
+ * buffer on each of the dsp output ports. Ports that have no free buffer
+ * or that still hold the previous one are converted into a discard plane */
+static int process_capture(struct node *n)
+{
+	struct pw_node *this = n->node;
+	struct port *inp = GET_IN_PORT(n, 0);
+	struct spa_io_buffers *inio = inp->io;
+	struct spa_data *d;
+	struct buffer *in, *out[MAX_PORTS];
+	const void *src[1];
+	void *dst[MAX_PORTS];
+	uint32_t offset, size, n_samples;
+	int i;
+
+	if (inio == NULL)
+		return -EIO;
+
+	if (inio->buffer_id >= inp->n_buffers || inio->status != SPA_STATUS_HAVE_BUFFER)
+		return SPA_STATUS_NEED_BUFFER;
+
+	in = &inp->buffers[inio->buffer_id];
+	d = in->outbuf->datas;
+	offset = SPA_MIN(d[0].chunk->offset, d[0].maxsize);
+	size = SPA_MIN(d[0].chunk->size, d[0].maxsize - offset);
+	n_samples = SPA_MIN(n->buffer_size, size / n->stride);
+
+	for (i = 0; i < n->channels; i++) {
+		struct port *outp = GET_OUT_PORT(n, i);
+
+		out[i] = NULL;
+		dst[i] = n->discard;
+
+		if (outp == NULL || outp->io == NULL ||
+		    outp->io->status == SPA_STATUS_HAVE_BUFFER)
+			continue;
+
+		recycle_output(n, outp);
+
+		if ((out[i] = dequeue_buffer(n, outp)) == NULL) {
+			pw_log_warn(NAME " %p: out of buffers on port %d", this, i);
+			continue;
+		}
+		if (out[i]->outbuf->datas[0].maxsize < n_samples * sizeof(float)) {
+			recycle_buffer(n, outp, out[i]->outbuf->id);
+			out[i] = NULL;
+			continue;
+		}
+		dst[i] = out[i]->ptr;
+	}
+
+	src[0] = SPA_MEMBER(in->ptr, offset, void);
+	convert_process(&n->conv, dst, src, n_samples);
+
+	for (i = 0; i < n->channels; i++) {
+		struct spa_io_buffers *outio;
+		struct spa_data *od;
+
+		if (out[i] == NULL)
+			continue;
+
+		od = out[i]->outbuf->datas;
+		od[0].chunk->offset = 0;
+		od[0].chunk->size = n_samples * sizeof(float);
+		od[0].chunk->stride = sizeof(float);
+
+		outio = GET_OUT_PORT(n, i)->io;
+		outio->buffer_id = out[i]->outbuf->id;
+		outio->status = SPA_STATUS_HAVE_BUFFER;
+	}
+	inio->status = SPA_STATUS_NEED_BUFFER;
+
+	return SPA_STATUS_HAVE_BUFFER;
+}
+
+static int node_process_input(struct spa_node *node)
+{
+	struct node *n = SPA_CONTAINER_OF(node, struct node, node_impl);
+
+	pw_log_trace(NAME " %p: process input", n->node);
+
+	if (n->conv.process == NULL)
+		return -EIO;
+
+	if (n->direction == PW_DIRECTION_OUTPUT)
+		return process_playback(n);
+	else
+		return process_capture(n);
+}
+
 static int node_process_output(struct spa_node *node)
 {
 	struct node *n = SPA_CONTAINER_OF(node, struct node, node_impl);
 	struct pw_node *this = n->node;
-	struct port *outp = GET_OUT_PORT(n, 0);
-	struct spa_io_buffers *outio = outp->io;
+	struct port *outp;
+	struct spa_io_buffers *outio;
 	int i;
 
 	pw_log_trace(NAME " %p: process output", this);
 
+	if (n->direction == PW_DIRECTION_INPUT) {
+		struct port *inp = GET_IN_PORT(n, 0);
+
+		for (i = 0; i < n->n_out_ports; i++) {
+			outp = GET_OUT_PORT(n, i);
+			if (outp != NULL && outp->io != NULL)
+				recycle_output(n, outp);
+		}
+		if (inp->io != NULL)
+			inp->io->status = SPA_STATUS_NEED_BUFFER;
+		return SPA_STATUS_NEED_BUFFER;
+	}
+
+	outp = GET_OUT_PORT(n, 0);
+	outio = outp->io;
+
         if (outio->status == SPA_STATUS_HAVE_BUFFER)
 		return SPA_STATUS_HAVE_BUFFER;
 
@@ -424,7 +544,11 @@ static int port_enum_formats(struct spa_node *node,
 			type->param.idEnumFormat, type->spa_format,
 			"I", t->media_type.audio,
 			"I", t->media_subtype.raw,
-                        ":", t->format_audio.format,   "I", t->audio_format.S16,
+                        ":", t->format_audio.format,   "Ieu", t->audio_format.S16,
+				SPA_POD_PROP_ENUM(4, t->audio_format.S16,
+						     t->audio_format.S24,
+						     t->audio_format.S32,
+						     t->audio_format.F32),
                         ":", t->format_audio.rate,     "i", n->sample_rate,
                         ":", t->format_audio.channels, "i", n->channels);
 	}
@@ -440,10 +564,12 @@ static int port_enum_params(struct spa_node *node,
 			    struct spa_pod_builder *builder)
 {
 	struct node *n = SPA_CONTAINER_OF(node, struct node, node_impl);
+	struct port *p = GET_PORT(n, direction, port_id);
 	struct pw_type *t = n->impl->t;
 	struct spa_pod *param;
 	struct spa_pod_builder b = { 0 };
 	uint8_t buffer[1024];
+	uint32_t size;
 	int res;
 
       next:
@@ -461,9 +587,15 @@ static int port_enum_params(struct spa_node *node,
 		if (*index > 0)
 			return 0;
 
+		/* the device port has all channels interleaved, samples are
+		 * at most the size of a float */
+		size = n->buffer_size * sizeof(float);
+		if (!SPA_FLAG_CHECK(p->flags, PORT_FLAG_DSP))
+			size *= n->channels;
+
 		param = spa_pod_builder_object(&b,
 			id, t->param_buffers.Buffers,
-			":", t->param_buffers.size,    "i", n->buffer_size * sizeof(float),
+			":", t->param_buffers.size,    "i", size,
 			":", t->param_buffers.stride,  "i", 0,
 			":", t->param_buffers.buffers, "ir", 2,
 				SPA_POD_PROP_MIN_MAX(1, MAX_BUFFERS),
@@ -503,6 +635,46 @@ static int port_set_format(struct spa_node *node, struct port *p,
 	if (spa_format_audio_raw_parse(format, &info.info.raw, &t->format_audio) < 0)
 		return -EINVAL;
 
+	if (!SPA_FLAG_CHECK(p->flags, PORT_FLAG_DSP)) {
+		struct convert conv = { 0 };
+		uint32_t fmt;
+
+		if (info.info.raw.format == t->audio_format.S16) {
+			fmt = CONV_S16;
+			n->stride = sizeof(int16_t);
+		} else if (info.info.raw.format == t->audio_format.S24) {
+			fmt = CONV_S24;
+			n->stride = 3;
+		} else if (info.info.raw.format == t->audio_format.S32) {
+			fmt = CONV_S32;
+			n->stride = sizeof(int32_t);
+		} else if (info.info.raw.format == t->audio_format.F32) {
+			fmt = CONV_F32;
+			n->stride = sizeof(float);
+		} else
+			return -EINVAL;
+
+		if (info.info.raw.channels != n->channels)
+			return -EINVAL;
+
+		if (p->port->direction == PW_DIRECTION_OUTPUT) {
+			conv.src_fmt = CONV_F32P;
+			conv.dst_fmt = fmt;
+		} else {
+			conv.src_fmt = fmt;
+			conv.dst_fmt = CONV_F32P;
+		}
+		conv.n_channels = n->channels;
+		conv.dither = n->impl->dither;
+		conv.cpu_flags = n->impl->cpu_flags;
+
+		if (convert_init(&conv) < 0)
+			return -EINVAL;
+
+		n->conv = conv;
+		n->stride *= n->channels;
+	}
+
 	pw_log_info(NAME " %p: set format on port %p", n, p);
 
 	return 0;
@@ -762,9 +934,10 @@ static struct pw_node *make_node(struct impl *impl, const struct pw_properties *
 	n->node = node;
 	n->impl = impl;
 	n->node_impl = node_impl;
-	n->channels = 2;
+	n->direction = direction;
+	n->channels = impl->channels;
 	n->sample_rate = 44100;
-	n->buffer_size = 1024 / sizeof(float);
+	n->buffer_size = impl->buffer_size;
 	pw_node_set_implementation(node, &n->node_impl);
 
 	p = make_port(n, direction, 0, 0, NULL);
@@ -897,6 +1070,21 @@ static const struct pw_core_events core_events = {
         .global_added = core_global_added,
 };
 
+static int parse_int(struct impl *impl, const char *key, const char *str,
+		int min, int max, int def)
+{
+	long val;
+	char *end;
+
+	errno = 0;
+	val = strtol(str, &end, 10);
+	if (errno != 0 || end == str || *end != '\0' || val < min || val > max) {
+		pw_log_warn("module %p: invalid %s '%s', using %d", impl, key, str, def);
+		return def;
+	}
+	return val;
+}
+
 static int module_init(struct pw_module *module, struct pw_properties *properties)
 {
 	struct pw_core *core = pw_module_get_core(module);
@@ -912,6 +1100,27 @@ static int module_init(struct pw_module *module, struct pw_properties *propertie
 	impl->t = pw_core_get_type(core);
 	impl->module = module;
 	impl->properties = properties;
+	impl->cpu_flags = convert_get_cpu_flags();
+	impl->dither = CONV_DITHER_NONE;
+	impl->channels = DEFAULT_CHANNELS;
+	impl->buffer_size = DEFAULT_BUFFER_SIZE;
+
+	if (properties) {
+		const char *str;
+
+		if ((str = pw_properties_get(properties, "dsp.dither")) != NULL) {
+			if (strcmp(str, "rectangular") == 0)
+				impl->dither = CONV_DITHER_RECTANGULAR;
+			else if (strcmp(str, "triangular") == 0)
+				impl->dither = CONV_DITHER_TRIANGULAR;
+		}
+		if ((str = pw_properties_get(properties, "dsp.channels")) != NULL)
+			impl->channels = parse_int(impl, "dsp.channels", str,
+					1, MAX_PORTS, DEFAULT_CHANNELS);
+		if ((str = pw_properties_get(properties, "dsp.buffer-size")) != NULL)
+			impl->buffer_size = parse_int(impl, "dsp.buffer-size", str,
+					1, MAX_SAMPLES, DEFAULT_BUFFER_SIZE);
+	}
 
 	init_type(&impl->type, core->type.map);
 
@@ -927,5 +1136,5 @@ static int module_init(struct pw_module *module, struct pw_properties *propertie
 
 int pipewire__module_init(struct pw_module *module, const char *args)
 {
-	return module_init(module, NULL);
+	return module_init(module, args ? pw_properties_new_string(args) : NULL);
 }
@@ -0,0 +1,195 @@
+/* PipeWire
+ * Copyright (C) 2018 Wim Taymans <wim.taymans@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include <string.h>
+#include <math.h>
+
+#include <emmintrin.h>
+
+#include "fmt-ops.h"
+
+#define S16_SCALE	32767.0f
+
+/* The planar channels are handled in pairs of 4 frames, the pair is
+ * interleaved in registers and then stored with one 32 or 64 bit store
+ * per frame. An odd last channel and the last frames are done in C. */
+
+static inline int16_t f32_to_s16(float v)
+{
+	return lrintf(SPA_CLAMP(v, -1.0f, 1.0f) * S16_SCALE);
+}
+
+static inline __m128i f32_to_s32_sse2(__m128 v)
+{
+	const __m128 scale = _mm_set1_ps(S16_SCALE);
+	const __m128 min = _mm_set1_ps(-1.0f);
+	const __m128 max = _mm_set1_ps(1.0f);
+
+	return _mm_cvtps_epi32(_mm_mul_ps(_mm_min_ps(_mm_max_ps(v, min), max), scale));
+}
+
+void
+conv_f32p_to_s16_sse2(struct convert *conv, void *dst[], const void *src[], uint32_t n_samples)
+{
+	const float **s = (const float **) src;
+	int16_t *d = dst[0];
+	uint32_t i, j, k, n_channels = conv->n_channels;
+	__m128i out;
+
+	for (i = 0; i + 1 < n_channels; i += 2) {
+		const float *s0 = s[i], *s1 = s[i + 1];
+
+		for (j = 0; j + 4 <= n_samples; j += 4) {
+			out = _mm_packs_epi32(f32_to_s32_sse2(_mm_loadu_ps(&s0[j])),
+					      f32_to_s32_sse2(_mm_loadu_ps(&s1[j])));
+			out = _mm_unpacklo_epi16(out, _mm_srli_si128(out, 8));
+
+			if (n_channels == 2) {
+				_mm_storeu_si128((__m128i*)&d[j * 2], out);
+			} else {
+				for (k = 0; k < 4; k++) {
+					int32_t v = _mm_cvtsi128_si32(out);
+					memcpy(&d[(j + k) * n_channels + i], &v, sizeof(v));
+					out = _mm_srli_si128(out, 4);
+				}
+			}
+		}
+		for (; j < n_samples; j++) {
+			d[j * n_channels + i] = f32_to_s16(s0[j]);
+			d[j * n_channels + i + 1] = f32_to_s16(s1[j]);
+		}
+	}
+	for (; i < n_channels; i++) {
+		for (j = 0; j < n_samples; j++)
+			d[j * n_channels + i] = f32_to_s16(s[i][j]);
+	}
+}
+
+void
+conv_s16_to_f32p_sse2(struct convert *conv, void *dst[], const void *src[], uint32_t n_samples)
+{
+	const int16_t *s = src[0];
+	float **d = (float **) dst;
+	uint32_t i, j, k, n_channels = conv->n_channels;
+	const __m128 scale = _mm_set1_ps(1.0f / S16_SCALE);
+	int32_t f[4];
+	__m128i in;
+
+	for (i = 0; i + 1 < n_channels; i += 2) {
+		float *d0 = d[i], *d1 = d[i + 1];
+
+		for (j = 0; j + 4 <= n_samples; j += 4) {
+			if (n_channels == 2) {
+				in = _mm_loadu_si128((const __m128i*)&s[j * 2]);
+			} else {
+				for (k = 0; k < 4; k++)
+					memcpy(&f[k], &s[(j + k) * n_channels + i], sizeof(f[k]));
+				in = _mm_loadu_si128((const __m128i*)f);
+			}
+			/* the first channel is in the low 16 bits of each frame */
+			_mm_storeu_ps(&d0[j], _mm_mul_ps(_mm_cvtepi32_ps(
+					_mm_srai_epi32(_mm_slli_epi32(in, 16), 16)), scale));
+			_mm_storeu_ps(&d1[j], _mm_mul_ps(_mm_cvtepi32_ps(
+					_mm_srai_epi32(in, 16)), scale));
+		}
+		for (; j < n_samples; j++) {
+			d0[j] = s[j * n_channels + i] * (1.0f / S16_SCALE);
+			d1[j] = s[j * n_channels + i + 1] * (1.0f / S16_SCALE);
+		}
+	}
+	for (; i < n_channels; i++) {
+		for (j = 0; j < n_samples; j++)
+			d[i][j] = s[j * n_channels + i] * (1.0f / S16_SCALE);
+	}
+}
+
+void
+conv_f32p_to_f32_sse2(struct convert *conv, void *dst[], const void *src[], uint32_t n_samples)
+{
+	const float **s = (const float **) src;
+	float *d = dst[0];
+	uint32_t i, j, n_channels = conv->n_channels;
+	__m128 in[2], lo, hi;
+
+	for (i = 0; i + 1 < n_channels; i += 2) {
+		const float *s0 = s[i], *s1 = s[i + 1];
+
+		for (j = 0; j + 4 <= n_samples; j += 4) {
+			in[0] = _mm_loadu_ps(&s0[j]);
+			in[1] = _mm_loadu_ps(&s1[j]);
+			lo = _mm_unpacklo_ps(in[0], in[1]);
+			hi = _mm_unpackhi_ps(in[0], in[1]);
+
+			if (n_channels == 2) {
+				_mm_storeu_ps(&d[j * 2], lo);
+				_mm_storeu_ps(&d[j * 2 + 4], hi);
+			} else {
+				_mm_storel_pi((__m64*)&d[j * n_channels + i], lo);
+				_mm_storeh_pi((__m64*)&d[(j + 1) * n_channels + i], lo);
+				_mm_storel_pi((__m64*)&d[(j + 2) * n_channels + i], hi);
+				_mm_storeh_pi((__m64*)&d[(j + 3) * n_channels + i], hi);
+			}
+		}
+		for (; j < n_samples; j++) {
+			d[j * n_channels + i] = s0[j];
+			d[j * n_channels + i + 1] = s1[j];
+		}
+	}
+	for (; i < n_channels; i++) {
+		for (j = 0; j < n_samples; j++)
+			d[j * n_channels + i] = s[i][j];
+	}
+}
+
+void
+conv_f32_to_f32p_sse2(struct convert *conv, void *dst[], const void *src[], uint32_t n_samples)
+{
+	const float *s = src[0];
+	float **d = (float **) dst;
+	uint32_t i, j, n_channels = conv->n_channels;
+	__m128 lo, hi;
+
+	for (i = 0; i + 1 < n_channels; i += 2) {
+		float *d0 = d[i], *d1 = d[i + 1];
+
+		for (j = 0; j + 4 <= n_samples; j += 4) {
+			if (n_channels == 2) {
+				lo = _mm_loadu_ps(&s[j * 2]);
+				hi = _mm_loadu_ps(&s[j * 2 + 4]);
+			} else {
+				lo = _mm_setzero_ps();
+				hi = _mm_setzero_ps();
+				lo = _mm_loadl_pi(lo, (const __m64*)&s[j * n_channels + i]);
+				lo = _mm_loadh_pi(lo, (const __m64*)&s[(j + 1) * n_channels + i]);
+				hi = _mm_loadl_pi(hi, (const __m64*)&s[(j + 2) * n_channels + i]);
+				hi = _mm_loadh_pi(hi, (const __m64*)&s[(j + 3) * n_channels + i]);
+			}
+			_mm_storeu_ps(&d0[j], _mm_shuffle_ps(lo, hi, _MM_SHUFFLE(2, 0, 2, 0)));
+			_mm_storeu_ps(&d1[j], _mm_shuffle_ps(lo, hi, _MM_SHUFFLE(3, 1, 3, 1)));
+		}
+		for (; j < n_samples; j++) {
+			d0[j] = s[j * n_channels + i];
+			d1[j] = s[j * n_channels + i + 1];
+		}
+	}
+	for (; i < n_channels; i++) {
+		for (j = 0; j < n_samples; j++)
+			d[i][j] = s[j * n_channels + i];
+	}
+}
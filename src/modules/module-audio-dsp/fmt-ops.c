@@ -0,0 +1,256 @@
+/* PipeWire
+ * Copyright (C) 2018 Wim Taymans <wim.taymans@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <math.h>
+
+#include "fmt-ops.h"
+
+#define S16_SCALE	32767.0f
+#define S24_SCALE	8388607.0f
+
+/* clamp without branches, the compiler makes min/max instructions of this */
+static inline float clamp_f32(float v)
+{
+	return SPA_CLAMP(v, -1.0f, 1.0f);
+}
+
+static inline int32_t f32_to_s24(float v)
+{
+	return lrintf(clamp_f32(v) * S24_SCALE);
+}
+
+static inline void write_s24(uint8_t *d, int32_t v)
+{
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	d[0] = v >> 16;
+	d[1] = v >> 8;
+	d[2] = v;
+#else
+	d[0] = v;
+	d[1] = v >> 8;
+	d[2] = v >> 16;
+#endif
+}
+
+static inline int32_t read_s24(const uint8_t *s)
+{
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	return (int32_t) (((uint32_t) s[0] << 24) | (s[1] << 16) | (s[2] << 8)) >> 8;
+#else
+	return (int32_t) (((uint32_t) s[2] << 24) | (s[1] << 16) | (s[0] << 8)) >> 8;
+#endif
+}
+
+/* white noise between -0.5 and 0.5 */
+static inline float noise(struct convert *conv)
+{
+	conv->random = conv->random * 1103515245 + 12345;
+	return (int32_t) conv->random * (1.0f / 4294967296.0f);
+}
+
+void
+conv_f32p_to_s16_c(struct convert *conv, void *dst[], const void *src[], uint32_t n_samples)
+{
+	const float **s = (const float **) src;
+	int16_t *d = dst[0];
+	uint32_t i, j, n_channels = conv->n_channels;
+
+	for (j = 0; j < n_samples; j++) {
+		for (i = 0; i < n_channels; i++)
+			*d++ = lrintf(clamp_f32(s[i][j]) * S16_SCALE);
+	}
+}
+
+static void
+conv_f32p_to_s16_dither_c(struct convert *conv, void *dst[], const void *src[], uint32_t n_samples)
+{
+	const float **s = (const float **) src;
+	int16_t *d = dst[0];
+	uint32_t i, j, n_channels = conv->n_channels;
+	bool triangular = conv->dither == CONV_DITHER_TRIANGULAR;
+	float v;
+
+	for (j = 0; j < n_samples; j++) {
+		for (i = 0; i < n_channels; i++) {
+			v = clamp_f32(s[i][j]) * S16_SCALE + noise(conv);
+			if (triangular)
+				v += noise(conv);
+			*d++ = SPA_CLAMP(lrintf(v), INT16_MIN, INT16_MAX);
+		}
+	}
+}
+
+void
+conv_s16_to_f32p_c(struct convert *conv, void *dst[], const void *src[], uint32_t n_samples)
+{
+	const int16_t *s = src[0];
+	float **d = (float **) dst;
+	uint32_t i, j, n_channels = conv->n_channels;
+
+	for (j = 0; j < n_samples; j++) {
+		for (i = 0; i < n_channels; i++)
+			d[i][j] = *s++ * (1.0f / S16_SCALE);
+	}
+}
+
+static void
+conv_f32p_to_s24_c(struct convert *conv, void *dst[], const void *src[], uint32_t n_samples)
+{
+	const float **s = (const float **) src;
+	uint8_t *d = dst[0];
+	uint32_t i, j, n_channels = conv->n_channels;
+
+	for (j = 0; j < n_samples; j++) {
+		for (i = 0; i < n_channels; i++) {
+			write_s24(d, f32_to_s24(s[i][j]));
+			d += 3;
+		}
+	}
+}
+
+static void
+conv_s24_to_f32p_c(struct convert *conv, void *dst[], const void *src[], uint32_t n_samples)
+{
+	const uint8_t *s = src[0];
+	float **d = (float **) dst;
+	uint32_t i, j, n_channels = conv->n_channels;
+
+	for (j = 0; j < n_samples; j++) {
+		for (i = 0; i < n_channels; i++) {
+			d[i][j] = read_s24(s) * (1.0f / S24_SCALE);
+			s += 3;
+		}
+	}
+}
+
+/* S32 uses the 24 most significant bits, a float has no more precision */
+static void
+conv_f32p_to_s32_c(struct convert *conv, void *dst[], const void *src[], uint32_t n_samples)
+{
+	const float **s = (const float **) src;
+	int32_t *d = dst[0];
+	uint32_t i, j, n_channels = conv->n_channels;
+
+	for (j = 0; j < n_samples; j++) {
+		for (i = 0; i < n_channels; i++)
+			*d++ = (uint32_t) f32_to_s24(s[i][j]) << 8;
+	}
+}
+
+static void
+conv_s32_to_f32p_c(struct convert *conv, void *dst[], const void *src[], uint32_t n_samples)
+{
+	const int32_t *s = src[0];
+	float **d = (float **) dst;
+	uint32_t i, j, n_channels = conv->n_channels;
+
+	for (j = 0; j < n_samples; j++) {
+		for (i = 0; i < n_channels; i++)
+			d[i][j] = (*s++ >> 8) * (1.0f / S24_SCALE);
+	}
+}
+
+void
+conv_f32p_to_f32_c(struct convert *conv, void *dst[], const void *src[], uint32_t n_samples)
+{
+	const float **s = (const float **) src;
+	float *d = dst[0];
+	uint32_t i, j, n_channels = conv->n_channels;
+
+	for (j = 0; j < n_samples; j++) {
+		for (i = 0; i < n_channels; i++)
+			*d++ = s[i][j];
+	}
+}
+
+void
+conv_f32_to_f32p_c(struct convert *conv, void *dst[], const void *src[], uint32_t n_samples)
+{
+	const float *s = src[0];
+	float **d = (float **) dst;
+	uint32_t i, j, n_channels = conv->n_channels;
+
+	for (j = 0; j < n_samples; j++) {
+		for (i = 0; i < n_channels; i++)
+			d[i][j] = *s++;
+	}
+}
+
+uint32_t convert_get_cpu_flags(void)
+{
+	uint32_t flags = 0;
+
+#if defined (__i386__) || defined (__x86_64__)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("sse2"))
+		flags |= CONV_CPU_FLAG_SSE2;
+#endif
+	return flags;
+}
+
+static const struct conv_info {
+	uint32_t src_fmt;
+	uint32_t dst_fmt;
+#define CONV_FLAG_DITHER	(1 << 0)	/* can dither */
+	uint32_t flags;
+	uint32_t cpu_flags;
+	convert_func_t process;
+} conv_table[] = {
+	/* the optimized versions first */
+#if defined (HAVE_SSE2)
+	{ CONV_F32P, CONV_S16, 0, CONV_CPU_FLAG_SSE2, conv_f32p_to_s16_sse2 },
+	{ CONV_S16, CONV_F32P, 0, CONV_CPU_FLAG_SSE2, conv_s16_to_f32p_sse2 },
+	{ CONV_F32P, CONV_F32, 0, CONV_CPU_FLAG_SSE2, conv_f32p_to_f32_sse2 },
+	{ CONV_F32, CONV_F32P, 0, CONV_CPU_FLAG_SSE2, conv_f32_to_f32p_sse2 },
+#endif
+	{ CONV_F32P, CONV_S16, CONV_FLAG_DITHER, 0, conv_f32p_to_s16_dither_c },
+	{ CONV_F32P, CONV_S16, 0, 0, conv_f32p_to_s16_c },
+	{ CONV_S16, CONV_F32P, 0, 0, conv_s16_to_f32p_c },
+	{ CONV_F32P, CONV_S24, 0, 0, conv_f32p_to_s24_c },
+	{ CONV_S24, CONV_F32P, 0, 0, conv_s24_to_f32p_c },
+	{ CONV_F32P, CONV_S32, 0, 0, conv_f32p_to_s32_c },
+	{ CONV_S32, CONV_F32P, 0, 0, conv_s32_to_f32p_c },
+	{ CONV_F32P, CONV_F32, 0, 0, conv_f32p_to_f32_c },
+	{ CONV_F32, CONV_F32P, 0, 0, conv_f32_to_f32p_c },
+};
+
+int convert_init(struct convert *conv)
+{
+	uint32_t i;
+	bool dither = conv->dither != CONV_DITHER_NONE && conv->dst_fmt == CONV_S16;
+
+	for (i = 0; i < SPA_N_ELEMENTS(conv_table); i++) {
+		const struct conv_info *info = &conv_table[i];
+
+		if (info->src_fmt != conv->src_fmt ||
+		    info->dst_fmt != conv->dst_fmt)
+			continue;
+		if ((info->cpu_flags & conv->cpu_flags) != info->cpu_flags)
+			continue;
+		if (dither != SPA_FLAG_CHECK(info->flags, CONV_FLAG_DITHER))
+			continue;
+
+		conv->process = info->process;
+		conv->random = 0x12345678;
+		return 0;
+	}
+	return -ENOTSUP;
+}
@@ -0,0 +1,88 @@
+/* PipeWire
+ * Copyright (C) 2018 Wim Taymans <wim.taymans@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef __PIPEWIRE_FMT_OPS_H__
+#define __PIPEWIRE_FMT_OPS_H__
+
+#include <spa/utils/defs.h>
+
+/* sample formats. F32P is planar float with one buffer per channel, the
+ * others are interleaved with all channels in one buffer */
+enum conv_format {
+	CONV_F32P,
+	CONV_S16,
+	CONV_S24,
+	CONV_S32,
+	CONV_F32,
+};
+
+enum conv_dither {
+	CONV_DITHER_NONE,
+	CONV_DITHER_RECTANGULAR,	/* 1 LSB of white noise */
+	CONV_DITHER_TRIANGULAR,		/* 2 LSB of triangular noise */
+};
+
+#define CONV_CPU_FLAG_SSE2	(1 << 0)
+
+struct convert;
+
+/* convert n_samples frames. For planar formats dst or src has one
+ * pointer for each channel, for interleaved formats only one */
+typedef void (*convert_func_t) (struct convert *conv, void *dst[], const void *src[],
+				uint32_t n_samples);
+
+struct convert {
+	uint32_t src_fmt;
+	uint32_t dst_fmt;
+	uint32_t n_channels;
+	uint32_t dither;
+	uint32_t cpu_flags;
+
+	convert_func_t process;
+	uint32_t random;
+};
+
+/* the cpu features that the optimized functions can use on this machine */
+uint32_t convert_get_cpu_flags(void);
+
+/* select the conversion function for the fields filled in conv. Only
+ * conversions from and to CONV_F32P are supported.
+ * Returns 0 or -ENOTSUP when there is no function. */
+int convert_init(struct convert *conv);
+
+static inline void convert_process(struct convert *conv, void *dst[], const void *src[],
+				   uint32_t n_samples)
+{
+	conv->process(conv, dst, src, n_samples);
+}
+
+/* plain C versions, used as fallback by the optimized versions */
+void conv_f32p_to_s16_c(struct convert *conv, void *dst[], const void *src[], uint32_t n_samples);
+void conv_s16_to_f32p_c(struct convert *conv, void *dst[], const void *src[], uint32_t n_samples);
+void conv_f32p_to_f32_c(struct convert *conv, void *dst[], const void *src[], uint32_t n_samples);
+void conv_f32_to_f32p_c(struct convert *conv, void *dst[], const void *src[], uint32_t n_samples);
+
+#if defined (HAVE_SSE2)
+void conv_f32p_to_s16_sse2(struct convert *conv, void *dst[], const void *src[], uint32_t n_samples);
+void conv_s16_to_f32p_sse2(struct convert *conv, void *dst[], const void *src[], uint32_t n_samples);
+void conv_f32p_to_f32_sse2(struct convert *conv, void *dst[], const void *src[], uint32_t n_samples);
+void conv_f32_to_f32p_sse2(struct convert *conv, void *dst[], const void *src[], uint32_t n_samples);
+#endif
+
+#endif /* __PIPEWIRE_FMT_OPS_H__ */
@@ -0,0 +1,312 @@
+/* PipeWire
+ * Copyright (C) 2018 Wim Taymans <wim.taymans@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+
+#include "fmt-ops.h"
+
+#define N_SAMPLES	1027
+#define MAX_CHANNELS	8
+
+static int n_failed;
+
+static const uint32_t test_channels[] = { 1, 2, 3, 6, 8 };
+
+static const struct test_conv {
+	const char *name;
+	uint32_t src_fmt;
+	uint32_t dst_fmt;
+	uint32_t size;		/* size of an interleaved sample */
+} convs[] = {
+	{ "f32p_to_s16", CONV_F32P, CONV_S16, sizeof(int16_t) },
+	{ "s16_to_f32p", CONV_S16, CONV_F32P, sizeof(int16_t) },
+	{ "f32p_to_s24", CONV_F32P, CONV_S24, 3 },
+	{ "s24_to_f32p", CONV_S24, CONV_F32P, 3 },
+	{ "f32p_to_s32", CONV_F32P, CONV_S32, sizeof(int32_t) },
+	{ "s32_to_f32p", CONV_S32, CONV_F32P, sizeof(int32_t) },
+	{ "f32p_to_f32", CONV_F32P, CONV_F32, sizeof(float) },
+	{ "f32_to_f32p", CONV_F32, CONV_F32P, sizeof(float) },
+};
+
+static float planar[2][MAX_CHANNELS][N_SAMPLES];
+static uint8_t interleaved[2][MAX_CHANNELS * N_SAMPLES * sizeof(int32_t)];
+
+static void fill_random(void)
+{
+	uint32_t i, j;
+
+	/* include values out of range to check the clamping */
+	for (i = 0; i < MAX_CHANNELS; i++)
+		for (j = 0; j < N_SAMPLES; j++)
+			planar[0][i][j] = (rand() / (float)RAND_MAX) * 2.4f - 1.2f;
+	for (i = 0; i < sizeof(interleaved[0]); i++)
+		interleaved[0][i] = rand();
+}
+
+static void setup(struct convert *conv, const struct test_conv *t, uint32_t n_channels,
+		  uint32_t cpu_flags, uint32_t dither)
+{
+	conv->src_fmt = t->src_fmt;
+	conv->dst_fmt = t->dst_fmt;
+	conv->n_channels = n_channels;
+	conv->dither = dither;
+	conv->cpu_flags = cpu_flags;
+	if (convert_init(conv) < 0) {
+		fprintf(stderr, "%s: no conversion\n", t->name);
+		n_failed++;
+	}
+}
+
+/* run conv on n_samples starting at frame offset, into set out */
+static void run(struct convert *conv, const struct test_conv *t, int out,
+		uint32_t offset, uint32_t n_samples)
+{
+	void *planes[MAX_CHANNELS], *d[1], *s[1];
+	uint32_t i, n_channels = conv->n_channels, stride = n_channels * t->size;
+
+	if (t->src_fmt == CONV_F32P) {
+		for (i = 0; i < n_channels; i++)
+			planes[i] = &planar[0][i][offset];
+		d[0] = &interleaved[out][offset * stride];
+		convert_process(conv, d, (const void **) planes, n_samples);
+	} else {
+		for (i = 0; i < n_channels; i++)
+			planes[i] = &planar[out][i][offset];
+		s[0] = &interleaved[0][offset * stride];
+		convert_process(conv, planes, (const void **) s, n_samples);
+	}
+}
+
+static bool compare(const struct test_conv *t, uint32_t n_channels)
+{
+	if (t->src_fmt == CONV_F32P)
+		return memcmp(interleaved[0], interleaved[1],
+				N_SAMPLES * n_channels * t->size) == 0;
+	else
+		return memcmp(planar[0], planar[1], sizeof(planar[0])) == 0;
+}
+
+static void clear_output(const struct test_conv *t)
+{
+	if (t->src_fmt == CONV_F32P) {
+		memset(interleaved[0], 0, sizeof(interleaved[0]));
+		memset(interleaved[1], 0, sizeof(interleaved[1]));
+	} else {
+		memset(planar, 0, sizeof(planar));
+	}
+}
+
+/* the optimized version must give the same result as the C version for
+ * all channel counts, with unaligned offsets and sizes */
+static void test_arch(const char *arch, uint32_t cpu_flags)
+{
+	struct convert conv, ref;
+	uint32_t i, j, offset, n_channels;
+
+	for (i = 0; i < SPA_N_ELEMENTS(convs); i++) {
+		const struct test_conv *t = &convs[i];
+
+		for (j = 0; j < SPA_N_ELEMENTS(test_channels); j++) {
+			n_channels = test_channels[j];
+
+			setup(&ref, t, n_channels, 0, CONV_DITHER_NONE);
+			setup(&conv, t, n_channels, cpu_flags, CONV_DITHER_NONE);
+
+			for (offset = 0; offset < 4; offset++) {
+				fill_random();
+				clear_output(t);
+				run(&ref, t, 0, offset, N_SAMPLES - offset - (offset & 1));
+				run(&conv, t, 1, offset, N_SAMPLES - offset - (offset & 1));
+				if (!compare(t, n_channels)) {
+					fprintf(stderr, "%s %s failed: channels %d offset %d\n",
+							arch, t->name, n_channels, offset);
+					n_failed++;
+				}
+			}
+		}
+	}
+}
+
+/* converting to an integer format and back gives the clamped input
+ * within half an LSB, float is not clamped */
+static void test_roundtrip(void)
+{
+	static const struct {
+		const char *name;
+		uint32_t fmt;
+		float lsb;
+	} fmts[] = {
+		{ "s16", CONV_S16, 1.0f / 32767.0f },
+		{ "s24", CONV_S24, 1.0f / 8388607.0f },
+		{ "s32", CONV_S32, 1.0f / 8388607.0f },
+		{ "f32", CONV_F32, 0.0f },
+	};
+	struct convert to, from;
+	void *planes[MAX_CHANNELS], *d[1];
+	uint32_t i, j, k, n_channels = 3;
+	float v;
+
+	for (i = 0; i < SPA_N_ELEMENTS(fmts); i++) {
+		to = (struct convert) { .src_fmt = CONV_F32P, .dst_fmt = fmts[i].fmt,
+			.n_channels = n_channels, };
+		from = (struct convert) { .src_fmt = fmts[i].fmt, .dst_fmt = CONV_F32P,
+			.n_channels = n_channels, };
+		if (convert_init(&to) < 0 || convert_init(&from) < 0) {
+			fprintf(stderr, "roundtrip %s: no conversion\n", fmts[i].name);
+			n_failed++;
+			continue;
+		}
+		fill_random();
+
+		for (j = 0; j < n_channels; j++)
+			planes[j] = planar[0][j];
+		d[0] = interleaved[0];
+		convert_process(&to, d, (const void **) planes, N_SAMPLES);
+		for (j = 0; j < n_channels; j++)
+			planes[j] = planar[1][j];
+		convert_process(&from, planes, (const void **) d, N_SAMPLES);
+
+		for (j = 0; j < n_channels; j++) {
+			for (k = 0; k < N_SAMPLES; k++) {
+				v = planar[0][j][k];
+				if (fmts[i].fmt != CONV_F32)
+					v = SPA_CLAMP(v, -1.0f, 1.0f);
+				if (fabsf(planar[1][j][k] - v) > fmts[i].lsb * 0.5f + 1e-7f) {
+					fprintf(stderr, "roundtrip %s failed: %f != %f\n",
+							fmts[i].name, planar[1][j][k], v);
+					n_failed++;
+					break;
+				}
+			}
+		}
+	}
+}
+
+/* dither adds at most 1 LSB of noise for rectangular and 2 LSB for
+ * triangular dither */
+static void test_dither(void)
+{
+	static const uint32_t dithers[] = { CONV_DITHER_RECTANGULAR, CONV_DITHER_TRIANGULAR };
+	struct convert conv, ref;
+	int16_t *a = (int16_t *) interleaved[0], *b = (int16_t *) interleaved[1];
+	uint32_t i, j, n_channels = 2;
+	bool differs = false;
+
+	for (i = 0; i < SPA_N_ELEMENTS(dithers); i++) {
+		setup(&ref, &convs[0], n_channels, 0, CONV_DITHER_NONE);
+		setup(&conv, &convs[0], n_channels, 0, dithers[i]);
+
+		fill_random();
+		run(&ref, &convs[0], 0, 0, N_SAMPLES);
+		run(&conv, &convs[0], 1, 0, N_SAMPLES);
+
+		for (j = 0; j < N_SAMPLES * n_channels; j++) {
+			if (abs(a[j] - b[j]) > (int)(i + 1)) {
+				fprintf(stderr, "dither %d failed: %d %d\n", dithers[i], a[j], b[j]);
+				n_failed++;
+				break;
+			}
+			if (a[j] != b[j])
+				differs = true;
+		}
+	}
+	if (!differs) {
+		fprintf(stderr, "dither failed: no noise added\n");
+		n_failed++;
+	}
+}
+
+/* capture converts to a separate buffer for each port, check that only
+ * the planes of the channels are written and only up to n_samples */
+static void test_capture(uint32_t cpu_flags)
+{
+	static float planes[MAX_CHANNELS + 1][N_SAMPLES + 1];
+	struct convert conv;
+	void *d[MAX_CHANNELS + 1], *s[1];
+	uint32_t i, j, k, n_channels, n_samples = N_SAMPLES - 3;
+
+	for (i = 0; i < SPA_N_ELEMENTS(convs); i++) {
+		const struct test_conv *t = &convs[i];
+
+		if (t->dst_fmt != CONV_F32P)
+			continue;
+
+		for (j = 0; j < SPA_N_ELEMENTS(test_channels); j++) {
+			n_channels = test_channels[j];
+
+			setup(&conv, t, n_channels, cpu_flags, CONV_DITHER_NONE);
+			fill_random();
+			memset(planar[0], 0, sizeof(planar[0]));
+			run(&conv, t, 0, 0, n_samples);
+
+			/* fill with NaN to see what was written */
+			for (k = 0; k <= MAX_CHANNELS; k++) {
+				memset(planes[k], 0xff, sizeof(planes[k]));
+				d[k] = planes[k];
+			}
+			s[0] = interleaved[0];
+			convert_process(&conv, d, (const void **) s, n_samples);
+
+			for (k = 0; k <= MAX_CHANNELS; k++) {
+				bool written = k < n_channels;
+
+				if ((written && memcmp(planes[k], planar[0][k],
+						n_samples * sizeof(float)) != 0) ||
+				    (!written && !isnan(planes[k][0])) ||
+				    !isnan(planes[k][n_samples])) {
+					fprintf(stderr, "capture %s failed: channels %d plane %d\n",
+							t->name, n_channels, k);
+					n_failed++;
+					break;
+				}
+			}
+		}
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	uint32_t cpu_flags = convert_get_cpu_flags();
+	struct convert conv = { .src_fmt = CONV_S16, .dst_fmt = CONV_S24, .n_channels = 2, };
+
+	srand(4321);
+
+	if (convert_init(&conv) != -ENOTSUP) {
+		fprintf(stderr, "s16_to_s24 should not be supported\n");
+		n_failed++;
+	}
+
+	test_roundtrip();
+	test_dither();
+
+	if (cpu_flags & CONV_CPU_FLAG_SSE2)
+		test_arch("sse2", CONV_CPU_FLAG_SSE2);
+	test_arch("best", cpu_flags);
+	test_capture(cpu_flags);
+
+	if (n_failed > 0) {
+		fprintf(stderr, "%d tests failed\n", n_failed);
+		return 1;
+	}
+	return 0;
+}
@@ -92,6 +92,11 @@ struct port {
 
 	uint32_t n_buffers;
 	struct buffer buffers[MAX_BUFFERS];
+
+	struct spa_hook port_listener;
+	bool direct;			/* input io is set by the client of the peer */
+	struct impl *peer;		/* output peer that is activated directly */
+	uint32_t peer_port_id;
 };
 
 struct node {
@@ -128,6 +133,7 @@ struct impl {
 	struct pw_client_node this;
 
 	bool client_reuse;
+	bool client_direct;
 
 	struct pw_core *core;
 	struct pw_type *t;
@@ -146,6 +152,7 @@ struct impl {
 
 	uint32_t input_ready;
 	bool out_pending;
+	bool out_direct;
 };
 
 /** \endcond */
@@ -267,6 +274,10 @@ static int impl_node_set_param(struct spa_node *node, uint32_t id, uint32_t flag
 static inline void do_flush(struct node *this)
 {
 	uint64_t cmd = 1;
+
+	if (!pw_client_node_transport_need_wakeup(this->impl->transport))
+		return;
+
 	if (write(this->writefd, &cmd, 8) != 8)
 		spa_log_warn(this->log, "node %p: error flushing : %s", this, strerror(errno));
 
@@ -623,6 +634,8 @@ impl_node_port_set_io(struct spa_node *node,
 			return -EINVAL;
 
 		mem_offset += mem->offset;
+		/* the client can keep the fd, never recycle the block */
+		mem->flags &= ~PW_MEMBLOCK_FLAG_POOL;
 		m = ensure_mem(impl, mem->fd, t->data.MemFd, mem->flags);
 		memid = m->id;
 	}
@@ -715,6 +728,9 @@ impl_node_port_use_buffers(struct spa_node *node,
 				data_size += d->maxsize;
 		}
 
+		/* the buffers can be reused from a link of server nodes, the
+		 * client can keep the fd so the block can't go back to the pool */
+		mem->flags &= ~PW_MEMBLOCK_FLAG_POOL;
 		m = ensure_mem(impl, mem->fd, t->data.MemFd, mem->flags);
 		b->memid = m->id;
 
@@ -789,6 +805,7 @@ impl_node_port_reuse_buffer(struct spa_node *node, uint32_t port_id, uint32_t bu
 {
 	struct node *this;
 	struct impl *impl;
+	int res;
 
 	this = SPA_CONTAINER_OF(node, struct node, node);
 	impl = this->impl;
@@ -798,9 +815,11 @@ impl_node_port_reuse_buffer(struct spa_node *node, uint32_t port_id, uint32_t bu
 
 	spa_log_trace(this->log, "reuse buffer %d", buffer_id);
 
-	pw_client_node_transport_add_message(impl->transport, (struct pw_client_node_message *)
-			&PW_CLIENT_NODE_MESSAGE_PORT_REUSE_BUFFER_INIT(port_id, buffer_id));
-	do_flush(this);
+	if ((res = pw_client_node_transport_reuse_buffer(impl->transport,
+					SPA_DIRECTION_OUTPUT, port_id, buffer_id)) < 0)
+		return res;
+	if (res > 0)
+		do_flush(this);
 
 	return 0;
 }
@@ -854,6 +873,9 @@ static int impl_node_process_input(struct spa_node *node)
 		spa_list_for_each(p, &n->ports[SPA_DIRECTION_INPUT], link) {
 			struct spa_io_buffers *io = p->io;
 
+			if (this->in_ports[p->port_id].direct)
+				continue;
+
 			pw_log_trace("set io status to %d %d", io->status, io->buffer_id);
 			impl->transport->inputs[p->port_id] = *io;
 
@@ -886,7 +908,8 @@ static int impl_node_process_output(struct spa_node *node)
 	if (impl->out_pending)
 		goto done;
 
-	impl->out_pending = true;
+	/* the client activates a direct peer itself, no have_output follows */
+	impl->out_pending = !impl->out_direct;
 
 	spa_list_for_each(p, &n->ports[SPA_DIRECTION_OUTPUT], link) {
 		struct spa_io_buffers *io = p->io;
@@ -942,6 +965,27 @@ static int handle_node_message(struct node *this, struct pw_client_node_message
 		}
 		break;
 
+	case PW_CLIENT_NODE_MESSAGE_PORT_REUSE_BUFFERS:
+	{
+		struct pw_client_node_message_port_reuse_buffers *p =
+		    (struct pw_client_node_message_port_reuse_buffers *) message;
+		uint32_t port_id = p->body.port_id.value;
+		uint64_t mask;
+
+		if (!CHECK_IN_PORT(this, SPA_DIRECTION_INPUT, port_id) ||
+		    port_id >= impl->transport->area->max_input_ports)
+			break;
+
+		mask = pw_client_node_transport_take_reuse(impl->transport,
+				SPA_DIRECTION_INPUT, port_id);
+		while (impl->client_reuse && mask) {
+			this->callbacks->reuse_buffer(this->callbacks_data, port_id,
+						      __builtin_ctzll(mask));
+			mask &= mask - 1;
+		}
+		break;
+	}
+
 	default:
 		pw_log_warn("unhandled message %d", PW_CLIENT_NODE_MESSAGE_TYPE(message));
 		return -ENOTSUP;
@@ -955,7 +999,8 @@ static void setup_transport(struct impl *impl)
 
 	spa_node_get_n_ports(&impl->node.node, &n_inputs, &max_inputs, &n_outputs, &max_outputs);
 
-	impl->transport = pw_client_node_transport_new(max_inputs, max_outputs);
+	impl->transport = pw_client_node_transport_new(max_inputs, max_outputs,
+			impl->core->mem_flags);
 	impl->transport->area->n_input_ports = n_inputs;
 	impl->transport->area->n_output_ports = n_outputs;
 }
@@ -1081,11 +1126,13 @@ static void node_on_data_fd_events(struct spa_source *source)
 			spa_log_warn(this->log, "node %p: error reading message: %s",
 					this, strerror(errno));
 
-		while (pw_client_node_transport_next_message(impl->transport, &message) == 1) {
-			struct pw_client_node_message *msg = alloca(SPA_POD_SIZE(&message));
-			pw_client_node_transport_parse_message(impl->transport, msg);
-			handle_node_message(this, msg);
-		}
+		do {
+			while (pw_client_node_transport_next_message(impl->transport, &message) == 1) {
+				struct pw_client_node_message *msg = alloca(SPA_POD_SIZE(&message));
+				pw_client_node_transport_parse_message(impl->transport, msg);
+				handle_node_message(this, msg);
+			}
+		} while (pw_client_node_transport_sleep(impl->transport));
 	}
 }
 
@@ -1112,6 +1159,131 @@ static const struct spa_node impl_node = {
 	impl_node_process_output,
 };
 
+static struct impl *port_get_client_node(struct pw_port *port)
+{
+	if (port == NULL || port->node->node->process_input != impl_node_process_input)
+		return NULL;
+	return SPA_CONTAINER_OF(port->node->node, struct impl, node.node);
+}
+
+static bool port_has_one_link(struct pw_port *port)
+{
+	return !spa_list_is_empty(&port->links) && port->links.next->next == &port->links;
+}
+
+/* find the input port of another client node that the output port can
+ * activate directly. Only a link that is exclusive to both ports of nodes with
+ * one port in that direction is handled by the clients. */
+static struct pw_port *find_direct_peer(struct impl *impl, struct pw_port *output)
+{
+	struct pw_link *link;
+	struct pw_port *input;
+	struct impl *peer;
+
+	if (!impl->client_direct || impl->transport == NULL ||
+	    impl->node.resource == NULL || impl->node.n_outputs != 1 ||
+	    !port_has_one_link(output))
+		return NULL;
+
+	link = spa_list_first(&output->links, struct pw_link, output_link);
+	if ((input = link->input) == NULL || !port_has_one_link(input))
+		return NULL;
+
+	if ((peer = port_get_client_node(input)) == NULL ||
+	    !peer->client_direct || peer->transport == NULL ||
+	    peer->node.resource == NULL || peer->node.n_inputs != 1 ||
+	    peer->fds[1] == -1)
+		return NULL;
+
+	return input;
+}
+
+static void update_peer(struct pw_port *output)
+{
+	struct impl *impl = port_get_client_node(output), *peer;
+	struct node *this;
+	struct port *port;
+	struct pw_port *input;
+
+	if (impl == NULL)
+		return;
+
+	this = &impl->node;
+	if (!CHECK_OUT_PORT_ID(this, SPA_DIRECTION_OUTPUT, output->port_id))
+		return;
+
+	port = GET_OUT_PORT(this, output->port_id);
+	input = find_direct_peer(impl, output);
+	peer = port_get_client_node(input);
+
+	if (port->peer == peer && (peer == NULL || port->peer_port_id == input->port_id))
+		return;
+
+	if (port->peer) {
+		port->peer->node.in_ports[port->peer_port_id].direct = false;
+		if (port->peer->transport)
+			__atomic_store_n(&port->peer->transport->area->direct_input,
+					 SPA_ID_INVALID, __ATOMIC_RELEASE);
+	}
+
+	port->peer = peer;
+	impl->out_direct = peer != NULL;
+
+	if (peer) {
+		pw_log_debug("client-node %p: port %d activates %p port %d directly", impl,
+				output->port_id, peer, input->port_id);
+		port->peer_port_id = input->port_id;
+		peer->node.in_ports[port->peer_port_id].direct = true;
+		/* the peer client copies the io of the activation to this port */
+		__atomic_store_n(&peer->transport->area->direct_input,
+				 port->peer_port_id, __ATOMIC_RELEASE);
+		pw_client_node_resource_port_set_peer(this->resource,
+						      output->port_id,
+						      peer->fds[1],
+						      pw_memblock_find(peer->transport->activation));
+	}
+	else {
+		pw_log_debug("client-node %p: port %d has no direct peer", impl, output->port_id);
+		port->peer_port_id = SPA_ID_INVALID;
+		if (this->resource)
+			pw_client_node_resource_port_set_peer(this->resource,
+							      output->port_id,
+							      -1, NULL);
+	}
+}
+
+static void port_link_changed(void *data, struct pw_link *link)
+{
+	struct pw_port *port = data;
+	struct pw_link *l;
+
+	if (port->direction == PW_DIRECTION_OUTPUT) {
+		update_peer(port);
+	}
+	else {
+		/* the input port can not be exclusive for the other outputs anymore */
+		update_peer(link->output);
+		spa_list_for_each(l, &port->links, input_link)
+			update_peer(l->output);
+	}
+}
+
+static void port_destroy(void *data)
+{
+	struct pw_port *port = data;
+	struct node *this = &port_get_client_node(port)->node;
+	struct port *p = GET_PORT(this, (enum spa_direction) port->direction, port->port_id);
+
+	spa_hook_remove(&p->port_listener);
+}
+
+static const struct pw_port_events port_events = {
+	PW_VERSION_PORT_EVENTS,
+	.destroy = port_destroy,
+	.link_added = port_link_changed,
+	.link_removed = port_link_changed,
+};
+
 static int
 node_init(struct node *this,
 	  struct spa_dict *info,
@@ -1227,6 +1399,20 @@ static void node_initialized(void *data)
 					  impl->transport);
 }
 
+static void node_port_added(void *data, struct pw_port *port)
+{
+	struct impl *impl = data;
+	struct node *this = &impl->node;
+	enum spa_direction direction = port->direction;
+	struct port *p;
+
+	if (!impl->client_direct || !CHECK_PORT_ID(this, direction, port->port_id))
+		return;
+
+	p = GET_PORT(this, direction, port->port_id);
+	pw_port_add_listener(port, &p->port_listener, &port_events, port);
+}
+
 static void node_free(void *data)
 {
 	struct impl *impl = data;
@@ -1234,8 +1420,17 @@ static void node_free(void *data)
 	pw_log_debug("client-node %p: free", &impl->this);
 	node_clear(&impl->node);
 
-	if (impl->transport)
+	if (impl->transport) {
+		struct pw_client_node_area *a = impl->transport->area;
+
+		pw_log_debug("client-node %p: ringbuffers in %u/%u %u overflows, out %u/%u %u overflows",
+				&impl->this,
+				a->input_stats.max_filled, a->input_stats.size,
+				a->input_stats.n_overflows,
+				a->output_stats.max_filled, a->output_stats.size,
+				a->output_stats.n_overflows);
 		pw_client_node_transport_destroy(impl->transport);
+	}
 
 	spa_hook_remove(&impl->node_listener);
 
@@ -1252,6 +1447,7 @@ static const struct pw_node_events node_events = {
 	PW_VERSION_NODE_EVENTS,
 	.free = node_free,
 	.initialized = node_initialized,
+	.port_added = node_port_added,
 };
 
 static const struct pw_resource_events resource_events = {
@@ -1318,6 +1514,9 @@ struct pw_client_node *pw_client_node_new(struct pw_resource *resource,
 	str = pw_properties_get(properties, "pipewire.client.reuse");
 	impl->client_reuse = str && pw_properties_parse_bool(str);
 
+	str = pw_properties_get(properties, "pipewire.client.direct");
+	impl->client_direct = str && pw_properties_parse_bool(str);
+
 	pw_resource_add_listener(this->resource,
 				 &impl->resource_listener,
 				 &resource_events,
@@ -18,6 +18,7 @@
  */
 
 #include <errno.h>
+#include <unistd.h>
 
 #include <spa/pod/parser.h>
 
@@ -25,6 +26,7 @@
 #include "pipewire/interfaces.h"
 #include "pipewire/protocol.h"
 #include "pipewire/client.h"
+#include "pipewire/private.h"
 
 #include "extensions/protocol-native.h"
 #include "extensions/client-node.h"
@@ -188,7 +190,7 @@ static int client_node_demarshal_transport(void *object, void *data, size_t size
 {
 	struct pw_proxy *proxy = object;
 	struct spa_pod_parser prs;
-	uint32_t node_id, ridx, widx, memfd_idx;
+	uint32_t node_id, ridx, widx, memfd_idx, activation_idx;
 	int readfd, writefd;
 	struct pw_client_node_transport_info info;
 	struct pw_client_node_transport *transport;
@@ -201,17 +203,20 @@ static int client_node_demarshal_transport(void *object, void *data, size_t size
 			"i", &widx,
 			"i", &memfd_idx,
 			"i", &info.offset,
-			"i", &info.size, NULL) < 0)
+			"i", &info.size,
+			"i", &activation_idx, NULL) < 0)
 		return -EINVAL;
 
 	readfd = pw_protocol_native_get_proxy_fd(proxy, ridx);
 	writefd = pw_protocol_native_get_proxy_fd(proxy, widx);
 	info.memfd = pw_protocol_native_get_proxy_fd(proxy, memfd_idx);
+	info.activation_memfd = pw_protocol_native_get_proxy_fd(proxy, activation_idx);
 
-	if (readfd == -1 || writefd == -1 || info.memfd == -1)
+	if (readfd == -1 || writefd == -1 || info.memfd == -1 || info.activation_memfd == -1)
 		return -EINVAL;
 
-	transport = pw_client_node_transport_new_from_info(&info);
+	transport = pw_client_node_transport_new_from_info(&info,
+			proxy->remote->core->mem_flags);
 
 	pw_proxy_notify(proxy, struct pw_client_node_proxy_events, transport, 0, node_id,
 								   readfd, writefd, transport);
@@ -439,6 +444,54 @@ static int client_node_demarshal_port_set_io(void *object, void *data, size_t si
 	return 0;
 }
 
+static int client_node_demarshal_port_set_peer(void *object, void *data, size_t size)
+{
+	struct pw_proxy *proxy = object;
+	struct spa_pod_parser prs;
+	uint32_t port_id, widx, memfd_idx;
+	int writefd, memfd, res;
+	struct pw_memblock *activation = NULL;
+
+	spa_pod_parser_init(&prs, data, size, 0);
+	if (spa_pod_parser_get(&prs,
+			"["
+			"i", &port_id,
+			"i", &widx,
+			"i", &memfd_idx, NULL) < 0)
+		return -EINVAL;
+
+	writefd = pw_protocol_native_get_proxy_fd(proxy, widx);
+	memfd = pw_protocol_native_get_proxy_fd(proxy, memfd_idx);
+
+	if (memfd != -1) {
+		if (writefd == -1) {
+			res = -EINVAL;
+			goto error;
+		}
+		if ((res = pw_memblock_import(PW_MEMBLOCK_FLAG_MAP_READWRITE |
+					      PW_MEMBLOCK_FLAG_WITH_FD,
+					      memfd, 0,
+					      sizeof(struct pw_client_node_activation),
+					      &activation)) < 0)
+			goto error;
+	}
+	else if (writefd != -1) {
+		close(writefd);
+		writefd = -1;
+	}
+
+	pw_proxy_notify(proxy, struct pw_client_node_proxy_events, port_set_peer, 0, port_id,
+									    writefd, activation);
+	return 0;
+
+      error:
+	if (writefd != -1)
+		close(writefd);
+	if (memfd != -1)
+		close(memfd);
+	return res;
+}
+
 static void
 client_node_marshal_add_mem(void *object,
 			    uint32_t mem_id,
@@ -476,7 +529,9 @@ static void client_node_marshal_transport(void *object, uint32_t node_id, int re
 			       "i", pw_protocol_native_add_resource_fd(resource, writefd),
 			       "i", pw_protocol_native_add_resource_fd(resource, info.memfd),
 			       "i", info.offset,
-			       "i", info.size);
+			       "i", info.size,
+			       "i", pw_protocol_native_add_resource_fd(resource,
+					info.activation_memfd));
 
 	pw_protocol_native_end_resource(resource, b);
 }
@@ -681,6 +736,31 @@ client_node_marshal_port_set_io(void *object,
 	pw_protocol_native_end_resource(resource, b);
 }
 
+static void
+client_node_marshal_port_set_peer(void *object,
+				  uint32_t port_id,
+				  int writefd,
+				  struct pw_memblock *activation)
+{
+	struct pw_resource *resource = object;
+	struct spa_pod_builder *b;
+	uint32_t widx = SPA_ID_INVALID, memfd_idx = SPA_ID_INVALID;
+
+	if (activation != NULL) {
+		widx = pw_protocol_native_add_resource_fd(resource, writefd);
+		memfd_idx = pw_protocol_native_add_resource_fd(resource, activation->fd);
+	}
+
+	b = pw_protocol_native_begin_resource(resource, PW_CLIENT_NODE_PROXY_EVENT_PORT_SET_PEER);
+
+	spa_pod_builder_struct(b,
+			       "i", port_id,
+			       "i", widx,
+			       "i", memfd_idx);
+
+	pw_protocol_native_end_resource(resource, b);
+}
+
 
 static int client_node_demarshal_done(void *object, void *data, size_t size)
 {
@@ -867,6 +947,7 @@ static const struct pw_client_node_proxy_events pw_protocol_native_client_node_e
 	&client_node_marshal_port_use_buffers,
 	&client_node_marshal_port_command,
 	&client_node_marshal_port_set_io,
+	&client_node_marshal_port_set_peer,
 };
 
 static const struct pw_protocol_native_demarshal pw_protocol_native_client_node_event_demarshal[] = {
@@ -881,6 +962,7 @@ static const struct pw_protocol_native_demarshal pw_protocol_native_client_node_
 	{ &client_node_demarshal_port_use_buffers, PW_PROTOCOL_NATIVE_REMAP },
 	{ &client_node_demarshal_port_command, PW_PROTOCOL_NATIVE_REMAP },
 	{ &client_node_demarshal_port_set_io, PW_PROTOCOL_NATIVE_REMAP },
+	{ &client_node_demarshal_port_set_peer, 0 },
 };
 
 static const struct pw_protocol_marshal pw_protocol_native_client_node_marshal = {
@@ -30,39 +30,58 @@
 
 /** \cond */
 
-#define INPUT_BUFFER_SIZE       (1<<12)
-#define OUTPUT_BUFFER_SIZE      (1<<12)
+#define MIN_BUFFER_SIZE		(1<<12)
+#define MESSAGE_SIZE		sizeof(struct pw_client_node_message_port_reuse_buffer)
 
 struct transport {
 	struct pw_client_node_transport trans;
 
 	struct pw_memblock *mem;
 	size_t offset;
+	struct pw_memblock *activation;
+
+	uint32_t input_size;
+	uint32_t output_size;
 
 	struct pw_client_node_message current;
 	uint32_t current_index;
 };
 /** \endcond */
 
+/* The ringbuffers have room for a few messages of each port. The reuse
+ * messages of a port are coalesced, there is at most one of them in the
+ * ringbuffer, whatever the number of buffers. */
+static uint32_t ring_get_size(uint32_t max_input_ports, uint32_t max_output_ports)
+{
+	uint32_t size = MIN_BUFFER_SIZE;
+
+	while (size < 2 * (max_input_ports + max_output_ports + 8) * MESSAGE_SIZE)
+		size <<= 1;
+	return size;
+}
+
 static size_t area_get_size(struct pw_client_node_area *area)
 {
 	size_t size;
-	size = sizeof(struct pw_client_node_area);
+	size = SPA_ROUND_UP_N(sizeof(struct pw_client_node_area), 8);
 	size += area->max_input_ports * sizeof(struct spa_io_buffers);
 	size += area->max_output_ports * sizeof(struct spa_io_buffers);
+	size += area->max_input_ports * sizeof(uint64_t);
+	size += area->max_output_ports * sizeof(uint64_t);
 	size += sizeof(struct spa_ringbuffer);
-	size += INPUT_BUFFER_SIZE;
+	size += area->input_stats.size;
 	size += sizeof(struct spa_ringbuffer);
-	size += OUTPUT_BUFFER_SIZE;
+	size += area->output_stats.size;
 	return size;
 }
 
 static void transport_setup_area(void *p, struct pw_client_node_transport *trans)
 {
+	struct transport *impl = (struct transport *) trans;
 	struct pw_client_node_area *a;
 
 	trans->area = a = p;
-	p = SPA_MEMBER(p, sizeof(struct pw_client_node_area), struct spa_io_buffers);
+	p = SPA_MEMBER(p, SPA_ROUND_UP_N(sizeof(struct pw_client_node_area), 8), void);
 
 	trans->inputs = p;
 	p = SPA_MEMBER(p, a->max_input_ports * sizeof(struct spa_io_buffers), void);
@@ -70,17 +89,31 @@ static void transport_setup_area(void *p, struct pw_client_node_transport *trans
 	trans->outputs = p;
 	p = SPA_MEMBER(p, a->max_output_ports * sizeof(struct spa_io_buffers), void);
 
+	trans->input_reuse = p;
+	p = SPA_MEMBER(p, a->max_input_ports * sizeof(uint64_t), void);
+
+	trans->output_reuse = p;
+	p = SPA_MEMBER(p, a->max_output_ports * sizeof(uint64_t), void);
+
+	impl->input_size = a->input_stats.size;
+	impl->output_size = a->output_stats.size;
+
 	trans->input_buffer = p;
 	p = SPA_MEMBER(p, sizeof(struct spa_ringbuffer), void);
 
 	trans->input_data = p;
-	p = SPA_MEMBER(p, INPUT_BUFFER_SIZE, void);
+	p = SPA_MEMBER(p, impl->input_size, void);
 
 	trans->output_buffer = p;
 	p = SPA_MEMBER(p, sizeof(struct spa_ringbuffer), void);
 
 	trans->output_data = p;
-	p = SPA_MEMBER(p, OUTPUT_BUFFER_SIZE, void);
+	p = SPA_MEMBER(p, impl->output_size, void);
+
+	trans->input_wakeup = &a->input_wakeup;
+	trans->output_wakeup = &trans->activation->wakeup;
+	trans->input_stats = &a->input_stats;
+	trans->output_stats = &a->output_stats;
 }
 
 static void transport_reset_area(struct pw_client_node_transport *trans)
@@ -91,13 +124,20 @@ static void transport_reset_area(struct pw_client_node_transport *trans)
 	for (i = 0; i < a->max_input_ports; i++) {
 		trans->inputs[i].status = SPA_STATUS_OK;
 		trans->inputs[i].buffer_id = SPA_ID_INVALID;
+		trans->input_reuse[i] = 0;
 	}
 	for (i = 0; i < a->max_output_ports; i++) {
 		trans->outputs[i].status = SPA_STATUS_OK;
 		trans->outputs[i].buffer_id = SPA_ID_INVALID;
+		trans->output_reuse[i] = 0;
 	}
 	spa_ringbuffer_init(trans->input_buffer);
 	spa_ringbuffer_init(trans->output_buffer);
+	a->input_wakeup = 0;
+	a->direct_input = SPA_ID_INVALID;
+	trans->activation->wakeup = 0;
+	trans->activation->activation = 0;
+	trans->activation->io = SPA_IO_BUFFERS_INIT;
 }
 
 static void destroy(struct pw_client_node_transport *trans)
@@ -106,6 +146,7 @@ static void destroy(struct pw_client_node_transport *trans)
 
 	pw_log_debug("transport %p: destroy", trans);
 
+	pw_memblock_free(impl->activation);
 	pw_memblock_free(impl->mem);
 	free(impl);
 }
@@ -113,23 +154,33 @@ static void destroy(struct pw_client_node_transport *trans)
 static int add_message(struct pw_client_node_transport *trans, struct pw_client_node_message *message)
 {
 	struct transport *impl = (struct transport *) trans;
+	struct pw_client_node_ring_stats *stats;
 	int32_t filled, avail;
 	uint32_t size, index;
 
 	if (impl == NULL || message == NULL)
 		return -EINVAL;
 
+	stats = trans->output_stats;
+
 	filled = spa_ringbuffer_get_write_index(trans->output_buffer, &index);
-	avail = OUTPUT_BUFFER_SIZE - filled;
+	avail = impl->output_size - filled;
 	size = SPA_POD_SIZE(message);
-	if (avail < size)
+	if (avail < size) {
+		if (stats->n_overflows++ == 0)
+			pw_log_warn("transport %p: ringbuffer of %u bytes is full", trans,
+					impl->output_size);
 		return -ENOSPC;
+	}
 
 	spa_ringbuffer_write_data(trans->output_buffer,
-				  trans->output_data, OUTPUT_BUFFER_SIZE,
-				  index & (OUTPUT_BUFFER_SIZE - 1), message, size);
+				  trans->output_data, impl->output_size,
+				  index & (impl->output_size - 1), message, size);
 	spa_ringbuffer_write_update(trans->output_buffer, index + size);
 
+	if (filled + size > stats->max_filled)
+		stats->max_filled = filled + size;
+
 	return 0;
 }
 
@@ -146,8 +197,8 @@ static int next_message(struct pw_client_node_transport *trans, struct pw_client
 		return 0;
 
 	spa_ringbuffer_read_data(trans->input_buffer,
-				 trans->input_data, INPUT_BUFFER_SIZE,
-				 impl->current_index & (INPUT_BUFFER_SIZE - 1),
+				 trans->input_data, impl->input_size,
+				 impl->current_index & (impl->input_size - 1),
 				 &impl->current, sizeof(struct pw_client_node_message));
 
 	if (avail < SPA_POD_SIZE(&impl->current))
@@ -169,8 +220,8 @@ static int parse_message(struct pw_client_node_transport *trans, void *message)
 	size = SPA_POD_SIZE(&impl->current);
 
 	spa_ringbuffer_read_data(trans->input_buffer,
-				 trans->input_data, INPUT_BUFFER_SIZE,
-				 impl->current_index & (INPUT_BUFFER_SIZE - 1), message, size);
+				 trans->input_data, impl->input_size,
+				 impl->current_index & (impl->input_size - 1), message, size);
 	spa_ringbuffer_read_update(trans->input_buffer, impl->current_index + size);
 
 	return 0;
@@ -183,7 +234,8 @@ static int parse_message(struct pw_client_node_transport *trans, void *message)
  * \memberof pw_client_node_transport
  */
 struct pw_client_node_transport *
-pw_client_node_transport_new(uint32_t max_input_ports, uint32_t max_output_ports)
+pw_client_node_transport_new(uint32_t max_input_ports, uint32_t max_output_ports,
+			     enum pw_memblock_flags flags)
 {
 	struct transport *impl;
 	struct pw_client_node_transport *trans;
@@ -193,23 +245,41 @@ pw_client_node_transport_new(uint32_t max_input_ports, uint32_t max_output_ports
 	area.n_input_ports = 0;
 	area.max_output_ports = max_output_ports;
 	area.n_output_ports = 0;
+	area.input_stats.size = ring_get_size(max_input_ports, max_output_ports);
+	area.output_stats.size = area.input_stats.size;
 
 	impl = calloc(1, sizeof(struct transport));
 	if (impl == NULL)
 		return NULL;
 
-	pw_log_debug("transport %p: new %d %d", impl, max_input_ports, max_output_ports);
+	pw_log_debug("transport %p: new %d %d, ringbuffers of %d bytes", impl,
+			max_input_ports, max_output_ports, area.input_stats.size);
 
 	trans = &impl->trans;
 	impl->offset = 0;
 
 	if (pw_memblock_alloc(PW_MEMBLOCK_FLAG_WITH_FD |
 			  PW_MEMBLOCK_FLAG_MAP_READWRITE |
-			  PW_MEMBLOCK_FLAG_SEAL,
+			  PW_MEMBLOCK_FLAG_SEAL |
+			  flags,
 			  area_get_size(&area),
 			  &impl->mem) < 0)
 		return NULL;
 
+	/* the activation is shared with the clients of peers, it has its own
+	 * memfd so that they can't map the rest of the area */
+	if (pw_memblock_alloc(PW_MEMBLOCK_FLAG_WITH_FD |
+			  PW_MEMBLOCK_FLAG_MAP_READWRITE |
+			  PW_MEMBLOCK_FLAG_SEAL |
+			  flags,
+			  sizeof(struct pw_client_node_activation),
+			  &impl->activation) < 0) {
+		pw_memblock_free(impl->mem);
+		free(impl);
+		return NULL;
+	}
+	trans->activation = impl->activation->ptr;
+
 	memcpy(impl->mem->ptr, &area, sizeof(struct pw_client_node_area));
 	transport_setup_area(impl->mem->ptr, trans);
 	transport_reset_area(trans);
@@ -223,11 +293,13 @@ pw_client_node_transport_new(uint32_t max_input_ports, uint32_t max_output_ports
 }
 
 struct pw_client_node_transport *
-pw_client_node_transport_new_from_info(struct pw_client_node_transport_info *info)
+pw_client_node_transport_new_from_info(struct pw_client_node_transport_info *info,
+				       enum pw_memblock_flags flags)
 {
 	struct transport *impl;
 	struct pw_client_node_transport *trans;
 	void *tmp;
+	uint32_t size;
 	int res;
 
 	impl = calloc(1, sizeof(struct transport));
@@ -238,7 +310,8 @@ pw_client_node_transport_new_from_info(struct pw_client_node_transport_info *inf
 	pw_log_debug("transport %p: new from info", impl);
 
 	if ((res = pw_memblock_import(PW_MEMBLOCK_FLAG_MAP_READWRITE |
-				      PW_MEMBLOCK_FLAG_WITH_FD,
+				      PW_MEMBLOCK_FLAG_WITH_FD |
+				      flags,
 				      info->memfd,
 				      info->offset,
 				      info->size, &impl->mem)) < 0) {
@@ -247,8 +320,27 @@ pw_client_node_transport_new_from_info(struct pw_client_node_transport_info *inf
 		goto mmap_failed;
 	}
 
+	if ((res = pw_memblock_import(PW_MEMBLOCK_FLAG_MAP_READWRITE |
+				      PW_MEMBLOCK_FLAG_WITH_FD |
+				      flags,
+				      info->activation_memfd, 0,
+				      sizeof(struct pw_client_node_activation),
+				      &impl->activation)) < 0) {
+		pw_log_warn("transport %p: failed to map activation fd %d: %s", impl,
+			    info->activation_memfd, spa_strerror(res));
+		goto activation_failed;
+	}
+	trans->activation = impl->activation->ptr;
+
 	impl->offset = info->offset;
 
+	if (info->size < sizeof(struct pw_client_node_area) ||
+	    area_get_size(impl->mem->ptr) > info->size) {
+		pw_log_warn("transport %p: invalid area size %u", impl, info->size);
+		res = -EINVAL;
+		goto invalid_area;
+	}
+
 	transport_setup_area(impl->mem->ptr, trans);
 
 	tmp = trans->output_buffer;
@@ -259,6 +351,18 @@ pw_client_node_transport_new_from_info(struct pw_client_node_transport_info *inf
 	trans->output_data = trans->input_data;
 	trans->input_data = tmp;
 
+	tmp = trans->output_wakeup;
+	trans->output_wakeup = trans->input_wakeup;
+	trans->input_wakeup = tmp;
+
+	tmp = trans->output_stats;
+	trans->output_stats = trans->input_stats;
+	trans->input_stats = tmp;
+
+	size = impl->output_size;
+	impl->output_size = impl->input_size;
+	impl->input_size = size;
+
 	trans->destroy = destroy;
 	trans->add_message = add_message;
 	trans->next_message = next_message;
@@ -266,6 +370,10 @@ pw_client_node_transport_new_from_info(struct pw_client_node_transport_info *inf
 
 	return trans;
 
+      invalid_area:
+	pw_memblock_free(impl->activation);
+      activation_failed:
+	pw_memblock_free(impl->mem);
       mmap_failed:
 	free(impl);
 	errno = -res;
@@ -290,6 +398,7 @@ int pw_client_node_transport_get_info(struct pw_client_node_transport *trans,
 	info->memfd = impl->mem->fd;
 	info->offset = impl->offset;
 	info->size = impl->mem->size;
+	info->activation_memfd = impl->activation->fd;
 
 	return 0;
 }
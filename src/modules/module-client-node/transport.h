@@ -35,13 +35,16 @@ struct pw_client_node_transport_info {
 	int memfd;		/**< the memfd of the transport area */
 	uint32_t offset;	/**< offset to map \a memfd at */
 	uint32_t size;		/**< size of memfd mapping */
+	int activation_memfd;	/**< the memfd of the activation */
 };
 
 struct pw_client_node_transport *
-pw_client_node_transport_new(uint32_t max_input_ports, uint32_t max_output_ports);
+pw_client_node_transport_new(uint32_t max_input_ports, uint32_t max_output_ports,
+			     enum pw_memblock_flags flags);
 
 struct pw_client_node_transport *
-pw_client_node_transport_new_from_info(struct pw_client_node_transport_info *info);
+pw_client_node_transport_new_from_info(struct pw_client_node_transport_info *info,
+				       enum pw_memblock_flags flags);
 
 int
 pw_client_node_transport_get_info(struct pw_client_node_transport *trans,
@@ -40,6 +40,7 @@
 #include "pipewire/log.h"
 #include "pipewire/module.h"
 #include "pipewire/utils.h"
+#include "pipewire/private.h"
 
 struct impl {
 	struct pw_core *core;
@@ -398,6 +399,21 @@ static const struct pw_module_events module_events = {
 	.destroy = module_destroy,
 };
 
+/* the data loop thread waits for the jobs of the workers, they need the same
+ * priority */
+static void make_workers_realtime(struct impl *impl, struct pw_rtkit_bus *system_bus, int rtprio)
+{
+	struct pw_data_loop *loop = impl->core->data_loop_impl;
+	uint32_t i;
+	int r;
+
+	for (i = 0; i < loop->workers.n_threads; i++) {
+		if ((r = pw_rtkit_make_realtime(system_bus, loop->workers.tids[i], rtprio)) < 0)
+			pw_log_warn("could not make worker %d realtime: %s", loop->workers.tids[i],
+					strerror(-r));
+	}
+}
+
 static void idle_func(struct spa_source *source)
 {
 	struct impl *impl = source->data;
@@ -439,6 +455,7 @@ static void idle_func(struct spa_source *source)
 		pw_log_debug("could not make thread realtime: %s", strerror(r));
 	} else {
 		pw_log_debug("thread made realtime");
+		make_workers_realtime(impl, system_bus, rtprio);
 	}
 	pw_rtkit_bus_free(system_bus);
 
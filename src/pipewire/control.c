@@ -17,6 +17,8 @@
  * Boston, MA 02110-1301, USA.
  */
 
+#include <string.h>
+
 #include <spa/pod/parser.h>
 
 #include <pipewire/control.h>
@@ -157,6 +159,8 @@ int pw_control_link(struct pw_control *control, struct pw_control *other)
 			spa_type_map_get_type(control->core->type.map, control->prop_id));
 
 	if (impl->mem == NULL) {
+		struct spa_pod_prop *prop;
+
 		if ((res = pw_memblock_alloc(PW_MEMBLOCK_FLAG_WITH_FD |
 					     PW_MEMBLOCK_FLAG_SEAL |
 					     PW_MEMBLOCK_FLAG_MAP_READWRITE,
@@ -164,6 +168,11 @@ int pw_control_link(struct pw_control *control, struct pw_control *other)
 					     &impl->mem)) < 0)
 			goto exit;
 
+		/* start with the default value of the control so that the input
+		 * does not see 0 before the output writes to it */
+		prop = spa_pod_find_prop(control->param, control->core->type.param.propType);
+		if (prop && SPA_POD_SIZE(&prop->body.value) <= control->size)
+			memcpy(impl->mem->ptr, &prop->body.value, SPA_POD_SIZE(&prop->body.value));
 	}
 
 	if (other->port) {
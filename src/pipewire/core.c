@@ -35,13 +35,99 @@
 
 #undef spa_debug
 #define spa_debug pw_log_trace
-#include <spa/graph/graph-scheduler6.h>
+#include <spa/graph/graph-scheduler.h>
 
 /** \cond */
+struct impl {
+	struct pw_core this;
+
+	struct spa_graph_data graph_data;
+	struct spa_graph_executor executor;
+	struct spa_source *plan_event;	/**< signaled when the plan is out of date */
+	bool plan_pending;		/**< plan_event was signaled, data thread only */
+};
+
 struct resource_data {
 	struct spa_hook resource_listener;
 };
 
+static void run_jobs(void *data, void (*func) (void *arg, uint32_t index), void *arg,
+		     uint32_t n_jobs)
+{
+	pw_data_loop_run_jobs(data, func, arg, n_jobs);
+}
+
+static int
+do_sync_graph(struct spa_loop *loop,
+	      bool async, uint32_t seq, const void *data, size_t size, void *user_data)
+{
+	return 0;
+}
+
+static int
+do_set_plan(struct spa_loop *loop,
+	    bool async, uint32_t seq, const void *data, size_t size, void *user_data)
+{
+	struct impl *impl = user_data;
+	struct spa_graph_plan *plan = *(struct spa_graph_plan **) data;
+
+	spa_graph_data_set_plan(&impl->graph_data, plan);
+	impl->plan_pending = false;
+	return 0;
+}
+
+/* The graph is only changed on the data loop from invokes that are done by
+ * the main thread, so it does not change while we make the plan after the
+ * queued changes are done. The plan is swapped in on the data loop and the
+ * old plan, which the data thread no longer uses, is freed here. */
+static void build_plan(void *data, uint64_t count)
+{
+	struct impl *impl = data;
+	struct pw_core *this = &impl->this;
+	struct spa_graph_plan *plan, *old = impl->graph_data.plan;
+
+	pw_loop_invoke(this->data_loop, do_sync_graph, 1, NULL, 0, true, impl);
+
+	if ((plan = spa_graph_plan_new(&this->rt.graph)) == NULL)
+		pw_log_error("core %p: can't make graph plan: %m", this);
+
+	pw_loop_invoke(this->data_loop, do_set_plan, 1, &plan, sizeof(plan), true, impl);
+	spa_graph_plan_free(old);
+}
+
+/* ask the main thread for a new plan when the graph changed, the graph is
+ * scheduled recursively until it is set */
+static void check_plan(struct impl *impl)
+{
+	struct spa_graph_plan *plan = impl->graph_data.plan;
+
+	if ((plan == NULL || plan->version != impl->this.rt.graph.version) &&
+	    !impl->plan_pending) {
+		impl->plan_pending = true;
+		pw_loop_signal_event(impl->this.main_loop, impl->plan_event);
+	}
+}
+
+static int plan_need_input(void *data, struct spa_graph_node *node)
+{
+	struct impl *impl = data;
+	check_plan(impl);
+	return spa_graph_impl_plan_need_input(&impl->graph_data, node);
+}
+
+static int plan_have_output(void *data, struct spa_graph_node *node)
+{
+	struct impl *impl = data;
+	check_plan(impl);
+	return spa_graph_impl_plan_have_output(&impl->graph_data, node);
+}
+
+static const struct spa_graph_callbacks plan_callbacks = {
+	SPA_VERSION_GRAPH_CALLBACKS,
+	.need_input = plan_need_input,
+	.have_output = plan_have_output,
+};
+
 /** \endcond */
 
 static void registry_bind(void *object, uint32_t id,
@@ -352,6 +438,19 @@ static const struct pw_global_events global_events = {
 	.bind = global_bind,
 };
 
+static void update_mem_flags(struct pw_core *core)
+{
+	const char *str;
+
+	core->mem_flags = 0;
+	if ((str = pw_properties_get(core->properties, PW_CORE_PROP_MEM_PREFAULT)) &&
+	    pw_properties_parse_bool(str))
+		core->mem_flags |= PW_MEMBLOCK_FLAG_PREFAULT;
+	if ((str = pw_properties_get(core->properties, PW_CORE_PROP_MEM_LOCK)) &&
+	    pw_properties_parse_bool(str))
+		core->mem_flags |= PW_MEMBLOCK_FLAG_LOCK;
+}
+
 /** Create a new core object
  *
  * \param main_loop the main loop to use
@@ -362,13 +461,16 @@ static const struct pw_global_events global_events = {
  */
 struct pw_core *pw_core_new(struct pw_loop *main_loop, struct pw_properties *properties)
 {
+	struct impl *impl;
 	struct pw_core *this;
 	const char *name;
 
-	this = calloc(1, sizeof(struct pw_core));
-	if (this == NULL)
+	impl = calloc(1, sizeof(struct impl));
+	if (impl == NULL)
 		return NULL;
 
+	this = &impl->this;
+
 	pw_log_debug("core %p: new", this);
 
 	if (properties == NULL)
@@ -389,7 +491,16 @@ struct pw_core *pw_core_new(struct pw_loop *main_loop, struct pw_properties *pro
 	pw_map_init(&this->globals, 128, 32);
 
 	spa_graph_init(&this->rt.graph);
-	spa_graph_set_callbacks(&this->rt.graph, &spa_graph_impl_default, NULL);
+	spa_graph_data_init(&impl->graph_data, &this->rt.graph);
+	/* schedule from a plan, with worker threads the independent nodes of a
+	 * level are processed in parallel, see spa/tests/benchmark-graph.c */
+	if (this->data_loop_impl->workers.n_threads > 0) {
+		impl->executor.run = run_jobs;
+		impl->executor.data = this->data_loop_impl;
+		spa_graph_data_set_executor(&impl->graph_data, &impl->executor, 2);
+	}
+	impl->plan_event = pw_loop_add_event(main_loop, build_plan, impl);
+	spa_graph_set_callbacks(&this->rt.graph, &plan_callbacks, impl);
 
 	this->dbus_iface = pw_get_spa_dbus(this->main_loop);
 
@@ -436,6 +547,7 @@ struct pw_core *pw_core_new(struct pw_loop *main_loop, struct pw_properties *pro
 	this->info.name = name;
 
 	this->sc_pagesize = sysconf(_SC_PAGESIZE);
+	update_mem_flags(this);
 
 	this->global = pw_global_new(this,
 				     this->type.core,
@@ -458,7 +570,7 @@ struct pw_core *pw_core_new(struct pw_loop *main_loop, struct pw_properties *pro
 
       no_mem:
       no_data_loop:
-	free(this);
+	free(impl);
 	return NULL;
 }
 
@@ -470,6 +582,7 @@ struct pw_core *pw_core_new(struct pw_loop *main_loop, struct pw_properties *pro
  */
 void pw_core_destroy(struct pw_core *core)
 {
+	struct impl *impl = SPA_CONTAINER_OF(core, struct impl, this);
 	struct pw_global *global, *t;
 	struct pw_module *module, *tm;
 	struct pw_remote *remote, *tr;
@@ -496,14 +609,19 @@ void pw_core_destroy(struct pw_core *core)
 
 	pw_data_loop_destroy(core->data_loop_impl);
 
+	if (impl->plan_event)
+		pw_loop_destroy_source(core->main_loop, impl->plan_event);
+
 	pw_release_spa_dbus(core->dbus_iface);
 
 	pw_properties_free(core->properties);
 
 	pw_map_clear(&core->globals);
 
+	spa_graph_data_clear(&impl->graph_data);
+
 	pw_log_debug("core %p: free", core);
-	free(core);
+	free(impl);
 }
 
 const struct pw_core_info *pw_core_get_info(struct pw_core *core)
@@ -567,6 +685,8 @@ int pw_core_update_properties(struct pw_core *core, const struct spa_dict *dict)
 	if (!changed)
 		return 0;
 
+	update_mem_flags(core);
+
 	core->info.change_mask = PW_CORE_CHANGE_MASK_PROPS;
 	core->info.props = &core->properties->dict;
 
@@ -110,6 +110,12 @@ struct pw_core_events {
 #define PW_CORE_PROP_VERSION	"pipewire.core.version"
 /** If the core should listen for connections, boolean default false */
 #define PW_CORE_PROP_DAEMON	"pipewire.daemon"
+/** If buffer and transport memory should be faulted in when mapped, boolean
+ * default false */
+#define PW_CORE_PROP_MEM_PREFAULT	"pipewire.mem.prefault"
+/** If buffer and transport memory should be locked in memory when mapped,
+ * boolean default false */
+#define PW_CORE_PROP_MEM_LOCK	"pipewire.mem.lock"
 
 /** Make a new core object for a given main_loop. Ownership of the properties is taken */
 struct pw_core * pw_core_new(struct pw_loop *main_loop, struct pw_properties *props);
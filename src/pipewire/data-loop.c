@@ -19,7 +19,11 @@
 
 #include <pthread.h>
 #include <errno.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sched.h>
 #include <sys/resource.h>
+#include <sys/syscall.h>
 
 #include "pipewire/log.h"
 #include "pipewire/data-loop.h"
@@ -43,6 +47,188 @@ static void *do_loop(void *user_data)
 	return NULL;
 }
 
+#define MAX_WORKERS	16
+
+static void wait_sem(sem_t *sem)
+{
+	while (sem_wait(sem) < 0 && errno == EINTR);
+}
+
+/* take the next job and run it, returns false when there are no more jobs.
+ * last is set in the thread that finished the last job */
+static bool run_job(struct pw_data_loop *this, bool *last)
+{
+	uint64_t state, next;
+	uint32_t index, n_jobs;
+
+	state = __atomic_load_n(&this->workers.state, __ATOMIC_ACQUIRE);
+	do {
+		index = state & 0xffffffff;
+		n_jobs = state >> 32;
+		if (index >= n_jobs)
+			return false;
+		next = state + 1;
+	} while (!__atomic_compare_exchange_n(&this->workers.state, &state, next, true,
+					      __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+
+	this->workers.func(this->workers.arg, index);
+	if (__atomic_add_fetch(&this->workers.n_done, 1, __ATOMIC_ACQ_REL) == n_jobs)
+		*last = true;
+	return true;
+}
+
+static void *do_worker(void *user_data)
+{
+	struct pw_data_loop *this = user_data;
+	pid_t tid = syscall(SYS_gettid), free_tid;
+	bool last;
+	uint32_t i;
+
+	/* take a free slot for the thread id, start_workers waits for it */
+	for (i = 0; i < this->workers.n_threads; i++) {
+		free_tid = 0;
+		if (__atomic_compare_exchange_n(&this->workers.tids[i], &free_tid, tid, false,
+						__ATOMIC_RELEASE, __ATOMIC_RELAXED))
+			break;
+	}
+	sem_post(&this->workers.done);
+
+	pw_log_debug("data-loop %p: enter worker", this);
+	while (true) {
+		wait_sem(&this->workers.sem);
+		if (!__atomic_load_n(&this->workers.running, __ATOMIC_ACQUIRE))
+			break;
+		last = false;
+		while (run_job(this, &last));
+		/* the data loop thread is waiting for this job */
+		if (last)
+			sem_post(&this->workers.done);
+	}
+	pw_log_debug("data-loop %p: leave worker", this);
+	return NULL;
+}
+
+/** Run jobs on the workers
+ * \param loop the data loop
+ * \param func the function to call for each job
+ * \param arg the first argument of func
+ * \param n_jobs the number of jobs, func is called with index 0 to n_jobs - 1
+ *
+ * The workers take the jobs one by one, the calling thread takes jobs as well
+ * and returns when all jobs are done. When a worker still runs a job, the
+ * calling thread sleeps until the worker finished it. Without workers, all
+ * jobs are run by the calling thread. This should only be called from the
+ * data loop thread.
+ *
+ * \memberof pw_data_loop
+ */
+void pw_data_loop_run_jobs(struct pw_data_loop *loop,
+			   void (*func) (void *arg, uint32_t index), void *arg,
+			   uint32_t n_jobs)
+{
+	uint32_t i, n_wake;
+	bool last = false;
+
+	if (n_jobs == 0)
+		return;
+
+	loop->workers.func = func;
+	loop->workers.arg = arg;
+	__atomic_store_n(&loop->workers.n_done, 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&loop->workers.state, (uint64_t) n_jobs << 32, __ATOMIC_RELEASE);
+
+	n_wake = loop->workers.threads ? SPA_MIN(n_jobs - 1, loop->workers.n_threads) : 0;
+	for (i = 0; i < n_wake; i++)
+		sem_post(&loop->workers.sem);
+
+	while (run_job(loop, &last));
+
+	/* a worker runs the last job, it posts when it is done */
+	if (!last)
+		wait_sem(&loop->workers.done);
+}
+
+/* the workers run jobs that the data loop thread waits for, they get the
+ * scheduling policy and priority of the data loop thread. Both are created
+ * from this thread, the data loop thread inherits them. module-rtkit makes
+ * the workers realtime together with the data loop thread. */
+static int create_worker(struct pw_data_loop *this, pthread_t *thread)
+{
+	pthread_attr_t attr;
+	struct sched_param param;
+	int err, policy;
+
+	if ((err = pthread_getschedparam(pthread_self(), &policy, &param)) != 0 ||
+	    policy == SCHED_OTHER)
+		return pthread_create(thread, NULL, do_worker, this);
+
+	pthread_attr_init(&attr);
+	pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+	pthread_attr_setschedpolicy(&attr, policy);
+	pthread_attr_setschedparam(&attr, &param);
+	err = pthread_create(thread, &attr, do_worker, this);
+	pthread_attr_destroy(&attr);
+
+	if (err == EPERM) {
+		pw_log_warn("data-loop %p: can't give worker policy %d priority %d",
+				this, policy, param.sched_priority);
+		err = pthread_create(thread, NULL, do_worker, this);
+	}
+	return err;
+}
+
+static int start_workers(struct pw_data_loop *this)
+{
+	uint32_t i, n;
+	int err;
+
+	if (this->workers.n_threads == 0)
+		return 0;
+
+	this->workers.threads = calloc(this->workers.n_threads, sizeof(pthread_t));
+	this->workers.tids = calloc(this->workers.n_threads, sizeof(pid_t));
+	if (this->workers.threads == NULL || this->workers.tids == NULL) {
+		free(this->workers.threads);
+		free(this->workers.tids);
+		this->workers.threads = NULL;
+		this->workers.tids = NULL;
+		return -ENOMEM;
+	}
+
+	this->workers.running = true;
+	for (i = 0; i < this->workers.n_threads; i++) {
+		if ((err = create_worker(this, &this->workers.threads[i])) != 0) {
+			pw_log_warn("data-loop %p: can't create worker: %s", this, strerror(err));
+			break;
+		}
+	}
+	/* wait until the workers stored their thread id */
+	for (n = i, i = 0; i < n; i++)
+		wait_sem(&this->workers.done);
+	this->workers.n_threads = n;
+
+	pw_log_debug("data-loop %p: started %d workers", this, this->workers.n_threads);
+	return 0;
+}
+
+static void stop_workers(struct pw_data_loop *this)
+{
+	uint32_t i;
+
+	if (this->workers.threads == NULL)
+		return;
+
+	__atomic_store_n(&this->workers.running, false, __ATOMIC_RELEASE);
+	for (i = 0; i < this->workers.n_threads; i++)
+		sem_post(&this->workers.sem);
+	for (i = 0; i < this->workers.n_threads; i++)
+		pthread_join(this->workers.threads[i], NULL);
+
+	free(this->workers.threads);
+	free(this->workers.tids);
+	this->workers.threads = NULL;
+	this->workers.tids = NULL;
+}
 
 static void do_stop(void *data, uint64_t count)
 {
@@ -51,6 +237,27 @@ static void do_stop(void *data, uint64_t count)
 	this->running = false;
 }
 
+/* more workers than cpus only add wakeups */
+static uint32_t parse_workers(struct pw_data_loop *this, const char *str)
+{
+	unsigned long n;
+	long n_cpus;
+	char *end;
+
+	errno = 0;
+	n = strtoul(str, &end, 10);
+	if (errno != 0 || end == str || *end != '\0' || str[0] == '-') {
+		pw_log_warn("data-loop %p: invalid number of workers '%s'", this, str);
+		return 0;
+	}
+	n_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	if (n_cpus > 1 && n > (unsigned long) n_cpus - 1)
+		n = n_cpus - 1;
+	if (n > MAX_WORKERS)
+		n = MAX_WORKERS;
+	return n;
+}
+
 /** Create a new \ref pw_data_loop.
  * \return a newly allocated data loop
  *
@@ -59,6 +266,7 @@ static void do_stop(void *data, uint64_t count)
 struct pw_data_loop *pw_data_loop_new(struct pw_properties *properties)
 {
 	struct pw_data_loop *this;
+	const char *str;
 
 	this = calloc(1, sizeof(struct pw_data_loop));
 	if (this == NULL)
@@ -74,6 +282,11 @@ struct pw_data_loop *pw_data_loop_new(struct pw_properties *properties)
 
 	this->event = pw_loop_add_event(this->loop, do_stop, this);
 
+	if (properties && (str = pw_properties_get(properties, "data-loop.workers")))
+		this->workers.n_threads = parse_workers(this, str);
+	sem_init(&this->workers.sem, 0, 0);
+	sem_init(&this->workers.done, 0, 0);
+
 	return this;
 
       no_loop:
@@ -93,6 +306,8 @@ void pw_data_loop_destroy(struct pw_data_loop *loop)
 
 	pw_data_loop_stop(loop);
 
+	sem_destroy(&loop->workers.sem);
+	sem_destroy(&loop->workers.done);
 	pw_loop_destroy_source(loop->loop, loop->event);
 	pw_loop_destroy(loop->loop);
 	free(loop);
@@ -116,7 +331,8 @@ pw_data_loop_get_loop(struct pw_data_loop *loop)
  * \param loop the data loop to start
  * \return 0 if ok, -1 on error
  *
- * This will start the realtime thread that manages the loop.
+ * This will start the realtime thread that manages the loop and the
+ * worker threads set with the "data-loop.workers" property.
  *
  * \memberof pw_data_loop
  */
@@ -125,10 +341,14 @@ int pw_data_loop_start(struct pw_data_loop *loop)
 	if (!loop->running) {
 		int err;
 
+		/* the workers are ready when the data loop thread runs */
+		start_workers(loop);
+
 		loop->running = true;
 		if ((err = pthread_create(&loop->thread, NULL, do_loop, loop)) != 0) {
 			pw_log_warn("data-loop %p: can't create thread: %s", loop, strerror(err));
 			loop->running = false;
+			stop_workers(loop);
 			return -err;
 		}
 	}
@@ -139,7 +359,8 @@ int pw_data_loop_start(struct pw_data_loop *loop)
  * \param loop the data loop to Stop
  * \return 0
  *
- * This will stop and join the realtime thread that manages the loop.
+ * This will stop and join the realtime thread that manages the loop and
+ * the worker threads.
  *
  * \memberof pw_data_loop
  */
@@ -149,6 +370,7 @@ int pw_data_loop_stop(struct pw_data_loop *loop)
 		pw_loop_signal_event(loop->loop, loop->event);
 
 		pthread_join(loop->thread, NULL);
+		stop_workers(loop);
 	}
 	return 0;
 }
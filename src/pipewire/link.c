@@ -314,6 +314,28 @@ static struct spa_pod *find_param(struct spa_pod **params, uint32_t n_params, ui
  * The shared memory block should not contain any types or structure,
  * just the actual metadata contents.
  */
+/* the default alignment of the data, a cache line */
+#define DATA_ALIGN	64
+
+/* the memfd of the buffers is only recycled through the memblock pool when
+ * both nodes are owned by the server. The fd of buffers of a client node is
+ * sent to the client, which can keep its mapping after the link is gone and
+ * must not see the buffers of the next link that gets the block. */
+static bool can_pool_buffers(struct pw_link *this)
+{
+	struct pw_node *out = this->output->node, *in = this->input->node;
+
+	return out->global != NULL && out->global->owner == NULL &&
+	       in->global != NULL && in->global->owner == NULL;
+}
+
+/* Allocate n_buffers buffers in one memfd. The metas and chunks of each
+ * buffer are kept together, as the clients expect, and are placed in a
+ * header area before the data. Each buffer header starts on its own cache
+ * line and each data plane is aligned to data_align so that the headers do
+ * not share cache lines with the data of another buffer. Extra memblock
+ * flags, like PW_MEMBLOCK_FLAG_HUGEPAGES or PW_MEMBLOCK_FLAG_POOL, are
+ * passed in flags. */
 static int alloc_buffers(struct pw_link *this,
 			 uint32_t n_buffers,
 			 uint32_t n_params,
@@ -321,17 +343,20 @@ static int alloc_buffers(struct pw_link *this,
 			 uint32_t n_datas,
 			 size_t *data_sizes,
 			 ssize_t *data_strides,
+			 size_t data_align,
+			 enum pw_memblock_flags flags,
 			 struct allocation *allocation)
 {
 	int res;
 	struct spa_buffer **buffers, *bp;
 	uint32_t i;
-	size_t skel_size, data_size, meta_size;
+	size_t skel_size, data_size, meta_size, hdr_size, hdr_area;
 	struct spa_chunk *cdp;
 	void *ddp;
 	uint32_t n_metas;
 	struct spa_meta *metas;
 	struct pw_memblock *m;
+	struct pw_memblock_pool_stats stats;
 	struct pw_type *t = &this->core->type;
 
 	n_metas = data_size = meta_size = 0;
@@ -359,23 +384,45 @@ static int alloc_buffers(struct pw_link *this,
 			skel_size += sizeof(struct spa_meta);
 		}
 	}
-	data_size += meta_size;
+	hdr_size = SPA_ROUND_UP_N(meta_size + n_datas * sizeof(struct spa_chunk), DATA_ALIGN);
 
 	/* data */
 	for (i = 0; i < n_datas; i++) {
-		data_size += sizeof(struct spa_chunk);
-		data_size += data_sizes[i];
+		data_size += SPA_ROUND_UP_N(data_sizes[i], data_align);
 		skel_size += sizeof(struct spa_data);
 	}
+	hdr_area = SPA_ROUND_UP_N(n_buffers * hdr_size, data_align);
 
 	buffers = calloc(n_buffers, skel_size + sizeof(struct spa_buffer *));
+	if (buffers == NULL)
+		return -ENOMEM;
 	/* pointer to buffer structures */
 	bp = SPA_MEMBER(buffers, n_buffers * sizeof(struct spa_buffer *), struct spa_buffer);
 
 	if ((res = pw_memblock_alloc(PW_MEMBLOCK_FLAG_WITH_FD |
 				     PW_MEMBLOCK_FLAG_MAP_READWRITE |
-				     PW_MEMBLOCK_FLAG_SEAL, n_buffers * data_size, &m)) < 0)
+				     PW_MEMBLOCK_FLAG_SEAL |
+				     flags,
+				     hdr_area + n_buffers * data_size, &m)) < 0) {
+		free(buffers);
 		return res;
+	}
+
+	if (flags & PW_MEMBLOCK_FLAG_HUGEPAGES)
+		pw_log_info("link %p: buffer memory of %zd bytes backed by %s", this, m->size,
+				m->flags & PW_MEMBLOCK_FLAG_HUGEPAGES ? "hugepages" : "normal pages");
+
+	pw_memblock_pool_get_stats(&stats);
+	pw_log_debug("link %p: pool hits %" PRIu64 " misses %" PRIu64 " retained %zd",
+			this, stats.hits, stats.misses, stats.retained);
+	if (m->flags & (PW_MEMBLOCK_FLAG_PREFAULT | PW_MEMBLOCK_FLAG_LOCK)) {
+		struct pw_memblock_prefault_stats pstats;
+
+		pw_memblock_get_prefault_stats(&pstats);
+		pw_log_debug("link %p: prefaulted %" PRIu64 " pages, locked %" PRIu64
+				" pages, %" PRIu64 " lock failures", this, pstats.pages,
+				pstats.locked, pstats.lock_failed);
+	}
 
 	for (i = 0; i < n_buffers; i++) {
 		int j;
@@ -384,7 +431,7 @@ static int alloc_buffers(struct pw_link *this,
 
 		buffers[i] = b = SPA_MEMBER(bp, skel_size * i, struct spa_buffer);
 
-		p = SPA_MEMBER(m->ptr, data_size * i, void);
+		p = SPA_MEMBER(m->ptr, hdr_size * i, void);
 
 		b->id = i;
 		b->n_metas = n_metas;
@@ -402,7 +449,7 @@ static int alloc_buffers(struct pw_link *this,
 		b->datas = SPA_MEMBER(b->metas, n_metas * sizeof(struct spa_meta), struct spa_data);
 
 		cdp = p;
-		ddp = SPA_MEMBER(cdp, sizeof(struct spa_chunk) * n_datas, void);
+		ddp = SPA_MEMBER(m->ptr, hdr_area + data_size * i, void);
 
 		for (j = 0; j < n_datas; j++) {
 			struct spa_data *d = &b->datas[j];
@@ -418,7 +465,7 @@ static int alloc_buffers(struct pw_link *this,
 				d->chunk->offset = 0;
 				d->chunk->size = 0;
 				d->chunk->stride = data_strides[j];
-				ddp += data_sizes[j];
+				ddp += SPA_ROUND_UP_N(data_sizes[j], data_align);
 			} else {
 				/* needs to be allocated by a node */
 				d->type = SPA_ID_INVALID;
@@ -482,6 +529,45 @@ param_filter(struct pw_link *this,
 	return num;
 }
 
+static inline bool has_one_item(struct spa_list *list)
+{
+	return !spa_list_is_empty(list) && list->next->next == list;
+}
+
+/* The buffers that output can use to process in place. A node with one
+ * input port where both ports can process in place changes the buffer on
+ * its input and sends the same buffer id on its output when both ports have
+ * the same buffers. This needs the input buffers to be exclusive: the input
+ * port has one link and the output port on the other side of that link has
+ * no other links, so that no other node sees the buffer while it is
+ * changed. */
+static struct allocation *find_in_place_allocation(struct pw_port *output)
+{
+	struct pw_node *node = output->node;
+	struct pw_port *input, *peer;
+	struct pw_link *link;
+
+	if (output->spa_info == NULL ||
+	    !(output->spa_info->flags & SPA_PORT_INFO_FLAG_IN_PLACE) ||
+	    !has_one_item(&node->input_ports))
+		return NULL;
+
+	input = spa_list_first(&node->input_ports, struct pw_port, link);
+	if (input->spa_info == NULL ||
+	    !(input->spa_info->flags & SPA_PORT_INFO_FLAG_IN_PLACE) ||
+	    input->state < PW_PORT_STATE_PAUSED ||
+	    !has_one_item(&input->links))
+		return NULL;
+
+	link = spa_list_first(&input->links, struct pw_link, input_link);
+	peer = link->output;
+	if (peer == NULL || !has_one_item(&peer->links) ||
+	    peer->allocation.n_buffers == 0)
+		return NULL;
+
+	return &peer->allocation;
+}
+
 static int do_allocation(struct pw_link *this, uint32_t in_state, uint32_t out_state)
 {
 	struct impl *impl = SPA_CONTAINER_OF(this, struct impl, this);
@@ -491,7 +577,7 @@ static int do_allocation(struct pw_link *this, uint32_t in_state, uint32_t out_s
 	char *error = NULL;
 	struct pw_port *input, *output;
 	struct pw_type *t = &this->core->type;
-	struct allocation allocation;
+	struct allocation allocation, *in_place;
 
 	if (in_state != PW_PORT_STATE_READY && out_state != PW_PORT_STATE_READY)
 		return 0;
@@ -576,15 +662,27 @@ static int do_allocation(struct pw_link *this, uint32_t in_state, uint32_t out_s
 
 		pw_log_debug("link %p: reusing %d input buffers %p", this,
 				allocation.n_buffers, allocation.buffers);
+	} else if ((out_flags & SPA_PORT_INFO_FLAG_CAN_USE_BUFFERS) &&
+		   (in_place = find_in_place_allocation(output)) != NULL) {
+		out_flags = SPA_PORT_INFO_FLAG_CAN_USE_BUFFERS;
+		in_flags = 0;
+
+		/* the memory stays with the port that allocated it */
+		allocation = *in_place;
+		allocation.mem = NULL;
+
+		pw_log_debug("link %p: using %d input buffers %p in place", this,
+				allocation.n_buffers, allocation.buffers);
 	} else {
 		struct spa_pod **params, *param;
 		uint8_t buffer[4096];
 		struct spa_pod_builder b = SPA_POD_BUILDER_INIT(buffer, sizeof(buffer));
 		uint32_t i, offset, n_params;
 		uint32_t max_buffers;
-		size_t minsize = 1024, stride = 0;
+		size_t minsize = 1024, stride = 0, align = DATA_ALIGN;
 		size_t data_sizes[1];
 		ssize_t data_strides[1];
+		enum pw_memblock_flags flags = this->core->mem_flags;
 
 		n_params = param_filter(this, input, output, t->param.idBuffers, &b);
 		n_params += param_filter(this, input, output, t->param.idMeta, &b);
@@ -604,18 +702,28 @@ static int do_allocation(struct pw_link *this, uint32_t in_state, uint32_t out_s
 		param = find_param(params, n_params, t->param_buffers.Buffers);
 		if (param) {
 			uint32_t qmax_buffers = max_buffers,
-			    qminsize = minsize, qstride = stride;
+			    qminsize = minsize, qstride = stride, qalign = 0;
+			int qhugepages = 0;
 
 			spa_pod_object_parse(param,
 				":", t->param_buffers.size, "i", &qminsize,
 				":", t->param_buffers.stride, "i", &qstride,
-				":", t->param_buffers.buffers, "i", &qmax_buffers, NULL);
+				":", t->param_buffers.buffers, "i", &qmax_buffers,
+				":", t->param_buffers.align, "?i", &qalign,
+				":", t->param_buffers.hugepages, "?b", &qhugepages, NULL);
 
 			max_buffers =
 			    qmax_buffers == 0 ? max_buffers : SPA_MIN(qmax_buffers,
 							      max_buffers);
 			minsize = SPA_MAX(minsize, qminsize);
 			stride = SPA_MAX(stride, qstride);
+			/* alignments are powers of 2, a page when more is asked */
+			if (qalign > align) {
+				while (align < qalign && align < this->core->sc_pagesize)
+					align <<= 1;
+			}
+			if (qhugepages)
+				flags |= PW_MEMBLOCK_FLAG_HUGEPAGES;
 
 			pw_log_debug("%d %d %d -> %zd %zd %d", qminsize, qstride, qmax_buffers,
 				     minsize, stride, max_buffers);
@@ -623,6 +731,8 @@ static int do_allocation(struct pw_link *this, uint32_t in_state, uint32_t out_s
 			pw_log_warn("no buffers param");
 			minsize = 1024;
 		}
+		if (can_pool_buffers(this))
+			flags |= PW_MEMBLOCK_FLAG_POOL;
 
 		/* when one of the ports can allocate buffer memory, set the minsize to
 		 * 0 to make sure we don't allocate memory in the shared memory */
@@ -639,6 +749,8 @@ static int do_allocation(struct pw_link *this, uint32_t in_state, uint32_t out_s
 					 params,
 					 1,
 					 data_sizes, data_strides,
+					 align,
+					 flags,
 					 &allocation)) < 0) {
 			asprintf(&error, "error alloc buffers: %d", res);
 			goto error;
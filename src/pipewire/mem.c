@@ -27,14 +27,18 @@
 #include <stddef.h>
 #include <stdio.h>
 #include <errno.h>
+#include <inttypes.h>
 #include <sys/mman.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <stdlib.h>
+#include <pthread.h>
 #include <sys/syscall.h>
+#include <sys/vfs.h>
 
 #include <spa/utils/list.h>
 
+#include <pipewire/array.h>
 #include <pipewire/log.h>
 #include <pipewire/mem.h>
 
@@ -63,6 +67,17 @@ static inline int memfd_create(const char *name, unsigned int flags)
 #define MFD_ALLOW_SEALING 0x0002U
 #endif
 
+#ifndef MFD_HUGETLB
+#define MFD_HUGETLB       0x0004U
+#endif
+
+/* the default hugepage size on x86 and arm64 */
+#define HUGEPAGE_SIZE	(2 * 1024 * 1024)
+
+#ifndef HUGETLBFS_MAGIC
+#define HUGETLBFS_MAGIC	0x958458f6
+#endif
+
 /* fcntl() seals-related flags */
 
 #ifndef F_LINUX_SPECIFIC_BASE
@@ -82,10 +97,195 @@ static inline int memfd_create(const char *name, unsigned int flags)
 struct memblock {
 	struct pw_memblock mem;
 	struct spa_list link;
+	void *index_ptr;	/**< ptr of the block in the index or NULL */
 };
 
+/* protects the list of blocks, the index, the pool and the mappings, they
+ * are shared by all cores in the process */
+static pthread_mutex_t _lock = PTHREAD_MUTEX_INITIALIZER;
+
 static struct spa_list _memblocks = SPA_LIST_INIT(&_memblocks);
 
+/* The mapped blocks sorted by address so that pw_memblock_find() can do a
+ * binary search. The mappings of the blocks don't overlap. */
+struct index_entry {
+	const void *start;
+	const void *end;
+	struct memblock *m;
+};
+
+static struct pw_array _index = { NULL, 0, 0, 64 * sizeof(struct index_entry) };
+
+/* the first entry that starts after ptr */
+static uint32_t index_upper(const void *ptr)
+{
+	struct index_entry *e = _index.data;
+	uint32_t lo = 0, hi = pw_array_get_len(&_index, struct index_entry), mid;
+
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (e[mid].start <= ptr)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+static void index_add(struct memblock *m)
+{
+	struct index_entry *e;
+	uint32_t i, n;
+
+	if (m->mem.ptr == NULL || m->mem.size == 0 || m->index_ptr != NULL)
+		return;
+
+	i = index_upper(m->mem.ptr);
+	if (pw_array_add(&_index, sizeof(struct index_entry)) == NULL) {
+		pw_log_warn("mem %p: can't add to index", m);
+		return;
+	}
+	e = _index.data;
+	n = pw_array_get_len(&_index, struct index_entry);
+	memmove(&e[i + 1], &e[i], (n - 1 - i) * sizeof(struct index_entry));
+	e[i].start = m->mem.ptr;
+	e[i].end = m->mem.ptr + m->mem.size;
+	e[i].m = m;
+	m->index_ptr = m->mem.ptr;
+}
+
+static void index_remove(struct memblock *m)
+{
+	struct index_entry *e = _index.data;
+	uint32_t i, n;
+
+	if (m->index_ptr == NULL)
+		return;
+
+	i = index_upper(m->index_ptr);
+	n = pw_array_get_len(&_index, struct index_entry);
+	if (i > 0 && e[i - 1].m == m) {
+		memmove(&e[i - 1], &e[i], (n - i) * sizeof(struct index_entry));
+		_index.size -= sizeof(struct index_entry);
+	}
+	m->index_ptr = NULL;
+}
+
+/* Blocks allocated with PW_MEMBLOCK_FLAG_POOL are rounded up to a size class
+ * and kept mapped in the pool when they are freed, so that the next
+ * allocation of the same class and flags does not need to create, truncate,
+ * seal and map a new memfd. There are 4 classes for each power of 2 pages. */
+#define POOL_CLASSES	64
+#define POOL_MAX_SIZE	(32 * 1024 * 1024)
+
+static struct spa_list _pool[POOL_CLASSES];
+static struct pw_memblock_pool_stats _pool_stats;
+
+static inline uint32_t pool_class(size_t size, size_t *class_size)
+{
+	size_t page_size = sysconf(_SC_PAGESIZE);
+	size_t pages = SPA_MAX((size + page_size - 1) / page_size, 1u), step;
+	uint32_t bits, idx;
+
+	if (pages < 4) {
+		idx = pages - 1;
+	} else {
+		bits = sizeof(long) * 8 - 1 - __builtin_clzl(pages);
+		step = 1u << (bits - 2);
+		pages = SPA_ROUND_UP_N(pages, step);
+		idx = 3 + (bits - 2) * 4 + pages / step - 4;
+	}
+	*class_size = pages * page_size;
+	return idx;
+}
+
+static struct memblock *pool_get(enum pw_memblock_flags flags, size_t size)
+{
+	struct memblock *m;
+	size_t class_size;
+	uint32_t idx;
+
+	if ((idx = pool_class(size, &class_size)) >= POOL_CLASSES || _pool[idx].next == NULL)
+		return NULL;
+
+	spa_list_for_each(m, &_pool[idx], link) {
+		if (m->mem.flags == flags) {
+			spa_list_remove(&m->link);
+			_pool_stats.n_blocks--;
+			_pool_stats.retained -= m->mem.size;
+			return m;
+		}
+	}
+	return NULL;
+}
+
+static bool pool_put(struct memblock *m)
+{
+	size_t class_size;
+	uint32_t idx;
+
+	if ((idx = pool_class(m->mem.size, &class_size)) >= POOL_CLASSES ||
+	    class_size != m->mem.size || m->mem.ptr == NULL ||
+	    _pool_stats.retained + m->mem.size > POOL_MAX_SIZE) {
+		_pool_stats.drops++;
+		return false;
+	}
+
+	if (_pool[idx].next == NULL)
+		spa_list_init(&_pool[idx]);
+
+	index_remove(m);
+	spa_list_remove(&m->link);
+	spa_list_append(&_pool[idx], &m->link);
+	_pool_stats.n_blocks++;
+	_pool_stats.retained += m->mem.size;
+
+	return true;
+}
+
+static struct pw_memblock_prefault_stats _prefault_stats;
+
+int pw_memblock_prefault(void *ptr, size_t size, enum pw_memblock_flags flags)
+{
+	size_t page_size = sysconf(_SC_PAGESIZE);
+	uint8_t *p, *end;
+	uint64_t pages;
+	int res = 0;
+
+	if (!(flags & (PW_MEMBLOCK_FLAG_PREFAULT | PW_MEMBLOCK_FLAG_LOCK)) ||
+	    ptr == NULL || size == 0)
+		return 0;
+
+	p = (uint8_t *) SPA_ROUND_DOWN_N((uintptr_t) ptr, page_size);
+	end = (uint8_t *) ptr + size;
+	pages = (end - p + page_size - 1) / page_size;
+
+	/* mlock faults in the pages, touch them ourselves when that fails */
+	if (flags & PW_MEMBLOCK_FLAG_LOCK) {
+		if (mlock(ptr, size) == 0) {
+			_prefault_stats.locked += pages;
+			p = end;
+		} else {
+			res = -errno;
+			_prefault_stats.lock_failed++;
+			pw_log_warn("mem %p: failed to lock %zd bytes: %m", ptr, size);
+		}
+	}
+	for (; p < end; p += page_size)
+		(void) *(volatile uint8_t *) p;
+
+	_prefault_stats.pages += pages;
+
+	pw_log_debug("mem %p: prefaulted %" PRIu64 " pages", ptr, pages);
+
+	return res;
+}
+
+void pw_memblock_get_prefault_stats(struct pw_memblock_prefault_stats *stats)
+{
+	*stats = _prefault_stats;
+}
+
 #define USE_MEMFD
 
 /** Map a memblock
@@ -135,6 +335,8 @@ int pw_memblock_map(struct pw_memblock *mem)
 			if (mem->ptr == MAP_FAILED)
 				return -ENOMEM;
 		}
+		pw_memblock_prefault(mem->ptr, mem->flags & PW_MEMBLOCK_FLAG_MAP_TWICE ?
+				mem->size << 1 : mem->size, mem->flags);
 	} else {
 		mem->ptr = NULL;
 	}
@@ -158,6 +360,41 @@ int pw_memblock_alloc(enum pw_memblock_flags flags, size_t size, struct pw_membl
 	if (mem == NULL)
 		return -EINVAL;
 
+	/* hugepages need a hugepage aligned size and mapping */
+	if (flags & PW_MEMBLOCK_FLAG_HUGEPAGES) {
+		if (!(flags & PW_MEMBLOCK_FLAG_WITH_FD) || (flags & PW_MEMBLOCK_FLAG_MAP_TWICE))
+			flags &= ~PW_MEMBLOCK_FLAG_HUGEPAGES;
+		else
+			flags &= ~PW_MEMBLOCK_FLAG_POOL;
+	}
+
+	if (flags & PW_MEMBLOCK_FLAG_POOL) {
+		size_t class_size;
+
+		if ((flags & PW_MEMBLOCK_FLAG_WITH_FD) &&
+		    pool_class(size, &class_size) < POOL_CLASSES) {
+			pthread_mutex_lock(&_lock);
+			if ((p = pool_get(flags, size)) != NULL) {
+				_pool_stats.hits++;
+				spa_list_append(&_memblocks, &p->link);
+				index_add(p);
+			} else
+				_pool_stats.misses++;
+			pthread_mutex_unlock(&_lock);
+
+			if (p != NULL) {
+				/* don't leak the old contents to the new user */
+				memset(p->mem.ptr, 0, p->mem.size);
+				*mem = &p->mem;
+				pw_log_debug("mem %p: alloc from pool", *mem);
+				return 0;
+			}
+			size = class_size;
+		}
+		else
+			flags &= ~PW_MEMBLOCK_FLAG_POOL;
+	}
+
 	m = &tmp.mem;
 	m->offset = 0;
 	m->flags = flags;
@@ -168,13 +405,24 @@ int pw_memblock_alloc(enum pw_memblock_flags flags, size_t size, struct pw_membl
 
 	if (use_fd) {
 #ifdef USE_MEMFD
-		m->fd = memfd_create("pipewire-memfd", MFD_CLOEXEC | MFD_ALLOW_SEALING);
-		if (m->fd == -1) {
-			pw_log_error("Failed to create memfd: %s\n", strerror(errno));
-			return -errno;
+	      again:
+		if (m->flags & PW_MEMBLOCK_FLAG_HUGEPAGES) {
+			m->size = SPA_ROUND_UP_N(size, HUGEPAGE_SIZE);
+			m->fd = memfd_create("pipewire-memfd",
+					MFD_CLOEXEC | MFD_ALLOW_SEALING | MFD_HUGETLB);
+			if (m->fd == -1)
+				goto no_hugepages;
+		} else {
+			m->size = size;
+			m->fd = memfd_create("pipewire-memfd", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+			if (m->fd == -1) {
+				pw_log_error("Failed to create memfd: %s\n", strerror(errno));
+				return -errno;
+			}
 		}
 #else
 		char filename[] = "/dev/shm/pipewire-tmpfile.XXXXXX";
+		m->flags &= ~PW_MEMBLOCK_FLAG_HUGEPAGES;
 		m->fd = mkostemp(filename, O_CLOEXEC);
 		if (m->fd == -1) {
 			pw_log_error("Failed to create temporary file: %s\n", strerror(errno));
@@ -183,7 +431,9 @@ int pw_memblock_alloc(enum pw_memblock_flags flags, size_t size, struct pw_membl
 		unlink(filename);
 #endif
 
-		if (ftruncate(m->fd, size) < 0) {
+		if (ftruncate(m->fd, m->size) < 0) {
+			if (m->flags & PW_MEMBLOCK_FLAG_HUGEPAGES)
+				goto no_hugepages_close;
 			pw_log_warn("Failed to truncate temporary file: %s", strerror(errno));
 			close(m->fd);
 			return -errno;
@@ -196,13 +446,20 @@ int pw_memblock_alloc(enum pw_memblock_flags flags, size_t size, struct pw_membl
 			}
 		}
 #endif
-		if (pw_memblock_map(m) != 0)
+		/* mapping fails when there are not enough free hugepages */
+		if (pw_memblock_map(m) != 0) {
+			if (m->flags & PW_MEMBLOCK_FLAG_HUGEPAGES)
+				goto no_hugepages_close;
 			goto mmap_failed;
+		}
+		if (m->flags & PW_MEMBLOCK_FLAG_HUGEPAGES)
+			pw_log_info("mem %zd bytes backed by hugepages", m->size);
 	} else {
 		if (size > 0) {
 			m->ptr = malloc(size);
 			if (m->ptr == NULL)
 				return -ENOMEM;
+			pw_memblock_prefault(m->ptr, size, m->flags);
 		}
 		m->fd = -1;
 	}
@@ -213,7 +470,11 @@ int pw_memblock_alloc(enum pw_memblock_flags flags, size_t size, struct pw_membl
 
 	p = calloc(1, sizeof(struct memblock));
 	*p = tmp;
+	p->index_ptr = NULL;
+	pthread_mutex_lock(&_lock);
 	spa_list_append(&_memblocks, &p->link);
+	index_add(p);
+	pthread_mutex_unlock(&_lock);
 	*mem = &p->mem;
 	pw_log_debug("mem %p: alloc", *mem);
 
@@ -222,6 +483,17 @@ int pw_memblock_alloc(enum pw_memblock_flags flags, size_t size, struct pw_membl
       mmap_failed:
 	close(m->fd);
 	return -ENOMEM;
+
+#ifdef USE_MEMFD
+      no_hugepages_close:
+	close(m->fd);
+      no_hugepages:
+	pw_log_info("no hugepages for %zd bytes, using normal pages: %s",
+			m->size, strerror(errno));
+	m->flags &= ~PW_MEMBLOCK_FLAG_HUGEPAGES;
+	m->ptr = NULL;
+	goto again;
+#endif
 }
 
 int
@@ -241,7 +513,13 @@ pw_memblock_import(enum pw_memblock_flags flags,
 
 	pw_log_debug("mem %p: import", *mem);
 
-	return pw_memblock_map(*mem);
+	if ((res = pw_memblock_map(*mem)) < 0)
+		return res;
+
+	pthread_mutex_lock(&_lock);
+	index_add((struct memblock *) *mem);
+	pthread_mutex_unlock(&_lock);
+	return 0;
 }
 
 /** Free a memblock
@@ -251,10 +529,24 @@ pw_memblock_import(enum pw_memblock_flags flags,
 void pw_memblock_free(struct pw_memblock *mem)
 {
 	struct memblock *m = (struct memblock *)mem;
+	bool pooled;
 
 	if (mem == NULL)
 		return;
 
+	pthread_mutex_lock(&_lock);
+	pooled = (mem->flags & PW_MEMBLOCK_FLAG_POOL) && pool_put(m);
+	if (!pooled) {
+		index_remove(m);
+		spa_list_remove(&m->link);
+	}
+	pthread_mutex_unlock(&_lock);
+
+	if (pooled) {
+		pw_log_debug("mem %p: free to pool", mem);
+		return;
+	}
+
 	pw_log_debug("mem %p: free", mem);
 	if (mem->flags & PW_MEMBLOCK_FLAG_WITH_FD) {
 		if (mem->ptr)
@@ -264,17 +556,221 @@ void pw_memblock_free(struct pw_memblock *mem)
 	} else {
 		free(mem->ptr);
 	}
-	spa_list_remove(&m->link);
 	free(mem);
 }
 
 struct pw_memblock * pw_memblock_find(const void *ptr)
 {
-	struct memblock *m;
+	struct index_entry *e;
+	struct pw_memblock *mem = NULL;
+	uint32_t i;
+
+	pthread_mutex_lock(&_lock);
+	e = _index.data;
+	i = index_upper(ptr);
+	if (i > 0 && ptr < e[i - 1].end)
+		mem = &e[i - 1].m->mem;
+	pthread_mutex_unlock(&_lock);
+
+	return mem;
+}
+
+/* The mappings made by pw_map_cache_map(). A process maps a few fds with
+ * many buffers each, a list is good enough. */
+struct mapping {
+	struct spa_list link;
+	int fd;
+	int prot;
+	uint32_t ref;
+	uint32_t offset;	/* page aligned offset of the mapping in the fd */
+	uint32_t size;		/* page aligned size */
+	void *ptr;
+};
+
+static struct spa_list _mappings = SPA_LIST_INIT(&_mappings);
 
-	spa_list_for_each(m, &_memblocks, link) {
-		if (ptr >= m->mem.ptr && ptr < m->mem.ptr + m->mem.size)
-			return &m->mem;
+/* mappings of a memfd with hugepages must start and end at a hugepage, the
+ * block size of the hugetlbfs, other fds are mapped in pages */
+static uint32_t map_align(int fd)
+{
+	struct statfs st;
+
+	if (fstatfs(fd, &st) == 0 && st.f_type == HUGETLBFS_MAGIC && st.f_bsize > 0)
+		return st.f_bsize;
+	return sysconf(_SC_PAGESIZE);
+}
+
+void *pw_map_cache_map(int fd, int prot, uint32_t offset, uint32_t size,
+		       enum pw_memblock_flags flags)
+{
+	struct mapping *mp, *largest = NULL;
+	uint32_t start, end, align;
+	void *ptr = NULL;
+	int res;
+
+	/* the returned pointer must be inside the mapping to find it again */
+	size = SPA_MAX(size, 1u);
+
+	pthread_mutex_lock(&_lock);
+	spa_list_for_each(mp, &_mappings, link) {
+		if (mp->fd != fd || (mp->prot & prot) != prot)
+			continue;
+		if (offset >= mp->offset && offset + size <= mp->offset + mp->size) {
+			mp->ref++;
+			ptr = SPA_MEMBER(mp->ptr, offset - mp->offset, void);
+			goto done;
+		}
+		if (mp->prot == prot && (largest == NULL || mp->size > largest->size))
+			largest = mp;
+	}
+
+	align = map_align(fd);
+	start = SPA_ROUND_DOWN_N(offset, align);
+	end = SPA_ROUND_UP_N(offset + size, align);
+	if (largest) {
+		start = SPA_MIN(start, largest->offset);
+		end = SPA_MAX(end, largest->offset + largest->size);
+	}
+
+	if ((mp = calloc(1, sizeof(struct mapping))) == NULL)
+		goto done;
+
+	mp->ptr = mmap(NULL, end - start, prot, MAP_SHARED, fd, start);
+	if (mp->ptr == MAP_FAILED) {
+		res = errno;
+		pw_log_error("mem: failed to map fd %d %u %u: %m", fd, start, end - start);
+		free(mp);
+		errno = res;
+		goto done;
+	}
+	pw_memblock_prefault(mp->ptr, end - start, flags);
+
+	mp->fd = fd;
+	mp->prot = prot;
+	mp->ref = 1;
+	mp->offset = start;
+	mp->size = end - start;
+	spa_list_prepend(&_mappings, &mp->link);
+
+	pw_log_debug("mem: fd %d mapped %u %u at %p", fd, mp->offset, mp->size, mp->ptr);
+
+	ptr = SPA_MEMBER(mp->ptr, offset - start, void);
+      done:
+	res = errno;
+	pthread_mutex_unlock(&_lock);
+	errno = res;
+	return ptr;
+}
+
+static void mapping_free(struct mapping *mp)
+{
+	pw_log_debug("mem: fd %d unmap %u %u", mp->fd, mp->offset, mp->size);
+	if (munmap(mp->ptr, mp->size) < 0)
+		pw_log_warn("mem: failed to unmap: %m");
+	spa_list_remove(&mp->link);
+	free(mp);
+}
+
+void pw_map_cache_unmap(void *ptr)
+{
+	struct mapping *mp;
+
+	pthread_mutex_lock(&_lock);
+	spa_list_for_each(mp, &_mappings, link) {
+		if (ptr >= mp->ptr && ptr < mp->ptr + mp->size) {
+			if (--mp->ref == 0)
+				mapping_free(mp);
+			goto done;
+		}
+	}
+	pw_log_warn("mem: unmap of unknown ptr %p", ptr);
+      done:
+	pthread_mutex_unlock(&_lock);
+}
+
+void pw_map_cache_clear(int fd)
+{
+	struct mapping *mp, *t;
+
+	pthread_mutex_lock(&_lock);
+	spa_list_for_each_safe(mp, t, &_mappings, link) {
+		if (mp->fd == fd)
+			mapping_free(mp);
+	}
+	pthread_mutex_unlock(&_lock);
+}
+
+uint32_t pw_map_cache_range_add(struct pw_map_cache_range *ranges, uint32_t n_ranges,
+				int fd, uint32_t offset, uint32_t size)
+{
+	uint32_t k;
+
+	for (k = 0; k < n_ranges && ranges[k].fd != fd; k++);
+	if (k == n_ranges) {
+		ranges[k].fd = fd;
+		ranges[k].start = offset;
+		ranges[k].end = offset + size;
+		ranges[k].ptr = NULL;
+		return n_ranges + 1;
+	}
+	ranges[k].start = SPA_MIN(ranges[k].start, offset);
+	ranges[k].end = SPA_MAX(ranges[k].end, offset + size);
+	return n_ranges;
+}
+
+void pw_map_cache_map_ranges(struct pw_map_cache_range *ranges, uint32_t n_ranges,
+			     int prot, enum pw_memblock_flags flags)
+{
+	uint32_t k;
+
+	for (k = 0; k < n_ranges; k++)
+		ranges[k].ptr = pw_map_cache_map(ranges[k].fd, prot, ranges[k].start,
+				ranges[k].end - ranges[k].start, flags);
+}
+
+void pw_map_cache_unmap_ranges(struct pw_map_cache_range *ranges, uint32_t n_ranges)
+{
+	uint32_t k;
+
+	for (k = 0; k < n_ranges; k++) {
+		if (ranges[k].ptr)
+			pw_map_cache_unmap(ranges[k].ptr);
+		ranges[k].ptr = NULL;
+	}
+}
+
+void pw_memblock_pool_get_stats(struct pw_memblock_pool_stats *stats)
+{
+	pthread_mutex_lock(&_lock);
+	*stats = _pool_stats;
+	pthread_mutex_unlock(&_lock);
+}
+
+void pw_memblock_pool_clear(void)
+{
+	struct spa_list blocks;
+	struct memblock *m, *t;
+	uint32_t i;
+
+	spa_list_init(&blocks);
+
+	pthread_mutex_lock(&_lock);
+	for (i = 0; i < POOL_CLASSES; i++) {
+		if (_pool[i].next == NULL)
+			continue;
+
+		spa_list_for_each_safe(m, t, &_pool[i], link) {
+			spa_list_remove(&m->link);
+			spa_list_append(&blocks, &m->link);
+		}
+	}
+	_pool_stats.n_blocks = 0;
+	_pool_stats.retained = 0;
+	pthread_mutex_unlock(&_lock);
+
+	/* pw_memblock_free removes them from the list and takes the lock */
+	spa_list_for_each_safe(m, t, &blocks, link) {
+		m->mem.flags &= ~PW_MEMBLOCK_FLAG_POOL;
+		pw_memblock_free(&m->mem);
 	}
-	return NULL;
 }
@@ -34,6 +34,16 @@ enum pw_memblock_flags {
 	PW_MEMBLOCK_FLAG_MAP_READ = (1 << 2),
 	PW_MEMBLOCK_FLAG_MAP_WRITE = (1 << 3),
 	PW_MEMBLOCK_FLAG_MAP_TWICE = (1 << 4),
+	PW_MEMBLOCK_FLAG_POOL = (1 << 5),	/**< take the block from the pool and
+						  *  return it to the pool when freed.
+						  *  Remove the flag from the block when
+						  *  its fd is sent to another process */
+	PW_MEMBLOCK_FLAG_HUGEPAGES = (1 << 6),	/**< use hugepages when available. The
+						  *  flag is removed from the block
+						  *  when normal pages were used */
+	PW_MEMBLOCK_FLAG_PREFAULT = (1 << 7),	/**< fault in all pages when mapping */
+	PW_MEMBLOCK_FLAG_LOCK = (1 << 8),	/**< fault in and lock all pages in
+						  *  memory when mapping */
 };
 
 #define PW_MEMBLOCK_FLAG_MAP_READWRITE (PW_MEMBLOCK_FLAG_MAP_READ | PW_MEMBLOCK_FLAG_MAP_WRITE)
@@ -65,6 +75,40 @@ pw_memblock_free(struct pw_memblock *mem);
 /** Find memblock for given \a ptr */
 struct pw_memblock * pw_memblock_find(const void *ptr);
 
+/** Statistics of the memblock pool \memberof pw_memblock */
+struct pw_memblock_pool_stats {
+	uint64_t hits;		/**< allocations served from the pool */
+	uint64_t misses;	/**< allocations that made a new block */
+	uint64_t drops;		/**< freed blocks that did not fit in the pool */
+	uint32_t n_blocks;	/**< number of blocks in the pool */
+	size_t retained;	/**< bytes of the blocks in the pool */
+};
+
+/** Get the statistics of the memblock pool */
+void pw_memblock_pool_get_stats(struct pw_memblock_pool_stats *stats);
+
+/** Free all the blocks in the memblock pool */
+void pw_memblock_pool_clear(void);
+
+/** Fault in the pages of \a size bytes at \a ptr when \a flags has
+ * PW_MEMBLOCK_FLAG_PREFAULT or PW_MEMBLOCK_FLAG_LOCK, so that the first
+ * accesses from the processing thread don't fault. With
+ * PW_MEMBLOCK_FLAG_LOCK the pages are also locked in memory.
+ * \return 0 on success, < 0 when the pages could not be locked, they
+ * are faulted in anyway. */
+int pw_memblock_prefault(void *ptr, size_t size, enum pw_memblock_flags flags);
+
+/** Statistics of prefaulted memory \memberof pw_memblock */
+struct pw_memblock_prefault_stats {
+	uint64_t pages;		/**< pages faulted in when mapped, the faults
+				  *  avoided in the processing thread */
+	uint64_t locked;	/**< pages locked in memory */
+	uint64_t lock_failed;	/**< failed attempts to lock memory */
+};
+
+/** Get the statistics of prefaulted memory */
+void pw_memblock_get_prefault_stats(struct pw_memblock_prefault_stats *stats);
+
 /** parameters to map a memory range */
 struct pw_map_range {
 	uint32_t start;		/** offset in first page with start of data */
@@ -85,6 +129,47 @@ static inline void pw_map_range_init(struct pw_map_range *range,
 	range->size = offset + size - range->offset;
 }
 
+/** Map \a size bytes at \a offset of \a fd with at least \a prot. The
+ * mappings are cached per fd and a mapping that covers the range is reused.
+ * Otherwise a new mapping is made that also covers the largest mapping of
+ * the fd with the same \a prot, so that mapping the whole range first and
+ * then the parts of it results in one mapping. Mappings of a memfd with
+ * hugepages are aligned to the hugepage size. A new mapping is prefaulted
+ * according to \a flags.
+ * \return a pointer to \a offset in the fd or NULL with errno set */
+void *pw_map_cache_map(int fd, int prot, uint32_t offset, uint32_t size,
+		       enum pw_memblock_flags flags);
+
+/** Release the range at \a ptr returned by pw_map_cache_map(). The mapping
+ * is unmapped when it has no more users. */
+void pw_map_cache_unmap(void *ptr);
+
+/** Unmap all cached mappings of \a fd. Call this before closing \a fd. */
+void pw_map_cache_clear(int fd);
+
+/** The range of the buffers in one fd, so that all buffers in the fd can be
+ * mapped at once and then take a ref on the mapping instead of making one
+ * each */
+struct pw_map_cache_range {
+	int fd;
+	uint32_t start;		/**< offset of the first buffer */
+	uint32_t end;		/**< offset of the end of the last buffer */
+	void *ptr;		/**< mapping of start or NULL */
+};
+
+/** Add \a size bytes at \a offset of \a fd to the \a n_ranges ranges in
+ * \a ranges, which has room for a new range.
+ * \return the new number of ranges */
+uint32_t pw_map_cache_range_add(struct pw_map_cache_range *ranges, uint32_t n_ranges,
+				int fd, uint32_t offset, uint32_t size);
+
+/** Map the ranges with pw_map_cache_map(), the ptr of a range that can not be
+ * mapped is NULL */
+void pw_map_cache_map_ranges(struct pw_map_cache_range *ranges, uint32_t n_ranges,
+			     int prot, enum pw_memblock_flags flags);
+
+/** Release the mappings of pw_map_cache_map_ranges() */
+void pw_map_cache_unmap_ranges(struct pw_map_cache_range *ranges, uint32_t n_ranges);
 
 #ifdef __cplusplus
 }
@@ -104,6 +104,9 @@ struct pw_node_events {
 #define PW_NODE_PROP_AUTOCONNECT	"pipewire.autoconnect"
 /** Try to connect the node to this node id */
 #define PW_NODE_PROP_TARGET_NODE	"pipewire.target.node"
+/** Number of times a remote node polls for the next message before it
+ * sleeps, 0 by default */
+#define PW_NODE_PROP_WAKEUP_SPIN	"pipewire.wakeup.spin"
 
 /** Create a new node \memberof pw_node */
 struct pw_node *
@@ -22,14 +22,42 @@
 #include <errno.h>
 
 #include <spa/pod/parser.h>
+#include <spa/param/audio/format-utils.h>
 
 #include "pipewire/pipewire.h"
 #include "pipewire/private.h"
 #include "pipewire/port.h"
 
 /** \cond */
+#define MAX_BUFFERS	64
+
+struct type {
+	struct spa_type_media_type media_type;
+	struct spa_type_media_subtype media_subtype;
+	struct spa_type_format_audio format_audio;
+	struct spa_type_audio_format audio_format;
+};
+
+static inline void init_type(struct type *type, struct spa_type_map *map)
+{
+	spa_type_media_type_map(map, &type->media_type);
+	spa_type_media_subtype_map(map, &type->media_subtype);
+	spa_type_format_audio_map(map, &type->format_audio);
+	spa_type_audio_format_map(map, &type->audio_format);
+}
+
+typedef void (*mix_func_t) (void *dst, const void *src, uint32_t n_bytes);
+
 struct impl {
 	struct pw_port this;
+
+	struct type type;
+
+	mix_func_t mix;			/**< add samples of the negotiated format */
+	struct spa_buffer **buffers;	/**< buffers used by the node */
+	uint32_t n_buffers;
+
+	uint32_t refs[MAX_BUFFERS];	/**< number of tee outputs using a buffer */
 };
 
 struct resource_data {
@@ -49,17 +77,40 @@ static void port_update_state(struct pw_port *port, enum pw_port_state state)
 	}
 }
 
+/* drop a reference on a buffer given to the tee outputs. Returns true when
+ * the buffer can be recycled by the node. */
+static bool tee_release(struct impl *impl, uint32_t buffer_id)
+{
+	if (buffer_id >= MAX_BUFFERS || impl->refs[buffer_id] == 0)
+		return true;
+	return --impl->refs[buffer_id] == 0;
+}
+
 static int schedule_tee_input(struct spa_node *data)
 {
 	struct pw_port *this = SPA_CONTAINER_OF(data, struct pw_port, mix_node);
+	struct impl *impl = SPA_CONTAINER_OF(this, struct impl, this);
 	struct spa_graph_node *node = &this->rt.mix_node;
 	struct spa_graph_port *p;
 	struct spa_io_buffers *io = this->rt.mix_port.io;
+	uint32_t n_refs = 0;
 
-	if (!spa_list_is_empty(&node->ports[SPA_DIRECTION_OUTPUT])) {
-		pw_log_trace("node %p: tee input %d %d", node, io->status, io->buffer_id);
-		spa_list_for_each(p, &node->ports[SPA_DIRECTION_OUTPUT], link)
-			*p->io = *io;
+	spa_list_for_each(p, &node->ports[SPA_DIRECTION_OUTPUT], link) {
+		if (!(p->flags & SPA_GRAPH_PORT_FLAG_DISABLED))
+			n_refs++;
+	}
+
+	if (n_refs > 0) {
+		pw_log_trace("node %p: tee input %d %d %d", node, io->status, io->buffer_id, n_refs);
+		/* all outputs share the buffer, it is recycled when the last one
+		 * releases it */
+		if (io->buffer_id < MAX_BUFFERS)
+			impl->refs[io->buffer_id] = n_refs;
+
+		spa_list_for_each(p, &node->ports[SPA_DIRECTION_OUTPUT], link) {
+			if (!(p->flags & SPA_GRAPH_PORT_FLAG_DISABLED))
+				*p->io = *io;
+		}
 		io->buffer_id = SPA_ID_INVALID;
 	}
 	else
@@ -70,12 +121,30 @@ static int schedule_tee_input(struct spa_node *data)
 static int schedule_tee_output(struct spa_node *data)
 {
 	struct pw_port *this = SPA_CONTAINER_OF(data, struct pw_port, mix_node);
+	struct impl *impl = SPA_CONTAINER_OF(this, struct impl, this);
 	struct spa_graph_node *node = &this->rt.mix_node;
-	struct spa_graph_port *p;
+	struct spa_graph_port *p, *pp = this->rt.mix_port.peer;
 	struct spa_io_buffers *io = this->rt.mix_port.io;
+	uint32_t buffer_id;
+
+	spa_list_for_each(p, &node->ports[SPA_DIRECTION_OUTPUT], link) {
+		io->status = p->io->status;
 
-	spa_list_for_each(p, &node->ports[SPA_DIRECTION_OUTPUT], link)
-		*io = *p->io;
+		if (p->io->status != SPA_STATUS_NEED_BUFFER ||
+		    (buffer_id = p->io->buffer_id) == SPA_ID_INVALID)
+			continue;
+
+		p->io->buffer_id = SPA_ID_INVALID;
+
+		if (!tee_release(impl, buffer_id))
+			continue;
+
+		/* the io can give back one buffer, others are recycled directly */
+		if (io->buffer_id == SPA_ID_INVALID)
+			io->buffer_id = buffer_id;
+		else if (pp != NULL)
+			spa_node_port_reuse_buffer(pp->node->implementation, pp->port_id, buffer_id);
+	}
 	pw_log_trace("node %p: tee output %d %d", node, io->status, io->buffer_id);
 	return io->status;
 }
@@ -83,9 +152,16 @@ static int schedule_tee_output(struct spa_node *data)
 static int schedule_tee_reuse_buffer(struct spa_node *data, uint32_t port_id, uint32_t buffer_id)
 {
 	struct pw_port *this = SPA_CONTAINER_OF(data, struct pw_port, mix_node);
+	struct impl *impl = SPA_CONTAINER_OF(this, struct impl, this);
 	struct spa_graph_node *node = &this->rt.mix_node;
 	struct spa_graph_port *p = &this->rt.mix_port, *pp;
 
+	if (!tee_release(impl, buffer_id)) {
+		pw_log_trace("node %p: tee buffer %d still in use %d", node,
+				buffer_id, impl->refs[buffer_id]);
+		return 0;
+	}
+
 	if ((pp = p->peer) != NULL) {
 		pw_log_trace("node %p: tee reuse buffer %d %d", node, port_id, buffer_id);
 		spa_node_port_reuse_buffer(pp->node->implementation, port_id, buffer_id);
@@ -101,33 +177,185 @@ static const struct spa_node schedule_tee_node = {
 	.port_reuse_buffer = schedule_tee_reuse_buffer,
 };
 
+static void mix_f32(void *dst, const void *src, uint32_t n_bytes)
+{
+	float *d = dst;
+	const float *s = src;
+	uint32_t i, n_samples = n_bytes / sizeof(float);
+
+	for (i = 0; i < n_samples; i++)
+		d[i] += s[i];
+}
+
+static void mix_s16(void *dst, const void *src, uint32_t n_bytes)
+{
+	int16_t *d = dst;
+	const int16_t *s = src;
+	uint32_t i, n_samples = n_bytes / sizeof(int16_t);
+
+	for (i = 0; i < n_samples; i++)
+		d[i] = SPA_CLAMP(d[i] + s[i], INT16_MIN, INT16_MAX);
+}
+
+static void mix_s32(void *dst, const void *src, uint32_t n_bytes)
+{
+	int32_t *d = dst;
+	const int32_t *s = src;
+	uint32_t i, n_samples = n_bytes / sizeof(int32_t);
+
+	for (i = 0; i < n_samples; i++)
+		d[i] = SPA_CLAMP((int64_t) d[i] + s[i], INT32_MIN, INT32_MAX);
+}
+
+static inline bool has_buffer(struct spa_graph_port *p)
+{
+	return !(p->flags & SPA_GRAPH_PORT_FLAG_DISABLED) &&
+		p->io->status == SPA_STATUS_HAVE_BUFFER && p->io->buffer_id != SPA_ID_INVALID;
+}
+
+/* the buffer on the link of mixer port p, NULL when not known */
+static struct spa_buffer *link_buffer(struct spa_graph_port *p)
+{
+	struct pw_link *link = p->scheduler_data;
+	struct allocation *a = &link->output->allocation;
+
+	if (p->io->buffer_id >= a->n_buffers)
+		return NULL;
+	return a->buffers[p->io->buffer_id];
+}
+
+/* if the node uses the buffers of the link of mixer port p */
+static inline bool is_node_buffers(struct impl *impl, struct spa_graph_port *p)
+{
+	struct pw_link *link = p->scheduler_data;
+	return impl->buffers == NULL || link->output->allocation.buffers == impl->buffers;
+}
+
+/* if the link of mixer port p is the only link of the output port, we can then
+ * write into its buffers without affecting other ports */
+static inline bool is_exclusive(struct spa_graph_port *p)
+{
+	struct spa_graph_port *pp = p->peer;
+	struct spa_list *ports;
+
+	if (pp == NULL)
+		return false;
+	ports = &pp->node->ports[SPA_DIRECTION_OUTPUT];
+	return ports->next == &pp->link && pp->link.next == ports;
+}
+
+/* add the data of src to dst, dst grows when src is larger */
+static void mix_buffer(struct impl *impl, struct spa_buffer *dst, struct spa_buffer *src)
+{
+	struct spa_data *dd = &dst->datas[0], *sd = &src->datas[0];
+	uint32_t doffs, dsize, soffs, ssize, n_bytes;
+
+	if (dd->data == NULL || sd->data == NULL)
+		return;
+
+	doffs = SPA_MIN(dd->chunk->offset, dd->maxsize);
+	dsize = SPA_MIN(dd->chunk->size, dd->maxsize - doffs);
+	soffs = SPA_MIN(sd->chunk->offset, sd->maxsize);
+	ssize = SPA_MIN(sd->chunk->size, sd->maxsize - soffs);
+
+	n_bytes = SPA_MIN(ssize, dd->maxsize - doffs);
+
+	impl->mix(SPA_MEMBER(dd->data, doffs, void),
+		  SPA_MEMBER(sd->data, soffs, void),
+		  SPA_MIN(n_bytes, dsize));
+
+	if (n_bytes > dsize) {
+		memcpy(SPA_MEMBER(dd->data, doffs + dsize, void),
+		       SPA_MEMBER(sd->data, soffs + dsize, void),
+		       n_bytes - dsize);
+		dd->chunk->size = n_bytes;
+	}
+}
+
+/* Find the port with the buffer to mix into. It needs to be a buffer that the
+ * node knows about and that is not seen by other ports. */
+static struct spa_graph_port *find_mix_port(struct impl *impl, struct spa_graph_node *node)
+{
+	struct spa_graph_port *p;
+
+	if (impl->mix == NULL || impl->buffers == NULL)
+		return NULL;
+
+	spa_list_for_each(p, &node->ports[SPA_DIRECTION_INPUT], link) {
+		if (has_buffer(p) && is_node_buffers(impl, p) && is_exclusive(p) &&
+		    link_buffer(p) != NULL)
+			return p;
+	}
+	return NULL;
+}
+
 static int schedule_mix_input(struct spa_node *data)
 {
 	struct pw_port *this = SPA_CONTAINER_OF(data, struct pw_port, mix_node);
+	struct impl *impl = SPA_CONTAINER_OF(this, struct impl, this);
 	struct spa_graph_node *node = &this->rt.mix_node;
-	struct spa_graph_port *p;
+	struct spa_graph_port *p, *mp = NULL;
 	struct spa_io_buffers *io = this->rt.mix_port.io;
+	struct spa_buffer *dst, *src;
+	uint32_t n_inputs = 0;
 
 	spa_list_for_each(p, &node->ports[SPA_DIRECTION_INPUT], link) {
 		pw_log_trace("mix %p: input %p %p->%p %d %d", node,
 				p, p->io, io, p->io->status, p->io->buffer_id);
-		*io = *p->io;
-		p->io->buffer_id = SPA_ID_INVALID;
-		break;
+		if (has_buffer(p))
+			n_inputs++;
+	}
+
+	/* more than one input, sum them into a buffer of one of the links. With
+	 * only one input, or when no suitable buffer was found, we pass the
+	 * input buffer to the node. */
+	if (n_inputs > 1 && (mp = find_mix_port(impl, node)) != NULL) {
+		dst = link_buffer(mp);
+
+		spa_list_for_each(p, &node->ports[SPA_DIRECTION_INPUT], link) {
+			if (p == mp || !has_buffer(p) || (src = link_buffer(p)) == NULL)
+				continue;
+			pw_log_trace("mix %p: mix %d into %d", node,
+					p->io->buffer_id, mp->io->buffer_id);
+			mix_buffer(impl, dst, src);
+		}
+	}
+	else {
+		spa_list_for_each(p, &node->ports[SPA_DIRECTION_INPUT], link) {
+			if (mp == NULL)
+				mp = p;
+			if (has_buffer(p) && is_node_buffers(impl, p)) {
+				mp = p;
+				break;
+			}
+		}
+		if (mp == NULL)
+			return io->status;
 	}
+	*io = *mp->io;
+	mp->io->buffer_id = SPA_ID_INVALID;
+
 	return io->status;
 }
 
 static int schedule_mix_output(struct spa_node *data)
 {
 	struct pw_port *this = SPA_CONTAINER_OF(data, struct pw_port, mix_node);
+	struct impl *impl = SPA_CONTAINER_OF(this, struct impl, this);
 	struct spa_graph_node *node = &this->rt.mix_node;
 	struct spa_graph_port *p;
 	struct spa_io_buffers *io = this->rt.mix_port.io;
 
 	if (!spa_list_is_empty(&node->ports[SPA_DIRECTION_INPUT])) {
-		spa_list_for_each(p, &node->ports[SPA_DIRECTION_INPUT], link)
-			*p->io = *io;
+		/* the buffer id of the node is only valid for the links that share
+		 * the buffers with the node, the others keep their own id so that
+		 * it is recycled */
+		spa_list_for_each(p, &node->ports[SPA_DIRECTION_INPUT], link) {
+			if (is_node_buffers(impl, p))
+				*p->io = *io;
+			else
+				p->io->status = io->status;
+		}
 	}
 	else {
 		io->status = SPA_STATUS_HAVE_BUFFER;
@@ -140,11 +368,12 @@ static int schedule_mix_output(struct spa_node *data)
 static int schedule_mix_reuse_buffer(struct spa_node *data, uint32_t port_id, uint32_t buffer_id)
 {
 	struct pw_port *this = SPA_CONTAINER_OF(data, struct pw_port, mix_node);
+	struct impl *impl = SPA_CONTAINER_OF(this, struct impl, this);
 	struct spa_graph_node *node = &this->rt.mix_node;
 	struct spa_graph_port *p, *pp;
 
 	spa_list_for_each(p, &node->ports[SPA_DIRECTION_INPUT], link) {
-		if ((pp = p->peer) != NULL) {
+		if ((pp = p->peer) != NULL && is_node_buffers(impl, p)) {
 			pw_log_trace("mix %p: reuse buffer %d %d", node, port_id, buffer_id);
 			spa_node_port_reuse_buffer(pp->node->implementation, port_id, buffer_id);
 		}
@@ -414,6 +643,7 @@ int pw_port_register(struct pw_port *port,
 
 int pw_port_add(struct pw_port *port, struct pw_node *node)
 {
+	struct impl *impl = SPA_CONTAINER_OF(port, struct impl, this);
 	uint32_t port_id = port->port_id;
 	struct pw_core *core = node->core;
 	struct pw_type *t = &core->type;
@@ -421,6 +651,8 @@ int pw_port_add(struct pw_port *port, struct pw_node *node)
 
 	port->node = node;
 
+	init_type(&impl->type, t->map);
+
 	spa_node_port_get_info(node->node,
 			       port->direction, port_id,
 			       &port->spa_info);
@@ -657,6 +889,38 @@ int pw_port_for_each_filtered_param(struct pw_port *in_port,
 	return res;
 }
 
+/* select the function to mix buffers of the format, only for
+ * raw audio formats that we can sum */
+static void update_mix(struct pw_port *port, const struct spa_pod *format)
+{
+	struct impl *impl = SPA_CONTAINER_OF(port, struct impl, this);
+	struct type *t = &impl->type;
+	struct spa_audio_info info = { 0 };
+
+	impl->mix = NULL;
+
+	if (format == NULL)
+		return;
+
+	spa_pod_object_parse(format,
+		"I", &info.media_type,
+		"I", &info.media_subtype);
+
+	if (info.media_type != t->media_type.audio ||
+	    info.media_subtype != t->media_subtype.raw)
+		return;
+
+	if (spa_format_audio_raw_parse(format, &info.info.raw, &t->format_audio) < 0)
+		return;
+
+	if (info.info.raw.format == t->audio_format.F32)
+		impl->mix = mix_f32;
+	else if (info.info.raw.format == t->audio_format.S16)
+		impl->mix = mix_s16;
+	else if (info.info.raw.format == t->audio_format.S32)
+		impl->mix = mix_s32;
+}
+
 int pw_port_set_param(struct pw_port *port, uint32_t id, uint32_t flags,
 		      const struct spa_pod *param)
 {
@@ -678,10 +942,21 @@ int pw_port_set_param(struct pw_port *port, uint32_t id, uint32_t flags,
 		else if (!SPA_RESULT_IS_ASYNC(res)) {
 			port_update_state (port, PW_PORT_STATE_READY);
 		}
+		if (port->direction == PW_DIRECTION_INPUT)
+			update_mix(port, res < 0 ? NULL : param);
 	}
 	return res;
 }
 
+static void set_buffers(struct pw_port *port, struct spa_buffer **buffers, uint32_t n_buffers)
+{
+	struct impl *impl = SPA_CONTAINER_OF(port, struct impl, this);
+
+	impl->buffers = n_buffers > 0 ? buffers : NULL;
+	impl->n_buffers = n_buffers;
+	memset(impl->refs, 0, sizeof(impl->refs));
+}
+
 int pw_port_use_buffers(struct pw_port *port, struct spa_buffer **buffers, uint32_t n_buffers)
 {
 	int res;
@@ -704,6 +979,7 @@ int pw_port_use_buffers(struct pw_port *port, struct spa_buffer **buffers, uint3
 		n_buffers = 0;
 		buffers = NULL;
 	}
+	set_buffers(port, buffers, n_buffers);
 
 	if (n_buffers == 0)
 		port_update_state (port, PW_PORT_STATE_READY);
@@ -738,6 +1014,7 @@ int pw_port_alloc_buffers(struct pw_port *port,
 	else {
 		port->allocated = true;
 	}
+	set_buffers(port, buffers, n_buffers ? *n_buffers : 0);
 
 	if (n_buffers == 0)
 		port_update_state (port, PW_PORT_STATE_READY);
@@ -26,6 +26,7 @@ extern "C" {
 
 #include <sys/socket.h>
 #include <sys/types.h> /* for pthread_t */
+#include <semaphore.h>
 
 
 #include "pipewire/mem.h"
@@ -191,6 +192,7 @@ struct pw_core {
 	struct pw_client *current_client;	/**< client currently executing code in mainloop */
 
 	long sc_pagesize;
+	enum pw_memblock_flags mem_flags;	/**< extra flags to map buffer memory */
 
 	struct {
 		struct spa_graph graph;
@@ -209,8 +211,27 @@ struct pw_data_loop {
 
         bool running;
         pthread_t thread;
+
+	struct {
+		uint32_t n_threads;	/**< number of worker threads */
+		pthread_t *threads;
+		pid_t *tids;		/**< kernel thread ids of the workers */
+		sem_t sem;		/**< posted to wake up the workers */
+		sem_t done;		/**< posted when a worker finished the last job */
+		bool running;
+		void (*func) (void *arg, uint32_t index);
+		void *arg;
+		uint64_t state;		/**< number of jobs << 32 | next job */
+		uint32_t n_done;	/**< number of jobs done */
+	} workers;
 };
 
+/** call func for index 0 to n_jobs - 1 on the data loop workers and the
+ * calling thread, returns when all jobs are done */
+void pw_data_loop_run_jobs(struct pw_data_loop *loop,
+			   void (*func) (void *arg, uint32_t index), void *arg,
+			   uint32_t n_jobs);
+
 #define pw_main_loop_events_emit(o,m,v,...) spa_hook_list_call(&o->listener_list, struct pw_main_loop_events, m, v, ##__VA_ARGS__)
 #define pw_main_loop_events_destroy(o) pw_main_loop_events_emit(o, destroy, 0)
 
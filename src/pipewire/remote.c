@@ -50,20 +50,23 @@ struct mem_id {
 	int fd;
 	uint32_t flags;
 	uint32_t ref;
-	struct pw_map_range map;
-	void *ptr;
 };
 
 struct buffer_id {
 	struct spa_list link;
 	uint32_t id;
 	struct spa_buffer *buf;
-	struct pw_map_range map;
-	void *ptr;
+	void *ptr;		/* the buffer in the mapping of the buffer mem */
 	uint32_t n_mem;
 	struct mem_id **mem;
 };
 
+/* input port of another client that an output port activates directly */
+struct port_peer {
+	struct pw_memblock *activation;
+	int fd;
+};
+
 struct port {
 	struct spa_graph_port output;
 	struct spa_graph_port input;
@@ -72,6 +75,8 @@ struct port {
 
 	struct pw_array buffer_ids;
 	bool in_order;
+
+	struct port_peer peer;
 };
 
 struct node_data {
@@ -83,6 +88,7 @@ struct node_data {
 	int rtwritefd;
 	struct spa_source *rtsocket_source;
         struct pw_client_node_transport *trans;
+	uint32_t spin;
 
 	struct spa_node out_node_impl;
 	struct spa_graph_node out_node;
@@ -91,7 +97,7 @@ struct node_data {
 	struct spa_graph_node in_node;
 	struct port *in_ports;
 
-        struct pw_array mem_ids;
+	struct pw_map mem_ids;		/* struct mem_id indexed by the mem id */
 
 	struct pw_node *node;
 	struct spa_hook node_listener;
@@ -515,6 +521,31 @@ static void handle_rtnode_message(struct pw_proxy *proxy, struct pw_client_node_
 		}
 		break;
 	}
+	case PW_CLIENT_NODE_MESSAGE_PORT_REUSE_BUFFERS:
+	{
+		struct pw_client_node_message_port_reuse_buffers *rb =
+		    (struct pw_client_node_message_port_reuse_buffers *) message;
+		uint32_t port_id = rb->body.port_id.value;
+		struct spa_graph_port *p, *pp;
+		uint64_t mask;
+
+		if (port_id >= data->trans->area->max_output_ports)
+			break;
+
+		mask = pw_client_node_transport_take_reuse(data->trans,
+				SPA_DIRECTION_OUTPUT, port_id);
+
+		spa_list_for_each(p, &data->out_node.ports[SPA_DIRECTION_INPUT], link) {
+			if (p->port_id != port_id || (pp = p->peer) == NULL)
+				continue;
+
+			for (; mask; mask &= mask - 1)
+				spa_node_port_reuse_buffer(pp->node->implementation,
+							   pp->port_id, __builtin_ctzll(mask));
+			break;
+		}
+		break;
+	}
 	default:
 		pw_log_warn("unexpected node message %d", PW_CLIENT_NODE_MESSAGE_TYPE(message));
 		break;
@@ -544,79 +575,122 @@ on_rtsocket_condition(void *user_data, int fd, enum spa_io mask)
 			pw_log_warn("proxy %p: %ld messages", proxy, cmd);
 
 
-		while (pw_client_node_transport_next_message(data->trans, &message) == 1) {
-			struct pw_client_node_message *msg = alloca(SPA_POD_SIZE(&message));
-			pw_client_node_transport_parse_message(data->trans, msg);
-			handle_rtnode_message(proxy, msg);
-		}
+		/* poll for the next message for a while, it often arrives in the
+		 * same period, before sleeping */
+		do {
+			if (pw_client_node_transport_activated(data->trans)) {
+				pw_log_trace("remote %p: activated", data->remote);
+				spa_graph_have_output(data->node->rt.graph, &data->in_node);
+			}
+			while (pw_client_node_transport_next_message(data->trans, &message) == 1) {
+				struct pw_client_node_message *msg = alloca(SPA_POD_SIZE(&message));
+				pw_client_node_transport_parse_message(data->trans, msg);
+				handle_rtnode_message(proxy, msg);
+			}
+		} while (pw_client_node_transport_spin(data->trans, data->spin) ||
+			 pw_client_node_transport_sleep(data->trans));
 	}
 }
 
-static struct mem_id *find_mem(struct pw_array *mem_ids, uint32_t id)
+static struct mem_id *find_mem(struct node_data *data, uint32_t id)
 {
-	struct mem_id *mid;
-
-	pw_array_for_each(mid, mem_ids) {
-		if (mid->id == id)
-			return mid;
-	}
-	return NULL;
+	return pw_map_lookup(&data->mem_ids, id);
 }
 
+/* the mappings are shared with the buffers in the same mem and are kept until
+ * the mem is cleared */
 static void *mem_map(struct node_data *data, struct mem_id *mid, uint32_t offset, uint32_t size)
 {
-	if (mid->ptr == NULL) {
-		pw_map_range_init(&mid->map, offset, size, data->core->sc_pagesize);
-
-		mid->ptr = mmap(NULL, mid->map.size, PROT_READ|PROT_WRITE,
-				MAP_SHARED, mid->fd, mid->map.offset);
+	void *ptr;
 
-		if (mid->ptr == MAP_FAILED) {
-			pw_log_error("Failed to mmap memory %d %p: %m", size, mid);
-			mid->ptr = NULL;
-			return NULL;
-		}
-	}
-	return SPA_MEMBER(mid->ptr, mid->map.start, void);
+	ptr = pw_map_cache_map(mid->fd, PROT_READ|PROT_WRITE, offset, size,
+			data->core->mem_flags);
+	if (ptr == NULL)
+		pw_log_error("Failed to mmap memory %d %p: %m", size, mid);
+	return ptr;
 }
-static void mem_unmap(struct node_data *data, struct mem_id *mid)
+
+/* Map the range of all buffers in each mem once. The buffers then take a ref
+ * on this mapping instead of making one each. */
+static uint32_t map_mem_ranges(struct node_data *data, struct pw_map_cache_range *ranges,
+			       uint32_t n_buffers, struct pw_client_node_buffer *buffers,
+			       int prot)
 {
-	if (mid->ptr != NULL) {
-		if (munmap(mid->ptr, mid->map.size) < 0)
-			pw_log_warn("failed to unmap: %m");
-		mid->ptr = NULL;
+	uint32_t i, n_ranges = 0;
+	struct mem_id *mid;
+
+	for (i = 0; i < n_buffers; i++) {
+		if ((mid = find_mem(data, buffers[i].mem_id)) != NULL)
+			n_ranges = pw_map_cache_range_add(ranges, n_ranges, mid->fd,
+					buffers[i].offset, buffers[i].size);
 	}
+	pw_map_cache_map_ranges(ranges, n_ranges, prot,
+			data->core->mem_flags | PW_MEMBLOCK_FLAG_LOCK);
+
+	return n_ranges;
 }
 
+/* remove mid from the map and close its fd when no other mem_id uses it. The
+ * ids stay in the map, the server hands them out again. mid is freed when no
+ * buffer uses it anymore. */
 static void clear_memid(struct node_data *data, struct mem_id *mid)
 {
+	if (mid->id != SPA_ID_INVALID) {
+		if (pw_map_lookup(&data->mem_ids, mid->id) == mid)
+			pw_map_insert_at(&data->mem_ids, mid->id, NULL);
+		mid->id = SPA_ID_INVALID;
+	}
 	if (mid->fd != -1) {
 		bool has_ref = false;
 		int fd;
+		union pw_map_item *item;
 		struct mem_id *m;
 
 		fd = mid->fd;
 		mid->fd = -1;
-		mid->id = SPA_ID_INVALID;
 
-		pw_array_for_each(m, &data->mem_ids) {
-			if (m->fd == fd) {
+		pw_array_for_each(item, &data->mem_ids.items) {
+			if ((m = item->data) != NULL && m->fd == fd) {
 				has_ref = true;
 				break;
 			}
 		}
 		if (!has_ref) {
-			mem_unmap(data, mid);
+			pw_map_cache_clear(fd);
 			close(fd);
 		}
 	}
+	if (mid->ref == 0)
+		free(mid);
+}
+
+static void clear_memids(struct node_data *data)
+{
+	union pw_map_item *item;
+
+	pw_array_for_each(item, &data->mem_ids.items) {
+		if (item->data != NULL)
+			clear_memid(data, item->data);
+	}
+}
+
+static void clear_peer(struct port_peer *peer)
+{
+	if (peer->activation) {
+		pw_memblock_free(peer->activation);
+		peer->activation = NULL;
+	}
+	if (peer->fd != -1) {
+		close(peer->fd);
+		peer->fd = -1;
+	}
 }
 
 static void clean_transport(struct pw_proxy *proxy)
 {
 	struct node_data *data = proxy->user_data;
 	struct pw_port *port;
-	struct mem_id *mid;
+	uint32_t i;
 
 	if (data->trans == NULL)
 		return;
@@ -631,10 +705,10 @@ static void clean_transport(struct pw_proxy *proxy)
 		spa_graph_port_remove(&data->out_ports[port->port_id].output);
 		spa_graph_port_remove(&data->out_ports[port->port_id].input);
 	}
+	for (i = 0; i < data->trans->area->max_output_ports; i++)
+		clear_peer(&data->out_ports[i].peer);
 
-	pw_array_for_each(mid, &data->mem_ids)
-		clear_memid(data, mid);
-	pw_array_clear(&data->mem_ids);
+	clear_memids(data);
 
 	free(data->in_ports);
 	free(data->out_ports);
@@ -649,6 +723,8 @@ static void port_init(struct port *port)
         pw_array_init(&port->buffer_ids, 32);
         pw_array_ensure_size(&port->buffer_ids, sizeof(struct buffer_id) * 64);
 	port->in_order = true;
+	port->peer.activation = NULL;
+	port->peer.fd = -1;
 }
 
 static struct port *find_port(struct node_data *data, enum spa_direction direction, uint32_t port_id)
@@ -673,22 +749,26 @@ static void client_node_add_mem(void *object,
 	struct node_data *data = proxy->user_data;
 	struct mem_id *m;
 
-	m = find_mem(&data->mem_ids, mem_id);
+	m = find_mem(data, mem_id);
 	if (m) {
 		pw_log_warn("duplicate mem %u, fd %d, flags %d",
 			     mem_id, memfd, flags);
 		return;
 	}
 
-	m = pw_array_add(&data->mem_ids, sizeof(struct mem_id));
+	m = calloc(1, sizeof(struct mem_id));
+	if (m == NULL || !pw_map_insert_at(&data->mem_ids, mem_id, m)) {
+		pw_log_error("can't add mem %u", mem_id);
+		free(m);
+		close(memfd);
+		return;
+	}
 	pw_log_debug("add mem %u, fd %d, flags %d", mem_id, memfd, flags);
 
 	m->id = mem_id;
 	m->fd = memfd;
 	m->flags = flags;
 	m->ref = 0;
-	m->map = PW_MAP_RANGE_INIT;
-	m->ptr = NULL;
 }
 
 static void client_node_transport(void *object, uint32_t node_id,
@@ -698,6 +778,7 @@ static void client_node_transport(void *object, uint32_t node_id,
 	struct pw_proxy *proxy = object;
 	struct node_data *data = proxy->user_data;
 	struct pw_port *port;
+	const char *str;
 	int i;
 
 	clean_transport(proxy);
@@ -757,6 +838,9 @@ static void client_node_transport(void *object, uint32_t node_id,
 		data->out_ports[port->port_id].port = port;
 	}
 
+	str = pw_properties_get(data->node->properties, PW_NODE_PROP_WAKEUP_SPIN);
+	data->spin = str ? atoi(str) : 0;
+
         data->rtwritefd = writefd;
         data->rtsocket_source = pw_loop_add_io(proxy->remote->core->data_loop,
                                                readfd,
@@ -844,16 +928,38 @@ static void node_need_input(void *data)
         uint64_t cmd = 1;
 	pw_client_node_transport_add_message(d->trans,
 				&PW_CLIENT_NODE_MESSAGE_INIT(PW_CLIENT_NODE_MESSAGE_NEED_INPUT));
-        write(d->rtwritefd, &cmd, 8);
+	if (pw_client_node_transport_need_wakeup(d->trans))
+		write(d->rtwritefd, &cmd, 8);
 }
 
 static void node_have_output(void *data)
 {
 	struct node_data *d = data;
         uint64_t cmd = 1;
+	uint32_t i;
+	bool direct = false;
+
+	for (i = 0; i < d->trans->area->max_output_ports; i++) {
+		struct port_peer *peer = &d->out_ports[i].peer;
+		struct spa_io_buffers io = d->trans->outputs[i];
+
+		if (peer->activation == NULL || io.status != SPA_STATUS_HAVE_BUFFER)
+			continue;
+
+		/* the server writes the recycled buffer here when the peer
+		 * needs input, clear it before activating the peer */
+		d->trans->outputs[i] = SPA_IO_BUFFERS_INIT;
+		if (pw_client_node_transport_activate(peer->activation->ptr, &io))
+			write(peer->fd, &cmd, 8);
+		direct = true;
+	}
+	if (direct)
+		return;
+
         pw_client_node_transport_add_message(d->trans,
                                &PW_CLIENT_NODE_MESSAGE_INIT(PW_CLIENT_NODE_MESSAGE_HAVE_OUTPUT));
-        write(d->rtwritefd, &cmd, 8);
+	if (pw_client_node_transport_need_wakeup(d->trans))
+		write(d->rtwritefd, &cmd, 8);
 }
 
 static void client_node_command(void *object, uint32_t seq, const struct spa_command *command)
@@ -967,10 +1073,8 @@ static void clear_buffers(struct node_data *data, struct port *port)
 	pw_port_use_buffers(port->port, NULL, 0);
 
         pw_array_for_each(bid, &port->buffer_ids) {
-		if (bid->ptr != NULL) {
-			if (munmap(bid->ptr, bid->map.size) < 0)
-				pw_log_warn("failed to unmap: %m");
-		}
+		if (bid->ptr != NULL)
+			pw_map_cache_unmap(bid->ptr);
 		if (bid->mem != NULL) {
 			for (i = 0; i < bid->n_mem; i++) {
 				if (--bid->mem[i]->ref == 0)
@@ -1001,6 +1105,8 @@ client_node_port_use_buffers(void *object,
 	struct pw_core *core = proxy->remote->core;
 	struct pw_type *t = &core->type;
 	int res, prot;
+	struct pw_map_cache_range *ranges;
+	uint32_t n_ranges;
 
 	port = find_port(data, direction, port_id);
 	if (port == NULL) {
@@ -1015,10 +1121,13 @@ client_node_port_use_buffers(void *object,
 
 	bufs = alloca(n_buffers * sizeof(struct spa_buffer *));
 
+	ranges = alloca(n_buffers * sizeof(struct pw_map_cache_range));
+	n_ranges = map_mem_ranges(data, ranges, n_buffers, buffers, prot);
+
 	for (i = 0; i < n_buffers; i++) {
 		off_t offset;
 
-		struct mem_id *mid = find_mem(&data->mem_ids, buffers[i].mem_id);
+		struct mem_id *mid = find_mem(data, buffers[i].mem_id);
 		if (mid == NULL) {
 			pw_log_error("unknown memory id %u", buffers[i].mem_id);
 			res = -EINVAL;
@@ -1028,19 +1137,14 @@ client_node_port_use_buffers(void *object,
 		len = pw_array_get_len(&port->buffer_ids, struct buffer_id);
 		bid = pw_array_add(&port->buffer_ids, sizeof(struct buffer_id));
 
-		pw_map_range_init(&bid->map, buffers[i].offset, buffers[i].size, core->sc_pagesize);
-
-		bid->ptr = mmap(NULL, bid->map.size, prot, MAP_SHARED, mid->fd, bid->map.offset);
-		if (bid->ptr == MAP_FAILED) {
-			bid->ptr = NULL;
+		bid->ptr = pw_map_cache_map(mid->fd, prot, buffers[i].offset, buffers[i].size,
+				core->mem_flags | PW_MEMBLOCK_FLAG_LOCK);
+		if (bid->ptr == NULL) {
 			pw_log_error("Failed to mmap memory %u %u %u %d: %m",
-				bid->map.offset, bid->map.size, buffers[i].mem_id, mid->fd);
+				buffers[i].offset, buffers[i].size, buffers[i].mem_id, mid->fd);
 			res = -errno;
 			goto cleanup;
 		}
-		if (mlock(bid->ptr, bid->map.size) < 0)
-			pw_log_warn("Failed to mlock memory %u %u: %m",
-					bid->map.offset, bid->map.size);
 
 		b = buffers[i].buffer;
 
@@ -1074,9 +1178,10 @@ client_node_port_use_buffers(void *object,
 		if (bid->id != len) {
 			pw_log_warn("unexpected id %u found, expected %u", bid->id, len);
 		}
-		pw_log_debug("add buffer %d %d %u %u", mid->id, bid->id, bid->map.offset, bid->map.size);
+		pw_log_debug("add buffer %d %d %u %u", mid->id, bid->id,
+				buffers[i].offset, buffers[i].size);
 
-		offset = bid->map.start;
+		offset = 0;
 		for (j = 0; j < b->n_metas; j++) {
 			struct spa_meta *m = &b->metas[j];
 			memcpy(m, &buffers[i].buffer->metas[j], sizeof(struct spa_meta));
@@ -1094,7 +1199,7 @@ client_node_port_use_buffers(void *object,
 
 			if (d->type == t->data.MemFd || d->type == t->data.DmaBuf) {
 				uint32_t id = SPA_PTR_TO_UINT32(d->data);
-				struct mem_id *bmid = find_mem(&data->mem_ids, id);
+				struct mem_id *bmid = find_mem(data, id);
 
 				if (bmid == NULL) {
 					pw_log_error("unknown buffer mem %u", id);
@@ -1108,8 +1213,7 @@ client_node_port_use_buffers(void *object,
 				bid->mem[bid->n_mem++] = bmid;
 				pw_log_debug(" data %d %u -> fd %d", j, bmid->id, bmid->fd);
 			} else if (d->type == t->data.MemPtr) {
-				d->data = SPA_MEMBER(bid->ptr,
-						bid->map.start + SPA_PTR_TO_INT(d->data), void);
+				d->data = SPA_MEMBER(bid->ptr, SPA_PTR_TO_INT(d->data), void);
 				d->fd = -1;
 				pw_log_debug(" data %d %u -> mem %p", j, bid->id, d->data);
 			} else {
@@ -1118,6 +1222,7 @@ client_node_port_use_buffers(void *object,
 		}
 		bufs[i] = b;
 	}
+	pw_map_cache_unmap_ranges(ranges, n_ranges);
 
 	res = pw_port_use_buffers(port->port, bufs, n_buffers);
 
@@ -1126,6 +1231,7 @@ client_node_port_use_buffers(void *object,
 	return;
 
      cleanup:
+	pw_map_cache_unmap_ranges(ranges, n_ranges);
 	clear_buffers(data, port);
 	goto done;
 
@@ -1174,7 +1280,7 @@ client_node_port_set_io(void *object,
 		size = 0;
 	}
 	else {
-		mid = find_mem(&data->mem_ids, memid);
+		mid = find_mem(data, memid);
 		if (mid == NULL) {
 			pw_log_warn("unknown memory id %u", memid);
 			return;
@@ -1195,6 +1301,46 @@ client_node_port_set_io(void *object,
 }
 
 
+struct set_peer {
+	struct port *port;
+	struct port_peer peer;
+};
+
+static int
+do_set_peer(struct spa_loop *loop,
+	    bool async, uint32_t seq, const void *data, size_t size, void *user_data)
+{
+	struct set_peer *sp = user_data;
+	struct port_peer tmp = sp->port->peer;
+
+	sp->port->peer = sp->peer;
+	sp->peer = tmp;
+	return 0;
+}
+
+static void client_node_port_set_peer(void *object,
+				      uint32_t port_id,
+				      int writefd,
+				      struct pw_memblock *activation)
+{
+	struct pw_proxy *proxy = object;
+	struct node_data *data = proxy->user_data;
+	struct set_peer sp = { NULL, { activation, writefd } };
+
+	if (data->trans == NULL || port_id >= data->trans->area->max_output_ports) {
+		pw_log_warn("node %p: unknown output port %d", proxy, port_id);
+		clear_peer(&sp.peer);
+		return;
+	}
+
+	pw_log_debug("node %p: port %d peer %p", proxy, port_id, activation);
+
+	/* swap in the new peer, the data thread might be activating the old one */
+	sp.port = &data->out_ports[port_id];
+	pw_loop_invoke(data->core->data_loop, do_set_peer, SPA_ID_INVALID, NULL, 0, true, &sp);
+	clear_peer(&sp.peer);
+}
+
 static const struct pw_client_node_proxy_events client_node_events = {
 	PW_VERSION_CLIENT_NODE_PROXY_EVENTS,
 	.add_mem = client_node_add_mem,
@@ -1208,6 +1354,7 @@ static const struct pw_client_node_proxy_events client_node_events = {
 	.port_use_buffers = client_node_port_use_buffers,
 	.port_command = client_node_port_command,
 	.port_set_io = client_node_port_set_io,
+	.port_set_peer = client_node_port_set_peer,
 };
 
 static void do_node_init(struct pw_proxy *proxy)
@@ -1279,6 +1426,8 @@ static void node_proxy_destroy(void *_data)
 			clear_port(data, &data->out_ports[i]);
 	}
 	clean_transport(proxy);
+	clear_memids(data);
+	pw_map_clear(&data->mem_ids);
 
 	spa_hook_remove(&data->node_listener);
 }
@@ -1343,8 +1492,7 @@ struct pw_proxy *pw_remote_export(struct pw_remote *remote,
 	data->in_node_impl = node_impl;
 	data->out_node_impl = node_impl;
 
-        pw_array_init(&data->mem_ids, 64);
-        pw_array_ensure_size(&data->mem_ids, sizeof(struct mem_id) * 64);
+	pw_map_init(&data->mem_ids, 64, 64);
 
 	spa_graph_node_init(&data->in_node);
 	spa_graph_node_set_implementation(&data->in_node, &data->in_node_impl);
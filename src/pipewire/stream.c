@@ -23,8 +23,11 @@
 #include <sys/mman.h>
 #include <errno.h>
 #include <time.h>
+#include <math.h>
 
 #include "spa/utils/ringbuffer.h"
+#include "spa/param/props.h"
+#include "spa/node/io.h"
 
 #include "pipewire/pipewire.h"
 #include "pipewire/private.h"
@@ -40,25 +43,24 @@
 #define MASK_BUFFERS	(MAX_BUFFERS-1)
 #define MIN_QUEUED	1
 
-#define MAX_PORTS	1
+#define MAX_PORTS	64
+#define MAX_CONTROLS	8
 
 struct mem {
 	uint32_t id;
 	int fd;
 	uint32_t flags;
 	uint32_t ref;
-	struct pw_map_range map;
-	void *ptr;
 };
 
 struct buffer {
 	struct pw_buffer buffer;
+	struct port *port;
 	uint32_t id;
 #define BUFFER_FLAG_MAPPED	(1 << 0)
 #define BUFFER_FLAG_QUEUED	(1 << 1)
 	uint32_t flags;
-	void *ptr;
-	struct pw_map_range map;
+	void *ptr;		/* the buffer in the mapping of the buffer mem */
 	uint32_t n_mem;
 	struct mem **mem;
 };
@@ -70,6 +72,78 @@ struct queue {
 	uint64_t outcount;
 };
 
+/* input port of another client that the output port activates directly */
+struct port_peer {
+	struct pw_memblock *activation;
+	int fd;
+};
+
+struct port {
+	uint32_t id;
+
+	uint32_t n_params;
+	struct spa_pod **params;
+
+	struct spa_pod *format;
+
+	struct spa_io_buffers *io;
+
+	struct port_peer peer;
+
+	struct queue dequeue;
+	struct queue queue;
+
+	struct buffer buffers[MAX_BUFFERS];
+	uint32_t n_buffers;
+};
+
+/* the controls that a stream can export, the values are written to the
+ * memory of the control io so they reach the linked node without a message */
+static const struct control_info {
+	const char *name;
+	const char *prop;
+	const char *io;
+	uint32_t type;		/* SPA_POD_TYPE_DOUBLE or SPA_POD_TYPE_INT */
+	float min;
+	float max;
+} control_info[] = {
+	{ PW_STREAM_CONTROL_VOLUME, SPA_TYPE_PROPS__volume,
+		SPA_TYPE_IO_PROP_BASE "volume", SPA_POD_TYPE_DOUBLE, 0.0, 10.0 },
+	{ PW_STREAM_CONTROL_CONTRAST, SPA_TYPE_PROPS__contrast,
+		SPA_TYPE_IO_PROP_BASE "contrast", SPA_POD_TYPE_INT, },
+	{ PW_STREAM_CONTROL_BRIGHTNESS, SPA_TYPE_PROPS__brightness,
+		SPA_TYPE_IO_PROP_BASE "brightness", SPA_POD_TYPE_INT, },
+	{ PW_STREAM_CONTROL_HUE, SPA_TYPE_PROPS__hue,
+		SPA_TYPE_IO_PROP_BASE "hue", SPA_POD_TYPE_INT, },
+	{ PW_STREAM_CONTROL_SATURATION, SPA_TYPE_PROPS__saturation,
+		SPA_TYPE_IO_PROP_BASE "saturation", SPA_POD_TYPE_INT, },
+};
+
+struct control {
+	const struct control_info *info;
+	uint32_t prop_id;
+	uint32_t io_id;
+	float value;
+	void *io;		/* struct spa_pod_double or spa_pod_int */
+};
+
+/* time info that is written by one thread and read from any thread.
+ * The writer makes seq odd while it updates, readers retry when seq was
+ * odd or changed while reading so that they never block the writer. */
+struct clock_info {
+	uint32_t seq;
+	struct pw_time time;
+};
+
+struct cycle_info {
+	uint32_t seq;
+	int64_t time;
+	uint64_t count;
+};
+
+/* weight of a new rate measurement in the filtered rate */
+#define RATE_FILTER	(1.0 / 8.0)
+
 struct stream {
 	struct pw_stream this;
 
@@ -78,19 +152,18 @@ struct stream {
 	uint32_t n_init_params;
 	struct spa_pod **init_params;
 
-	uint32_t n_params;
-	struct spa_pod **params;
-
-	struct spa_pod *format;
-
 	struct spa_port_info port_info;
 	enum spa_direction direction;
-	uint32_t port_id;
 	uint32_t pending_seq;
+	struct port *pending_port;
+
+	struct port *ports;
+	uint32_t n_ports;
 
 	enum pw_stream_flags flags;
 
 	int rtwritefd;
+	uint32_t spin;
 	struct spa_source *rtsocket_source;
 
 	struct pw_client_node_proxy *node_proxy;
@@ -102,78 +175,62 @@ struct stream {
 
 	struct spa_source *timeout_source;
 
-	struct pw_array mem_ids;
-
-	struct spa_io_buffers *io;
+	struct pw_map mems;		/* struct mem indexed by the mem id */
 
 	bool client_reuse;
-	struct queue dequeue;
-	struct queue queue;
 	bool in_process;
 
-	struct buffer buffers[MAX_BUFFERS];
-	int n_buffers;
+	struct control controls[MAX_CONTROLS];
+	uint32_t n_controls;
+
+	struct clock_info clock;	/* written from the main thread */
+	struct cycle_info cycle;	/* written from the data thread */
 
-	struct pw_time last_time;
+	int64_t rate_now;
+	uint64_t rate_ticks;
+	int32_t rate_denom;
+	double rate_diff;
 };
 /** \endcond */
 
 static struct mem *find_mem(struct pw_stream *stream, uint32_t id)
 {
 	struct stream *impl = SPA_CONTAINER_OF(stream, struct stream, this);
-	struct mem *m;
-
-	pw_array_for_each(m, &impl->mem_ids) {
-		if (m->id == id)
-			return m;
-	}
-	return NULL;
+	return pw_map_lookup(&impl->mems, id);
 }
 
+/* the mappings are shared with the buffers in the same mem and are kept until
+ * the mem is cleared */
 static void *mem_map(struct pw_stream *stream, struct mem *m, uint32_t offset, uint32_t size)
 {
-	if (m->ptr == NULL) {
-		pw_map_range_init(&m->map, offset, size, stream->remote->core->sc_pagesize);
-
-		m->ptr = mmap(NULL, m->map.size, PROT_READ|PROT_WRITE,
-				MAP_SHARED, m->fd, m->map.offset);
-
-		if (m->ptr == MAP_FAILED) {
-			pw_log_error("stream %p: Failed to mmap memory %d %p: %m", stream, size, m);
-			m->ptr = NULL;
-			return NULL;
-		}
-	}
-	return SPA_MEMBER(m->ptr, m->map.start, void);
-}
+	void *ptr;
 
-static void mem_unmap(struct stream *impl, struct mem *m)
-{
-	if (m->ptr != NULL) {
-		if (munmap(m->ptr, m->map.size) < 0)
-			pw_log_warn("stream %p: failed to unmap: %m", impl);
-		m->ptr = NULL;
-	}
+	ptr = pw_map_cache_map(m->fd, PROT_READ|PROT_WRITE, offset, size,
+			stream->remote->core->mem_flags);
+	if (ptr == NULL)
+		pw_log_error("stream %p: Failed to mmap memory %d %p: %m", stream, size, m);
+	return ptr;
 }
 
 static void clear_mem(struct stream *impl, struct mem *m)
 {
 	if (m->fd != -1) {
 		bool has_ref = false;
+		union pw_map_item *item;
 		struct mem *m2;
 		int fd;
 
 		fd = m->fd;
 		m->fd = -1;
 
-		pw_array_for_each(m2, &impl->mem_ids) {
-			if (m2->fd == fd) {
+		pw_array_for_each(item, &impl->mems.items) {
+			if ((m2 = item->data) != NULL && m2->fd == fd) {
 				has_ref = true;
 				break;
 			}
 		}
 		if (!has_ref) {
-			mem_unmap(impl, m);
+			pw_map_cache_clear(fd);
 			close(fd);
 		}
 	}
@@ -182,63 +239,64 @@ static void clear_mem(struct stream *impl, struct mem *m)
 static void clear_mems(struct pw_stream *stream)
 {
 	struct stream *impl = SPA_CONTAINER_OF(stream, struct stream, this);
+	union pw_map_item *item;
 	struct mem *m;
 
-	pw_array_for_each(m, &impl->mem_ids)
+	/* the ids stay in the map, the server hands them out again */
+	pw_array_for_each(item, &impl->mems.items) {
+		if ((m = item->data) == NULL)
+			continue;
+		item->data = NULL;
 		clear_mem(impl, m);
-	impl->mem_ids.size = 0;
+		free(m);
+	}
 }
 
 static int map_data(struct stream *impl, struct spa_data *data, int prot)
 {
 	void *ptr;
-	struct pw_map_range range;
-
-	pw_map_range_init(&range, data->mapoffset, data->maxsize,
-			impl->this.remote->core->sc_pagesize);
 
-	ptr = mmap(NULL, range.size, prot, MAP_SHARED, data->fd, range.offset);
-	if (ptr == MAP_FAILED) {
+	ptr = pw_map_cache_map(data->fd, prot, data->mapoffset, data->maxsize,
+			impl->this.remote->core->mem_flags);
+	if (ptr == NULL) {
 		pw_log_error("stream %p: failed to mmap buffer mem: %m", impl);
 		return -errno;
 	}
-	data->data = SPA_MEMBER(ptr, range.start, void);
+	data->data = ptr;
 	pw_log_debug("stream %p: fd %d mapped %d %d %p", impl, data->fd,
-			range.offset, range.size, data->data);
+			data->mapoffset, data->maxsize, data->data);
 	return 0;
 }
 
 static int unmap_data(struct stream *impl, struct spa_data *data)
 {
-	struct pw_map_range range;
-
-	pw_map_range_init(&range, data->mapoffset, data->maxsize,
-			impl->this.remote->core->sc_pagesize);
-
-	if (munmap(SPA_MEMBER(data->data, -range.start, void), range.size) < 0)
-		pw_log_warn("failed to unmap: %m");
+	pw_map_cache_unmap(data->data);
 
 	pw_log_debug("stream %p: fd %d unmapped", impl, data->fd);
 	data->data = NULL;
 	return 0;
 }
 
-static void clear_buffers(struct pw_stream *stream)
+static void clear_buffers(struct pw_stream *stream, struct port *port)
 {
 	struct stream *impl = SPA_CONTAINER_OF(stream, struct stream, this);
 	struct buffer *b;
 	int i, j;
 
-	pw_log_debug("stream %p: clear %d buffers", stream, impl->n_buffers);
+	pw_log_debug("stream %p: port %d clear %d buffers", stream, port->id, port->n_buffers);
 
-	for (i = 0; i < impl->n_buffers; i++) {
-		b = &impl->buffers[i];
+	for (i = 0; i < port->n_buffers; i++) {
+		b = &port->buffers[i];
 
 		pw_stream_events_remove_buffer(stream, &b->buffer);
 
 		if (SPA_FLAG_CHECK(b->flags, BUFFER_FLAG_MAPPED)) {
 			for (j = 0; j < b->buffer.buffer->n_datas; j++) {
 				struct spa_data *d = &b->buffer.buffer->datas[j];
+
+				if (d->fd == -1 || d->data == NULL)
+					continue;
+
 				pw_log_debug("stream %p: clear buffer %d mem",
 						stream, b->id);
 				unmap_data(impl, d);
@@ -246,19 +304,26 @@ static void clear_buffers(struct pw_stream *stream)
 		}
 
 		if (b->ptr != NULL)
-			if (munmap(b->ptr, b->map.size) < 0)
-				pw_log_warn("failed to unmap buffer: %m");
+			pw_map_cache_unmap(b->ptr);
 		b->ptr = NULL;
 		free(b->buffer.buffer);
 		b->buffer.buffer = NULL;
 	}
-	impl->n_buffers = 0;
-	spa_ringbuffer_init(&impl->queue.ring);
-	spa_ringbuffer_init(&impl->dequeue.ring);
+	port->n_buffers = 0;
+	spa_ringbuffer_init(&port->queue.ring);
+	spa_ringbuffer_init(&port->dequeue.ring);
+}
 
+static void clear_all_buffers(struct pw_stream *stream)
+{
+	struct stream *impl = SPA_CONTAINER_OF(stream, struct stream, this);
+	uint32_t i;
+
+	for (i = 0; i < impl->n_ports; i++)
+		clear_buffers(stream, &impl->ports[i]);
 }
 
-static inline int push_queue(struct stream *stream, struct queue *queue, struct buffer *buffer)
+static inline int push_queue(struct port *port, struct queue *queue, struct buffer *buffer)
 {
 	uint32_t index;
 	int32_t filled;
@@ -273,12 +338,12 @@ static inline int push_queue(struct stream *stream, struct queue *queue, struct
 	queue->ids[index & MASK_BUFFERS] = buffer->id;
 	spa_ringbuffer_write_update(&queue->ring, index + 1);
 
-	pw_log_trace("stream %p: queued buffer %d %d", stream, buffer->id, filled);
+	pw_log_trace("port %d: queued buffer %d %d", port->id, buffer->id, filled);
 
 	return filled;
 }
 
-static inline struct buffer *pop_queue(struct stream *stream, struct queue *queue)
+static inline struct buffer *pop_queue(struct port *port, struct queue *queue)
 {
 	int32_t avail;
 	uint32_t index, id;
@@ -290,15 +355,102 @@ static inline struct buffer *pop_queue(struct stream *stream, struct queue *queu
 	id = queue->ids[index & MASK_BUFFERS];
 	spa_ringbuffer_read_update(&queue->ring, index + 1);
 
-	buffer = &stream->buffers[id];
+	buffer = &port->buffers[id];
 	queue->outcount += buffer->buffer.size;
 	SPA_FLAG_UNSET(buffer->flags, BUFFER_FLAG_QUEUED);
 
-	pw_log_trace("stream %p: dequeued buffer %d %d", stream, id, avail);
+	pw_log_trace("port %d: dequeued buffer %d %d", port->id, id, avail);
 
 	return buffer;
 }
 
+/* queue the buffers with one update of the ringbuffer, none of the buffers
+ * may be queued already. Returns the number of queued buffers. */
+static inline uint32_t push_queue_n(struct port *port, struct queue *queue,
+				    struct buffer **buffers, uint32_t n_buffers)
+{
+	uint32_t i, index;
+	int32_t filled;
+
+	filled = spa_ringbuffer_get_write_index(&queue->ring, &index);
+	for (i = 0; i < n_buffers; i++) {
+		struct buffer *b = buffers[i];
+
+		SPA_FLAG_SET(b->flags, BUFFER_FLAG_QUEUED);
+		queue->incount += b->buffer.size;
+		queue->ids[(index + i) & MASK_BUFFERS] = b->id;
+	}
+	spa_ringbuffer_write_update(&queue->ring, index + n_buffers);
+
+	pw_log_trace("port %d: queued %d buffers %d", port->id, n_buffers, filled);
+
+	return n_buffers;
+}
+
+/* dequeue up to n_buffers buffers with one update of the ringbuffer */
+static inline uint32_t pop_queue_n(struct port *port, struct queue *queue,
+				   struct buffer **buffers, uint32_t n_buffers)
+{
+	int32_t avail;
+	uint32_t i, index, n;
+
+	if ((avail = spa_ringbuffer_get_read_index(&queue->ring, &index)) < MIN_QUEUED)
+		return 0;
+
+	n = SPA_MIN((uint32_t) avail, n_buffers);
+	for (i = 0; i < n; i++) {
+		struct buffer *b = &port->buffers[queue->ids[(index + i) & MASK_BUFFERS]];
+
+		queue->outcount += b->buffer.size;
+		SPA_FLAG_UNSET(b->flags, BUFFER_FLAG_QUEUED);
+		buffers[i] = b;
+	}
+	spa_ringbuffer_read_update(&queue->ring, index + n);
+
+	pw_log_trace("port %d: dequeued %d buffers %d", port->id, n, avail);
+
+	return n;
+}
+
+static inline void seq_write_begin(uint32_t *seq)
+{
+	__atomic_store_n(seq, *seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static inline void seq_write_end(uint32_t *seq)
+{
+	__atomic_store_n(seq, *seq + 1, __ATOMIC_RELEASE);
+}
+
+static inline uint32_t seq_read_begin(uint32_t *seq)
+{
+	uint32_t s;
+
+	while ((s = __atomic_load_n(seq, __ATOMIC_ACQUIRE)) & 1)
+		;
+	return s;
+}
+
+static inline bool seq_read_retry(uint32_t *seq, uint32_t s)
+{
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	return __atomic_load_n(seq, __ATOMIC_RELAXED) != s;
+}
+
+/* called from the data thread at the start of each processing cycle */
+static inline void mark_cycle(struct stream *impl)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	seq_write_begin(&impl->cycle.seq);
+	impl->cycle.time = SPA_TIMESPEC_TO_TIME(&ts);
+	impl->cycle.count++;
+	seq_write_end(&impl->cycle.seq);
+}
+
 static bool stream_set_state(struct pw_stream *stream, enum pw_stream_state state, char *error)
 {
 	enum pw_stream_state old = stream->state;
@@ -318,14 +470,28 @@ static bool stream_set_state(struct pw_stream *stream, enum pw_stream_state stat
 	return res;
 }
 
-static struct buffer *get_buffer(struct pw_stream *stream, uint32_t id)
+static struct buffer *get_buffer(struct port *port, uint32_t id)
 {
-	struct stream *impl = SPA_CONTAINER_OF(stream, struct stream, this);
-	if (id < impl->n_buffers)
-		return &impl->buffers[id];
+	if (id < port->n_buffers)
+		return &port->buffers[id];
 	return NULL;
 }
 
+static struct port *get_port(struct stream *impl, enum spa_direction direction, uint32_t port_id)
+{
+	if (direction != impl->direction || port_id >= impl->n_ports)
+		return NULL;
+	return &impl->ports[port_id];
+}
+
+static void init_port(struct port *port, uint32_t id)
+{
+	port->id = id;
+	port->peer.fd = -1;
+	spa_ringbuffer_init(&port->queue.ring);
+	spa_ringbuffer_init(&port->dequeue.ring);
+}
+
 static int
 do_call_process(struct spa_loop *loop,
                  bool async, uint32_t seq, const void *data, size_t size, void *user_data)
@@ -384,6 +550,12 @@ struct pw_stream *pw_stream_new(struct pw_remote *remote,
 	this = &impl->this;
 	pw_log_debug("stream %p: new", impl);
 
+	impl->ports = calloc(1, sizeof(struct port));
+	if (impl->ports == NULL)
+		goto no_mem;
+	impl->n_ports = 1;
+	init_port(&impl->ports[0], 0);
+
 	if (props == NULL) {
 		props = pw_properties_new("media.name", name, NULL);
 	} else if (!pw_properties_get(props, "media.name")) {
@@ -406,19 +578,17 @@ struct pw_stream *pw_stream_new(struct pw_remote *remote,
 
 	this->state = PW_STREAM_STATE_UNCONNECTED;
 
-	pw_array_init(&impl->mem_ids, 64);
-	pw_array_ensure_size(&impl->mem_ids, sizeof(struct mem) * 64);
+	pw_map_init(&impl->mems, 64, 64);
 
 	impl->pending_seq = SPA_ID_INVALID;
-
-	spa_ringbuffer_init(&impl->queue.ring);
-	spa_ringbuffer_init(&impl->dequeue.ring);
+	impl->rate_diff = 1.0;
 
 	spa_list_append(&remote->stream_list, &this->link);
 
 	return this;
 
       no_mem:
+	free(impl->ports);
 	free(impl);
 	return NULL;
 }
@@ -455,12 +625,25 @@ void pw_stream_add_listener(struct pw_stream *stream,
 	spa_hook_list_append(&stream->listener_list, listener, events, data);
 }
 
+static void clear_peer(struct port_peer *peer)
+{
+	if (peer->activation) {
+		pw_memblock_free(peer->activation);
+		peer->activation = NULL;
+	}
+	if (peer->fd != -1) {
+		close(peer->fd);
+		peer->fd = -1;
+	}
+}
+
 static int
 do_remove_sources(struct spa_loop *loop,
                   bool async, uint32_t seq, const void *data, size_t size, void *user_data)
 {
 	struct stream *impl = user_data;
 	struct pw_stream *stream = &impl->this;
+	uint32_t i;
 
 	if (impl->rtsocket_source) {
 		pw_loop_destroy_source(stream->remote->core->data_loop, impl->rtsocket_source);
@@ -470,6 +653,8 @@ do_remove_sources(struct spa_loop *loop,
 		close(impl->rtwritefd);
 		impl->rtwritefd = -1;
 	}
+	for (i = 0; i < impl->n_ports; i++)
+		clear_peer(&impl->ports[i].peer);
 	return 0;
 }
 
@@ -507,22 +692,21 @@ set_init_params(struct pw_stream *stream,
 	}
 }
 
-static void set_params(struct pw_stream *stream, int n_params, const struct spa_pod **params)
+static void set_params(struct port *port, int n_params, const struct spa_pod **params)
 {
-	struct stream *impl = SPA_CONTAINER_OF(stream, struct stream, this);
 	int i;
 
-	if (impl->params) {
-		for (i = 0; i < impl->n_params; i++)
-			free(impl->params[i]);
-		free(impl->params);
-		impl->params = NULL;
+	if (port->params) {
+		for (i = 0; i < port->n_params; i++)
+			free(port->params[i]);
+		free(port->params);
+		port->params = NULL;
 	}
-	impl->n_params = n_params;
+	port->n_params = n_params;
 	if (n_params > 0) {
-		impl->params = malloc(n_params * sizeof(struct spa_pod *));
+		port->params = malloc(n_params * sizeof(struct spa_pod *));
 		for (i = 0; i < n_params; i++)
-			impl->params[i] = pw_spa_pod_copy(params[i]);
+			port->params[i] = pw_spa_pod_copy(params[i]);
 	}
 }
 
@@ -538,7 +722,9 @@ void pw_stream_destroy(struct pw_stream *stream)
 
 	spa_list_remove(&stream->link);
 
-	pw_array_clear(&impl->mem_ids);
+	clear_mems(stream);
+	pw_map_clear(&impl->mems);
+	free(impl->ports);
 
 	if (stream->error)
 		free(stream->error);
@@ -558,39 +744,71 @@ static void add_node_update(struct pw_stream *stream, uint32_t change_mask)
 	uint32_t max_input_ports = 0, max_output_ports = 0;
 
 	if (change_mask & PW_CLIENT_NODE_UPDATE_MAX_INPUTS)
-		max_input_ports = impl->direction == SPA_DIRECTION_INPUT ? 1 : 0;
+		max_input_ports = impl->direction == SPA_DIRECTION_INPUT ? impl->n_ports : 0;
 	if (change_mask & PW_CLIENT_NODE_UPDATE_MAX_OUTPUTS)
-		max_output_ports = impl->direction == SPA_DIRECTION_OUTPUT ? 1 : 0;
+		max_output_ports = impl->direction == SPA_DIRECTION_OUTPUT ? impl->n_ports : 0;
 
 	pw_client_node_proxy_update(impl->node_proxy,
 				    change_mask, max_input_ports, max_output_ports,
 				    0, NULL);
 }
 
-static void add_port_update(struct pw_stream *stream, uint32_t change_mask)
+static struct spa_pod *build_control_param(struct pw_stream *stream, struct spa_pod_builder *b,
+					   struct control *c)
+{
+	struct pw_type *t = &stream->remote->core->type;
+
+	if (c->info->type == SPA_POD_TYPE_DOUBLE)
+		return spa_pod_builder_object(b,
+			t->param_io.idPropsOut, t->param_io.Prop,
+			":", t->param_io.id, "I", c->io_id,
+			":", t->param_io.size, "i", sizeof(struct spa_pod_double),
+			":", t->param.propId, "I", c->prop_id,
+			":", t->param.propType, "dru", (double) c->value,
+				SPA_POD_PROP_MIN_MAX((double) c->info->min, (double) c->info->max));
+	else
+		return spa_pod_builder_object(b,
+			t->param_io.idPropsOut, t->param_io.Prop,
+			":", t->param_io.id, "I", c->io_id,
+			":", t->param_io.size, "i", sizeof(struct spa_pod_int),
+			":", t->param.propId, "I", c->prop_id,
+			":", t->param.propType, "i", (int32_t) lrintf(c->value));
+}
+
+static void add_port_update(struct pw_stream *stream, struct port *port, uint32_t change_mask)
 {
 	struct stream *impl = SPA_CONTAINER_OF(stream, struct stream, this);
 	uint32_t n_params;
 	struct spa_pod **params;
 	int i, j;
 
-	n_params = impl->n_params + impl->n_init_params;
-	if (impl->format)
+	uint8_t buffer[256 * MAX_CONTROLS];
+	struct spa_pod_builder b = SPA_POD_BUILDER_INIT(buffer, sizeof(buffer));
+
+	n_params = port->n_params + impl->n_init_params;
+	if (port->format)
 		n_params += 1;
+	/* the controls are on the first port */
+	if (port->id == 0)
+		n_params += impl->n_controls;
 
 	params = alloca(n_params * sizeof(struct spa_pod *));
 
 	j = 0;
 	for (i = 0; i < impl->n_init_params; i++)
 		params[j++] = impl->init_params[i];
-	if (impl->format)
-		params[j++] = impl->format;
-	for (i = 0; i < impl->n_params; i++)
-		params[j++] = impl->params[i];
+	if (port->format)
+		params[j++] = port->format;
+	for (i = 0; i < port->n_params; i++)
+		params[j++] = port->params[i];
+	if (port->id == 0) {
+		for (i = 0; i < impl->n_controls; i++)
+			params[j++] = build_control_param(stream, &b, &impl->controls[i]);
+	}
 
 	pw_client_node_proxy_port_update(impl->node_proxy,
 					 impl->direction,
-					 impl->port_id,
+					 port->id,
 					 change_mask,
 					 n_params,
 					 (const struct spa_pod **) params,
@@ -605,29 +823,75 @@ static inline void send_need_input(struct pw_stream *stream)
 	pw_log_trace("send");
 	pw_client_node_transport_add_message(impl->trans,
 			       &PW_CLIENT_NODE_MESSAGE_INIT(PW_CLIENT_NODE_MESSAGE_NEED_INPUT));
-	write(impl->rtwritefd, &cmd, 8);
+	if (pw_client_node_transport_need_wakeup(impl->trans))
+		write(impl->rtwritefd, &cmd, 8);
 }
 
 static inline void send_have_output(struct pw_stream *stream)
 {
 	struct stream *impl = SPA_CONTAINER_OF(stream, struct stream, this);
 	uint64_t cmd = 1;
+	uint32_t i;
+	bool direct = false;
+
+	for (i = 0; i < impl->n_ports; i++) {
+		struct port *port = &impl->ports[i];
+		struct spa_io_buffers io;
+
+		if (port->peer.activation == NULL)
+			continue;
+
+		direct = true;
+		io = impl->trans->outputs[i];
+		if (io.status != SPA_STATUS_HAVE_BUFFER)
+			continue;
+
+		/* the server writes the recycled buffer here when the peer
+		 * needs input, clear it before activating the peer */
+		impl->trans->outputs[i] = SPA_IO_BUFFERS_INIT;
+		pw_log_trace("activate peer %d", io.buffer_id);
+		if (pw_client_node_transport_activate(port->peer.activation->ptr, &io))
+			write(port->peer.fd, &cmd, 8);
+	}
+	if (direct)
+		return;
 
 	pw_log_trace("send");
 	pw_client_node_transport_add_message(impl->trans,
 			       &PW_CLIENT_NODE_MESSAGE_INIT(PW_CLIENT_NODE_MESSAGE_HAVE_OUTPUT));
-	write(impl->rtwritefd, &cmd, 8);
+	if (pw_client_node_transport_need_wakeup(impl->trans))
+		write(impl->rtwritefd, &cmd, 8);
 }
 
-static inline void send_reuse_buffer(struct pw_stream *stream, uint32_t id)
+static inline void send_reuse_buffer(struct pw_stream *stream, struct port *port, uint32_t id)
 {
 	struct stream *impl = SPA_CONTAINER_OF(stream, struct stream, this);
 	uint64_t cmd = 1;
 
 	pw_log_trace("send");
-	pw_client_node_transport_add_message(impl->trans, (struct pw_client_node_message*)
-			       &PW_CLIENT_NODE_MESSAGE_PORT_REUSE_BUFFER_INIT(impl->port_id, id));
-	write(impl->rtwritefd, &cmd, 8);
+	if (pw_client_node_transport_reuse_buffer(impl->trans, SPA_DIRECTION_INPUT,
+						  port->id, id) > 0 &&
+	    pw_client_node_transport_need_wakeup(impl->trans))
+		write(impl->rtwritefd, &cmd, 8);
+}
+
+static inline void send_reuse_buffers(struct pw_stream *stream, struct port *port,
+				      struct buffer **buffers, uint32_t n_buffers)
+{
+	struct stream *impl = SPA_CONTAINER_OF(stream, struct stream, this);
+	uint64_t cmd = 1;
+	uint32_t i;
+	bool added = false;
+
+	/* the reused buffers are coalesced in one message */
+	for (i = 0; i < n_buffers; i++) {
+		if (pw_client_node_transport_reuse_buffer(impl->trans, SPA_DIRECTION_INPUT,
+							  port->id, buffers[i]->id) > 0)
+			added = true;
+	}
+	pw_log_trace("send %d", n_buffers);
+	if (added && pw_client_node_transport_need_wakeup(impl->trans))
+		write(impl->rtwritefd, &cmd, 8);
 }
 
 static void add_async_complete(struct pw_stream *stream, uint32_t seq, int res)
@@ -641,12 +905,16 @@ static void do_node_init(struct pw_stream *stream)
 {
 	struct stream *impl = SPA_CONTAINER_OF(stream, struct stream, this);
 
+	uint32_t i;
+
 	add_node_update(stream, PW_CLIENT_NODE_UPDATE_MAX_INPUTS |
 			PW_CLIENT_NODE_UPDATE_MAX_OUTPUTS);
 
 	impl->port_info.flags = SPA_PORT_INFO_FLAG_CAN_USE_BUFFERS;
 
-	add_port_update(stream, PW_CLIENT_NODE_PORT_UPDATE_PARAMS |
+	for (i = 0; i < impl->n_ports; i++)
+		add_port_update(stream, &impl->ports[i],
+				PW_CLIENT_NODE_PORT_UPDATE_PARAMS |
 				PW_CLIENT_NODE_PORT_UPDATE_INFO);
 
 	add_async_complete(stream, 0, 0);
@@ -672,24 +940,26 @@ static void on_timeout(void *data, uint64_t expirations)
 	add_request_clock_update(stream);
 }
 
-static inline void reuse_buffer(struct pw_stream *stream, uint32_t id)
+static inline void reuse_buffer(struct pw_stream *stream, struct port *port, uint32_t id)
 {
-	struct stream *impl = SPA_CONTAINER_OF(stream, struct stream, this);
 	struct buffer *b;
 
-	if ((b = get_buffer(stream, id)) &&
+	if ((b = get_buffer(port, id)) &&
 	    !SPA_FLAG_CHECK(b->flags, BUFFER_FLAG_QUEUED)) {
-		pw_log_trace("stream %p: reuse buffer %u", stream, id);
-		push_queue(impl, &impl->dequeue, b);
+		pw_log_trace("stream %p: port %d reuse buffer %u", stream, port->id, id);
+		push_queue(port, &port->dequeue, b);
 	}
 }
 
+/* process all ports and call the process callback once for the cycle */
 static int process_input(struct pw_stream *stream)
 {
 	struct stream *impl = SPA_CONTAINER_OF(stream, struct stream, this);
-	int i;
+	uint32_t i, n_ports = SPA_MIN(impl->trans->area->n_input_ports, impl->n_ports);
+	bool have_buffer = false;
 
-	for (i = 0; i < impl->trans->area->n_input_ports; i++) {
+	for (i = 0; i < n_ports; i++) {
+		struct port *port = &impl->ports[i];
 		struct spa_io_buffers *input = &impl->trans->inputs[i];
 		struct buffer *b;
 		uint32_t buffer_id;
@@ -698,68 +968,84 @@ static int process_input(struct pw_stream *stream)
 		buffer_id = input->buffer_id;
 		status = input->status;
 
-		pw_log_trace("stream %p: process input %d %d", stream, status,
+		pw_log_trace("stream %p: process input %d %d %d", stream, i, status,
 			     buffer_id);
 
 		if (status != SPA_STATUS_HAVE_BUFFER)
 			goto done;
 
-		if ((b = get_buffer(stream, buffer_id)) == NULL)
+		if ((b = get_buffer(port, buffer_id)) == NULL)
 			goto done;
 
-		if (push_queue(impl, &impl->dequeue, b) >= 0)
-			call_process(impl);
+		if (push_queue(port, &port->dequeue, b) >= 0)
+			have_buffer = true;
 
 	      done:
 		/* pop buffer to recycle if we can */
-		b = pop_queue(impl, &impl->queue);
+		b = pop_queue(port, &port->queue);
 		input->buffer_id = b ? b->id : SPA_ID_INVALID;
 		input->status = SPA_STATUS_NEED_BUFFER;
 
 		pw_log_trace("stream %p: reuse %d", stream, input->buffer_id);
 	}
+	if (have_buffer)
+		call_process(impl);
+
 	return SPA_STATUS_NEED_BUFFER;
 }
 
 static int process_output(struct pw_stream *stream)
 {
-	int i, res = 0;
 	struct stream *impl = SPA_CONTAINER_OF(stream, struct stream, this);
+	uint32_t i, index, n_ports = SPA_MIN(impl->trans->area->n_output_ports, impl->n_ports);
+	bool again;
+	int res;
 
-	for (i = 0; i < impl->trans->area->n_output_ports; i++) {
-		struct spa_io_buffers *io = &impl->trans->outputs[i];
-		struct buffer *b;
-		uint32_t index;
-
-	      again:
-		pw_log_trace("stream %p: process out %d %d", stream,
-				io->status, io->buffer_id);
-
-		if (io->status != SPA_STATUS_HAVE_BUFFER) {
-			/* recycle old buffer */
-			if ((b = get_buffer(stream, io->buffer_id)) != NULL)
-				push_queue(impl, &impl->dequeue, b);
-
-			/* pop new buffer */
-			if ((b = pop_queue(impl, &impl->queue)) != NULL) {
-				io->buffer_id = b->id;
-				io->status = SPA_STATUS_HAVE_BUFFER;
-				pw_log_trace("stream %p: pop %d %p", stream, b->id, io);
-			} else {
-				io->buffer_id = SPA_ID_INVALID;
-				io->status = SPA_STATUS_NEED_BUFFER;
-				pw_log_trace("stream %p: no more buffers %p", stream, io);
+	do {
+		again = false;
+		res = SPA_STATUS_NEED_BUFFER;
+
+		for (i = 0; i < n_ports; i++) {
+			struct port *port = &impl->ports[i];
+			struct spa_io_buffers *io = &impl->trans->outputs[i];
+			struct buffer *b;
+
+			pw_log_trace("stream %p: process out %d %d %d", stream, i,
+					io->status, io->buffer_id);
+
+			if (io->status != SPA_STATUS_HAVE_BUFFER) {
+				/* recycle old buffer */
+				if ((b = get_buffer(port, io->buffer_id)) != NULL)
+					push_queue(port, &port->dequeue, b);
+
+				/* pop new buffer */
+				if ((b = pop_queue(port, &port->queue)) != NULL) {
+					io->buffer_id = b->id;
+					io->status = SPA_STATUS_HAVE_BUFFER;
+					pw_log_trace("stream %p: pop %d %p", stream, b->id, io);
+				} else {
+					io->buffer_id = SPA_ID_INVALID;
+					io->status = SPA_STATUS_NEED_BUFFER;
+					pw_log_trace("stream %p: no more buffers %p", stream, io);
+				}
 			}
 		}
 
-		if (!SPA_FLAG_CHECK(impl->flags, PW_STREAM_FLAG_DRIVER)) {
+		if (!SPA_FLAG_CHECK(impl->flags, PW_STREAM_FLAG_DRIVER))
 			call_process(impl);
-			if (spa_ringbuffer_get_read_index(&impl->queue.ring, &index) >= MIN_QUEUED &&
-			    io->status == SPA_STATUS_NEED_BUFFER)
-				goto again;
+
+		for (i = 0; i < n_ports; i++) {
+			struct port *port = &impl->ports[i];
+			struct spa_io_buffers *io = &impl->trans->outputs[i];
+
+			if (io->status == SPA_STATUS_HAVE_BUFFER)
+				res = SPA_STATUS_HAVE_BUFFER;
+			else if (!SPA_FLAG_CHECK(impl->flags, PW_STREAM_FLAG_DRIVER) &&
+			    spa_ringbuffer_get_read_index(&port->queue.ring, &index) >= MIN_QUEUED)
+				again = true;
 		}
-		res = io->status;
-	}
+	} while (again);
+
 	return res;
 }
 
@@ -772,11 +1058,13 @@ static void handle_rtnode_message(struct pw_stream *stream, struct pw_client_nod
 
 	switch (PW_CLIENT_NODE_MESSAGE_TYPE(message)) {
 	case PW_CLIENT_NODE_MESSAGE_PROCESS_INPUT:
+		mark_cycle(impl);
 		if (process_input(stream) == SPA_STATUS_NEED_BUFFER)
 			send_need_input(stream);
 		break;
 
 	case PW_CLIENT_NODE_MESSAGE_PROCESS_OUTPUT:
+		mark_cycle(impl);
 		if (process_output(stream) == SPA_STATUS_HAVE_BUFFER)
 			send_have_output(stream);
 		break;
@@ -785,14 +1073,28 @@ static void handle_rtnode_message(struct pw_stream *stream, struct pw_client_nod
 	{
 		struct pw_client_node_message_port_reuse_buffer *p =
 		    (struct pw_client_node_message_port_reuse_buffer *) message;
+		struct port *port;
 
-		if (p->body.port_id.value != impl->port_id)
-			return;
-		if (impl->direction != SPA_DIRECTION_OUTPUT)
+		if ((port = get_port(impl, SPA_DIRECTION_OUTPUT, p->body.port_id.value)) == NULL)
 			return;
 
+		reuse_buffer(stream, port, p->body.buffer_id.value);
+		break;
+	}
+	case PW_CLIENT_NODE_MESSAGE_PORT_REUSE_BUFFERS:
+	{
+		struct pw_client_node_message_port_reuse_buffers *p =
+		    (struct pw_client_node_message_port_reuse_buffers *) message;
+		struct port *port;
+		uint64_t mask;
+
+		if ((port = get_port(impl, SPA_DIRECTION_OUTPUT, p->body.port_id.value)) == NULL)
+			return;
 
-		reuse_buffer(stream, p->body.buffer_id.value);
+		mask = pw_client_node_transport_take_reuse(impl->trans,
+				SPA_DIRECTION_OUTPUT, port->id);
+		for (; mask; mask &= mask - 1)
+			reuse_buffer(stream, port, __builtin_ctzll(mask));
 		break;
 	}
 	default:
@@ -820,11 +1122,22 @@ on_rtsocket_condition(void *data, int fd, enum spa_io mask)
 		if (read(fd, &cmd, sizeof(uint64_t)) != sizeof(uint64_t))
 			pw_log_warn("stream %p: read failed %m", impl);
 
-		while (pw_client_node_transport_next_message(impl->trans, &message) == 1) {
-			struct pw_client_node_message *msg = alloca(SPA_POD_SIZE(&message));
-			pw_client_node_transport_parse_message(impl->trans, msg);
-			handle_rtnode_message(stream, msg);
-		}
+		/* poll for the next message for a while, it often arrives in the
+		 * same period, before sleeping */
+		do {
+			if (pw_client_node_transport_activated(impl->trans)) {
+				mark_cycle(impl);
+				if (process_input(stream) == SPA_STATUS_NEED_BUFFER)
+					send_need_input(stream);
+			}
+
+			while (pw_client_node_transport_next_message(impl->trans, &message) == 1) {
+				struct pw_client_node_message *msg = alloca(SPA_POD_SIZE(&message));
+				pw_client_node_transport_parse_message(impl->trans, msg);
+				handle_rtnode_message(stream, msg);
+			}
+		} while (pw_client_node_transport_spin(impl->trans, impl->spin) ||
+			 pw_client_node_transport_sleep(impl->trans));
 	}
 }
 
@@ -832,6 +1145,10 @@ static void handle_socket(struct pw_stream *stream, int rtreadfd, int rtwritefd)
 {
 	struct stream *impl = SPA_CONTAINER_OF(stream, struct stream, this);
 	struct timespec interval;
+	const char *str;
+
+	str = pw_properties_get(stream->properties, PW_NODE_PROP_WAKEUP_SPIN);
+	impl->spin = str ? atoi(str) : 0;
 
 	impl->rtwritefd = rtwritefd;
 	impl->rtsocket_source = pw_loop_add_io(stream->remote->core->data_loop,
@@ -859,6 +1176,41 @@ static void client_node_event(void *data, const struct spa_event *event)
 	pw_log_warn("unhandled node event %d", SPA_EVENT_TYPE(event));
 }
 
+static void update_clock(struct stream *impl, const struct spa_command_node_clock_update *cu)
+{
+	int64_t now = cu->body.monotonic_time.value;
+	uint64_t ticks = cu->body.ticks.value;
+	int32_t denom = cu->body.rate.value;
+
+	/* measure the rate of the ticks against the monotonic clock since the
+	 * previous update and filter it, start over when the clock jumps */
+	if (denom != impl->rate_denom || now <= impl->rate_now || ticks < impl->rate_ticks) {
+		impl->rate_diff = 1.0;
+	}
+	else if (ticks > impl->rate_ticks) {
+		double elapsed = (double) (now - impl->rate_now) / SPA_NSEC_PER_SEC;
+		double diff = (double) (ticks - impl->rate_ticks) / denom / elapsed;
+
+		if (diff > 0.5 && diff < 2.0)
+			impl->rate_diff += (diff - impl->rate_diff) * RATE_FILTER;
+	}
+	impl->rate_now = now;
+	impl->rate_ticks = ticks;
+	impl->rate_denom = denom;
+
+	seq_write_begin(&impl->clock.seq);
+	impl->clock.time.now = now;
+	impl->clock.time.ticks = ticks;
+	impl->clock.time.rate.num = 1;
+	impl->clock.time.rate.denom = denom;
+	impl->clock.time.delay = 0;
+	impl->clock.time.rate_diff = impl->rate_diff;
+	seq_write_end(&impl->clock.seq);
+
+	pw_log_debug("clock update %" PRIu64 " %d %" PRId64 " rate %f",
+			ticks, denom, now, impl->rate_diff);
+}
+
 static void client_node_command(void *data, uint32_t seq, const struct spa_command *command)
 {
 	struct stream *impl = data;
@@ -907,13 +1259,7 @@ static void client_node_command(void *data, uint32_t seq, const struct spa_comma
 					   PW_STREAM_PROP_LATENCY_MIN, "%" PRId64,
 					   cu->body.latency.value);
 		}
-		impl->last_time.now = cu->body.monotonic_time.value;
-		impl->last_time.ticks = cu->body.ticks.value;
-		impl->last_time.rate.num = 1;
-		impl->last_time.rate.denom = cu->body.rate.value;
-		impl->last_time.delay = 0;
-		pw_log_debug("clock update %ld %d %ld", impl->last_time.ticks,
-				impl->last_time.rate.denom, impl->last_time.now);
+		update_clock(impl, cu);
 	} else {
 		pw_log_warn("unhandled node command %d", SPA_COMMAND_TYPE(command));
 		add_async_complete(stream, seq, -ENOTSUP);
@@ -932,6 +1278,54 @@ client_node_remove_port(void *data, uint32_t seq, enum spa_direction direction,
 	pw_log_warn("remove port not supported");
 }
 
+static struct control *find_control(struct stream *impl, const char *name)
+{
+	uint32_t i;
+
+	for (i = 0; i < impl->n_controls; i++) {
+		if (strcmp(impl->controls[i].info->name, name) == 0)
+			return &impl->controls[i];
+	}
+	return NULL;
+}
+
+static struct control *find_control_io(struct stream *impl, uint32_t port_id, uint32_t io_id)
+{
+	uint32_t i;
+
+	if (port_id != 0)
+		return NULL;
+
+	for (i = 0; i < impl->n_controls; i++) {
+		if (impl->controls[i].io_id == io_id)
+			return &impl->controls[i];
+	}
+	return NULL;
+}
+
+/* the control memory is read by the linked node in the realtime thread */
+static void write_control(struct control *c)
+{
+	if (c->io == NULL)
+		return;
+
+	if (c->info->type == SPA_POD_TYPE_DOUBLE)
+		SPA_POD_VALUE(struct spa_pod_double, c->io) = c->value;
+	else
+		SPA_POD_VALUE(struct spa_pod_int, c->io) = lrintf(c->value);
+}
+
+static float read_control(struct control *c)
+{
+	if (c->io == NULL)
+		return c->value;
+
+	if (c->info->type == SPA_POD_TYPE_DOUBLE)
+		return SPA_POD_VALUE(struct spa_pod_double, c->io);
+	else
+		return SPA_POD_VALUE(struct spa_pod_int, c->io);
+}
+
 static void
 client_node_port_set_param(void *data,
 			   uint32_t seq,
@@ -942,30 +1336,42 @@ client_node_port_set_param(void *data,
 	struct stream *impl = data;
 	struct pw_stream *stream = &impl->this;
 	struct pw_type *t = &stream->remote->core->type;
+	struct port *port;
+
+	if ((port = get_port(impl, direction, port_id)) == NULL) {
+		pw_log_warn("stream %p: unknown port %d", stream, port_id);
+		return;
+	}
 
 	if (id == t->param.idFormat) {
 		int count;
+		uint32_t i;
+		bool configured = true;
 
-		pw_log_debug("stream %p: format changed %d", stream, seq);
+		pw_log_debug("stream %p: port %d format changed %d", stream, port_id, seq);
 
-		if (impl->format)
-			free(impl->format);
+		if (port->format)
+			free(port->format);
 
 		if (spa_pod_is_object_type(param, t->spa_format)) {
-			impl->format = pw_spa_pod_copy(param);
-			((struct spa_pod_object*)impl->format)->body.id = id;
+			port->format = pw_spa_pod_copy(param);
+			((struct spa_pod_object*)port->format)->body.id = id;
 		}
 		else
-			impl->format = NULL;
+			port->format = NULL;
 
 		impl->pending_seq = seq;
+		impl->pending_port = port;
 
-		count = pw_stream_events_format_changed(stream, impl->format);
+		count = pw_stream_events_format_changed(stream, port->format);
 
 		if (count == 0)
 			pw_stream_finish_format(stream, 0, NULL, 0);
 
-		if (impl->format)
+		for (i = 0; i < impl->n_ports; i++)
+			configured &= impl->ports[i].format != NULL;
+
+		if (configured)
 			stream_set_state(stream, PW_STREAM_STATE_READY, NULL);
 		else
 			stream_set_state(stream, PW_STREAM_STATE_CONFIGURE, NULL);
@@ -989,15 +1395,39 @@ client_node_add_mem(void *data,
 			     mem_id, memfd, flags);
 		clear_mem(impl, m);
 	} else {
-		m = pw_array_add(&impl->mem_ids, sizeof(struct mem));
+		m = calloc(1, sizeof(struct mem));
+		if (m == NULL || !pw_map_insert_at(&impl->mems, mem_id, m)) {
+			pw_log_error("stream %p: can't add mem %u", stream, mem_id);
+			free(m);
+			close(memfd);
+			return;
+		}
 		pw_log_debug("add mem %u, fd %d, flags %d",
 			     mem_id, memfd, flags);
 	}
 	m->id = mem_id;
 	m->fd = memfd;
 	m->flags = flags;
-	m->map = PW_MAP_RANGE_INIT;
-	m->ptr = NULL;
+}
+
+/* Map the range of all buffers in each mem once. The buffers then take a ref
+ * on this mapping instead of making one each. */
+static uint32_t map_mem_ranges(struct stream *impl, struct pw_map_cache_range *ranges,
+			       uint32_t n_buffers, struct pw_client_node_buffer *buffers,
+			       int prot)
+{
+	struct pw_stream *stream = &impl->this;
+	uint32_t i, n_ranges = 0;
+	struct mem *m;
+
+	for (i = 0; i < n_buffers; i++) {
+		if ((m = find_mem(stream, buffers[i].mem_id)) != NULL)
+			n_ranges = pw_map_cache_range_add(ranges, n_ranges, m->fd,
+					buffers[i].offset, buffers[i].size);
+	}
+	pw_map_cache_map_ranges(ranges, n_ranges, prot, stream->remote->core->mem_flags);
+
+	return n_ranges;
 }
 
 static void
@@ -1010,15 +1440,28 @@ client_node_port_use_buffers(void *data,
 	struct pw_stream *stream = &impl->this;
 	struct pw_core *core = stream->remote->core;
 	struct pw_type *t = &core->type;
+	struct port *port;
 	struct buffer *bid;
 	uint32_t i, j;
 	struct spa_buffer *b;
+	bool allocated = true, unused = true;
 	int prot;
+	struct pw_map_cache_range *ranges;
+	uint32_t n_ranges;
+
+	if ((port = get_port(impl, direction, port_id)) == NULL) {
+		pw_log_warn("stream %p: unknown port %d", stream, port_id);
+		add_async_complete(stream, seq, -EINVAL);
+		return;
+	}
 
 	prot = PROT_READ | (direction == SPA_DIRECTION_OUTPUT ? PROT_WRITE : 0);
 
 	/* clear previous buffers */
-	clear_buffers(stream);
+	clear_buffers(stream, port);
+
+	ranges = alloca(n_buffers * sizeof(struct pw_map_cache_range));
+	n_ranges = map_mem_ranges(impl, ranges, n_buffers, buffers, prot);
 
 	for (i = 0; i < n_buffers; i++) {
 		off_t offset;
@@ -1029,18 +1472,17 @@ client_node_port_use_buffers(void *data,
 			continue;
 		}
 
-		bid = &impl->buffers[i];
+		bid = &port->buffers[i];
+		bid->port = port;
+		bid->buffer.port_id = port->id;
 		bid->id = i;
 		bid->flags = 0;
 		b = buffers[i].buffer;
 
-		pw_map_range_init(&bid->map, buffers[i].offset, buffers[i].size,
-				core->sc_pagesize);
-
-		bid->ptr = mmap(NULL, bid->map.size, prot, MAP_SHARED, m->fd, bid->map.offset);
-		if (bid->ptr == MAP_FAILED) {
-			bid->ptr = NULL;
-			pw_log_warn("Failed to mmap memory %d %p: %s", bid->map.size, m,
+		bid->ptr = pw_map_cache_map(m->fd, prot, buffers[i].offset, buffers[i].size,
+				core->mem_flags);
+		if (bid->ptr == NULL) {
+			pw_log_warn("Failed to mmap memory %d %p: %s", buffers[i].size, m,
 				    strerror(errno));
 			continue;
 		}
@@ -1072,9 +1514,9 @@ client_node_port_use_buffers(void *data,
 		}
 
 		pw_log_debug("add buffer %d %d %u %u", m->id,
-				b->id, bid->map.offset, bid->map.size);
+				b->id, buffers[i].offset, buffers[i].size);
 
-		offset = bid->map.start;
+		offset = 0;
 		for (j = 0; j < b->n_metas; j++) {
 			struct spa_meta *m = &b->metas[j];
 			memcpy(m, &buffers[i].buffer->metas[j], sizeof(struct spa_meta));
@@ -1099,13 +1541,14 @@ client_node_port_use_buffers(void *data,
 				pw_log_debug(" data %d %u -> fd %d", j, bm->id, bm->fd);
 
 				if (SPA_FLAG_CHECK(impl->flags, PW_STREAM_FLAG_MAP_BUFFERS)) {
-					if (map_data(impl, d, prot) < 0)
+					if (map_data(impl, d, prot) < 0) {
+						pw_map_cache_unmap_ranges(ranges, n_ranges);
 						return;
+					}
 					SPA_FLAG_SET(bid->flags, BUFFER_FLAG_MAPPED);
 				}
 			} else if (d->type == t->data.MemPtr) {
-				d->data = SPA_MEMBER(bid->ptr,
-						bid->map.start + SPA_PTR_TO_INT(d->data), void);
+				d->data = SPA_MEMBER(bid->ptr, SPA_PTR_TO_INT(d->data), void);
 				d->fd = -1;
 				pw_log_debug(" data %d %u -> mem %p", j, b->id, d->data);
 			} else {
@@ -1114,21 +1557,29 @@ client_node_port_use_buffers(void *data,
 		}
 
 		if (impl->direction == SPA_DIRECTION_OUTPUT)
-			push_queue(impl, &impl->dequeue, bid);
+			push_queue(port, &port->dequeue, bid);
 
 		pw_stream_events_add_buffer(stream, &bid->buffer);
 	}
+	pw_map_cache_unmap_ranges(ranges, n_ranges);
 
 	add_async_complete(stream, seq, 0);
 
-	impl->n_buffers = n_buffers;
+	port->n_buffers = n_buffers;
 
-	if (n_buffers)
-		stream_set_state(stream, PW_STREAM_STATE_PAUSED, NULL);
-	else {
+	for (i = 0; i < impl->n_ports; i++) {
+		allocated &= impl->ports[i].n_buffers > 0;
+		unused &= impl->ports[i].n_buffers == 0;
+	}
+
+	/* the memory is shared between the ports */
+	if (unused)
 		clear_mems(stream);
+
+	if (allocated)
+		stream_set_state(stream, PW_STREAM_STATE_PAUSED, NULL);
+	else
 		stream_set_state(stream, PW_STREAM_STATE_READY, NULL);
-	}
 }
 
 static void
@@ -1173,10 +1624,18 @@ static void client_node_port_set_io(void *data,
 	struct pw_stream *stream = &impl->this;
 	struct pw_core *core = stream->remote->core;
 	struct pw_type *t = &core->type;
+	struct port *port;
+	struct control *c;
 	struct mem *m;
 	void *ptr;
 	int res;
 
+	if ((port = get_port(impl, direction, port_id)) == NULL) {
+		pw_log_warn("stream %p: unknown port %d", stream, port_id);
+		res = -EINVAL;
+		goto exit;
+	}
+
 	if (mem_id == SPA_ID_INVALID) {
 		ptr = NULL;
 		size = 0;
@@ -1195,8 +1654,20 @@ static void client_node_port_set_io(void *data,
 	}
 
 	if (id == t->io.Buffers) {
-		impl->io = ptr;
-		pw_log_debug("stream %p: set io id %u %p", stream, id, ptr);
+		port->io = ptr;
+		pw_log_debug("stream %p: port %d set io id %u %p", stream, port_id, id, ptr);
+	}
+	else if ((c = find_control_io(impl, port_id, id)) != NULL) {
+		uint32_t min_size = c->info->type == SPA_POD_TYPE_DOUBLE ?
+			sizeof(struct spa_pod_double) : sizeof(struct spa_pod_int);
+
+		if (ptr && size < min_size) {
+			res = -EINVAL;
+			goto exit;
+		}
+		c->io = ptr;
+		write_control(c);
+		pw_log_debug("stream %p: control %s io %p", stream, c->info->name, ptr);
 	}
 
 	res = 0;
@@ -1205,6 +1676,46 @@ static void client_node_port_set_io(void *data,
 	add_async_complete(stream, seq, res);
 }
 
+struct set_peer {
+	struct port *port;
+	struct port_peer peer;
+};
+
+static int
+do_set_peer(struct spa_loop *loop,
+	    bool async, uint32_t seq, const void *data, size_t size, void *user_data)
+{
+	struct set_peer *sp = user_data;
+	struct port_peer tmp = sp->port->peer;
+
+	sp->port->peer = sp->peer;
+	sp->peer = tmp;
+	return 0;
+}
+
+static void client_node_port_set_peer(void *data,
+				      uint32_t port_id,
+				      int writefd,
+				      struct pw_memblock *activation)
+{
+	struct stream *impl = data;
+	struct pw_stream *stream = &impl->this;
+	struct set_peer sp = { NULL, { activation, writefd } };
+
+	if ((sp.port = get_port(impl, SPA_DIRECTION_OUTPUT, port_id)) == NULL) {
+		pw_log_warn("stream %p: unknown output port %d", stream, port_id);
+		clear_peer(&sp.peer);
+		return;
+	}
+
+	pw_log_debug("stream %p: port %d peer %p", stream, port_id, activation);
+
+	/* swap in the new peer, the data thread might be activating the old one */
+	pw_loop_invoke(stream->remote->core->data_loop,
+		       do_set_peer, SPA_ID_INVALID, NULL, 0, true, &sp);
+	clear_peer(&sp.peer);
+}
+
 static const struct pw_client_node_proxy_events client_node_events = {
 	PW_VERSION_CLIENT_NODE_PROXY_EVENTS,
 	.add_mem = client_node_add_mem,
@@ -1218,27 +1729,36 @@ static const struct pw_client_node_proxy_events client_node_events = {
 	.port_use_buffers = client_node_port_use_buffers,
 	.port_command = client_node_port_command,
 	.port_set_io = client_node_port_set_io,
+	.port_set_peer = client_node_port_set_peer,
 };
 
 static void on_node_proxy_destroy(void *data)
 {
 	struct stream *impl = data;
 	struct pw_stream *this = &impl->this;
+	uint32_t i;
 
 	impl->disconnecting = false;
 	impl->node_proxy = NULL;
 	spa_hook_remove(&impl->proxy_listener);
 
 	set_init_params(this, 0, NULL);
-	set_params(this, 0, NULL);
 
-	clear_buffers(this);
+	clear_all_buffers(this);
 	clear_mems(this);
 
-	if (impl->format) {
-		free(impl->format);
-		impl->format = NULL;
+	for (i = 0; i < impl->n_ports; i++) {
+		struct port *port = &impl->ports[i];
+
+		set_params(port, 0, NULL);
+		if (port->format) {
+			free(port->format);
+			port->format = NULL;
+		}
+		port->io = NULL;
 	}
+	for (i = 0; i < impl->n_controls; i++)
+		impl->controls[i].io = NULL;
 	if (impl->trans) {
 		pw_client_node_transport_destroy(impl->trans);
 		impl->trans = NULL;
@@ -1264,7 +1784,6 @@ pw_stream_connect(struct pw_stream *stream,
 
 	impl->direction =
 	    direction == PW_DIRECTION_INPUT ? SPA_DIRECTION_INPUT : SPA_DIRECTION_OUTPUT;
-	impl->port_id = 0;
 	impl->flags = flags;
 
 	set_init_params(stream, n_params, params);
@@ -1311,22 +1830,31 @@ pw_stream_finish_format(struct pw_stream *stream,
 			uint32_t n_params)
 {
 	struct stream *impl = SPA_CONTAINER_OF(stream, struct stream, this);
+	struct port *port = impl->pending_port ? impl->pending_port : &impl->ports[0];
 
-	pw_log_debug("stream %p: finish format %d %d", stream, res, impl->pending_seq);
+	pw_log_debug("stream %p: finish format %d %d on port %d", stream, res,
+			impl->pending_seq, port->id);
 
-	set_params(stream, n_params, params);
+	set_params(port, n_params, params);
 
 	if (SPA_RESULT_IS_OK(res)) {
-		add_port_update(stream, PW_CLIENT_NODE_PORT_UPDATE_PARAMS);
+		add_port_update(stream, port, PW_CLIENT_NODE_PORT_UPDATE_PARAMS);
+
+		if (!port->format) {
+			uint32_t i;
+			bool unused = true;
 
-		if (!impl->format) {
-			clear_buffers(stream);
-			clear_mems(stream);
+			clear_buffers(stream, port);
+			for (i = 0; i < impl->n_ports; i++)
+				unused &= impl->ports[i].n_buffers == 0;
+			if (unused)
+				clear_mems(stream);
 		}
 	}
 	add_async_complete(stream, impl->pending_seq, res);
 
 	impl->pending_seq = SPA_ID_INVALID;
+	impl->pending_port = NULL;
 }
 
 int pw_stream_disconnect(struct pw_stream *stream)
@@ -1358,72 +1886,281 @@ static inline int64_t get_queue_size(struct queue *queue)
 	return (int64_t)(queue->incount - queue->outcount);
 }
 
-int pw_stream_get_time(struct pw_stream *stream, struct pw_time *time)
+int pw_stream_get_time_n(struct pw_stream *stream, struct pw_time *time, size_t size)
 {
 	struct stream *impl = SPA_CONTAINER_OF(stream, struct stream, this);
+	struct pw_time t;
+	uint32_t seq, i;
 
-	if (impl->last_time.rate.denom == 0)
+	do {
+		seq = seq_read_begin(&impl->clock.seq);
+		t = impl->clock.time;
+	} while (seq_read_retry(&impl->clock.seq, seq));
+
+	if (t.rate.denom == 0)
 		return -EAGAIN;
 
-	*time = impl->last_time;
-	if (impl->direction == SPA_DIRECTION_INPUT)
-		time->queued = get_queue_size(&impl->dequeue);
-	else
-		time->queued = get_queue_size(&impl->queue);
+	do {
+		seq = seq_read_begin(&impl->cycle.seq);
+		t.cycle_time = impl->cycle.time;
+		t.cycles = impl->cycle.count;
+	} while (seq_read_retry(&impl->cycle.seq, seq));
 
-	pw_log_trace("stream %p: %ld %d/%d %ld", stream,
-			time->ticks, time->rate.num, time->rate.denom, time->queued);
+	for (t.queued = 0, i = 0; i < impl->n_ports; i++) {
+		if (impl->direction == SPA_DIRECTION_INPUT)
+			t.queued += get_queue_size(&impl->ports[i].dequeue);
+		else
+			t.queued += get_queue_size(&impl->ports[i].queue);
+	}
+
+	pw_log_trace("stream %p: %" PRIu64 " %d/%d %" PRIu64 " %" PRIu64, stream,
+			t.ticks, t.rate.num, t.rate.denom, t.queued, t.cycles);
+
+	/* only fill the fields that the caller knows about */
+	memcpy(time, &t, SPA_MIN(size, sizeof(t)));
 
 	return 0;
 }
 
+int pw_stream_get_time(struct pw_stream *stream, struct pw_time *time)
+{
+	return pw_stream_get_time_n(stream, time, PW_TIME_SIZE_V0);
+}
+
 int pw_stream_set_control(struct pw_stream *stream, const char *name, float value)
 {
-	return -ENOTSUP;
+	struct stream *impl = SPA_CONTAINER_OF(stream, struct stream, this);
+	struct spa_type_map *map = stream->remote->core->type.map;
+	struct control *c;
+	uint32_t i;
+
+	if ((c = find_control(impl, name)) == NULL) {
+		/* the controls are exported when connecting */
+		if (impl->node_proxy != NULL)
+			return -EBUSY;
+		if (impl->n_controls >= MAX_CONTROLS)
+			return -ENOSPC;
+
+		for (i = 0; i < SPA_N_ELEMENTS(control_info); i++) {
+			if (strcmp(control_info[i].name, name) == 0)
+				break;
+		}
+		if (i == SPA_N_ELEMENTS(control_info))
+			return -ENOTSUP;
+
+		c = &impl->controls[impl->n_controls++];
+		c->info = &control_info[i];
+		c->prop_id = spa_type_map_get_id(map, c->info->prop);
+		c->io_id = spa_type_map_get_id(map, c->info->io);
+		c->io = NULL;
+	}
+	c->value = value;
+	write_control(c);
+
+	return 0;
 }
 
 int pw_stream_get_control(struct pw_stream *stream, const char *name, float *value)
 {
-	return -ENOTSUP;
+	struct stream *impl = SPA_CONTAINER_OF(stream, struct stream, this);
+	struct control *c;
+
+	if ((c = find_control(impl, name)) == NULL)
+		return -ENOTSUP;
+
+	*value = read_control(c);
+	return 0;
 }
 
-struct pw_buffer *pw_stream_dequeue_buffer(struct pw_stream *stream)
+int pw_stream_set_n_ports(struct pw_stream *stream, uint32_t n_ports)
+{
+	struct stream *impl = SPA_CONTAINER_OF(stream, struct stream, this);
+	struct port *ports;
+	uint32_t i;
+
+	if (n_ports == 0 || n_ports > MAX_PORTS)
+		return -EINVAL;
+	if (impl->node_proxy != NULL)
+		return -EBUSY;
+
+	if ((ports = calloc(n_ports, sizeof(struct port))) == NULL)
+		return -ENOMEM;
+	for (i = 0; i < n_ports; i++)
+		init_port(&ports[i], i);
+
+	free(impl->ports);
+	impl->ports = ports;
+	impl->n_ports = n_ports;
+
+	return 0;
+}
+
+uint32_t pw_stream_get_n_ports(struct pw_stream *stream)
+{
+	struct stream *impl = SPA_CONTAINER_OF(stream, struct stream, this);
+	return impl->n_ports;
+}
+
+struct pw_buffer *pw_stream_dequeue_port_buffer(struct pw_stream *stream, uint32_t port_id)
 {
 	struct stream *impl = SPA_CONTAINER_OF(stream, struct stream, this);
+	struct port *port;
 	struct buffer *b;
 
-	if ((b = pop_queue(impl, &impl->dequeue)) == NULL) {
-		pw_log_trace("stream %p: no more buffers", stream);
+	if ((port = get_port(impl, impl->direction, port_id)) == NULL)
+		return NULL;
+
+	if ((b = pop_queue(port, &port->dequeue)) == NULL) {
+		pw_log_trace("stream %p: no more buffers on port %d", stream, port_id);
 		return NULL;
 	}
-	pw_log_trace("stream %p: dequeue buffer %d", stream, b->id);
+	pw_log_trace("stream %p: dequeue buffer %d on port %d", stream, b->id, port_id);
 
 	return &b->buffer;
 }
 
+struct pw_buffer *pw_stream_dequeue_buffer(struct pw_stream *stream)
+{
+	return pw_stream_dequeue_port_buffer(stream, 0);
+}
+
+/* a driver pushes out the cycle when all the ports have a buffer queued */
+static bool ports_queued(struct stream *impl)
+{
+	uint32_t i, index;
+
+	for (i = 0; i < impl->n_ports; i++) {
+		if (spa_ringbuffer_get_read_index(&impl->ports[i].queue.ring, &index) < MIN_QUEUED)
+			return false;
+	}
+	return true;
+}
+
+static int
+do_driver_output(struct spa_loop *loop,
+		 bool async, uint32_t seq, const void *data, size_t size, void *user_data)
+{
+	struct stream *impl = user_data;
+	struct pw_stream *stream = &impl->this;
+
+	if (impl->rtsocket_source == NULL || !ports_queued(impl))
+		return 0;
+
+	if (process_output(stream) == SPA_STATUS_HAVE_BUFFER)
+		send_have_output(stream);
+	return 0;
+}
+
+/* the peers of the ports are swapped and released on the data thread, so
+ * the cycle of a driver is pushed out from there as well. This runs in
+ * place when the buffers are queued from the data thread */
+static void driver_output(struct stream *impl)
+{
+	pw_loop_invoke(impl->this.remote->core->data_loop,
+		       do_driver_output, 1, NULL, 0, false, impl);
+}
+
 int pw_stream_queue_buffer(struct pw_stream *stream, struct pw_buffer *buffer)
 {
 	struct stream *impl = SPA_CONTAINER_OF(stream, struct stream, this);
+	struct port *port;
 	struct buffer *b;
 	int res;
 
-	if ((b = get_buffer(stream, buffer->buffer->id)) == NULL)
+	if ((port = get_port(impl, impl->direction, buffer->port_id)) == NULL)
+		return -EINVAL;
+	if ((b = get_buffer(port, buffer->buffer->id)) == NULL)
 		return -EINVAL;
 
-	pw_log_trace("stream %p: queue buffer %d", stream, b->id);
-	if ((res = push_queue(impl, &impl->queue, b)) < 0)
+	pw_log_trace("stream %p: queue buffer %d on port %d", stream, b->id, port->id);
+	if ((res = push_queue(port, &port->queue, b)) < 0)
 		return res;
 
 	if (impl->direction == SPA_DIRECTION_OUTPUT) {
-		if (res == 0 &&
-		    SPA_FLAG_CHECK(impl->flags, PW_STREAM_FLAG_DRIVER) &&
-		    process_output(stream) == SPA_STATUS_HAVE_BUFFER)
-			send_have_output(stream);
+		if (res == 0 && SPA_FLAG_CHECK(impl->flags, PW_STREAM_FLAG_DRIVER))
+			driver_output(impl);
 	}
 	else {
 		if (impl->client_reuse)
-			if ((b = pop_queue(impl, &impl->queue)))
-				send_reuse_buffer(stream, b->id);
+			if ((b = pop_queue(port, &port->queue)))
+				send_reuse_buffer(stream, port, b->id);
 	}
 	return 0;
 }
+
+uint32_t pw_stream_dequeue_buffers(struct pw_stream *stream, uint32_t port_id,
+				   struct pw_buffer **buffers, uint32_t n_buffers)
+{
+	struct stream *impl = SPA_CONTAINER_OF(stream, struct stream, this);
+	struct buffer **bufs = alloca(SPA_MIN(n_buffers, MAX_BUFFERS) * sizeof(struct buffer *));
+	struct port *port;
+	uint32_t i, n;
+
+	if ((port = get_port(impl, impl->direction, port_id)) == NULL)
+		return 0;
+
+	n = pop_queue_n(port, &port->dequeue, bufs, SPA_MIN(n_buffers, MAX_BUFFERS));
+	for (i = 0; i < n; i++)
+		buffers[i] = &bufs[i]->buffer;
+
+	pw_log_trace("stream %p: dequeue %d buffers on port %d", stream, n, port_id);
+
+	return n;
+}
+
+int pw_stream_queue_buffers(struct pw_stream *stream, struct pw_buffer **buffers, uint32_t n_buffers)
+{
+	struct stream *impl = SPA_CONTAINER_OF(stream, struct stream, this);
+	struct buffer **bufs;
+	struct port *port;
+	uint64_t *seen;
+	uint32_t i, start;
+	bool pushed = false;
+
+	if (n_buffers > impl->n_ports * MAX_BUFFERS)
+		return -EINVAL;
+
+	/* check all the buffers first, buffers that are queued already or
+	 * that are given twice fail like in pw_stream_queue_buffer() */
+	bufs = alloca(n_buffers * sizeof(struct buffer *));
+	seen = alloca(impl->n_ports * sizeof(uint64_t));
+	memset(seen, 0, impl->n_ports * sizeof(uint64_t));
+	for (i = 0; i < n_buffers; i++) {
+		struct buffer *b;
+
+		if ((port = get_port(impl, impl->direction, buffers[i]->port_id)) == NULL)
+			return -EINVAL;
+		if ((b = get_buffer(port, buffers[i]->buffer->id)) == NULL)
+			return -EINVAL;
+		if (SPA_FLAG_CHECK(b->flags, BUFFER_FLAG_QUEUED) ||
+		    (seen[port->id] & (1ULL << b->id)))
+			return -EINVAL;
+		seen[port->id] |= 1ULL << b->id;
+		bufs[i] = b;
+	}
+
+	pw_log_trace("stream %p: queue %d buffers", stream, n_buffers);
+
+	/* queue the runs of buffers of the same port in one go */
+	for (start = 0; start < n_buffers; start = i) {
+		port = bufs[start]->port;
+		for (i = start + 1; i < n_buffers && bufs[i]->port == port; i++);
+
+		if (push_queue_n(port, &port->queue, &bufs[start], i - start) > 0)
+			pushed = true;
+
+		if (impl->direction == SPA_DIRECTION_INPUT && impl->client_reuse) {
+			struct buffer *reuse[MAX_BUFFERS];
+			uint32_t n;
+
+			n = pop_queue_n(port, &port->queue, reuse, MAX_BUFFERS);
+			send_reuse_buffers(stream, port, reuse, n);
+		}
+	}
+
+	if (impl->direction == SPA_DIRECTION_OUTPUT) {
+		if (pushed && SPA_FLAG_CHECK(impl->flags, PW_STREAM_FLAG_DRIVER))
+			driver_output(impl);
+	}
+	return n_buffers;
+}
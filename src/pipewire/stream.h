@@ -146,6 +146,8 @@ extern "C" {
  */
 struct pw_stream;
 
+#include <stddef.h>
+
 #include <spa/buffer/buffer.h>
 #include <spa/param/param.h>
 
@@ -171,6 +173,7 @@ struct pw_buffer {
 					   For output streams, this field is set by the user.
 					   This field is added for all queued buffers and
 					   returned in the time info. */
+	uint32_t port_id;		/* the port of the buffer */
 };
 
 /** Events for a stream */
@@ -184,7 +187,8 @@ struct pw_stream_events {
 				enum pw_stream_state state, const char *error);
 	/** when the format changed. The listener should call
 	 * pw_stream_finish_format() from within this callback or later to complete
-	 * the format negotiation and start the buffer negotiation. */
+	 * the format negotiation and start the buffer negotiation. This is
+	 * emitted for each port of the stream. */
 	void (*format_changed) (void *data, const struct spa_pod *format);
 
         /** when a new buffer was created for this stream */
@@ -193,7 +197,8 @@ struct pw_stream_events {
         void (*remove_buffer) (void *data, struct pw_buffer *buffer);
 
         /** when a buffer can be queued (for playback streams) or
-         *  dequeued (for capture streams). This is normally called from the
+         *  dequeued (for capture streams). This is called once per cycle
+	 *  for all the ports of the stream. This is normally called from the
 	 *  mainloop but can also be called directly from the realtime data
 	 *  thread if the user is prepared to deal with this. */
         void (*process) (void *data);
@@ -254,6 +259,17 @@ struct pw_remote *pw_stream_get_remote(struct pw_stream *stream);
 
 const struct pw_properties *pw_stream_get_properties(struct pw_stream *stream);
 
+/** Set the number of ports of the stream. \memberof pw_stream
+ *
+ * All ports have the same direction and are processed in the same cycle
+ * with one call to the process event. This must be called before
+ * pw_stream_connect(), a stream has 1 port by default.
+ * \return 0 on success < 0 on error. */
+int pw_stream_set_n_ports(struct pw_stream *stream, uint32_t n_ports);
+
+/** Get the number of ports of the stream \memberof pw_stream */
+uint32_t pw_stream_get_n_ports(struct pw_stream *stream);
+
 /** Connect a stream for input or output on \a port_path. \memberof pw_stream
  * \return 0 on success < 0 on error.
  *
@@ -302,7 +318,12 @@ pw_stream_finish_format(struct pw_stream *stream,	/**< a \ref pw_stream */
 #define PW_STREAM_CONTROL_HUE		"hue"
 #define PW_STREAM_CONTROL_SATURATION	"saturation"
 
-/** Set a control value */
+/** Set a control value. The controls that are set before pw_stream_connect()
+ * are exported on the first port of the stream and can be linked to the
+ * controls of other nodes. The value is written to shared memory that the
+ * linked node reads when it processes.
+ * \return 0 on success, -ENOTSUP for an unknown control or -EBUSY when a
+ * new control is set on a connected stream. */
 int pw_stream_set_control(struct pw_stream *stream, const char *name, float value);
 /** Get a control value */
 int pw_stream_get_control(struct pw_stream *stream, const char *name, float *value);
@@ -322,18 +343,52 @@ struct pw_time {
 	uint64_t queued;		/**< data queued in the stream, this is the sum
 					     of the size fields in the pw_buffer that are
 					     currently queued */
+	/* the fields below are only filled by pw_stream_get_time_n() */
+	double rate_diff;		/**< filtered rate of the ticks measured against the
+					     monotonic clock, 1.0 when the clock runs at
+					     exactly \a rate */
+	int64_t cycle_time;		/**< the monotonic time of the start of the last
+					     processing cycle */
+	uint64_t cycles;		/**< the number of processing cycles */
 };
 
-/** Query the time on the stream \memberof pw_stream */
+/** the size of the fields of struct pw_time that pw_stream_get_time() fills */
+#define PW_TIME_SIZE_V0	offsetof(struct pw_time, rate_diff)
+
+/** Query the time on the stream \memberof pw_stream
+ * This can be called from any thread, it does not lock and does not block
+ * the realtime thread. At most \a size bytes of \a time are filled, pass
+ * sizeof(struct pw_time).
+ * \return 0 on success, -EAGAIN when there is no clock information yet */
+int pw_stream_get_time_n(struct pw_stream *stream, struct pw_time *time, size_t size);
+
+/** Query the time on the stream, only the fields up to \a queued are
+ * filled, see pw_stream_get_time_n() \memberof pw_stream */
 int pw_stream_get_time(struct pw_stream *stream, struct pw_time *time);
 
 /** Get a buffer that can be filled for playback streams or consumed
  * for capture streams.  */
 struct pw_buffer *pw_stream_dequeue_buffer(struct pw_stream *stream);
 
-/** Submit a buffer for playback or recycle a buffer for capture. */
+/** Get a buffer of port \a port_id, see pw_stream_dequeue_buffer() */
+struct pw_buffer *pw_stream_dequeue_port_buffer(struct pw_stream *stream, uint32_t port_id);
+
+/** Submit a buffer for playback or recycle a buffer for capture. The buffer
+ * is queued on the port it was dequeued from. */
 int pw_stream_queue_buffer(struct pw_stream *stream, struct pw_buffer *buffer);
 
+/** Get up to \a n_buffers buffers of port \a port_id at once.
+ * \return the number of buffers placed in \a buffers */
+uint32_t pw_stream_dequeue_buffers(struct pw_stream *stream, uint32_t port_id,
+				   struct pw_buffer **buffers, uint32_t n_buffers);
+
+/** Submit \a n_buffers buffers at once, see pw_stream_queue_buffer(). Reused
+ * buffers of capture streams are sent to the server in one message.
+ * \return the number of queued buffers or < 0 on error, nothing is queued
+ * on error. */
+int pw_stream_queue_buffers(struct pw_stream *stream, struct pw_buffer **buffers,
+			    uint32_t n_buffers);
+
 
 #ifdef __cplusplus
 }